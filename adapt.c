@@ -0,0 +1,492 @@
+/* Load-adaptive slot counts. */
+
+#define _GNU_SOURCE		/* For pipe2. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include "adapt.h"
+
+/*
+ * When a host is judged short of memory, or contended, or idle.
+ * Memory is the fraction of it available; pressures are the percent
+ * of the last 10s some (or all) tasks were stalled; loads are per
+ * CPU.  The averages lag, so a host is only idle if it also has no
+ * more tasks runnable at the moment of the sample than CPUs; the
+ * moment is too noisy to judge contention by.
+ */
+#define AD_MEM_SHORT	0.10
+#define AD_MEM_AMPLE	0.25
+#define AD_MEM_FULL	5.0
+#define AD_MEM_CALM	10.0
+#define AD_CPU_HOT	40.0
+#define AD_CPU_IDLE	10.0
+#define AD_LOAD_HOT	1.5
+#define AD_LOAD_IDLE	0.75
+#define AD_NOW_IDLE	1.0
+
+/* ad_apply --
+ *
+ * Synopsis:
+ *
+ *    Set the target of host 'h', unparking parked slots or parking
+ *    ready ones to meet it.  Running slots over the target are parked
+ *    as they finish.  Returns the number of slots unparked.
+ */
+
+static size_t
+ad_apply(AD_Control* ad, QI_Index h, size_t target)
+{
+    MachineList*	ms = ad->ms;
+    MachineHost*	mh = &ms->hosts[h];
+    AD_Host*		ah = &ad->hosts[h];
+    size_t		unparked = 0;
+    size_t		i;
+
+    mh->target = target;
+    if (target < ah->least) {
+	ah->least = target;
+    }
+    if (target > ah->most) {
+	ah->most = target;
+    }
+    for (i = ah->first;  i < ah->first + ah->cnt;  ++i) {
+	QI_Index	s = ad->slots[i];
+
+	if (mh->active < target && ms->state[s] == ml_sParked) {
+	    ML_UnparkSlot(ms, s);
+	    unparked++;
+	} else if (mh->active > target && ms->state[s] == ml_sReady) {
+	    ML_ParkSlot(ms, s);
+	}
+    }
+    return unparked;
+}
+
+/* AD_Init --
+ *
+ * Synopsis:
+ *
+ *    Start adapting the slot counts of the hosts in 'ms' between 'lo'
+ *    and 'hi' times their configured counts, sampling every
+ *    'interval' seconds, the first time an interval after 'now'.
+ *    Hosts that are down are left alone.  Samplers run 'command',
+ *    through 'spawnCommand' unless 'localExec' and the host is this
+ *    one, with the signal mask 'childMask'.
+ */
+
+void
+AD_Init(AD_Control* ad, MachineList* ms, double lo, double hi,
+	double interval, const char* spawnCommand, const char* command,
+	int localExec, const sigset_t* childMask, double now)
+{
+    size_t*	fill;
+    size_t	h, s, total = 0;
+
+    ad->ms = ms;
+    ad->interval = interval;
+    ad->spawnCommand = spawnCommand;
+    ad->command = command;
+    ad->localExec = localExec;
+    ad->childMask = childMask;
+    ad->roundStart = -1.0;
+    ad->nextRound = now + interval;
+    ad->running = 0;
+    ad->hosts = (AD_Host*) calloc(ms->hcnt, sizeof(AD_Host));
+    /*FIXME: Out of memory */
+
+    for (s = 0;  s < ms->mcnt;  ++s) {
+	ad->hosts[ms->host[s]].configured++;
+    }
+
+    /*
+     * Make the slots for the upper bound; they start parked.
+     */
+    for (h = 0;  h < ms->hcnt;  ++h) {
+	AD_Host*	ah = &ad->hosts[h];
+	size_t		c = ah->configured;
+
+	ah->pid = 0;
+	ah->fd = -1;
+	if (ms->hosts[h].isDown) {
+	    ah->lo = ah->hi = c;
+	} else {
+	    ah->lo = (size_t) (c * lo + 0.5);
+	    ah->hi = (size_t) (c * hi + 0.5);
+	    if (ah->lo < 1) {
+		ah->lo = 1;
+	    }
+	    if (ah->hi < ah->lo) {
+		ah->hi = ah->lo;
+	    }
+	}
+	for (s = c;  s < ah->hi;  ++s) {
+	    ML_ParkSlot(ms, ML_AddSlot(ms, (QI_Index) h));
+	}
+	ah->cnt = c > ah->hi ? c : ah->hi;
+	ah->first = total;
+	total += ah->cnt;
+    }
+
+    /*
+     * Group the slots by host, for adjusting one host at a time.
+     */
+    ad->slots = (QI_Index*) malloc(total * sizeof(QI_Index));
+    fill = (size_t*) malloc(ms->hcnt * sizeof(size_t));
+    /*FIXME: Out of memory */
+    for (h = 0;  h < ms->hcnt;  ++h) {
+	fill[h] = ad->hosts[h].first;
+    }
+    for (s = 0;  s < ms->mcnt;  ++s) {
+	ad->slots[fill[ms->host[s]]++] = (QI_Index) s;
+    }
+    free(fill);
+
+    /*
+     * Start every host at its configured count, within the bounds.
+     */
+    for (h = 0;  h < ms->hcnt;  ++h) {
+	AD_Host*	ah = &ad->hosts[h];
+	size_t		t = ah->configured;
+
+	if (ms->hosts[h].isDown) {
+	    continue;
+	}
+	t = t < ah->lo ? ah->lo : t > ah->hi ? ah->hi : t;
+	ah->least = ah->most = t;
+	ad_apply(ad, (QI_Index) h, t);
+    }
+}
+
+/* ad_start --
+ *
+ * Synopsis:
+ *
+ *    Run the sampler for host 'h', with its output on a pipe.
+ */
+
+static void
+ad_start(AD_Control* ad, QI_Index h)
+{
+    MachineHost*	mh = &ad->ms->hosts[h];
+    AD_Host*		ah = &ad->hosts[h];
+    int			p[2];
+    pid_t		pid;
+
+    if (pipe2(p, O_CLOEXEC) < 0) {
+	return;
+    }
+    pid = fork();
+    if (pid < 0) {
+	close(p[0]);
+	close(p[1]);
+	return;
+    }
+    if (pid == 0) {
+	int	fd = open("/dev/null", O_RDWR);
+
+	dup2(p[1], 1);
+	if (fd >= 0) {
+	    dup2(fd, 0);
+	    dup2(fd, 2);
+	}
+	signal(SIGINT, SIG_DFL);
+	signal(SIGQUIT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	sigprocmask(SIG_SETMASK, ad->childMask, (sigset_t*) NULL);
+	setpgid(0, 0);
+	if (mh->isLocal && ad->localExec) {
+	    execl("/bin/sh", "sh", "-c", ad->command, (char*) NULL);
+	} else {
+	    execl(ad->spawnCommand, ad->spawnCommand, mh->name,
+		  ad->command, (char*) NULL);
+	}
+	_exit(127);
+    }
+    setpgid(pid, pid);
+    close(p[1]);
+    fcntl(p[0], F_SETFL, fcntl(p[0], F_GETFL) | O_NONBLOCK);
+    ah->pid = pid;
+    ah->fd = p[0];
+    ah->out = (char*) malloc(AD_OUT_MAX);
+    /*FIXME: Out of memory */
+    ah->outLen = 0;
+    ad->running++;
+}
+
+/* ad_end --
+ *
+ * Synopsis:
+ *
+ *    Stop reading the sampler of host 'h', killing it if 'kill' is
+ *    set.  Its exit is reaped with the job's processes.
+ */
+
+static void
+ad_end(AD_Control* ad, QI_Index h, int kill)
+{
+    AD_Host*	ah = &ad->hosts[h];
+
+    if (kill) {
+	killpg(ah->pid, SIGKILL);
+    }
+    close(ah->fd);
+    free(ah->out);
+    ah->out = (char*) NULL;
+    ah->fd = -1;
+    ah->pid = 0;
+    ad->running--;
+}
+
+/* AD_Tick --
+ *
+ * Synopsis:
+ *
+ *    Give up on samplers that have run for an interval, and start
+ *    the next round of them when it is due.
+ */
+
+void
+AD_Tick(AD_Control* ad, double now)
+{
+    size_t	h;
+
+    if (ad->roundStart >= 0.0) {
+	if (now < ad->roundStart + ad->interval) {
+	    return;
+	}
+	for (h = 0;  h < ad->ms->hcnt;  ++h) {
+	    if (ad->hosts[h].fd >= 0) {
+		ad_end(ad, (QI_Index) h, 1);
+	    }
+	}
+	ad->roundStart = -1.0;
+    }
+    if (now < ad->nextRound) {
+	return;
+    }
+    ad->nextRound = now + ad->interval;
+    for (h = 0;  h < ad->ms->hcnt;  ++h) {
+	if (!ad->ms->hosts[h].isDown) {
+	    ad_start(ad, (QI_Index) h);
+	}
+    }
+    if (ad->running > 0) {
+	ad->roundStart = now;
+    }
+}
+
+/* AD_Next --
+ *
+ * Synopsis:
+ *
+ *    When AD_Tick next has something to do.
+ */
+
+double
+AD_Next(const AD_Control* ad)
+{
+    return ad->roundStart >= 0.0 ? ad->roundStart + ad->interval : ad->nextRound;
+}
+
+/* ad_value --
+ *
+ * Synopsis:
+ *
+ *    The number at 'p', or -1 if there is none.
+ */
+
+static double
+ad_value(const char* p)
+{
+    char*	ep;
+    double	v = strtod(p, &ep);
+
+    return ep == p ? -1.0 : v;
+}
+
+/* ad_parse --
+ *
+ * Synopsis:
+ *
+ *    Read a sampler's output.  Returns 0 if it said nothing useful.
+ */
+
+static int
+ad_parse(char* out, AD_Sample* as)
+{
+    char*	line;
+    char*	next;
+
+    as->load = as->runnable = -1.0;
+    as->cpus = 0;
+    as->cpuSome = as->memSome = as->memFull = -1.0;
+    as->memTotal = as->memAvail = 0.0;
+    for (line = out;  line != NULL && *line;  line = next) {
+	next = strchr(line, '\n');
+	if (next != NULL) {
+	    *next++ = '\0';
+	}
+	if (!strncmp(line, "load ", 5)) {
+	    char*	rp = strchr(line, '/');
+
+	    as->load = ad_value(line + 5);
+	    /* The runnable count precedes the '/'; the sampler is one. */
+	    if (rp != NULL) {
+		while (rp > line && rp[-1] != ' ') {
+		    --rp;
+		}
+		as->runnable = ad_value(rp) - 1.0;
+	    }
+	} else if (!strncmp(line, "cpus ", 5)) {
+	    as->cpus = (long) ad_value(line + 5);
+	} else if (!strncmp(line, "cpu some avg10=", 15)) {
+	    as->cpuSome = ad_value(line + 15);
+	} else if (!strncmp(line, "mem some avg10=", 15)) {
+	    as->memSome = ad_value(line + 15);
+	} else if (!strncmp(line, "mem full avg10=", 15)) {
+	    as->memFull = ad_value(line + 15);
+	} else if (!strncmp(line, "MemTotal:", 9)) {
+	    as->memTotal = ad_value(line + 9);
+	} else if (!strncmp(line, "MemAvailable:", 13)) {
+	    as->memAvail = ad_value(line + 13);
+	}
+    }
+    return as->load >= 0.0 || as->cpuSome >= 0.0 || as->memTotal > 0.0;
+}
+
+/* ad_adjust --
+ *
+ * Synopsis:
+ *
+ *    Move the target of host 'h' a step, if its sample calls for it.
+ *    Returns the number of slots unparked.
+ */
+
+static size_t
+ad_adjust(AD_Control* ad, QI_Index h, const AD_Sample* as)
+{
+    MachineList*	ms = ad->ms;
+    MachineHost*	mh = &ms->hosts[h];
+    AD_Host*		ah = &ad->hosts[h];
+    size_t		step = ah->configured / 4 ? ah->configured / 4 : 1;
+    size_t		target = mh->target;
+    size_t		busy = 0, i;
+    double		perCpu = -1.0, nowPerCpu = -1.0, avail = -1.0;
+    int			shortMem, hot, idle, ample;
+
+    if (as->load >= 0.0 && as->cpus > 0) {
+	perCpu = as->load / as->cpus;
+    }
+    if (as->runnable >= 0.0 && as->cpus > 0) {
+	nowPerCpu = as->runnable / as->cpus;
+    }
+    if (as->memTotal > 0.0 && as->memAvail >= 0.0) {
+	avail = as->memAvail / as->memTotal;
+    }
+    shortMem = (avail >= 0.0 && avail < AD_MEM_SHORT) || as->memFull > AD_MEM_FULL;
+    ample = (avail < 0.0 || avail > AD_MEM_AMPLE) && as->memSome < AD_MEM_CALM;
+    hot = as->cpuSome >= 0.0 ? as->cpuSome > AD_CPU_HOT : perCpu > AD_LOAD_HOT;
+    idle = perCpu >= 0.0 && perCpu < AD_LOAD_IDLE && nowPerCpu <= AD_NOW_IDLE
+	&& as->cpuSome < AD_CPU_IDLE;
+
+    for (i = ah->first;  i < ah->first + ah->cnt;  ++i) {
+	uint8_t	st = ms->state[ad->slots[i]];
+	busy += st == ml_sRun || st == ml_sKilled;
+    }
+
+    if (shortMem || hot) {
+	target = target > ah->lo + step ? target - step : ah->lo;
+    } else if (idle && ample && busy >= mh->active) {
+	/* More slots only help if those it has are all in use. */
+	target = target + step < ah->hi ? target + step : ah->hi;
+    }
+    if (target == mh->target) {
+	return 0;
+    }
+    return ad_apply(ad, h, target);
+}
+
+/* AD_Service --
+ *
+ * Synopsis:
+ *
+ *    Read what the samplers have written.  Each that has finished is
+ *    judged, and its host's target moved.
+ *
+ * Returns:
+ *
+ *    The number of slots unparked, which are now ready.
+ */
+
+size_t
+AD_Service(AD_Control* ad)
+{
+    size_t	unparked = 0;
+    size_t	h;
+
+    for (h = 0;  h < ad->ms->hcnt;  ++h) {
+	AD_Host*	ah = &ad->hosts[h];
+	AD_Sample	as;
+	ssize_t		r;
+
+	if (ah->fd < 0) {
+	    continue;
+	}
+	for (;;) {
+	    char	discard[512];
+	    size_t	room = AD_OUT_MAX - 1 - ah->outLen;
+
+	    if (room > 0) {
+		r = read(ah->fd, ah->out + ah->outLen, room);
+	    } else {
+		r = read(ah->fd, discard, sizeof(discard));
+	    }
+	    if (r > 0) {
+		if (room > 0) {
+		    ah->outLen += (size_t) r;
+		}
+	    } else if (r < 0 && errno == EINTR) {
+		continue;
+	    } else {
+		break;
+	    }
+	}
+	if (r < 0 && errno == EAGAIN) {
+	    continue;
+	}
+	ah->out[ah->outLen] = '\0';
+	if (r == 0 && ad_parse(ah->out, &as)) {
+	    unparked += ad_adjust(ad, (QI_Index) h, &as);
+	}
+	ad_end(ad, (QI_Index) h, 0);
+    }
+    if (ad->running == 0) {
+	ad->roundStart = -1.0;
+    }
+    return unparked;
+}
+
+/* AD_Stop --
+ *
+ * Synopsis:
+ *
+ *    Kill any samplers still running.
+ */
+
+void
+AD_Stop(AD_Control* ad)
+{
+    size_t	h;
+
+    for (h = 0;  h < ad->ms->hcnt;  ++h) {
+	if (ad->hosts[h].fd >= 0) {
+	    ad_end(ad, (QI_Index) h, 1);
+	}
+    }
+    ad->roundStart = -1.0;
+}
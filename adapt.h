@@ -0,0 +1,107 @@
+/* Load-adaptive slot counts. */
+
+#ifndef ADAPTIVE_SLOTS_H
+#define ADAPTIVE_SLOTS_H
+
+#include <stddef.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#include "qi.h"
+#include "ml.h"
+
+/*
+ * With -adapt, each host runs between 'lo' and 'hi' times as many
+ * processes at once as the machine file gives it slots, following
+ * its load.  Every interval, a sampler is run on every host that is
+ * up (through the spawn command, or directly on this host) and prints
+ * its load in lines of the form
+ *
+ *     load 0.52 0.58 0.59 1/1234 5678		(/proc/loadavg)
+ *     cpus 16
+ *     cpu some avg10=1.20 ...			(/proc/pressure/cpu)
+ *     mem some avg10=0.00 ...			(/proc/pressure/memory)
+ *     mem full avg10=0.00 ...
+ *     MemTotal: 65536000 kB			(/proc/meminfo)
+ *     MemAvailable: 32768000 kB
+ *
+ * Lines it does not recognise are ignored, as are missing ones; a host
+ * without pressure information is judged by its load alone.  A host
+ * short of memory, or whose CPUs are contended, gives up a step of
+ * slots; one whose slots are all busy while its CPUs are idle and its
+ * memory ample gets a step more.  A step is a quarter of the host's
+ * slots, at least one.
+ *
+ * The slots for the upper bound are all made at the start, and those
+ * over a host's target are parked (see ML_ParkSlot), so the tables
+ * sized by slot never grow.  A sampler that has not finished within
+ * the interval is killed, and its host left as it is.
+ */
+
+#define AD_OUT_MAX	4096	/* Sampler output kept. */
+#define AD_DEFAULT_INTERVAL	5.0	/* Seconds. */
+
+#define AD_DEFAULT_COMMAND \
+    "echo load $(cat /proc/loadavg);" \
+    " echo cpus $(getconf _NPROCESSORS_ONLN);" \
+    " sed 's/^/cpu /' /proc/pressure/cpu 2>/dev/null;" \
+    " sed 's/^/mem /' /proc/pressure/memory 2>/dev/null;" \
+    " grep -E '^Mem(Total|Available):' /proc/meminfo"
+
+typedef struct AD_Sample {
+    double	load;		/* Run queue, one minute average. */
+    double	runnable;	/* Tasks runnable when sampled. */
+    long	cpus;		/* 0 if unknown. */
+    double	cpuSome;	/* Percent stalled, over 10s; < 0 if unknown. */
+    double	memSome;
+    double	memFull;
+    double	memTotal;	/* kB; 0 if unknown. */
+    double	memAvail;
+} AD_Sample;
+
+typedef struct AD_Host {
+    size_t	configured;	/* Slots in the machine file. */
+    size_t	lo;		/* Bounds on the target. */
+    size_t	hi;
+    size_t	first;		/* Its slots, in AD_Control.slots, */
+    size_t	cnt;		/* and how many. */
+    size_t	least;		/* Range of the target, for the summary. */
+    size_t	most;
+    pid_t	pid;		/* Sampler running, or 0. */
+    int		fd;		/* Its output, or -1. */
+    size_t	outLen;
+    char*	out;		/* While sampling. */
+} AD_Host;
+
+typedef struct AD_Control {
+    MachineList*	ms;
+    AD_Host*		hosts;
+    QI_Index*		slots;		/* Grouped by host. */
+    double		interval;	/* Seconds between samples. */
+    const char*		spawnCommand;
+    const char*		command;	/* The sampler. */
+    int			localExec;	/* Sample this host directly. */
+    const sigset_t*	childMask;	/* Signal mask for samplers. */
+    double		roundStart;	/* < 0 if no samplers are running. */
+    double		nextRound;
+    size_t		running;
+} AD_Control;
+
+void
+AD_Init(AD_Control* ad, MachineList* ms, double lo, double hi,
+	double interval, const char* spawnCommand, const char* command,
+	int localExec, const sigset_t* childMask, double now);
+
+void
+AD_Tick(AD_Control* ad, double now);
+
+double
+AD_Next(const AD_Control* ad);
+
+size_t
+AD_Service(AD_Control* ad);
+
+void
+AD_Stop(AD_Control* ad);
+
+#endif /* !defined ADAPTIVE_SLOTS_H */
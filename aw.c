@@ -0,0 +1,726 @@
+/* Asynchronous output writes. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#ifdef HAVE_LINUX_IO_URING_H
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#include "aw.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+/* aw_ring_free --
+ *
+ * Synopsis:
+ *
+ *    Unmap the ring's queues and close it.
+ */
+
+static void
+aw_ring_free(AW_Writer* aw)
+{
+    if (aw->sqes != NULL && aw->sqes != MAP_FAILED) {
+	munmap(aw->sqes, aw->sqesLen);
+    }
+    if (aw->cqMap != NULL && aw->cqMap != MAP_FAILED && aw->cqMap != aw->sqMap) {
+	munmap(aw->cqMap, aw->cqMapLen);
+    }
+    if (aw->sqMap != NULL && aw->sqMap != MAP_FAILED) {
+	munmap(aw->sqMap, aw->sqMapLen);
+    }
+    aw->sqes = aw->cqMap = aw->sqMap = NULL;
+    close(aw->ring);
+    aw->ring = -1;
+}
+
+/* aw_ring_setup --
+ *
+ * Synopsis:
+ *
+ *    Set up the ring, map its queues, and register the notification
+ *    descriptor and the buffers with it.
+ *
+ * Returns:
+ *
+ *    0 on success, or -1 if this kernel (or its configuration) will
+ *    not run one.
+ */
+
+static int
+aw_ring_setup(AW_Writer* aw)
+{
+    struct io_uring_params	p;
+    struct iovec		iov[AW_FIXED];
+    int				i;
+
+    memset(&p, 0, sizeof(p));
+    aw->ring = (int) syscall(__NR_io_uring_setup, AW_RING, &p);
+    if (aw->ring < 0) {
+	return -1;
+    }
+    if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+	/* Writes at the current position are needed for pipes and appends. */
+	aw_ring_free(aw);
+	return -1;
+    }
+
+    aw->sqMapLen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    aw->cqMapLen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	if (aw->cqMapLen > aw->sqMapLen) {
+	    aw->sqMapLen = aw->cqMapLen;
+	}
+	aw->cqMapLen = 0;
+    }
+    aw->sqMap = mmap(NULL, aw->sqMapLen, PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_POPULATE, aw->ring, IORING_OFF_SQ_RING);
+    if (aw->cqMapLen == 0) {
+	aw->cqMap = aw->sqMap;
+    } else {
+	aw->cqMap = mmap(NULL, aw->cqMapLen, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, aw->ring, IORING_OFF_CQ_RING);
+    }
+    aw->sqesLen = p.sq_entries * sizeof(struct io_uring_sqe);
+    aw->sqes = mmap(NULL, aw->sqesLen, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, aw->ring, IORING_OFF_SQES);
+    if (aw->sqMap == MAP_FAILED || aw->cqMap == MAP_FAILED
+	|| aw->sqes == MAP_FAILED) {
+	aw_ring_free(aw);
+	return -1;
+    }
+
+    aw->sqHead = (unsigned*) ((char*) aw->sqMap + p.sq_off.head);
+    aw->sqTail = (unsigned*) ((char*) aw->sqMap + p.sq_off.tail);
+    aw->sqMask = (unsigned*) ((char*) aw->sqMap + p.sq_off.ring_mask);
+    aw->sqArray = (unsigned*) ((char*) aw->sqMap + p.sq_off.array);
+    aw->cqHead = (unsigned*) ((char*) aw->cqMap + p.cq_off.head);
+    aw->cqTail = (unsigned*) ((char*) aw->cqMap + p.cq_off.tail);
+    aw->cqMask = (unsigned*) ((char*) aw->cqMap + p.cq_off.ring_mask);
+    aw->cqes = (char*) aw->cqMap + p.cq_off.cqes;
+
+    if (syscall(__NR_io_uring_register, aw->ring, IORING_REGISTER_EVENTFD,
+		&aw->notifyFd, 1) < 0) {
+	aw_ring_free(aw);
+	return -1;
+    }
+
+    /*
+     * Registered buffers save the kernel mapping them on every write.
+     * If they cannot be (e.g., the locked memory limit is low), the
+     * same buffers are used unregistered.
+     */
+    for (i = 0;  i < AW_FIXED;  ++i) {
+	iov[i].iov_base = aw->arena + (size_t) i * AW_BUF;
+	iov[i].iov_len = AW_BUF;
+    }
+    aw->fixed = syscall(__NR_io_uring_register, aw->ring,
+			IORING_REGISTER_BUFFERS, iov, AW_FIXED) == 0;
+    return 0;
+}
+
+/* aw_ring_start --
+ *
+ * Synopsis:
+ *
+ *    Queue a write of the rest of buffer 'b' to 'fd' on the ring.
+ */
+
+static void
+aw_ring_start(AW_Writer* aw, int fd, AW_Buf* b)
+{
+    unsigned			tail = *aw->sqTail;
+    unsigned			i = tail & *aw->sqMask;
+    struct io_uring_sqe*	sqe = &((struct io_uring_sqe*) aw->sqes)[i];
+    int				fixed = aw->fixed && b->index >= 0;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) (b->data + b->off);
+    sqe->len = (uint32_t) (b->len - b->off);
+    sqe->off = (uint64_t) -1;
+    sqe->buf_index = fixed ? (uint16_t) b->index : 0;
+    sqe->user_data = (uint64_t) fd;
+    aw->sqArray[i] = i;
+    __atomic_store_n(aw->sqTail, tail + 1, __ATOMIC_RELEASE);
+    aw->sqPending++;
+}
+
+#endif /* HAVE_LINUX_IO_URING_H */
+
+/* aw_worker --
+ *
+ * Synopsis:
+ *
+ *    A writer thread: take writes off the job ring, do them, and
+ *    post the results.  Signals are left to the main thread.
+ */
+
+static void*
+aw_worker(void* arg)
+{
+    AW_Writer*	aw = (AW_Writer*) arg;
+    sigset_t	all;
+    uint64_t	one = 1;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, (sigset_t*) NULL);
+
+    pthread_mutex_lock(&aw->lock);
+    for (;;) {
+	AW_Job	job;
+
+	while (aw->jobCnt == 0 && !aw->stopping) {
+	    pthread_cond_wait(&aw->work, &aw->lock);
+	}
+	if (aw->jobCnt == 0) {
+	    break;
+	}
+	job = aw->jobs[aw->jobHead];
+	aw->jobHead = (aw->jobHead + 1) % AW_RING;
+	aw->jobCnt--;
+	pthread_mutex_unlock(&aw->lock);
+
+	do {
+	    job.result = write(job.fd, job.p, job.n);
+	} while (job.result < 0 && errno == EINTR);
+	job.err = job.result < 0 ? errno : 0;
+
+	pthread_mutex_lock(&aw->lock);
+	aw->done[aw->doneCnt++] = job;
+	if (write(aw->notifyFd, &one, sizeof(one)) < 0) {
+	    /* The count is already non-zero. */
+	}
+    }
+    pthread_mutex_unlock(&aw->lock);
+    return NULL;
+}
+
+/* AW_Create --
+ *
+ * Synopsis:
+ *
+ *    Make a writer, on io_uring if 'want' is aw_bUring and the
+ *    kernel allows, and otherwise on threads.
+ *
+ * Returns:
+ *
+ *    The writer, or NULL if neither can be had.
+ */
+
+AW_Writer*
+AW_Create(AW_Backend want)
+{
+    AW_Writer*	aw;
+    int		i;
+
+    aw = (AW_Writer*) calloc(1, sizeof(AW_Writer));
+    /*FIXME: Out of memory */
+    aw->startHead = aw->startTail = -1;
+    aw->ring = -1;
+    aw->notifyFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    aw->arena = (char*) malloc((size_t) AW_FIXED * AW_BUF);
+    if (aw->notifyFd < 0 || aw->arena == NULL) {
+	free(aw->arena);
+	free(aw);
+	return (AW_Writer*) NULL;
+    }
+    for (i = AW_FIXED;  i-- > 0;  ) {
+	AW_Buf*	b = (AW_Buf*) malloc(sizeof(AW_Buf));
+	/*FIXME: Out of memory */
+	b->data = aw->arena + (size_t) i * AW_BUF;
+	b->index = i;
+	b->next = aw->spare;
+	aw->spare = b;
+	aw->spareCnt++;
+    }
+
+#ifdef HAVE_LINUX_IO_URING_H
+    if (want == aw_bUring && aw_ring_setup(aw) == 0) {
+	aw->backend = aw_bUring;
+	return aw;
+    }
+#else
+    (void) want;	/* Built without io_uring: always threads. */
+#endif
+
+    aw->backend = aw_bThreads;
+    pthread_mutex_init(&aw->lock, (pthread_mutexattr_t*) NULL);
+    pthread_cond_init(&aw->work, (pthread_condattr_t*) NULL);
+    for (i = 0;  i < AW_THREADS;  ++i) {
+	if (pthread_create(&aw->threads[i], (pthread_attr_t*) NULL,
+			   aw_worker, aw) != 0) {
+	    break;
+	}
+	aw->threadCnt++;
+    }
+    if (aw->threadCnt == 0) {
+	AW_Destroy(aw);
+	return (AW_Writer*) NULL;
+    }
+    return aw;
+}
+
+/* aw_file --
+ *
+ * Synopsis:
+ *
+ *    The writer's record of 'fd', growing the table to hold it.
+ */
+
+static AW_File*
+aw_file(AW_Writer* aw, int fd)
+{
+    if (fd >= aw->fileLen) {
+	int	n = aw->fileLen ? aw->fileLen : 64;
+	while (n <= fd) {
+	    n *= 2;
+	}
+	aw->files = (AW_File*) realloc(aw->files, n * sizeof(AW_File));
+	/*FIXME: Out of memory */
+	memset(aw->files + aw->fileLen, 0, (n - aw->fileLen) * sizeof(AW_File));
+	aw->fileLen = n;
+    }
+    return &aw->files[fd];
+}
+
+/* aw_get_buf --
+ *
+ * Synopsis:
+ *
+ *    An empty buffer: a spare one if there is one, else a new one.
+ */
+
+static AW_Buf*
+aw_get_buf(AW_Writer* aw)
+{
+    AW_Buf*	b = aw->spare;
+
+    if (b != NULL) {
+	aw->spare = b->next;
+	aw->spareCnt--;
+    } else {
+	b = (AW_Buf*) malloc(sizeof(AW_Buf));
+	b->data = (char*) malloc(AW_BUF);
+	/*FIXME: Out of memory */
+	b->index = -1;
+    }
+    b->next = (AW_Buf*) NULL;
+    b->len = b->off = 0;
+    return b;
+}
+
+/* aw_put_buf --
+ *
+ * Synopsis:
+ *
+ *    Recycle a buffer.  Registered ones are always kept; others only
+ *    while there are fewer spares than registered buffers.
+ */
+
+static void
+aw_put_buf(AW_Writer* aw, AW_Buf* b)
+{
+    if (b->index < 0 && aw->spareCnt >= AW_FIXED) {
+	free(b->data);
+	free(b);
+	return;
+    }
+    b->next = aw->spare;
+    aw->spare = b;
+    aw->spareCnt++;
+}
+
+/* aw_queue --
+ *
+ * Synopsis:
+ *
+ *    Put 'fd' on the list of files with a write to start.
+ */
+
+static void
+aw_queue(AW_Writer* aw, int fd)
+{
+    AW_File*	f = &aw->files[fd];
+
+    if (f->queued) {
+	return;
+    }
+    f->queued = 1;
+    f->next = -1;
+    if (aw->startTail < 0) {
+	aw->startHead = fd;
+    } else {
+	aw->files[aw->startTail].next = fd;
+    }
+    aw->startTail = fd;
+}
+
+/* aw_forget --
+ *
+ * Synopsis:
+ *
+ *    Close 'fd' and forget it.
+ */
+
+static void
+aw_forget(AW_Writer* aw, int fd)
+{
+    close(fd);
+    memset(&aw->files[fd], 0, sizeof(AW_File));
+}
+
+/* AW_Write --
+ *
+ * Synopsis:
+ *
+ *    Queue 'n' bytes to be written to 'fd'.  They are copied, so the
+ *    caller may reuse 'p' at once.
+ */
+
+void
+AW_Write(AW_Writer* aw, int fd, const char* p, size_t n)
+{
+    AW_File*	f;
+
+    if (fd < 0 || n == 0) {
+	return;
+    }
+    f = aw_file(aw, fd);
+    f->open = 1;
+    aw->queued += n;
+    while (n > 0) {
+	AW_Buf*	b = f->tail;
+	size_t	k;
+
+	if (b == NULL || b->len == AW_BUF || (f->busy && b == f->head)) {
+	    b = aw_get_buf(aw);
+	    if (f->tail == NULL) {
+		f->head = b;
+	    } else {
+		f->tail->next = b;
+	    }
+	    f->tail = b;
+	}
+	k = AW_BUF - b->len;
+	if (k > n) {
+	    k = n;
+	}
+	memcpy(b->data + b->len, p, k);
+	b->len += k;
+	p += k;
+	n -= k;
+    }
+    if (!f->busy) {
+	aw_queue(aw, fd);
+    }
+}
+
+/* AW_Full --
+ *
+ * Synopsis:
+ *
+ *    True iff AW_BUDGET bytes or more are queued.
+ */
+
+int
+AW_Full(const AW_Writer* aw)
+{
+    return aw->queued >= AW_BUDGET;
+}
+
+/* AW_Throttle --
+ *
+ * Synopsis:
+ *
+ *    Wait until fewer than AW_BUDGET bytes are queued.
+ */
+
+void
+AW_Throttle(AW_Writer* aw)
+{
+    while (AW_Full(aw)) {
+	struct pollfd	pfd;
+
+	AW_Submit(aw);
+	pfd.fd = aw->notifyFd;
+	pfd.events = POLLIN;
+	/* If the ring would not take everything, try again shortly. */
+	poll(&pfd, 1, aw->sqPending > 0 ? 1 : -1);
+	AW_Reap(aw);
+    }
+}
+
+/* AW_Close --
+ *
+ * Synopsis:
+ *
+ *    Close 'fd' once everything queued for it is written.
+ */
+
+void
+AW_Close(AW_Writer* aw, int fd)
+{
+    AW_File*	f;
+
+    if (fd < 0) {
+	return;
+    }
+    if (fd >= aw->fileLen || !aw->files[fd].open) {
+	close(fd);
+	return;
+    }
+    f = &aw->files[fd];
+    f->closing = 1;
+    if (!f->busy && f->head == NULL) {
+	aw_forget(aw, fd);
+    }
+}
+
+/* AW_Submit --
+ *
+ * Synopsis:
+ *
+ *    Start a write on every file that has output waiting and none in
+ *    flight, up to AW_RING in flight in all, in one submission.
+ */
+
+void
+AW_Submit(AW_Writer* aw)
+{
+    int		fd;
+
+    if (aw->backend == aw_bThreads) {
+	pthread_mutex_lock(&aw->lock);
+    }
+    while ((fd = aw->startHead) >= 0 && aw->inFlight < AW_RING) {
+	AW_File*	f = &aw->files[fd];
+	AW_Buf*		b = f->head;
+
+	aw->startHead = f->next;
+	if (aw->startHead < 0) {
+	    aw->startTail = -1;
+	}
+	f->queued = 0;
+	if (f->busy || b == NULL) {
+	    continue;
+	}
+	f->busy = 1;
+	aw->inFlight++;
+#ifdef HAVE_LINUX_IO_URING_H
+	if (aw->backend == aw_bUring) {
+	    aw_ring_start(aw, fd, b);
+	    continue;
+	}
+#endif
+	{
+	    AW_Job*	job = &aw->jobs[(aw->jobHead + aw->jobCnt++) % AW_RING];
+	    job->fd = fd;
+	    job->p = b->data + b->off;
+	    job->n = b->len - b->off;
+	}
+    }
+    if (aw->backend == aw_bThreads) {
+	if (aw->jobCnt > 0) {
+	    pthread_cond_broadcast(&aw->work);
+	}
+	pthread_mutex_unlock(&aw->lock);
+    }
+#ifdef HAVE_LINUX_IO_URING_H
+    if (aw->backend == aw_bUring && aw->sqPending > 0) {
+	long	r = syscall(__NR_io_uring_enter, aw->ring, aw->sqPending, 0, 0,
+			    NULL, 0);
+	if (r > 0) {
+	    aw->sqPending -= (unsigned) r;
+	}
+    }
+#endif
+}
+
+/* aw_complete --
+ *
+ * Synopsis:
+ *
+ *    Account for a finished write to 'fd' that wrote 'res' bytes, or
+ *    failed with -'res'.  A file whose write fails loses the rest of
+ *    its queued output; the first such error is kept for AW_Drain.
+ */
+
+static void
+aw_complete(AW_Writer* aw, int fd, long res)
+{
+    AW_File*	f = &aw->files[fd];
+    AW_Buf*	b = f->head;
+
+    aw->inFlight--;
+    f->busy = 0;
+    if (res == -EINTR || res == -EAGAIN) {
+	res = 0;
+    } else if (res <= 0) {
+	if (aw->error == 0) {
+	    aw->error = res < 0 ? (int) -res : EIO;
+	}
+	while ((b = f->head) != NULL) {
+	    f->head = b->next;
+	    aw->queued -= b->len - b->off;
+	    aw_put_buf(aw, b);
+	}
+	f->tail = (AW_Buf*) NULL;
+    }
+    if (b != NULL) {
+	aw->queued -= (size_t) res;
+	b->off += (size_t) res;
+	if (b->off == b->len) {
+	    f->head = b->next;
+	    if (f->head == NULL) {
+		f->tail = (AW_Buf*) NULL;
+	    }
+	    aw_put_buf(aw, b);
+	}
+    }
+    if (f->head != NULL) {
+	aw_queue(aw, fd);
+    } else if (f->closing) {
+	aw_forget(aw, fd);
+    }
+}
+
+/* AW_Reap --
+ *
+ * Synopsis:
+ *
+ *    Collect the writes that have finished.  Call when notifyFd is
+ *    readable, then AW_Submit to start the writes that follow.
+ */
+
+void
+AW_Reap(AW_Writer* aw)
+{
+    uint64_t	cnt;
+
+    if (read(aw->notifyFd, &cnt, sizeof(cnt)) < 0) {
+	/* Nothing signalled; look anyway. */
+    }
+#ifdef HAVE_LINUX_IO_URING_H
+    if (aw->backend == aw_bUring) {
+	unsigned	head = *aw->cqHead;
+
+	while (head != __atomic_load_n(aw->cqTail, __ATOMIC_ACQUIRE)) {
+	    struct io_uring_cqe*	cqe;
+
+	    cqe = &((struct io_uring_cqe*) aw->cqes)[head & *aw->cqMask];
+	    aw_complete(aw, (int) cqe->user_data, (long) cqe->res);
+	    ++head;
+	}
+	__atomic_store_n(aw->cqHead, head, __ATOMIC_RELEASE);
+	return;
+    }
+#endif
+    {
+	AW_Job	done[AW_RING];
+	size_t	i, n;
+
+	pthread_mutex_lock(&aw->lock);
+	n = aw->doneCnt;
+	memcpy(done, aw->done, n * sizeof(AW_Job));
+	aw->doneCnt = 0;
+	pthread_mutex_unlock(&aw->lock);
+	for (i = 0;  i < n;  ++i) {
+	    aw_complete(aw, done[i].fd,
+			done[i].result < 0 ? -(long) done[i].err : (long) done[i].result);
+	}
+    }
+}
+
+/* AW_Drain --
+ *
+ * Synopsis:
+ *
+ *    Wait until everything queued is written.
+ *
+ * Returns:
+ *
+ *    0, or -1 with errno set if any write failed.
+ */
+
+int
+AW_Drain(AW_Writer* aw)
+{
+    for (;;) {
+	struct pollfd	pfd;
+
+	AW_Submit(aw);
+	if (aw->inFlight == 0 && aw->startHead < 0) {
+	    break;
+	}
+	pfd.fd = aw->notifyFd;
+	pfd.events = POLLIN;
+	/* If the ring would not take everything, try again shortly. */
+	poll(&pfd, 1, aw->sqPending > 0 ? 1 : -1);
+	AW_Reap(aw);
+    }
+    if (aw->error != 0) {
+	errno = aw->error;
+	return -1;
+    }
+    return 0;
+}
+
+/* AW_Destroy --
+ *
+ * Synopsis:
+ *
+ *    Stop the writer and free it.  Output not yet written is lost;
+ *    call AW_Drain first.
+ */
+
+void
+AW_Destroy(AW_Writer* aw)
+{
+    AW_Buf*	b;
+    int		i;
+
+    if (aw->backend == aw_bThreads) {
+	pthread_mutex_lock(&aw->lock);
+	aw->stopping = 1;
+	pthread_cond_broadcast(&aw->work);
+	pthread_mutex_unlock(&aw->lock);
+	for (i = 0;  i < aw->threadCnt;  ++i) {
+	    pthread_join(aw->threads[i], (void**) NULL);
+	}
+	pthread_mutex_destroy(&aw->lock);
+	pthread_cond_destroy(&aw->work);
+    }
+#ifdef HAVE_LINUX_IO_URING_H
+    if (aw->ring >= 0) {
+	aw_ring_free(aw);
+    }
+#endif
+    for (i = 0;  i < aw->fileLen;  ++i) {
+	while ((b = aw->files[i].head) != NULL) {
+	    aw->files[i].head = b->next;
+	    aw_put_buf(aw, b);
+	}
+    }
+    while ((b = aw->spare) != NULL) {
+	aw->spare = b->next;
+	if (b->index < 0) {
+	    free(b->data);
+	}
+	free(b);
+    }
+    free(aw->files);
+    free(aw->arena);
+    close(aw->notifyFd);
+    free(aw);
+}
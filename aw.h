@@ -0,0 +1,142 @@
+/* Asynchronous output writes. */
+
+#ifndef ASYNC_WRITE_H
+#define ASYNC_WRITE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+/*
+ * The writer takes output the coordinator has captured and writes it
+ * to its files without ever blocking the caller.  AW_Write copies the
+ * bytes into buffers queued on the file (small writes to the same
+ * file share a buffer), and AW_Submit hands every file's oldest
+ * buffer to the kernel in one go.  Each file has at most one write
+ * in flight, so its output stays in order.
+ *
+ * Writes go through io_uring where the kernel has it, using a set of
+ * buffers registered with the ring (more are allocated if output
+ * arrives faster than it drains, and kept for reuse), and otherwise
+ * through a small pool of threads.  Either way, completions are
+ * signalled on aw->notifyFd, which the caller polls along with
+ * everything else, and collected by AW_Reap.  At most AW_RING writes
+ * are in flight at once.
+ *
+ * Output is queued only up to AW_BUDGET bytes, or the coordinator's
+ * memory would grow with whatever its processes print to a slow file
+ * system.  Past that, AW_Full is true, and the caller stops reading
+ * output until writes complete; AW_Throttle waits for them.
+ */
+
+#define AW_BUF		65536	/* Bytes per buffer. */
+#define AW_FIXED	64	/* Buffers registered with the ring. */
+#define AW_THREADS	4
+#define AW_RING		256	/* Submission queue entries. */
+#define AW_BUDGET	(64 * 1024 * 1024)	/* Bytes queued, at most. */
+
+typedef enum AW_Backend {
+    aw_bUring,
+    aw_bThreads
+} AW_Backend;
+
+typedef struct AW_Buf {
+    struct AW_Buf*	next;
+    char*		data;
+    size_t		len;
+    size_t		off;		/* Bytes already written. */
+    int			index;		/* In the arena, or -1. */
+} AW_Buf;
+
+typedef struct AW_File {
+    AW_Buf*		head;		/* Oldest first. */
+    AW_Buf*		tail;
+    int			open;		/* Known to the writer. */
+    int			busy;		/* head is being written. */
+    int			closing;	/* Close once written. */
+    int			queued;		/* On the start list. */
+    int			next;		/* Next fd on the start list. */
+} AW_File;
+
+typedef struct AW_Job {
+    int			fd;
+    const char*		p;
+    size_t		n;
+    ssize_t		result;
+    int			err;
+} AW_Job;
+
+typedef struct AW_Writer {
+    AW_Backend		backend;
+    AW_File*		files;		/* By descriptor. */
+    int			fileLen;
+    int			startHead;	/* Files with a write to start. */
+    int			startTail;
+    AW_Buf*		spare;		/* Buffers for reuse. */
+    size_t		spareCnt;
+    char*		arena;		/* The registered buffers. */
+    int			fixed;		/* They are registered with the ring. */
+    size_t		inFlight;
+    size_t		queued;		/* Bytes not yet written. */
+    int			notifyFd;	/* An eventfd. */
+    int			error;		/* First write errno, or 0. */
+
+    /* io_uring */
+    int			ring;
+    void*		sqMap;
+    size_t		sqMapLen;
+    void*		cqMap;
+    size_t		cqMapLen;
+    void*		sqes;
+    size_t		sqesLen;
+    unsigned*		sqHead;
+    unsigned*		sqTail;
+    unsigned*		sqMask;
+    unsigned*		sqArray;
+    unsigned*		cqHead;
+    unsigned*		cqTail;
+    unsigned*		cqMask;
+    void*		cqes;
+    unsigned		sqPending;
+
+    /* Threads */
+    pthread_t		threads[AW_THREADS];
+    pthread_mutex_t	lock;
+    pthread_cond_t	work;
+    AW_Job		jobs[AW_RING];	/* Writes to do, a ring. */
+    AW_Job		done[AW_RING];	/* Writes done. */
+    size_t		jobHead;
+    size_t		jobCnt;
+    size_t		doneCnt;
+    int			threadCnt;
+    int			stopping;
+} AW_Writer;
+
+AW_Writer*
+AW_Create(AW_Backend want);
+
+void
+AW_Write(AW_Writer* aw, int fd, const char* p, size_t n);
+
+int
+AW_Full(const AW_Writer* aw);
+
+void
+AW_Throttle(AW_Writer* aw);
+
+void
+AW_Close(AW_Writer* aw, int fd);
+
+void
+AW_Submit(AW_Writer* aw);
+
+void
+AW_Reap(AW_Writer* aw);
+
+int
+AW_Drain(AW_Writer* aw);
+
+void
+AW_Destroy(AW_Writer* aw);
+
+#endif /* !defined ASYNC_WRITE_H */
@@ -0,0 +1,223 @@
+/* Batch output streams. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include "batch.h"
+
+/* BAT_MakeMark --
+ *
+ * Synopsis:
+ *
+ *    Choose the batch mark for this run: a record separator, "RO",
+ *    and a token from the process id and the time.
+ */
+
+void
+BAT_MakeMark(char* mark, size_t* markLen)
+{
+    struct timespec	ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    snprintf(mark, BAT_MARK_MAX, "\036RO%08lx%08lx",
+	     (unsigned long) getpid() & 0xffffffffUL,
+	     (unsigned long) (ts.tv_sec ^ ts.tv_nsec) & 0xffffffffUL);
+    *markLen = strlen(mark);
+}
+
+/* BAT_Open --
+ *
+ * Synopsis:
+ *
+ *    Start reading a batch pipe.  The pipe is made non-blocking, and
+ *    is not inherited by processes started later.
+ */
+
+BAT_Stream*
+BAT_Open(int fd, int dest)
+{
+    BAT_Stream*	bs;
+
+    bs = (BAT_Stream*) malloc(sizeof(BAT_Stream));
+    /*FIXME: Out of memory */
+    bs->fd = fd;
+    bs->dest = dest;
+    bs->sink = (BAT_Sink) NULL;
+    bs->sinkArg = NULL;
+    bs->len = 0;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return bs;
+}
+
+/* bat_write --
+ *
+ * Synopsis:
+ *
+ *    Pass 'n' bytes on to the destination, or the sink.
+ */
+
+static void
+bat_write(BAT_Stream* bs, const char* p, size_t n)
+{
+    if (bs->sink != NULL) {
+	if (n > 0) {
+	    bs->sink(bs->sinkArg, bs->dest, p, n);
+	}
+	return;
+    }
+    while (n > 0 && bs->dest >= 0) {
+	ssize_t	w = write(bs->dest, p, n);
+	if (w < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    return;
+	}
+	p += w;
+	n -= (size_t) w;
+    }
+}
+
+/* bat_consume --
+ *
+ * Synopsis:
+ *
+ *    Drop the first 'n' bytes of the buffer.
+ */
+
+static void
+bat_consume(BAT_Stream* bs, size_t n)
+{
+    memmove(bs->buf, bs->buf + n, bs->len - n);
+    bs->len -= n;
+}
+
+/* BAT_Fill --
+ *
+ * Synopsis:
+ *
+ *    Read what the pipe has ready into the buffer.
+ *
+ * Returns:
+ *
+ *    1 if anything was read, 0 at end of file (the pipe is closed),
+ *    or -1 if nothing is ready.
+ */
+
+int
+BAT_Fill(BAT_Stream* bs)
+{
+    ssize_t	r;
+
+    if (bs->fd < 0) {
+	return 0;
+    }
+    if (bs->len == BAT_BUF) {
+	/* No mark can be this long; pass on the oldest half. */
+	bat_write(bs, bs->buf, BAT_BUF / 2);
+	bat_consume(bs, BAT_BUF / 2);
+    }
+    do {
+	r = read(bs->fd, bs->buf + bs->len, BAT_BUF - bs->len);
+    } while (r < 0 && errno == EINTR);
+    if (r > 0) {
+	bs->len += (size_t) r;
+	return 1;
+    }
+    if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+	return -1;
+    }
+    close(bs->fd);
+    bs->fd = -1;
+    return 0;
+}
+
+/* BAT_Next --
+ *
+ * Synopsis:
+ *
+ *    Pass on buffered output up to the next complete record, and
+ *    consume the record.  The status in the record, if any, is
+ *    stored in 'status'.  Output that might be the start of a mark
+ *    is kept until more is read.
+ *
+ * Returns:
+ *
+ *    1 if a record was consumed, or 0 if more input is needed.
+ */
+
+int
+BAT_Next(BAT_Stream* bs, const char* mark, size_t markLen, int* status)
+{
+    char*	m = (char*) NULL;
+    char*	nl;
+    size_t	i, keep;
+
+    for (i = 0;  i < bs->len;  ++i) {
+	if (bs->buf[i] != mark[0]) {
+	    continue;
+	}
+	keep = bs->len - i < markLen ? bs->len - i : markLen;
+	if (!memcmp(bs->buf + i, mark, keep)) {
+	    m = bs->buf + i;
+	    break;
+	}
+    }
+    if (m == NULL) {
+	bat_write(bs, bs->buf, bs->len);
+	bs->len = 0;
+	return 0;
+    }
+
+    /* Pass on what precedes the mark, then look for its end. */
+    bat_write(bs, bs->buf, (size_t) (m - bs->buf));
+    bat_consume(bs, (size_t) (m - bs->buf));
+    if (bs->len < markLen) {
+	return 0;
+    }
+    nl = (char*) memchr(bs->buf + markLen, '\n', bs->len - markLen);
+    if (nl == NULL) {
+	return 0;
+    }
+    *nl = '\0';
+    *status = atoi(bs->buf + markLen);
+    bat_consume(bs, (size_t) (nl + 1 - bs->buf));
+    return 1;
+}
+
+/* BAT_Flush --
+ *
+ * Synopsis:
+ *
+ *    Pass on whatever is left in the buffer, including an unfinished
+ *    record.  For use once the pipe is closed.
+ */
+
+void
+BAT_Flush(BAT_Stream* bs)
+{
+    bat_write(bs, bs->buf, bs->len);
+    bs->len = 0;
+}
+
+/* BAT_Close --
+ *
+ * Synopsis:
+ *
+ *    Close the pipe, if still open, and free the stream.  The
+ *    destination is left to the caller.
+ */
+
+void
+BAT_Close(BAT_Stream* bs)
+{
+    if (bs->fd >= 0) {
+	close(bs->fd);
+    }
+    free(bs);
+}
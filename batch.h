@@ -0,0 +1,56 @@
+/* Batch output streams. */
+
+#ifndef BATCH_STREAM_H
+#define BATCH_STREAM_H
+
+#include <stddef.h>
+
+/*
+ * A batch runs several processes one after another in a single shell,
+ * and its standard output and error come back on one pipe each.  After
+ * each process the shell writes a record to both: the batch mark,
+ * then (on standard output only) a space and the process's exit
+ * status, then a newline.  The mark starts with an ASCII record
+ * separator and carries a token chosen per run, so it does not occur
+ * in ordinary output.
+ *
+ * A BAT_Stream reads one of those pipes, passes the bytes between
+ * records through to the current destination unchanged, and stops at
+ * each record so the caller can switch to the next process's
+ * destination.  The bytes can go to a sink function instead of a file
+ * descriptor.
+ */
+
+#define BAT_BUF		65536
+#define BAT_MARK_MAX	32
+
+typedef void (*BAT_Sink)(void* arg, int dest, const char* p, size_t n);
+
+typedef struct BAT_Stream {
+    int		fd;		/* Read end of the pipe; -1 at EOF. */
+    int		dest;		/* Current destination; -1 to discard. */
+    BAT_Sink	sink;		/* If set, called instead of writing dest. */
+    void*	sinkArg;
+    size_t	len;		/* Bytes in buf not yet passed on. */
+    char	buf[BAT_BUF];
+} BAT_Stream;
+
+void
+BAT_MakeMark(char* mark, size_t* markLen);
+
+BAT_Stream*
+BAT_Open(int fd, int dest);
+
+int
+BAT_Fill(BAT_Stream* bs);
+
+int
+BAT_Next(BAT_Stream* bs, const char* mark, size_t markLen, int* status);
+
+void
+BAT_Flush(BAT_Stream* bs);
+
+void
+BAT_Close(BAT_Stream* bs);
+
+#endif /* !defined BATCH_STREAM_H */
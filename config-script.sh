@@ -10,3 +10,20 @@ echo "machinescript /etc/runover/machine-script.sh"
 # system, created a "jobname" directive to pass this information to
 # runover.
 
+
+# Processes on this host are run directly, without the spawn command.
+# Turn this off to run every process through the spawn command.
+#
+# echo "localexec off"
+
+# When the job is interrupted, local spawn commands are signalled
+# directly.  A kill command, run through the spawn command on each
+# remote host, can make sure nothing is left behind there.
+#
+# echo "killcommand pkill -u \$USER -f runover-job-%j"
+# echo "killgrace 5"
+
+# With -probe, this command is run on every host before the job
+# starts; hosts where it fails are dropped.
+#
+# echo "probecommand test -d /scratch"
@@ -0,0 +1,490 @@
+/* Task dependency graphs. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "dag.h"
+#include "av.h"
+#include "ca.h"
+
+#define MAX_DAG_LINE	4096
+
+/* dag_hash --
+ *
+ * Synopsis:
+ *
+ *    Hash a task ID, for the ID lookup table.
+ */
+
+static size_t
+dag_hash(const char* s)
+{
+    size_t	h = 5381;
+    while (*s) {
+	h = (h * 33) ^ (unsigned char) *s++;
+    }
+    return h;
+}
+
+/* dag_lookup --
+ *
+ * Synopsis:
+ *
+ *    Find a task ID in an open addressed table of 'tabLen' task
+ *    indices (a power of two; empty slots hold -1).  Returns the
+ *    table slot holding the ID, or the empty slot where it belongs.
+ */
+
+static size_t
+dag_lookup(DAG_Graph* g, long* tab, size_t tabLen, const char* id)
+{
+    size_t	i = dag_hash(id) & (tabLen - 1);
+    while (tab[i] >= 0 && strcmp(g->tasks[tab[i]].id, id)) {
+	i = (i + 1) & (tabLen - 1);
+    }
+    return i;
+}
+
+/* dag_split --
+ *
+ * Synopsis:
+ *
+ *    Split a line into words at white space, honoring single and
+ *    double quotes.  Returns a NULL terminated vector, to be freed
+ *    with "free", or NULL if the line holds no words.
+ */
+
+static const char**
+dag_split(const char* cp)
+{
+    AV_Control	avc;
+    CharAccum	ca;
+    size_t	argc;
+    const char**	av;
+
+    AV_Init(&avc);
+    CHARACCUM_INIT(&ca);
+    for (;;) {
+	char	q = 0;
+	int	any = 0;
+
+	while (*cp && isspace((unsigned char) *cp)) {
+	    ++cp;
+	}
+	if (!*cp) {
+	    break;
+	}
+	for (;  *cp && (q || !isspace((unsigned char) *cp));  ++cp) {
+	    if (q && *cp == q) {
+		q = 0;
+	    } else if (!q && (*cp == '"' || *cp == '\'')) {
+		q = *cp;
+	    } else {
+		CHARACCUM_APPEND_CHAR(&ca, *cp);
+	    }
+	    any = 1;
+	}
+	if (any) {
+	    AV_AddString(&avc, CHARACCUM_STRING(&ca));
+	    CHARACCUM_CLEAR(&ca);
+	}
+    }
+    free(ca.cb);
+    av = AV_Finalize(&avc, &argc);
+    if (argc <= 1) {
+	free((char*) av);
+	return (const char**) NULL;
+    }
+    return av;
+}
+
+/* DAG_Parse --
+ *
+ * Synopsis:
+ *
+ *    Read a DAG file, and build the graph.
+ *
+ * Returns:
+ *
+ *    0 on success, or -1 with a message in 'err'.
+ */
+
+int
+DAG_Parse(DAG_Graph* g, FILE* df, char* err, size_t errLen)
+{
+    char	dl[MAX_DAG_LINE+1];
+    char**	depLists = (char**) NULL;
+    size_t	taskMax = 0;
+    size_t	lineCount = 0;
+    long*	tab;
+    size_t	tabLen;
+    size_t	t;
+
+    g->tasks = (DAG_Task*) NULL;
+    g->taskCnt = 0;
+    g->heap = (size_t*) NULL;
+    g->heapCnt = 0;
+    g->blocked = (size_t*) NULL;
+    g->blockedCnt = 0;
+
+    /*
+     * Read the tasks.  Dependencies are resolved once all the IDs are
+     * known, so keep the dependency lists as text for now.
+     */
+    while (fgets(dl, MAX_DAG_LINE+1, df) != NULL) {
+	const char**	words;
+	DAG_Task*	tp;
+	size_t		wc;
+
+	lineCount++;
+	if (dl[0] == '#' || (words = dag_split(dl)) == NULL) {
+	    continue;
+	}
+	for (wc = 0;  words[wc] != NULL;  ++wc)
+	    ;
+	if (wc < 3) {
+	    snprintf(err, errLen, "%lu: expected ID, dependencies and command",
+		     lineCount);
+	    free((char*) words);
+	    return -1;
+	}
+
+	if (g->taskCnt == taskMax) {
+	    taskMax = taskMax ? 2 * taskMax : 64;
+	    g->tasks = (DAG_Task*) realloc(g->tasks, taskMax * sizeof(DAG_Task));
+	    depLists = (char**) realloc(depLists, taskMax * sizeof(char*));
+	    /*FIXME: Out of memory */
+	}
+	tp = &g->tasks[g->taskCnt];
+	tp->id = strdup(words[0]);
+	tp->timeout = 0.0;
+	tp->need = (char*) NULL;
+	{
+	    char*	at;
+	    char*	end;
+	    char*	comma = strchr(tp->id, ',');
+
+	    if (comma != NULL) {
+		*comma++ = '\0';
+		tp->need = comma;
+	    }
+	    at = strchr(tp->id, '@');
+
+	    if (at != NULL) {
+		*at++ = '\0';
+		tp->timeout = strtod(at, &end);
+		if (at == end || *end || tp->timeout <= 0) {
+		    snprintf(err, errLen, "%lu: bad time limit \"%s\"",
+			     lineCount, at);
+		    free((char*) words);
+		    return -1;
+		}
+	    }
+	}
+	depLists[g->taskCnt] = strcmp(words[1], "-") ? strdup(words[1]) : NULL;
+	/* The command is the tail of the word vector. */
+	memmove(words, words + 2, (wc - 1) * sizeof(const char*));
+	tp->argv = words;
+	tp->succ = (size_t*) NULL;
+	tp->succCnt = 0;
+	tp->waitCnt = 0;
+	tp->weight = 1.0;
+	tp->prio = 0.0;
+	tp->state = dag_sWait;
+	g->taskCnt++;
+    }
+
+    /*
+     * Index the IDs, then resolve the dependencies.
+     */
+    for (tabLen = 64;  tabLen < 2 * g->taskCnt;  tabLen *= 2)
+	;
+    tab = (long*) malloc(tabLen * sizeof(long));
+    /*FIXME: Out of memory */
+    memset(tab, 0xff, tabLen * sizeof(long));
+    for (t = 0;  t < g->taskCnt;  ++t) {
+	size_t	i = dag_lookup(g, tab, tabLen, g->tasks[t].id);
+	if (tab[i] >= 0) {
+	    snprintf(err, errLen, "duplicate task ID \"%s\"", g->tasks[t].id);
+	    free(tab);
+	    return -1;
+	}
+	tab[i] = (long) t;
+    }
+    for (t = 0;  t < g->taskCnt;  ++t) {
+	char*	dep;
+	char*	save;
+
+	if (depLists[t] == NULL) {
+	    continue;
+	}
+	for (dep = strtok_r(depLists[t], ",", &save);
+	     dep != NULL;
+	     dep = strtok_r(NULL, ",", &save)) {
+	    long	d = tab[dag_lookup(g, tab, tabLen, dep)];
+	    DAG_Task*	dp;
+	    if (d < 0) {
+		snprintf(err, errLen, "task \"%s\" depends on unknown task \"%s\"",
+			 g->tasks[t].id, dep);
+		free(tab);
+		return -1;
+	    }
+	    dp = &g->tasks[d];
+	    dp->succ = (size_t*) realloc(dp->succ,
+					 (dp->succCnt + 1) * sizeof(size_t));
+	    /*FIXME: Out of memory */
+	    dp->succ[dp->succCnt++] = t;
+	    g->tasks[t].waitCnt++;
+	}
+	free(depLists[t]);
+    }
+    free(tab);
+    free(depLists);
+
+    g->heap = (size_t*) malloc((g->taskCnt + 1) * sizeof(size_t));
+    /*FIXME: Out of memory */
+    return 0;
+}
+
+/* dag_before --
+ *
+ * Synopsis:
+ *
+ *    True iff task 'a' should be handed out before task 'b': higher
+ *    priority first, then file order.
+ */
+
+static int
+dag_before(DAG_Graph* g, size_t a, size_t b)
+{
+    if (g->tasks[a].prio != g->tasks[b].prio) {
+	return g->tasks[a].prio > g->tasks[b].prio;
+    }
+    return a < b;
+}
+
+/* dag_push --
+ *
+ * Synopsis:
+ *
+ *    Add a task to the ready heap.
+ */
+
+static void
+dag_push(DAG_Graph* g, size_t t)
+{
+    size_t	i = g->heapCnt++;
+
+    g->tasks[t].state = dag_sReady;
+    while (i > 0 && dag_before(g, t, g->heap[(i-1)/2])) {
+	g->heap[i] = g->heap[(i-1)/2];
+	i = (i-1)/2;
+    }
+    g->heap[i] = t;
+}
+
+/* DAG_TakeReady --
+ *
+ * Synopsis:
+ *
+ *    Take the highest priority ready task.  Tasks completed while
+ *    still in the heap are discarded here.
+ *
+ * Returns:
+ *
+ *    The task number, or -1 if no task is ready.
+ */
+
+long
+DAG_TakeReady(DAG_Graph* g)
+{
+    while (g->heapCnt > 0) {
+	size_t	top, last, i;
+
+	top = g->heap[0];
+	last = g->heap[--g->heapCnt];
+	i = 0;
+	for (;;) {
+	    size_t	c = 2*i + 1;
+	    if (c >= g->heapCnt) {
+		break;
+	    }
+	    if (c+1 < g->heapCnt && dag_before(g, g->heap[c+1], g->heap[c])) {
+		++c;
+	    }
+	    if (!dag_before(g, g->heap[c], last)) {
+		break;
+	    }
+	    g->heap[i] = g->heap[c];
+	    i = c;
+	}
+	g->heap[i] = last;
+	if (g->tasks[top].state == dag_sReady) {
+	    g->tasks[top].state = dag_sRun;
+	    return (long) top;
+	}
+    }
+    return -1;
+}
+
+/* DAG_Prepare --
+ *
+ * Synopsis:
+ *
+ *    Compute critical path priorities from the task weights, check
+ *    that the graph has no cycles, and fill the ready heap with the
+ *    tasks that have no dependencies.  Call this after setting the
+ *    weights, and before completing any task.
+ *
+ * Returns:
+ *
+ *    0 on success, or -1 with a message in 'err'.
+ */
+
+int
+DAG_Prepare(DAG_Graph* g, char* err, size_t errLen)
+{
+    size_t*	order;
+    size_t*	waits;
+    size_t	head = 0, tail = 0;
+    size_t	t, i;
+
+    /*
+     * Kahn's algorithm gives a topological order; walking it
+     * backwards computes each task's longest path to a sink.
+     */
+    order = (size_t*) malloc((g->taskCnt + 1) * sizeof(size_t));
+    waits = (size_t*) malloc((g->taskCnt + 1) * sizeof(size_t));
+    /*FIXME: Out of memory */
+    for (t = 0;  t < g->taskCnt;  ++t) {
+	waits[t] = g->tasks[t].waitCnt;
+	if (waits[t] == 0) {
+	    order[tail++] = t;
+	}
+    }
+    while (head < tail) {
+	DAG_Task*	tp = &g->tasks[order[head++]];
+	for (i = 0;  i < tp->succCnt;  ++i) {
+	    if (--waits[tp->succ[i]] == 0) {
+		order[tail++] = tp->succ[i];
+	    }
+	}
+    }
+    if (tail != g->taskCnt) {
+	for (t = 0;  waits[t] == 0;  ++t)
+	    ;
+	snprintf(err, errLen, "dependency cycle through task \"%s\"",
+		 g->tasks[t].id);
+	free(order);
+	free(waits);
+	return -1;
+    }
+    while (tail-- > 0) {
+	DAG_Task*	tp = &g->tasks[order[tail]];
+	double		best = 0.0;
+	for (i = 0;  i < tp->succCnt;  ++i) {
+	    if (g->tasks[tp->succ[i]].prio > best) {
+		best = g->tasks[tp->succ[i]].prio;
+	    }
+	}
+	tp->prio = tp->weight + best;
+    }
+    free(order);
+    free(waits);
+
+    for (t = 0;  t < g->taskCnt;  ++t) {
+	if (g->tasks[t].waitCnt == 0) {
+	    dag_push(g, t);
+	}
+    }
+    return 0;
+}
+
+/* DAG_CriticalPath --
+ *
+ * Synopsis:
+ *
+ *    The total weight along the longest chain of dependent tasks.
+ *    Valid after DAG_Prepare.
+ */
+
+double
+DAG_CriticalPath(DAG_Graph* g)
+{
+    double	cp = 0.0;
+    size_t	t;
+
+    for (t = 0;  t < g->taskCnt;  ++t) {
+	if (g->tasks[t].prio > cp) {
+	    cp = g->tasks[t].prio;
+	}
+    }
+    return cp;
+}
+
+/* dag_block --
+ *
+ * Synopsis:
+ *
+ *    Mark everything that depends on a failed task as blocked, adding
+ *    each to the end of the 'blocked' list.  The list is walked as the
+ *    queue of tasks whose dependents are still to be marked.
+ */
+
+static void
+dag_block(DAG_Graph* g, size_t t)
+{
+    size_t	next = g->blockedCnt;
+    size_t	i;
+
+    if (g->blocked == NULL) {
+	g->blocked = (size_t*) malloc((g->taskCnt + 1) * sizeof(size_t));
+	/*FIXME: Out of memory */
+    }
+    for (;;) {
+	DAG_Task*	tp = &g->tasks[t];
+	for (i = 0;  i < tp->succCnt;  ++i) {
+	    DAG_Task*	dp = &g->tasks[tp->succ[i]];
+	    if (dp->state == dag_sWait) {
+		dp->state = dag_sBlocked;
+		g->blocked[g->blockedCnt++] = tp->succ[i];
+	    }
+	}
+	if (next == g->blockedCnt) {
+	    break;
+	}
+	t = g->blocked[next++];
+    }
+}
+
+/* DAG_Complete --
+ *
+ * Synopsis:
+ *
+ *    Record that a task has finished.  If it succeeded, tasks whose
+ *    last dependency this was become ready; if not, every task that
+ *    depends on it is blocked, and added to the 'blocked' list, from
+ *    'blockedCnt' before the call on.  A task that has not been handed out
+ *    may be completed too, e.g., when it is known to be done already.
+ */
+
+void
+DAG_Complete(DAG_Graph* g, size_t t, int ok)
+{
+    DAG_Task*	tp = &g->tasks[t];
+    size_t	i;
+
+    if (!ok) {
+	tp->state = dag_sFailed;
+	dag_block(g, t);
+	return;
+    }
+    tp->state = dag_sDone;
+    for (i = 0;  i < tp->succCnt;  ++i) {
+	DAG_Task*	sp = &g->tasks[tp->succ[i]];
+	if (--sp->waitCnt == 0 && sp->state == dag_sWait) {
+	    dag_push(g, tp->succ[i]);
+	}
+    }
+}
@@ -0,0 +1,77 @@
+/* Task dependency graphs. */
+
+#ifndef TASK_DAG_H
+#define TASK_DAG_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/*
+ * A DAG file lists one task per line:
+ *
+ *     ID  DEPS  COMMAND ARGS...
+ *
+ * DEPS is a comma separated list of task IDs, or "-" for none.  The
+ * command words are templates, split at white space; single or
+ * double quotes group words.  Blank lines and lines starting with
+ * '#' are ignored.  Tasks are numbered from 0 in file order, and that
+ * number is the process number substituted for %p.  An ID may carry
+ * a time limit for its task, in seconds, as ID@SECONDS; it overrides
+ * the -timeout given on the command line.  It may then give what the
+ * task needs, after commas, as in "ID@SECONDS,mem=4G,cores=2"; that
+ * overrides -need (see pack.h).
+ *
+ * A task becomes ready once all its dependencies have succeeded.
+ * Ready tasks are handed out longest critical path first: a task's
+ * priority is its own weight plus the largest priority among the
+ * tasks that depend on it.  Tasks that depend, directly or not, on a
+ * failed task are never run.
+ */
+
+typedef enum DAG_State {
+    dag_sWait,		/* Waiting on dependencies. */
+    dag_sReady,		/* In the ready heap. */
+    dag_sRun,		/* Handed out. */
+    dag_sDone,		/* Completed successfully. */
+    dag_sFailed,	/* Completed unsuccessfully. */
+    dag_sBlocked	/* Will not run; a dependency failed. */
+} DAG_State;
+
+typedef struct DAG_Task {
+    char*		id;
+    const char**	argv;
+    size_t*		succ;		/* Tasks depending on this one. */
+    size_t		succCnt;
+    size_t		waitCnt;	/* Unfinished dependencies. */
+    double		weight;
+    double		prio;
+    double		timeout;	/* Seconds; 0 for the default. */
+    char*		need;		/* What it needs, or NULL. */
+    DAG_State		state;
+} DAG_Task;
+
+typedef struct DAG_Graph {
+    DAG_Task*	tasks;
+    size_t	taskCnt;
+    size_t*	heap;		/* Ready tasks, by priority. */
+    size_t	heapCnt;
+    size_t*	blocked;	/* Blocked tasks, in the order blocked. */
+    size_t	blockedCnt;
+} DAG_Graph;
+
+int
+DAG_Parse(DAG_Graph* g, FILE* df, char* err, size_t errLen);
+
+int
+DAG_Prepare(DAG_Graph* g, char* err, size_t errLen);
+
+void
+DAG_Complete(DAG_Graph* g, size_t t, int ok);
+
+long
+DAG_TakeReady(DAG_Graph* g);
+
+double
+DAG_CriticalPath(DAG_Graph* g);
+
+#endif /* !defined TASK_DAG_H */
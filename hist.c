@@ -0,0 +1,219 @@
+/* Runtime history. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include "hist.h"
+
+/* HIST_Hash --
+ *
+ * Synopsis:
+ *
+ *    Fold a string, including its terminating NUL, into a 64-bit
+ *    FNV-1a hash.  Start with HIST_HASH_INIT.
+ */
+
+uint64_t
+HIST_Hash(uint64_t h, const char* s)
+{
+    do {
+	h ^= (unsigned char) *s;
+	h *= UINT64_C(1099511628211);
+    } while (*s++);
+    return h;
+}
+
+/* HIST_Init --
+ *
+ * Synopsis:
+ *
+ *    Initialize an empty history table.
+ */
+
+void
+HIST_Init(HIST_Table* ht)
+{
+    ht->tabLen = 1024;
+    ht->cnt = 0;
+    ht->tab = (HIST_Entry*) calloc(ht->tabLen, sizeof(HIST_Entry));
+    /*FIXME: Out of memory */
+}
+
+/* hist_slot --
+ *
+ * Synopsis:
+ *
+ *    Find the slot holding 'key', or the empty slot where it belongs.
+ */
+
+static HIST_Entry*
+hist_slot(HIST_Table* ht, uint64_t key)
+{
+    size_t	i = (size_t) (key ^ (key >> 32)) & (ht->tabLen - 1);
+    while (ht->tab[i].key != 0 && ht->tab[i].key != key) {
+	i = (i + 1) & (ht->tabLen - 1);
+    }
+    return &ht->tab[i];
+}
+
+/* hist_insert --
+ *
+ * Synopsis:
+ *
+ *    Find or add the entry for 'key', growing the table as needed.
+ */
+
+static HIST_Entry*
+hist_insert(HIST_Table* ht, uint64_t key)
+{
+    HIST_Entry*	he;
+
+    if (key == 0) {
+	key = 1;
+    }
+    if (2 * (ht->cnt + 1) > ht->tabLen) {
+	HIST_Entry*	old = ht->tab;
+	size_t		oldLen = ht->tabLen;
+	size_t		i;
+
+	ht->tabLen *= 2;
+	ht->tab = (HIST_Entry*) calloc(ht->tabLen, sizeof(HIST_Entry));
+	/*FIXME: Out of memory */
+	for (i = 0;  i < oldLen;  ++i) {
+	    if (old[i].key != 0) {
+		*hist_slot(ht, old[i].key) = old[i];
+	    }
+	}
+	free(old);
+    }
+    he = hist_slot(ht, key);
+    if (he->key == 0) {
+	he->key = key;
+	he->secs = 0.0;
+	he->count = 0;
+	ht->cnt++;
+    }
+    return he;
+}
+
+/* HIST_Load --
+ *
+ * Synopsis:
+ *
+ *    Read a history file into the table.  Malformed lines are
+ *    skipped.
+ *
+ * Returns:
+ *
+ *    0 on success (a missing file is treated as empty), or -1 with
+ *    errno set.
+ */
+
+int
+HIST_Load(HIST_Table* ht, const char* path)
+{
+    FILE*		hf;
+    uint64_t		key;
+    double		secs;
+    unsigned long	count;
+    char		hl[128];
+
+    hf = fopen(path, "r");
+    if (hf == (FILE*) NULL) {
+	return (errno == ENOENT) ? 0 : -1;
+    }
+    while (fgets(hl, sizeof(hl), hf) != NULL) {
+	if (sscanf(hl, "%" SCNx64 " %lf %lu", &key, &secs, &count) == 3
+	    && secs >= 0.0) {
+	    HIST_Entry*	he = hist_insert(ht, key);
+	    he->secs = secs;
+	    he->count = count;
+	}
+    }
+    fclose(hf);
+    return 0;
+}
+
+/* HIST_Lookup --
+ *
+ * Synopsis:
+ *
+ *    Look up the expected runtime of a task.
+ *
+ * Returns:
+ *
+ *    The runtime in seconds, or -1.0 if the task has no history.
+ */
+
+double
+HIST_Lookup(HIST_Table* ht, uint64_t key)
+{
+    HIST_Entry*	he = hist_slot(ht, key ? key : 1);
+    return (he->key != 0) ? he->secs : -1.0;
+}
+
+/* HIST_Update --
+ *
+ * Synopsis:
+ *
+ *    Fold a new runtime into a task's history.
+ */
+
+void
+HIST_Update(HIST_Table* ht, uint64_t key, double secs)
+{
+    HIST_Entry*	he = hist_insert(ht, key);
+    if (he->count == 0) {
+	he->secs = secs;
+    } else {
+	he->secs = HIST_ALPHA * secs + (1.0 - HIST_ALPHA) * he->secs;
+    }
+    he->count++;
+}
+
+/* HIST_Save --
+ *
+ * Synopsis:
+ *
+ *    Write the table to a history file.  The file is replaced
+ *    atomically, so an interrupted save leaves the old history.
+ *
+ * Returns:
+ *
+ *    0 on success, or -1 with errno set.
+ */
+
+int
+HIST_Save(HIST_Table* ht, const char* path)
+{
+    FILE*	hf;
+    char*	tmp;
+    size_t	i;
+
+    tmp = (char*) malloc(strlen(path) + 5);
+    /*FIXME: Out of memory */
+    sprintf(tmp, "%s.new", path);
+    hf = fopen(tmp, "w");
+    if (hf == (FILE*) NULL) {
+	free(tmp);
+	return -1;
+    }
+    for (i = 0;  i < ht->tabLen;  ++i) {
+	if (ht->tab[i].key != 0) {
+	    fprintf(hf, "%016" PRIx64 " %.6f %lu\n",
+		    ht->tab[i].key, ht->tab[i].secs, ht->tab[i].count);
+	}
+    }
+    if (fclose(hf) != 0 || rename(tmp, path) < 0) {
+	int e = errno;
+	unlink(tmp);
+	free(tmp);
+	errno = e;
+	return -1;
+    }
+    free(tmp);
+    return 0;
+}
@@ -0,0 +1,50 @@
+/* Runtime history. */
+
+#ifndef RUNTIME_HISTORY_H
+#define RUNTIME_HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The runtime history maps a 64-bit task key (a hash of the rendered
+ * command line and input path) to a smoothed runtime in seconds.  It
+ * is kept in a text file, one "KEY SECONDS COUNT" line per task, read
+ * at startup and rewritten at exit.
+ */
+
+#define HIST_ALPHA	0.5	/* Weight of the newest runtime. */
+
+typedef struct HIST_Entry {
+    uint64_t		key;	/* 0 marks an empty slot. */
+    double		secs;
+    unsigned long	count;
+} HIST_Entry;
+
+typedef struct HIST_Table {
+    HIST_Entry*	tab;
+    size_t	tabLen;
+    size_t	cnt;
+} HIST_Table;
+
+#define HIST_HASH_INIT	UINT64_C(14695981039346656037)
+
+uint64_t
+HIST_Hash(uint64_t h, const char* s);
+
+void
+HIST_Init(HIST_Table* ht);
+
+int
+HIST_Load(HIST_Table* ht, const char* path);
+
+double
+HIST_Lookup(HIST_Table* ht, uint64_t key);
+
+void
+HIST_Update(HIST_Table* ht, uint64_t key, double secs);
+
+int
+HIST_Save(HIST_Table* ht, const char* path);
+
+#endif /* !defined RUNTIME_HISTORY_H */
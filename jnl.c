@@ -0,0 +1,406 @@
+/* Completion journal. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include "jnl.h"
+
+/* jnl_now --
+ *
+ * Synopsis:
+ *
+ *    Seconds on the monotonic clock, for deciding when to sync.
+ */
+
+static double
+jnl_now(void)
+{
+    struct timespec	ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* jnl_upper --
+ *
+ * Synopsis:
+ *
+ *    The index of the first run of a rank set that starts after
+ *    'rank', or runCnt if none does.
+ */
+
+static size_t
+jnl_upper(const JNL_RankSet* rs, size_t rank)
+{
+    size_t	lo = 0, hi = rs->runCnt;
+
+    /* Most lookups are at or past the last run. */
+    if (hi > 0 && rs->runs[hi - 1].lo <= rank) {
+	return hi;
+    }
+    while (lo < hi) {
+	size_t	mid = lo + (hi - lo) / 2;
+	if (rs->runs[mid].lo <= rank) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
+	}
+    }
+    return lo;
+}
+
+/* JNL_Find --
+ *
+ * Synopsis:
+ *
+ *    Find the run of a rank set that holds 'rank'.
+ *
+ * Returns:
+ *
+ *    The run's index, or (size_t) -1 if the rank is not in the set.
+ */
+
+size_t
+JNL_Find(const JNL_RankSet* rs, size_t rank)
+{
+    size_t	k = jnl_upper(rs, rank);
+
+    if (k > 0 && rank < rs->runs[k - 1].hi) {
+	return k - 1;
+    }
+    return (size_t) -1;
+}
+
+/* JNL_NextUndone --
+ *
+ * Synopsis:
+ *
+ *    The first rank, from 'rank' on, that is not in the set.
+ */
+
+size_t
+JNL_NextUndone(const JNL_RankSet* rs, size_t rank)
+{
+    size_t	k;
+
+    if (rs->runCnt == 0) {
+	return rank;
+    }
+    k = JNL_Find(rs, rank);
+    return k == (size_t) -1 ? rank : rs->runs[k].hi;
+}
+
+/* jnl_insert_run --
+ *
+ * Synopsis:
+ *
+ *    Insert the run [lo, hi) at index 'k' of a rank set.
+ */
+
+static void
+jnl_insert_run(JNL_RankSet* rs, size_t k, size_t lo, size_t hi)
+{
+    if (rs->runCnt == rs->runMax) {
+	rs->runMax = rs->runMax ? 2 * rs->runMax : 64;
+	rs->runs = (JNL_Run*) realloc(rs->runs, rs->runMax * sizeof(JNL_Run));
+	/*FIXME: Out of memory */
+    }
+    memmove(&rs->runs[k + 1], &rs->runs[k],
+	    (rs->runCnt - k) * sizeof(JNL_Run));
+    rs->runs[k].lo = lo;
+    rs->runs[k].hi = hi;
+    rs->runCnt++;
+}
+
+/* jnl_remove_run --
+ *
+ * Synopsis:
+ *
+ *    Remove run 'k' of a rank set.
+ */
+
+static void
+jnl_remove_run(JNL_RankSet* rs, size_t k)
+{
+    memmove(&rs->runs[k], &rs->runs[k + 1],
+	    (rs->runCnt - k - 1) * sizeof(JNL_Run));
+    rs->runCnt--;
+}
+
+/* jnl_set_rank --
+ *
+ * Synopsis:
+ *
+ *    Mark a rank as done (or not done) in a rank set, joining or
+ *    splitting runs as needed.
+ */
+
+static void
+jnl_set_rank(JNL_RankSet* rs, size_t rank, int done)
+{
+    size_t	k = jnl_upper(rs, rank);
+    JNL_Run*	prev = k > 0 ? &rs->runs[k - 1] : (JNL_Run*) NULL;
+
+    if (prev != NULL && rank < prev->hi) {
+	/* In run k - 1. */
+	if (done) {
+	    return;
+	}
+	if (prev->lo == rank) {
+	    if (++prev->lo == prev->hi) {
+		jnl_remove_run(rs, k - 1);
+	    }
+	} else if (prev->hi - 1 == rank) {
+	    prev->hi--;
+	} else {
+	    size_t	hi = prev->hi;
+
+	    prev->hi = rank;
+	    jnl_insert_run(rs, k, rank + 1, hi);
+	}
+	rs->count--;
+	return;
+    }
+    if (!done) {
+	return;
+    }
+    if (prev != NULL && prev->hi == rank) {
+	prev->hi++;
+	if (k < rs->runCnt && rs->runs[k].lo == rank + 1) {
+	    prev->hi = rs->runs[k].hi;
+	    jnl_remove_run(rs, k);
+	}
+    } else if (k < rs->runCnt && rs->runs[k].lo == rank + 1) {
+	rs->runs[k].lo--;
+    } else {
+	jnl_insert_run(rs, k, rank, rank + 1);
+    }
+    rs->count++;
+}
+
+/* jnl_magic --
+ *
+ * Synopsis:
+ *
+ *    Read and check a journal's magic number.
+ *
+ * Returns:
+ *
+ *    1 if it is a journal, 0 if it is empty, or -1 with errno set.
+ */
+
+static int
+jnl_magic(FILE* jf)
+{
+    char	magic[JNL_MAGIC_LEN];
+    size_t	n = fread(magic, 1, JNL_MAGIC_LEN, jf);
+
+    if (n == 0) {
+	return 0;
+    }
+    if (n == JNL_MAGIC_LEN && !memcmp(magic, JNL_MAGIC, JNL_MAGIC_LEN)) {
+	return 1;
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+/* JNL_Load --
+ *
+ * Synopsis:
+ *
+ *    Read a journal, recording in 'rs' each process whose last
+ *    recorded exit was successful.
+ *
+ * Returns:
+ *
+ *    0 on success (a missing journal is treated as empty), or -1 with
+ *    errno set.
+ */
+
+int
+JNL_Load(const char* path, JNL_RankSet* rs)
+{
+    FILE*	jf;
+    JNL_Record	rec[JNL_BATCH];
+    int		rc;
+    size_t	n;
+
+    jf = fopen(path, "rb");
+    if (jf == (FILE*) NULL) {
+	return (errno == ENOENT) ? 0 : -1;
+    }
+    rc = jnl_magic(jf);
+    if (rc <= 0) {
+	fclose(jf);
+	return rc;
+    }
+    /* Any partial record at the end is dropped by fread. */
+    while ((n = fread(rec, sizeof(JNL_Record), JNL_BATCH, jf)) > 0) {
+	size_t	i;
+	for (i = 0;  i < n;  ++i) {
+	    int st = rec[i].status;
+	    jnl_set_rank(rs, (size_t) rec[i].rank,
+			 WIFEXITED(st) && WEXITSTATUS(st) == 0);
+	}
+    }
+    fclose(jf);
+    return 0;
+}
+
+/* JNL_Open --
+ *
+ * Synopsis:
+ *
+ *    Open a journal for writing.  If 'append' is false, any existing
+ *    journal is discarded.
+ *
+ * Returns:
+ *
+ *    0 on success, or -1 with errno set.
+ */
+
+int
+JNL_Open(JNL_Control* jc, const char* path, int append)
+{
+    off_t	end;
+
+    jc->fd = open(path, O_WRONLY|O_CREAT|O_CLOEXEC|(append ? 0 : O_TRUNC),
+		  0644);
+    if (jc->fd < 0) {
+	return -1;
+    }
+    jc->recCnt = 0;
+    jc->lastSync = jnl_now();
+
+    /*
+     * Position after the last whole record, so a torn record left by
+     * a crash is overwritten.
+     */
+    end = lseek(jc->fd, 0, SEEK_END);
+    if (end < JNL_MAGIC_LEN) {
+	if (ftruncate(jc->fd, 0) < 0
+	    || write(jc->fd, JNL_MAGIC, JNL_MAGIC_LEN) != JNL_MAGIC_LEN) {
+	    close(jc->fd);
+	    return -1;
+	}
+    } else {
+	end -= (end - JNL_MAGIC_LEN) % sizeof(JNL_Record);
+	if (ftruncate(jc->fd, end) < 0 || lseek(jc->fd, end, SEEK_SET) < 0) {
+	    close(jc->fd);
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+/* JNL_Flush --
+ *
+ * Synopsis:
+ *
+ *    Write the buffered records, and sync the journal.
+ *
+ * Returns:
+ *
+ *    0 on success, or -1 with errno set.
+ */
+
+int
+JNL_Flush(JNL_Control* jc)
+{
+    const char*	bp = (const char*) jc->rec;
+    size_t	left = jc->recCnt * sizeof(JNL_Record);
+
+    while (left > 0) {
+	ssize_t	n = write(jc->fd, bp, left);
+	if (n < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    return -1;
+	}
+	bp += n;
+	left -= n;
+    }
+    jc->recCnt = 0;
+    jc->lastSync = jnl_now();
+    return fdatasync(jc->fd);
+}
+
+/* JNL_Append --
+ *
+ * Synopsis:
+ *
+ *    Record the completion of a process.  The record is buffered; the
+ *    buffer is flushed when full, or when the last sync is more than
+ *    JNL_SYNC_INTERVAL seconds old.
+ */
+
+void
+JNL_Append(JNL_Control* jc, size_t rank, int status)
+{
+    jc->rec[jc->recCnt].rank = (uint64_t) rank;
+    jc->rec[jc->recCnt].status = (int32_t) status;
+    jc->rec[jc->recCnt].unused = 0;
+    if (++jc->recCnt == JNL_BATCH
+	|| jnl_now() - jc->lastSync >= JNL_SYNC_INTERVAL) {
+	JNL_Flush(jc);
+	/*FIXME: Report write errors? */
+    }
+}
+
+/* JNL_Tick --
+ *
+ * Synopsis:
+ *
+ *    Flush the buffered records if the last sync is JNL_SYNC_INTERVAL
+ *    seconds old.  Called while waiting, so records are synced in
+ *    time even if no more processes complete.
+ *
+ * Returns:
+ *
+ *    The seconds until the records still buffered must be synced, or
+ *    -1 if none are.
+ */
+
+double
+JNL_Tick(JNL_Control* jc)
+{
+    double	left;
+
+    if (jc->recCnt == 0) {
+	return -1.0;
+    }
+    left = jc->lastSync + JNL_SYNC_INTERVAL - jnl_now();
+    if (left <= 0.0) {
+	JNL_Flush(jc);
+	/*FIXME: Report write errors? */
+	return -1.0;
+    }
+    return left;
+}
+
+/* JNL_Close --
+ *
+ * Synopsis:
+ *
+ *    Flush and close the journal.
+ *
+ * Returns:
+ *
+ *    0 on success, or -1 with errno set.
+ */
+
+int
+JNL_Close(JNL_Control* jc)
+{
+    int	rc = JNL_Flush(jc);
+    if (close(jc->fd) < 0) {
+	rc = -1;
+    }
+    jc->fd = -1;
+    return rc;
+}
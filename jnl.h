@@ -0,0 +1,101 @@
+/* Completion journal. */
+
+#ifndef COMPLETION_JOURNAL_H
+#define COMPLETION_JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * A journal is an append-only file: an 8 byte magic number, followed
+ * by one fixed-size record for each completed process, giving the
+ * process number (64 bits) and its wait status.  Records are
+ * buffered, and written and synced in batches: when the buffer fills,
+ * or when JNL_SYNC_INTERVAL seconds have passed since the last sync,
+ * which the coordinator checks with JNL_Tick whenever it waits.  A
+ * torn record at the end of the file (from a crash during a write) is
+ * ignored when the journal is loaded.
+ */
+
+#define JNL_MAGIC		"RUNOVRJ2"
+#define JNL_MAGIC_LEN		8
+#define JNL_BATCH		1024
+#define JNL_SYNC_INTERVAL	1
+
+/*
+ * The status recorded for a process killed for running past its time
+ * limit.  Wait statuses are never negative.
+ */
+#define JNL_TIMEDOUT		(-1)
+
+typedef struct JNL_Record {
+    uint64_t	rank;
+    int32_t	status;
+    int32_t	unused;
+} JNL_Record;
+
+typedef struct JNL_Control {
+    int		fd;
+    size_t	recCnt;
+    double	lastSync;	/* Monotonic seconds. */
+    JNL_Record	rec[JNL_BATCH];
+} JNL_Control;
+
+/*
+ * A rank set records which processes completed successfully, as
+ * sorted runs of consecutive process numbers.  A job's processes
+ * mostly succeed, so its size follows the failures, not the number
+ * of processes, and finding a process is a binary search of the runs.
+ * Adding a process next to the last run, as loading a journal mostly
+ * does, extends it in place.
+ */
+
+typedef struct JNL_Run {
+    size_t	lo;
+    size_t	hi;		/* Just past the last. */
+} JNL_Run;
+
+typedef struct JNL_RankSet {
+    JNL_Run*	runs;		/* Disjoint, not touching, by lo. */
+    size_t	runCnt;
+    size_t	runMax;
+    size_t	count;
+} JNL_RankSet;
+
+#define JNL_RankSetInit(rs) \
+{ \
+    (rs)->runs = (JNL_Run*) NULL; \
+    (rs)->runCnt = 0; \
+    (rs)->runMax = 0; \
+    (rs)->count = 0; \
+}
+
+#define JNL_RankDone(rs, r) \
+    ((rs)->runCnt > 0 && JNL_Find(rs, (size_t)(r)) != (size_t) -1)
+
+size_t
+JNL_Find(const JNL_RankSet* rs, size_t rank);
+
+size_t
+JNL_NextUndone(const JNL_RankSet* rs, size_t rank);
+
+int
+JNL_Load(const char* path, JNL_RankSet* rs);
+
+int
+JNL_Open(JNL_Control* jc, const char* path, int append);
+
+void
+JNL_Append(JNL_Control* jc, size_t rank, int status);
+
+int
+JNL_Flush(JNL_Control* jc);
+
+double
+JNL_Tick(JNL_Control* jc);
+
+int
+JNL_Close(JNL_Control* jc);
+
+#endif /* !defined COMPLETION_JOURNAL_H */
@@ -0,0 +1,729 @@
+/* Rendezvous key-value service. */
+
+#define _GNU_SOURCE		/* For accept4. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include "kvs.h"
+
+#define KVS_EVENTS	64
+
+/* kvs_token --
+ *
+ * Synopsis:
+ *
+ *    Make the job's random token.
+ *
+ * Returns:
+ *
+ *    0 on success, or -1 with errno set.
+ */
+
+static int
+kvs_token(KVS_Server* ks)
+{
+    unsigned char	raw[KVS_TOKEN_LEN / 2];
+    size_t		got = 0;
+    size_t		i;
+    int			fd;
+
+    fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+	return -1;
+    }
+    while (got < sizeof(raw)) {
+	ssize_t	n = read(fd, raw + got, sizeof(raw) - got);
+	if (n < 0 && errno == EINTR) {
+	    continue;
+	}
+	if (n <= 0) {
+	    close(fd);
+	    return -1;
+	}
+	got += (size_t) n;
+    }
+    close(fd);
+    for (i = 0;  i < sizeof(raw);  ++i) {
+	sprintf(ks->token + 2 * i, "%02x", raw[i]);
+    }
+    return 0;
+}
+
+/* kvs_bind_address --
+ *
+ * Synopsis:
+ *
+ *    Find the address to listen on: loopback if 'local', or else the
+ *    first address this host's name resolves to that is not loopback.
+ *
+ * Returns:
+ *
+ *    0 on success, or -1 with a message in 'err'.
+ */
+
+static int
+kvs_bind_address(struct in_addr* addr, int local, char* err, size_t errLen)
+{
+    struct addrinfo	hints;
+    struct addrinfo*	res;
+    struct addrinfo*	ai;
+    char		host[256];
+    int			rc;
+
+    if (local) {
+	addr->s_addr = htonl(INADDR_LOOPBACK);
+	return 0;
+    }
+    if (gethostname(host, sizeof(host)) < 0) {
+	snprintf(err, errLen, "gethostname: %s", strerror(errno));
+	return -1;
+    }
+    host[sizeof(host)-1] = '\0';
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    rc = getaddrinfo(host, (const char*) NULL, &hints, &res);
+    if (rc != 0) {
+	snprintf(err, errLen, "%s: %s", host, gai_strerror(rc));
+	return -1;
+    }
+    for (ai = res;  ai != NULL;  ai = ai->ai_next) {
+	struct in_addr	a = ((struct sockaddr_in*) ai->ai_addr)->sin_addr;
+	if ((ntohl(a.s_addr) >> 24) != 127) {
+	    *addr = a;
+	    break;
+	}
+    }
+    freeaddrinfo(res);
+    if (ai == NULL) {
+	snprintf(err, errLen, "%s has only loopback addresses", host);
+	return -1;
+    }
+    return 0;
+}
+
+/* KVS_Open --
+ *
+ * Synopsis:
+ *
+ *    Start the service for a job of 'size' processes, on a port
+ *    chosen by the system, of the loopback address if every process
+ *    is 'local' to this host, or else of this host's address.  Its
+ *    address is left in ks->address, and the token the processes must
+ *    give in ks->token.
+ *
+ * Returns:
+ *
+ *    0 on success, or -1 with a message in 'err'.
+ */
+
+int
+KVS_Open(KVS_Server* ks, const char* name, size_t size, int local,
+	 char* err, size_t errLen)
+{
+    struct sockaddr_in	sin;
+    socklen_t		sl = sizeof(sin);
+    struct epoll_event	ev;
+    char		ip[INET_ADDRSTRLEN];
+    int			one = 1;
+
+    memset(ks, 0, sizeof(*ks));
+    ks->epollFd = -1;
+    ks->size = size;
+    ks->abortRank = -1;
+    snprintf(ks->name, sizeof(ks->name), "kvs_%s", name);
+    if (kvs_token(ks) < 0) {
+	snprintf(err, errLen, "token: %s", strerror(errno));
+	return -1;
+    }
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = 0;
+    if (kvs_bind_address(&sin.sin_addr, local, err, errLen) < 0) {
+	return -1;
+    }
+    ks->listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (ks->listenFd < 0) {
+	snprintf(err, errLen, "socket: %s", strerror(errno));
+	return -1;
+    }
+    setsockopt(ks->listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(ks->listenFd, (struct sockaddr*) &sin, sizeof(sin)) < 0
+	|| listen(ks->listenFd, SOMAXCONN) < 0
+	|| getsockname(ks->listenFd, (struct sockaddr*) &sin, &sl) < 0) {
+	snprintf(err, errLen, "listen: %s", strerror(errno));
+	close(ks->listenFd);
+	return -1;
+    }
+
+    ks->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (ks->epollFd < 0) {
+	snprintf(err, errLen, "epoll: %s", strerror(errno));
+	close(ks->listenFd);
+	return -1;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(ks->epollFd, EPOLL_CTL_ADD, ks->listenFd, &ev);
+
+    inet_ntop(AF_INET, &sin.sin_addr, ip, sizeof(ip));
+    snprintf(ks->address, sizeof(ks->address), "%s:%u",
+	     ip, (unsigned) ntohs(sin.sin_port));
+    return 0;
+}
+
+/* kvs_hash --
+ *
+ * Synopsis:
+ *
+ *    FNV-1a hash of a key.
+ */
+
+static size_t
+kvs_hash(const char* key)
+{
+    unsigned long long	h = 0xcbf29ce484222325ULL;
+
+    for (;  *key;  ++key) {
+	h = (h ^ (unsigned char) *key) * 0x100000001b3ULL;
+    }
+    return (size_t) h;
+}
+
+/* kvs_find --
+ *
+ * Synopsis:
+ *
+ *    The entry for 'key', or the free entry where it belongs.
+ */
+
+static KVS_Pair*
+kvs_find(KVS_Server* ks, const char* key)
+{
+    size_t	i = kvs_hash(key) & (ks->pairLen - 1);
+
+    while (ks->pairs[i].key != NULL && strcmp(ks->pairs[i].key, key)) {
+	i = (i + 1) & (ks->pairLen - 1);
+    }
+    return &ks->pairs[i];
+}
+
+/* kvs_put --
+ *
+ * Synopsis:
+ *
+ *    Store a value, replacing any stored under the same key.
+ */
+
+static void
+kvs_put(KVS_Server* ks, const char* key, const char* value)
+{
+    KVS_Pair*	kp;
+
+    if (2 * (ks->pairCnt + 1) > ks->pairLen) {
+	KVS_Pair*	old = ks->pairs;
+	size_t		oldLen = ks->pairLen;
+	size_t		i;
+
+	ks->pairLen = oldLen ? 2 * oldLen : 256;
+	ks->pairs = (KVS_Pair*) calloc(ks->pairLen, sizeof(KVS_Pair));
+	/*FIXME: Out of memory */
+	for (i = 0;  i < oldLen;  ++i) {
+	    if (old[i].key != NULL) {
+		*kvs_find(ks, old[i].key) = old[i];
+	    }
+	}
+	free(old);
+    }
+
+    kp = kvs_find(ks, key);
+    if (kp->key == NULL) {
+	kp->key = strdup(key);
+	ks->pairCnt++;
+    } else {
+	free(kp->value);
+    }
+    kp->value = strdup(value);
+    /*FIXME: Out of memory */
+}
+
+/* kvs_get --
+ *
+ * Synopsis:
+ *
+ *    The value stored under 'key', or NULL.
+ */
+
+static const char*
+kvs_get(KVS_Server* ks, const char* key)
+{
+    if (ks->pairLen == 0) {
+	return (const char*) NULL;
+    }
+    return kvs_find(ks, key)->value;
+}
+
+/* kvs_drop --
+ *
+ * Synopsis:
+ *
+ *    Close a client's connection.  A process that closes its
+ *    connection while in a fence still counts as having arrived.
+ */
+
+static void
+kvs_drop(KVS_Server* ks, KVS_Client* c)
+{
+    if (c->fd >= 0) {
+	epoll_ctl(ks->epollFd, EPOLL_CTL_DEL, c->fd, (struct epoll_event*) NULL);
+	close(c->fd);
+	c->fd = -1;
+    }
+    free(c->out);
+    c->out = (char*) NULL;
+    c->outLen = c->outMax = 0;
+}
+
+/* kvs_flush --
+ *
+ * Synopsis:
+ *
+ *    Write as much of a client's queued replies as the socket will
+ *    take, and watch for it to take more only while some are left.
+ */
+
+static void
+kvs_flush(KVS_Server* ks, KVS_Client* c)
+{
+    struct epoll_event	ev;
+    size_t		done = 0;
+
+    while (done < c->outLen) {
+	ssize_t	w = write(c->fd, c->out + done, c->outLen - done);
+	if (w < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+		kvs_drop(ks, c);
+		return;
+	    }
+	    break;
+	}
+	done += (size_t) w;
+    }
+    memmove(c->out, c->out + done, c->outLen - done);
+    c->outLen -= done;
+
+    ev.events = c->outLen > 0 ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    ev.data.ptr = c;
+    epoll_ctl(ks->epollFd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+/* kvs_send --
+ *
+ * Synopsis:
+ *
+ *    Queue a reply to a client.  It is written at once if the socket
+ *    will take it.
+ */
+
+static void
+kvs_send(KVS_Server* ks, KVS_Client* c, const char* msg)
+{
+    size_t	n = strlen(msg);
+    int		idle = c->outLen == 0;
+
+    if (c->fd < 0) {
+	return;
+    }
+    if (c->outLen + n > c->outMax) {
+	size_t	m = c->outMax ? c->outMax : 256;
+	while (m < c->outLen + n) {
+	    m *= 2;
+	}
+	c->out = (char*) realloc(c->out, m);
+	/*FIXME: Out of memory */
+	c->outMax = m;
+    }
+    memcpy(c->out + c->outLen, msg, n);
+    c->outLen += n;
+    if (idle) {
+	kvs_flush(ks, c);
+    }
+}
+
+/* kvs_arg --
+ *
+ * Synopsis:
+ *
+ *    Copy the value of word 'name=' of a command line into 'buf'.
+ *
+ * Returns:
+ *
+ *    'buf', or NULL if the line has no such word.
+ */
+
+static char*
+kvs_arg(const char* line, const char* name, char* buf, size_t bufLen)
+{
+    size_t	nl = strlen(name);
+    const char*	cp = line;
+
+    while (*cp) {
+	size_t	wl;
+
+	while (*cp == ' ') {
+	    ++cp;
+	}
+	wl = strcspn(cp, " ");
+	if (wl > nl && cp[nl] == '=' && !strncmp(cp, name, nl)) {
+	    size_t	vl = wl - nl - 1;
+	    if (vl >= bufLen) {
+		vl = bufLen - 1;
+	    }
+	    memcpy(buf, cp + nl + 1, vl);
+	    buf[vl] = '\0';
+	    return buf;
+	}
+	cp += wl;
+    }
+    return (char*) NULL;
+}
+
+/* kvs_rest --
+ *
+ * Synopsis:
+ *
+ *    Copy the value of word 'name=' of a command line, and the rest
+ *    of the line after it, into 'buf'.  For values that may hold
+ *    spaces, such as an abort message.
+ *
+ * Returns:
+ *
+ *    'buf', or NULL if the line has no such word.
+ */
+
+static char*
+kvs_rest(const char* line, const char* name, char* buf, size_t bufLen)
+{
+    size_t	nl = strlen(name);
+    const char*	cp = line;
+
+    while (*cp) {
+	while (*cp == ' ') {
+	    ++cp;
+	}
+	if (!strncmp(cp, name, nl) && cp[nl] == '=') {
+	    snprintf(buf, bufLen, "%s", cp + nl + 1);
+	    return buf;
+	}
+	cp += strcspn(cp, " ");
+    }
+    return (char*) NULL;
+}
+
+/* kvs_trust --
+ *
+ * Synopsis:
+ *
+ *    Trust a client if its command line gives the job's token.  The
+ *    comparison takes the same time wherever the token differs.
+ */
+
+static void
+kvs_trust(KVS_Server* ks, KVS_Client* c, const char* line)
+{
+    char		token[KVS_TOKEN_LEN + 2];
+    unsigned char	diff = 0;
+    size_t		i;
+
+    if (kvs_arg(line, "token", token, sizeof(token)) == NULL
+	|| strlen(token) != KVS_TOKEN_LEN) {
+	return;
+    }
+    for (i = 0;  i < KVS_TOKEN_LEN;  ++i) {
+	diff |= (unsigned char) (token[i] ^ ks->token[i]);
+    }
+    if (diff == 0) {
+	c->trusted = 1;
+    }
+}
+
+/* kvs_command --
+ *
+ * Synopsis:
+ *
+ *    Carry out one command line from a client.
+ */
+
+static void
+kvs_command(KVS_Server* ks, KVS_Client* c, const char* line)
+{
+    char	cmd[32];
+    char	key[KVS_KEY_MAX];
+    char	value[KVS_VALUE_MAX];
+    char	reply[KVS_LINE_MAX];
+    const char*	v;
+    size_t	i;
+
+    if (kvs_arg(line, "cmd", cmd, sizeof(cmd)) == NULL) {
+	kvs_send(ks, c, "cmd=error rc=-1 msg=no_command\n");
+	return;
+    }
+    if (!c->trusted && (!strcmp(cmd, "initack") || !strcmp(cmd, "init"))) {
+	kvs_trust(ks, c, line);
+    }
+    if (!c->trusted && strcmp(cmd, "init")) {
+	/* Only a process of the job, which knows the token, is served. */
+	kvs_send(ks, c, "cmd=error rc=-1 msg=bad_token\n");
+	kvs_drop(ks, c);
+	return;
+    }
+
+    if (!strcmp(cmd, "initack")) {
+	if (kvs_arg(line, "pmiid", value, sizeof(value)) != NULL) {
+	    c->rank = strtol(value, (char**) NULL, 10);
+	}
+	snprintf(reply, sizeof(reply),
+		 "cmd=initack\ncmd=set size=%lu\ncmd=set rank=%ld\ncmd=set debug=0\n",
+		 (unsigned long) ks->size, c->rank);
+	kvs_send(ks, c, reply);
+    } else if (!strcmp(cmd, "init")) {
+	kvs_send(ks, c, "cmd=response_to_init pmi_version=1 pmi_subversion=1 rc=0\n");
+    } else if (!strcmp(cmd, "get_maxes")) {
+	snprintf(reply, sizeof(reply),
+		 "cmd=maxes kvsname_max=%d keylen_max=%d vallen_max=%d rc=0\n",
+		 KVS_NAME_MAX, KVS_KEY_MAX, KVS_VALUE_MAX);
+	kvs_send(ks, c, reply);
+    } else if (!strcmp(cmd, "get_appnum")) {
+	kvs_send(ks, c, "cmd=appnum appnum=0 rc=0\n");
+    } else if (!strcmp(cmd, "get_my_kvsname")) {
+	snprintf(reply, sizeof(reply), "cmd=my_kvsname kvsname=%s rc=0\n", ks->name);
+	kvs_send(ks, c, reply);
+    } else if (!strcmp(cmd, "get_universe_size")) {
+	snprintf(reply, sizeof(reply), "cmd=universe_size size=%lu rc=0\n",
+		 (unsigned long) ks->size);
+	kvs_send(ks, c, reply);
+    } else if (!strcmp(cmd, "put")) {
+	if (kvs_arg(line, "key", key, sizeof(key)) == NULL
+	    || kvs_arg(line, "value", value, sizeof(value)) == NULL) {
+	    kvs_send(ks, c, "cmd=put_result rc=-1 msg=missing_key_or_value\n");
+	    return;
+	}
+	kvs_put(ks, key, value);
+	kvs_send(ks, c, "cmd=put_result rc=0 msg=success\n");
+    } else if (!strcmp(cmd, "get")) {
+	if (kvs_arg(line, "key", key, sizeof(key)) == NULL) {
+	    kvs_send(ks, c, "cmd=get_result rc=-1 msg=missing_key\n");
+	    return;
+	}
+	v = kvs_get(ks, key);
+	if (v != NULL) {
+	    snprintf(reply, sizeof(reply), "cmd=get_result rc=0 msg=success value=%s\n", v);
+	} else {
+	    snprintf(reply, sizeof(reply), "cmd=get_result rc=-1 msg=key_%s_not_found\n", key);
+	}
+	kvs_send(ks, c, reply);
+    } else if (!strcmp(cmd, "barrier_in")) {
+	if (c->inBarrier) {
+	    return;
+	}
+	c->inBarrier = 1;
+	if (ks->barrierCnt == ks->barrierMax) {
+	    ks->barrierMax = ks->barrierMax ? 2 * ks->barrierMax : 64;
+	    ks->barrier = (KVS_Client**) realloc(ks->barrier,
+						 ks->barrierMax * sizeof(KVS_Client*));
+	    /*FIXME: Out of memory */
+	}
+	ks->barrier[ks->barrierCnt++] = c;
+	if (ks->barrierCnt < ks->size) {
+	    return;
+	}
+	for (i = 0;  i < ks->barrierCnt;  ++i) {
+	    ks->barrier[i]->inBarrier = 0;
+	    kvs_send(ks, ks->barrier[i], "cmd=barrier_out\n");
+	}
+	ks->barrierCnt = 0;
+	ks->fenceCnt++;
+    } else if (!strcmp(cmd, "finalize")) {
+	kvs_send(ks, c, "cmd=finalize_ack\n");
+    } else if (!strcmp(cmd, "abort")) {
+	ks->aborted = 1;
+	ks->abortRank = c->rank;
+	if (kvs_rest(line, "msg", ks->abortMsg, sizeof(ks->abortMsg)) == NULL) {
+	    ks->abortMsg[0] = '\0';
+	}
+    } else {
+	snprintf(reply, sizeof(reply), "cmd=%s_result rc=-1 msg=unknown_command\n", cmd);
+	kvs_send(ks, c, reply);
+    }
+}
+
+/* kvs_read --
+ *
+ * Synopsis:
+ *
+ *    Read what a client has sent, and carry out each complete line.
+ *    A line too long for the buffer ends the connection.
+ */
+
+static void
+kvs_read(KVS_Server* ks, KVS_Client* c)
+{
+    for (;;) {
+	ssize_t	r;
+	char*	start;
+	char*	nl;
+
+	r = read(c->fd, c->in + c->inLen, sizeof(c->in) - c->inLen);
+	if (r < 0 && errno == EINTR) {
+	    continue;
+	}
+	if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+	    return;
+	}
+	if (r <= 0) {
+	    kvs_drop(ks, c);
+	    return;
+	}
+	c->inLen += (size_t) r;
+
+	start = c->in;
+	while ((nl = memchr(start, '\n', c->inLen - (start - c->in))) != NULL) {
+	    *nl = '\0';
+	    kvs_command(ks, c, start);
+	    if (c->fd < 0) {
+		return;
+	    }
+	    start = nl + 1;
+	}
+	c->inLen -= (size_t) (start - c->in);
+	memmove(c->in, start, c->inLen);
+	if (c->inLen == sizeof(c->in)) {
+	    kvs_drop(ks, c);
+	    return;
+	}
+    }
+}
+
+/* kvs_accept --
+ *
+ * Synopsis:
+ *
+ *    Take every pending connection.
+ */
+
+static void
+kvs_accept(KVS_Server* ks)
+{
+    for (;;) {
+	struct epoll_event	ev;
+	KVS_Client*		c;
+	int			one = 1;
+	int			fd;
+
+	fd = accept4(ks->listenFd, (struct sockaddr*) NULL, (socklen_t*) NULL,
+		     SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0) {
+	    if (errno == EINTR || errno == ECONNABORTED) {
+		continue;
+	    }
+	    return;
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	c = (KVS_Client*) malloc(sizeof(KVS_Client));
+	/*FIXME: Out of memory */
+	c->fd = fd;
+	c->rank = -1;
+	c->trusted = 0;
+	c->inBarrier = 0;
+	c->inLen = 0;
+	c->out = (char*) NULL;
+	c->outLen = c->outMax = 0;
+	if (ks->clientCnt == ks->clientMax) {
+	    ks->clientMax = ks->clientMax ? 2 * ks->clientMax : 64;
+	    ks->clients = (KVS_Client**) realloc(ks->clients,
+						 ks->clientMax * sizeof(KVS_Client*));
+	    /*FIXME: Out of memory */
+	}
+	ks->clients[ks->clientCnt++] = c;
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = c;
+	epoll_ctl(ks->epollFd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+/* KVS_Service --
+ *
+ * Synopsis:
+ *
+ *    Handle whatever the service's connections have ready, without
+ *    waiting.  The caller waits for ks->epollFd to be readable.
+ */
+
+void
+KVS_Service(KVS_Server* ks)
+{
+    struct epoll_event	evs[KVS_EVENTS];
+    int			n, i;
+
+    do {
+	n = epoll_wait(ks->epollFd, evs, KVS_EVENTS, 0);
+	for (i = 0;  i < n;  ++i) {
+	    KVS_Client*	c = (KVS_Client*) evs[i].data.ptr;
+
+	    if (c == NULL) {
+		kvs_accept(ks);
+		continue;
+	    }
+	    if (c->fd >= 0 && (evs[i].events & EPOLLOUT)) {
+		kvs_flush(ks, c);
+	    }
+	    if (c->fd >= 0 && (evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+		kvs_read(ks, c);
+	    }
+	}
+    } while (n == KVS_EVENTS);
+}
+
+/* KVS_Close --
+ *
+ * Synopsis:
+ *
+ *    Stop the service, and free everything it holds.
+ */
+
+void
+KVS_Close(KVS_Server* ks)
+{
+    size_t	i;
+
+    for (i = 0;  i < ks->clientCnt;  ++i) {
+	kvs_drop(ks, ks->clients[i]);
+	free(ks->clients[i]);
+    }
+    free(ks->clients);
+    free(ks->barrier);
+    for (i = 0;  i < ks->pairLen;  ++i) {
+	free(ks->pairs[i].key);
+	free(ks->pairs[i].value);
+    }
+    free(ks->pairs);
+    close(ks->listenFd);
+    close(ks->epollFd);
+}
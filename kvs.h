@@ -0,0 +1,86 @@
+/* Rendezvous key-value service. */
+
+#ifndef RENDEZVOUS_KVS_H
+#define RENDEZVOUS_KVS_H
+
+#include <stddef.h>
+
+/*
+ * The rendezvous service lets the processes of a job find each other
+ * at startup.  It listens on a TCP port of the coordinator and speaks
+ * the wire protocol of PMI-1: newline terminated lines of
+ * "cmd=NAME key=value ..." words.  A process identifies itself with
+ * "cmd=initack pmiid=RANK token=TOKEN", stores values with "cmd=put",
+ * enters a fence with "cmd=barrier_in", and after the fence reads the
+ * values the others stored with "cmd=get".
+ *
+ * The service listens only on the loopback address if every process
+ * runs on this host, and otherwise on the address this host's name
+ * resolves to.  TOKEN is random, made for each job; a connection that
+ * has not given it in "cmd=init" or "cmd=initack" may do nothing
+ * else, and is closed if it tries.
+ *
+ * The server keeps every connection non-blocking on one epoll set, so
+ * the cost of a message does not depend on how many processes are
+ * connected.  Values go in a hash table as they are put, so a fence
+ * carries no data: each arrival is added to a list, and when the
+ * last process arrives one prepared release is queued to each on it.
+ */
+
+#define KVS_NAME_MAX	64
+#define KVS_KEY_MAX	256
+#define KVS_VALUE_MAX	1024
+#define KVS_LINE_MAX	(KVS_KEY_MAX + KVS_VALUE_MAX + 128)
+#define KVS_ADDR_MAX	300
+#define KVS_TOKEN_LEN	32		/* Hex digits. */
+
+typedef struct KVS_Client {
+    int		fd;		/* -1 once closed. */
+    long	rank;		/* -1 until the process says. */
+    int		trusted;	/* Gave the token. */
+    int		inBarrier;
+    size_t	inLen;
+    char	in[KVS_LINE_MAX];
+    char*	out;		/* Replies not yet written. */
+    size_t	outLen;
+    size_t	outMax;
+} KVS_Client;
+
+typedef struct KVS_Pair {
+    char*	key;		/* NULL if the entry is free. */
+    char*	value;
+} KVS_Pair;
+
+typedef struct KVS_Server {
+    int			listenFd;
+    int			epollFd;
+    char		address[KVS_ADDR_MAX];	/* "host:port" */
+    char		name[KVS_NAME_MAX];
+    char		token[KVS_TOKEN_LEN + 1];
+    size_t		size;		/* Processes in the job. */
+    KVS_Client**	clients;
+    size_t		clientCnt;
+    size_t		clientMax;
+    KVS_Pair*		pairs;		/* Open addressed, by key. */
+    size_t		pairCnt;
+    size_t		pairLen;
+    KVS_Client**	barrier;	/* Arrivals at the current fence. */
+    size_t		barrierCnt;
+    size_t		barrierMax;
+    size_t		fenceCnt;	/* Fences completed. */
+    int			aborted;	/* A process aborted the job. */
+    long		abortRank;	/* Its rank, or -1. */
+    char		abortMsg[KVS_VALUE_MAX];
+} KVS_Server;
+
+int
+KVS_Open(KVS_Server* ks, const char* name, size_t size, int local,
+	 char* err, size_t errLen);
+
+void
+KVS_Service(KVS_Server* ks);
+
+void
+KVS_Close(KVS_Server* ks);
+
+#endif /* !defined RENDEZVOUS_KVS_H */
@@ -0,0 +1,613 @@
+/* Machine lists. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "ml.h"
+
+#define MAX_MACHINE_LINE	1024
+
+/* ML_Create --
+ *
+ * Synopsis:
+ *
+ *    Create an empty machine list.
+ */
+
+MachineList*
+ML_Create(void)
+{
+    MachineList*	ms;
+
+    ms = (MachineList*) calloc(1, sizeof(MachineList));
+    /*FIXME: Out of memory */
+    QI_QUEUE_INIT(&ms->ready);
+    QI_QUEUE_INIT(&ms->run);
+    return ms;
+}
+
+/* ml_hash --
+ *
+ * Synopsis:
+ *
+ *    Hash a host name, for the host name index.
+ */
+
+static size_t
+ml_hash(const char* s)
+{
+    size_t	h = 5381;
+    while (*s) {
+	h = (h * 33) ^ (unsigned char) *s++;
+    }
+    return h;
+}
+
+/* ml_host_slot --
+ *
+ * Synopsis:
+ *
+ *    Find the host name index entry for 'name', or the empty entry
+ *    where it belongs.
+ */
+
+static size_t
+ml_host_slot(MachineList* ms, const char* name)
+{
+    size_t	i = ml_hash(name) & (ms->hostTabLen - 1);
+    while (ms->hostTab[i] != QI_NIL
+	   && strcmp(ms->hosts[ms->hostTab[i]].name, name)) {
+	i = (i + 1) & (ms->hostTabLen - 1);
+    }
+    return i;
+}
+
+/* ML_AddHost --
+ *
+ * Synopsis:
+ *
+ *    Find a host by name, adding it to the host table if it is new.
+ *
+ * Returns:
+ *
+ *    The host number.
+ */
+
+QI_Index
+ML_AddHost(MachineList* ms, const char* name)
+{
+    size_t	i;
+
+    if (2 * (ms->hcnt + 1) > ms->hostTabLen) {
+	size_t	h;
+
+	ms->hostTabLen = ms->hostTabLen ? 2 * ms->hostTabLen : 64;
+	free(ms->hostTab);
+	ms->hostTab = (QI_Index*) malloc(ms->hostTabLen * sizeof(QI_Index));
+	/*FIXME: Out of memory */
+	memset(ms->hostTab, 0xff, ms->hostTabLen * sizeof(QI_Index));
+	for (h = 0;  h < ms->hcnt;  ++h) {
+	    ms->hostTab[ml_host_slot(ms, ms->hosts[h].name)] = (QI_Index) h;
+	}
+    }
+
+    i = ml_host_slot(ms, name);
+    if (ms->hostTab[i] == QI_NIL) {
+	if (ms->hcnt == ms->hmax) {
+	    ms->hmax = ms->hmax ? 2 * ms->hmax : 16;
+	    ms->hosts = (MachineHost*) realloc(ms->hosts,
+					       ms->hmax * sizeof(MachineHost));
+	    /*FIXME: Out of memory */
+	}
+	ms->hosts[ms->hcnt].name = strdup(name);
+	ms->hosts[ms->hcnt].isLocal = 0;
+	ms->hosts[ms->hcnt].isDown = 0;
+	ms->hosts[ms->hcnt].probeTime = -1.0;
+	ms->hosts[ms->hcnt].active = 0;
+	ms->hosts[ms->hcnt].target = 0;
+	ms->hosts[ms->hcnt].mem = 0;
+	ms->hostTab[i] = (QI_Index) ms->hcnt++;
+    }
+    return ms->hostTab[i];
+}
+
+#define ML_GROW(ms, field, n) \
+    (ms)->field = realloc((ms)->field, (n) * sizeof(*(ms)->field))
+
+/* ml_grow --
+ *
+ * Synopsis:
+ *
+ *    Make room for at least 'need' slots, and for the pid table that
+ *    goes with them.
+ */
+
+static void
+ml_grow(MachineList* ms, size_t need)
+{
+    size_t	n;
+    size_t	i;
+
+    if (need <= ms->mmax) {
+	return;
+    }
+    for (n = ms->mmax ? ms->mmax : 64;  n < need;  n *= 2)
+	;
+    ML_GROW(ms, host, n);
+    ML_GROW(ms, pid, n);
+    ML_GROW(ms, state, n);
+    ML_GROW(ms, start, n);
+    ML_GROW(ms, link, n);
+    ML_GROW(ms, proc, n);
+    ML_GROW(ms, key, n);
+    if (ms->pin != NULL) {
+	ML_GROW(ms, pin, n);
+	memset(ms->pin + ms->mmax, 0, (n - ms->mmax) * sizeof(MachinePin));
+    }
+    /*FIXME: Out of memory */
+    ms->mmax = n;
+
+    /* Rebuild the pid table at twice the slot count. */
+    {
+	pid_t*		oldKey = ms->pidKey;
+	QI_Index*	oldSlot = ms->pidSlot;
+	size_t		oldLen = ms->pidTabLen;
+
+	ms->pidTabLen = 2 * n;
+	ms->pidKey = (pid_t*) calloc(ms->pidTabLen, sizeof(pid_t));
+	ms->pidSlot = (QI_Index*) malloc(ms->pidTabLen * sizeof(QI_Index));
+	/*FIXME: Out of memory */
+	for (i = 0;  i < oldLen;  ++i) {
+	    if (oldKey[i] != 0) {
+		ML_MapPid(ms, oldKey[i], oldSlot[i]);
+	    }
+	}
+	free(oldKey);
+	free(oldSlot);
+    }
+}
+
+/* ML_AddSlot --
+ *
+ * Synopsis:
+ *
+ *    Add a slot on a host, and put it on the 'ready' queue.
+ *
+ * Returns:
+ *
+ *    The slot number.
+ */
+
+QI_Index
+ML_AddSlot(MachineList* ms, QI_Index host)
+{
+    QI_Index	s = (QI_Index) ms->mcnt;
+
+    ml_grow(ms, ms->mcnt + 1);
+    ms->host[s] = host;
+    ms->pid[s] = 0;
+    ms->state[s] = ml_sReady;
+    ms->start[s] = 0.0;
+    ms->proc[s] = 0;
+    ms->key[s] = 0;
+    QI_ADD(&ms->ready, ms->link, s);
+    ms->mcnt++;
+    ms->liveCnt++;
+    ms->hosts[host].active++;
+    ms->hosts[host].target++;
+    return s;
+}
+
+/* ML_DropHost --
+ *
+ * Synopsis:
+ *
+ *    Mark a host down, and take its slots off the 'ready' queue so
+ *    they are never handed out.  Slots that are running are left to
+ *    finish; the caller must not requeue them.
+ */
+
+void
+ML_DropHost(MachineList* ms, QI_Index host)
+{
+    size_t	s;
+
+    if (ms->hosts[host].isDown) {
+	return;
+    }
+    ms->hosts[host].isDown = 1;
+    for (s = 0;  s < ms->mcnt;  ++s) {
+	if (ms->host[s] == host) {
+	    if (ms->state[s] == ml_sReady) {
+		QI_REMOVE(&ms->ready, ms->link, (QI_Index) s);
+	    }
+	    ms->liveCnt--;
+	}
+    }
+}
+
+/* ML_ParkSlot --
+ *
+ * Synopsis:
+ *
+ *    Take a ready slot off the 'ready' queue until it is unparked, so
+ *    its host runs one process fewer at once.
+ */
+
+void
+ML_ParkSlot(MachineList* ms, QI_Index slot)
+{
+    MachineHost*	mh = ML_HOST(ms, slot);
+
+    if (ms->state[slot] == ml_sReady && !mh->isDown) {
+	QI_REMOVE(&ms->ready, ms->link, slot);
+    }
+    ms->state[slot] = ml_sParked;
+    mh->active--;
+}
+
+/* ML_UnparkSlot --
+ *
+ * Synopsis:
+ *
+ *    Put a parked slot back on the 'ready' queue.
+ */
+
+void
+ML_UnparkSlot(MachineList* ms, QI_Index slot)
+{
+    MachineHost*	mh = ML_HOST(ms, slot);
+
+    ms->state[slot] = ml_sReady;
+    mh->active++;
+    if (!mh->isDown) {
+	QI_ADD(&ms->ready, ms->link, slot);
+    }
+}
+
+/* ML_ReleaseSlot --
+ *
+ * Synopsis:
+ *
+ *    Return a slot whose process has finished, and which has been
+ *    taken off the 'run' queue.  It goes back on the 'ready' queue,
+ *    unless its host is down, or has more slots active than its
+ *    target, in which case it is parked.
+ */
+
+void
+ML_ReleaseSlot(MachineList* ms, QI_Index slot)
+{
+    MachineHost*	mh = ML_HOST(ms, slot);
+
+    if (mh->isDown) {
+	ms->state[slot] = ml_sReady;
+    } else if (mh->active > mh->target) {
+	ms->state[slot] = ml_sParked;
+	mh->active--;
+    } else {
+	ms->state[slot] = ml_sReady;
+	QI_ADD(&ms->ready, ms->link, slot);
+    }
+}
+
+/* ml_pid_hash --
+ *
+ * Synopsis:
+ *
+ *    Home position of a pid in the pid table.
+ */
+
+static size_t
+ml_pid_hash(MachineList* ms, pid_t pid)
+{
+    return ((size_t) pid * 2654435761u) & (ms->pidTabLen - 1);
+}
+
+/* ML_Resize --
+ *
+ * Synopsis:
+ *
+ *    Set the target of 'host' to 'want' active slots: park ready
+ *    slots, or unpark parked ones and then add more.  Running slots
+ *    over the target are parked as they finish.
+ */
+
+void
+ML_Resize(MachineList* ms, QI_Index host, size_t want)
+{
+    size_t	s;
+
+    ms->hosts[host].target = want;
+    for (s = 0;  s < ms->mcnt && ms->hosts[host].active != want;  ++s) {
+	if (ms->host[s] != host) {
+	    continue;
+	}
+	if (ms->hosts[host].active > want && ms->state[s] == ml_sReady) {
+	    ML_ParkSlot(ms, (QI_Index) s);
+	} else if (ms->hosts[host].active < want && ms->state[s] == ml_sParked) {
+	    ML_UnparkSlot(ms, (QI_Index) s);
+	}
+    }
+    while (ms->hosts[host].active < want) {
+	ML_AddSlot(ms, host);
+    }
+    ms->hosts[host].target = want;
+}
+
+/* ML_Reconcile --
+ *
+ * Synopsis:
+ *
+ *    Bring the list in line with 'next', a machine list parsed anew:
+ *    hosts it adds are added, every host gets as many active slots as
+ *    'next' gives it, and hosts it leaves out get none, draining as
+ *    their processes finish.  Memory capacities are taken from
+ *    'next'.  Hosts that are down stay down.
+ */
+
+void
+ML_Reconcile(MachineList* ms, const MachineList* next)
+{
+    QI_Index*	map;
+    size_t*	want;
+    size_t	h, s;
+
+    map = (QI_Index*) malloc((next->hcnt + 1) * sizeof(QI_Index));
+    /*FIXME: Out of memory */
+    for (h = 0;  h < next->hcnt;  ++h) {
+	map[h] = ML_AddHost(ms, next->hosts[h].name);
+	ms->hosts[map[h]].mem = next->hosts[h].mem;
+    }
+    want = (size_t*) calloc(ms->hcnt + 1, sizeof(size_t));
+    /*FIXME: Out of memory */
+    for (s = 0;  s < next->mcnt;  ++s) {
+	want[map[next->host[s]]]++;
+    }
+    for (h = 0;  h < ms->hcnt;  ++h) {
+	if (!ms->hosts[h].isDown && ms->hosts[h].target != want[h]) {
+	    ML_Resize(ms, (QI_Index) h, want[h]);
+	}
+    }
+    free(want);
+    free(map);
+}
+
+/* ML_MapPid --
+ *
+ * Synopsis:
+ *
+ *    Record that 'slot' is running process 'pid'.
+ */
+
+void
+ML_MapPid(MachineList* ms, pid_t pid, QI_Index slot)
+{
+    size_t	i = ml_pid_hash(ms, pid);
+
+    while (ms->pidKey[i] != 0) {
+	i = (i + 1) & (ms->pidTabLen - 1);
+    }
+    ms->pidKey[i] = pid;
+    ms->pidSlot[i] = slot;
+}
+
+/* ML_UnmapPid --
+ *
+ * Synopsis:
+ *
+ *    Find and forget the slot running process 'pid'.  Removal shifts
+ *    later entries back, so the table needs no tombstones.
+ *
+ * Returns:
+ *
+ *    The slot, or QI_NIL if no slot was running 'pid'.
+ */
+
+QI_Index
+ML_UnmapPid(MachineList* ms, pid_t pid)
+{
+    size_t	mask = ms->pidTabLen - 1;
+    size_t	i, j;
+    QI_Index	slot;
+
+    if (ms->pidTabLen == 0) {
+	return QI_NIL;
+    }
+    for (i = ml_pid_hash(ms, pid);  ms->pidKey[i] != pid;  i = (i + 1) & mask) {
+	if (ms->pidKey[i] == 0) {
+	    return QI_NIL;
+	}
+    }
+    slot = ms->pidSlot[i];
+
+    for (j = (i + 1) & mask;  ms->pidKey[j] != 0;  j = (j + 1) & mask) {
+	size_t	home = ml_pid_hash(ms, ms->pidKey[j]);
+	/* Move j back to i unless its home lies in (i, j]. */
+	if ((j > i && (home <= i || home > j))
+	    || (j < i && (home <= i && home > j))) {
+	    ms->pidKey[i] = ms->pidKey[j];
+	    ms->pidSlot[i] = ms->pidSlot[j];
+	    i = j;
+	}
+    }
+    ms->pidKey[i] = 0;
+    return slot;
+}
+
+/* ML_Destroy --
+ *
+ * Synopsis:
+ *
+ *    Free a machine list, with its host names and slot placements.
+ */
+
+void
+ML_Destroy(MachineList* ms)
+{
+    size_t	i;
+
+    if (ms->pin != NULL) {
+	for (i = 0;  i < ms->mcnt;  ++i) {
+	    free(ms->pin[i].place.cpus);
+	    free(ms->pin[i].cpuList);
+	    free(ms->pin[i].nodeList);
+	}
+	free(ms->pin);
+    }
+    for (i = 0;  i < ms->hcnt;  ++i) {
+	free(ms->hosts[i].name);
+    }
+    free(ms->hosts);
+    free(ms->hostTab);
+    free(ms->host);
+    free(ms->pid);
+    free(ms->state);
+    free(ms->start);
+    free(ms->link);
+    free(ms->proc);
+    free(ms->key);
+    free(ms->pidKey);
+    free(ms->pidSlot);
+    free(ms);
+}
+
+/* ML_ParseSize --
+ *
+ * Synopsis:
+ *
+ *    Parse a memory size: a number of megabytes, or a number with a
+ *    suffix K, M, G or T, in powers of 1024.
+ *
+ * Returns:
+ *
+ *    0, with the size in kB, or -1 if 's' is not a size.
+ */
+
+int
+ML_ParseSize(const char* s, uint64_t* kb)
+{
+    char*	end;
+    double	v = strtod(s, &end);
+    double	unit = 1024.0;
+
+    if (end == s || v < 0) {
+	return -1;
+    }
+    switch (toupper((unsigned char) *end)) {
+    case '\0':
+	break;
+    case 'K':
+	unit = 1.0;
+	break;
+    case 'M':
+	break;
+    case 'G':
+	unit = 1024.0 * 1024.0;
+	break;
+    case 'T':
+	unit = 1024.0 * 1024.0 * 1024.0;
+	break;
+    default:
+	return -1;
+    }
+    if (*end && end[1] && !((end[1] == 'B' || end[1] == 'b') && !end[2])) {
+	return -1;
+    }
+    v *= unit;
+    if (v >= 18446744073709551615.0) {
+	return -1;
+    }
+    *kb = (uint64_t) (v + 0.999);
+    return 0;
+}
+
+/* ParseMachineFile --
+ *
+ * Parse the machine file information from the specified file stream.
+ * Return a machine structure, or NULL, with a message in 'err', if a
+ * line gives a capacity that does not parse.
+ */
+MachineList*
+ParseMachineFile(FILE* mff, char* err, size_t errLen)
+{
+    MachineList*	ms;
+    char		ml[MAX_MACHINE_LINE+1];
+    QI_Index		host = QI_NIL;
+    unsigned long	lineCount = 0;
+
+    /*
+     * Allocate, initialize the MachineList object.
+     */
+    ms = ML_Create();
+
+    /*
+     * Read lines from machine file, and parse.
+     */
+    while (fgets(ml, MAX_MACHINE_LINE+1, mff) != NULL) {
+	size_t	mls = strlen(ml);
+	char*	cp;
+	char*	attr;
+	char*	save;
+	long	cores = 1;
+
+	lineCount++;
+
+	/*
+	 * Remove trailing newline.  If missing, the line was
+	 * truncated.
+	 */
+	if (ml[--mls] == '\n') {
+	    ml[mls] = '\0';
+	}
+	/*FIXME: What to do if line was truncated? */
+
+	/*
+	 * Skip leading whitespace.  Check if we have a comment or
+	 * blank line.
+	 */
+	for (cp = ml;  *cp && isspace(*cp);  ++cp)
+	    ;
+	if (!*cp || *cp == '#') {
+	    continue;
+	}
+
+	/*
+	 * The host name ends at white space; any capacities follow.
+	 */
+	for (attr = cp;  *attr && !isspace(*attr);  ++attr)
+	    ;
+	if (*attr) {
+	    *attr++ = '\0';
+	}
+
+	/*
+	 * Add a slot on this host.  Hosts are usually listed several
+	 * times in a row, so try the last one before the index.
+	 */
+	if (host == QI_NIL || strcmp(ms->hosts[host].name, cp)) {
+	    host = ML_AddHost(ms, cp);
+	}
+
+	for (attr = strtok_r(attr, " \t\r\f\v", &save);
+	     attr != NULL;
+	     attr = strtok_r(NULL, " \t\r\f\v", &save)) {
+	    uint64_t	kb;
+	    char*	end;
+
+	    if (!strncmp(attr, "mem=", 4) && ML_ParseSize(attr + 4, &kb) == 0) {
+		ms->hosts[host].mem += kb;
+	    } else if (strncmp(attr, "cores=", 6)
+		       || (cores = strtol(attr + 6, &end, 10)) <= 0 || *end) {
+		snprintf(err, errLen, "%lu: bad capacity \"%s\"", lineCount, attr);
+		ML_Destroy(ms);
+		return (MachineList*) NULL;
+	    }
+	}
+	while (cores-- > 0) {
+	    ML_AddSlot(ms, host);
+	}
+    }
+    return ms;
+}
@@ -0,0 +1,145 @@
+/* Machine lists. */
+
+#ifndef MACHINE_LIST_H
+#define MACHINE_LIST_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "qi.h"
+#include "topo.h"
+
+/*
+ * A machine list is a table of slots: each slot is an instance of a
+ * process on a particular host.  A host appears once in the host
+ * table however many slots it has.
+ *
+ * Slot state is kept as a structure of arrays indexed by slot number,
+ * so the state touched on every launch and exit (host, pid, state,
+ * start time, queue linkage) is packed together, with no per-slot
+ * allocation.  A slot is on at most one of the 'ready' and 'run'
+ * queues, so the two share a link array; a parked slot, or a ready
+ * one on a host that is down, is on neither.  Running slots are also
+ * found by pid through an open addressed table.
+ *
+ * Each host keeps a target for how many of its slots are active (not
+ * parked).  It is the slot count unless something moves it, as
+ * -adapt and reloading the machine list (ML_Reconcile) do; slots over
+ * the target are parked as they finish.  Slots are never freed, so a
+ * slot number stays valid for the life of the list.
+ *
+ * A machine file lists a host per line, once for each slot.  A line
+ * may go on to give capacities, as "HOST mem=SIZE cores=N": cores=N
+ * makes N slots of the line in place of one, and the memory of a
+ * host's lines adds up to the memory its processes may use at once
+ * (see pack.h).  A SIZE is a number of megabytes, or a number with a
+ * suffix K, M, G or T.  A host none of whose lines gives memory is not
+ * limited by it.
+ */
+
+typedef enum ML_State {
+    ml_sReady,
+    ml_sRun,
+    ml_sKilled,		/* Running, but killed for its time limit. */
+    ml_sParked		/* Held off the 'ready' queue; see ML_ParkSlot. */
+} ML_State;
+
+typedef struct MachineHost {
+    char*	name;
+    int		isLocal;
+    int		isDown;		/* Dropped; its slots are never ready. */
+    double	probeTime;	/* Seconds; negative if not probed. */
+    size_t	active;		/* Slots not parked. */
+    size_t	target;		/* Slots wanted active. */
+    uint64_t	mem;		/* kB given in the machine file, or 0. */
+} MachineHost;
+
+typedef struct MachinePin {
+    TOPO_Place	place;
+    char*	cpuList;
+    char*	nodeList;
+} MachinePin;
+
+typedef struct MachineList {
+    size_t		mcnt;		/* Slots. */
+    size_t		mmax;
+    size_t		liveCnt;	/* Slots on hosts that are up. */
+
+    /* Per-slot state, on the launch and exit paths. */
+    QI_Index*		host;
+    pid_t*		pid;
+    uint8_t*		state;
+    double*		start;
+    QI_Link*		link;		/* On 'ready' or 'run'. */
+
+    /* Per-slot state of the process in progress. */
+    size_t*		proc;
+    uint64_t*		key;
+
+    /* Per-slot placement; NULL unless slots are pinned. */
+    MachinePin*		pin;
+
+    /* Hosts, and an index of their names. */
+    MachineHost*	hosts;
+    size_t		hcnt;
+    size_t		hmax;
+    QI_Index*		hostTab;
+    size_t		hostTabLen;
+
+    /* Running slots by pid; 0 marks an empty entry. */
+    pid_t*		pidKey;
+    QI_Index*		pidSlot;
+    size_t		pidTabLen;
+
+    QI_Queue		ready;
+    QI_Queue		run;
+} MachineList;
+
+#define ML_HOST(ms, s)		(&(ms)->hosts[(ms)->host[s]])
+#define ML_NAME(ms, s)		(ML_HOST(ms, s)->name)
+
+MachineList*
+ML_Create(void);
+
+QI_Index
+ML_AddHost(MachineList* ms, const char* name);
+
+QI_Index
+ML_AddSlot(MachineList* ms, QI_Index host);
+
+void
+ML_DropHost(MachineList* ms, QI_Index host);
+
+void
+ML_ParkSlot(MachineList* ms, QI_Index slot);
+
+void
+ML_UnparkSlot(MachineList* ms, QI_Index slot);
+
+void
+ML_ReleaseSlot(MachineList* ms, QI_Index slot);
+
+void
+ML_Resize(MachineList* ms, QI_Index host, size_t want);
+
+void
+ML_Reconcile(MachineList* ms, const MachineList* next);
+
+void
+ML_MapPid(MachineList* ms, pid_t pid, QI_Index slot);
+
+QI_Index
+ML_UnmapPid(MachineList* ms, pid_t pid);
+
+void
+ML_Destroy(MachineList* ms);
+
+int
+ML_ParseSize(const char* s, uint64_t* kb);
+
+MachineList*
+ParseMachineFile(FILE* mff, char* err, size_t errLen);
+
+#endif /* !defined MACHINE_LIST_H */
@@ -0,0 +1,506 @@
+/* Ordered output. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "order.h"
+
+#define ORD_COPY_BUF	65536
+
+/* ORD_Init --
+ *
+ * Synopsis:
+ *
+ *    Start ordered output to 'fd' of ranks 0 to rankCnt-1, holding at
+ *    most 'budget' bytes in memory.
+ */
+
+void
+ORD_Init(ORD_Control* oc, int fd, size_t rankCnt, size_t budget)
+{
+    oc->fd = fd;
+    oc->out = (ORD_Out) NULL;
+    oc->outArg = NULL;
+    oc->next = 0;
+    oc->rankCnt = rankCnt;
+    oc->finished = (unsigned char*) calloc(ORD_WINDOW / 8, 1);
+    /*FIXME: Out of memory */
+    oc->base = 0;
+    oc->winBits = ORD_WINDOW;
+    oc->skip = (const JNL_RankSet*) NULL;
+    oc->budget = budget;
+    oc->inMem = 0;
+    oc->held = (ORD_Held*) NULL;
+    oc->heldCnt = 0;
+    oc->heldLen = 0;
+    oc->spillFd = -1;
+    oc->spillEnd = 0;
+    oc->extentCnt = 0;
+}
+
+/* ord_output --
+ *
+ * Synopsis:
+ *
+ *    Write all of a buffer to the output, retrying short writes, or
+ *    pass it to the output function.
+ */
+
+static int
+ord_output(ORD_Control* oc, const char* p, size_t n)
+{
+    int		fd = oc->fd;
+
+    if (oc->out != NULL) {
+	if (n > 0) {
+	    oc->out(oc->outArg, fd, p, n);
+	}
+	return 0;
+    }
+    while (n > 0) {
+	ssize_t	w = write(fd, p, n);
+	if (w < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    return -1;
+	}
+	p += w;
+	n -= (size_t) w;
+    }
+    return 0;
+}
+
+/* ord_home --
+ *
+ * Synopsis:
+ *
+ *    Home position of a rank in the held table.
+ */
+
+static size_t
+ord_home(const ORD_Control* oc, size_t rank)
+{
+    return (size_t) (((unsigned long long) rank * 0x9e3779b97f4a7c15ULL) >> 17)
+	& (oc->heldLen - 1);
+}
+
+/* ord_find --
+ *
+ * Synopsis:
+ *
+ *    The entry for 'rank', or the free entry where it belongs.
+ */
+
+static size_t
+ord_find(const ORD_Control* oc, size_t rank)
+{
+    size_t	i = ord_home(oc, rank);
+
+    while (oc->held[i].rank != ORD_NIL && oc->held[i].rank != rank) {
+	i = (i + 1) & (oc->heldLen - 1);
+    }
+    return i;
+}
+
+/* ord_get --
+ *
+ * Synopsis:
+ *
+ *    The held output of 'rank', created empty if there is none.
+ */
+
+static ORD_Held*
+ord_get(ORD_Control* oc, size_t rank)
+{
+    ORD_Held*	h;
+    size_t	i;
+
+    if (2 * (oc->heldCnt + 1) > oc->heldLen) {
+	ORD_Held*	old = oc->held;
+	size_t		oldLen = oc->heldLen;
+
+	oc->heldLen = oldLen ? 2 * oldLen : 64;
+	oc->held = (ORD_Held*) malloc(oc->heldLen * sizeof(ORD_Held));
+	/*FIXME: Out of memory */
+	for (i = 0;  i < oc->heldLen;  ++i) {
+	    oc->held[i].rank = ORD_NIL;
+	}
+	for (i = 0;  i < oldLen;  ++i) {
+	    if (old[i].rank != ORD_NIL) {
+		oc->held[ord_find(oc, old[i].rank)] = old[i];
+	    }
+	}
+	free(old);
+    }
+
+    i = ord_find(oc, rank);
+    h = &oc->held[i];
+    if (h->rank == ORD_NIL) {
+	h->rank = rank;
+	h->mem = (char*) NULL;
+	h->memLen = h->memMax = 0;
+	h->spill = h->spillTail = (ORD_Extent*) NULL;
+	oc->heldCnt++;
+    }
+    return h;
+}
+
+/* ord_remove --
+ *
+ * Synopsis:
+ *
+ *    Free entry 'i' of the held table, shifting back the entries
+ *    displaced past it.
+ */
+
+static void
+ord_remove(ORD_Control* oc, size_t i)
+{
+    size_t	j = i;
+    size_t	mask = oc->heldLen - 1;
+
+    oc->held[i].rank = ORD_NIL;
+    oc->heldCnt--;
+    for (;;) {
+	size_t	home;
+
+	j = (j + 1) & mask;
+	if (oc->held[j].rank == ORD_NIL) {
+	    return;
+	}
+	home = ord_home(oc, oc->held[j].rank);
+	if (((j - home) & mask) >= ((j - i) & mask)) {
+	    oc->held[i] = oc->held[j];
+	    oc->held[j].rank = ORD_NIL;
+	    i = j;
+	}
+    }
+}
+
+/* ord_spill --
+ *
+ * Synopsis:
+ *
+ *    Move the held memory of 'h', followed by 'n' more bytes, to the
+ *    end of the spill file.  If the spill file cannot be written, the
+ *    output is written out of order rather than lost.
+ */
+
+static void
+ord_spill(ORD_Control* oc, ORD_Held* h, const char* p, size_t n)
+{
+    ORD_Extent*	e;
+
+    if (oc->spillFd < 0) {
+	FILE*	tf = tmpfile();
+	if (tf != NULL) {
+	    oc->spillFd = dup(fileno(tf));
+	    fclose(tf);
+	    if (oc->spillFd >= 0) {
+		fcntl(oc->spillFd, F_SETFD, FD_CLOEXEC);
+	    }
+	}
+    }
+    if (oc->spillFd < 0
+	|| pwrite(oc->spillFd, h->mem, h->memLen, oc->spillEnd) != (ssize_t) h->memLen
+	|| pwrite(oc->spillFd, p, n, oc->spillEnd + h->memLen) != (ssize_t) n) {
+	ord_output(oc, h->mem, h->memLen);
+	ord_output(oc, p, n);
+    } else {
+	e = (ORD_Extent*) malloc(sizeof(ORD_Extent));
+	/*FIXME: Out of memory */
+	e->off = oc->spillEnd;
+	e->len = h->memLen + n;
+	e->next = (ORD_Extent*) NULL;
+	if (h->spillTail == NULL) {
+	    h->spill = e;
+	} else {
+	    h->spillTail->next = e;
+	}
+	h->spillTail = e;
+	oc->spillEnd += (off_t) e->len;
+	oc->extentCnt++;
+    }
+    oc->inMem -= h->memLen;
+    free(h->mem);
+    h->mem = (char*) NULL;
+    h->memLen = h->memMax = 0;
+}
+
+/* ord_emit --
+ *
+ * Synopsis:
+ *
+ *    Write out and forget the held output of 'rank', if any.
+ */
+
+static void
+ord_emit(ORD_Control* oc, size_t rank)
+{
+    ORD_Held*	h;
+    ORD_Extent*	e;
+    size_t	i;
+
+    if (oc->heldCnt == 0) {
+	return;
+    }
+    i = ord_find(oc, rank);
+    h = &oc->held[i];
+    if (h->rank == ORD_NIL) {
+	return;
+    }
+
+    if (h->spill != NULL) {
+	char*	buf = (char*) malloc(ORD_COPY_BUF);
+	/*FIXME: Out of memory */
+	while ((e = h->spill) != NULL) {
+	    off_t	off = e->off;
+	    size_t	left = e->len;
+
+	    while (left > 0) {
+		ssize_t	r = pread(oc->spillFd, buf,
+				  left < ORD_COPY_BUF ? left : ORD_COPY_BUF, off);
+		if (r <= 0) {
+		    break;
+		}
+		ord_output(oc, buf, (size_t) r);
+		off += r;
+		left -= (size_t) r;
+	    }
+	    h->spill = e->next;
+	    free(e);
+	    oc->extentCnt--;
+	}
+	free(buf);
+	if (oc->extentCnt == 0) {
+	    /* Nothing held is in the spill file; start it over. */
+	    if (ftruncate(oc->spillFd, 0) == 0) {
+		oc->spillEnd = 0;
+	    }
+	}
+    }
+    ord_output(oc, h->mem, h->memLen);
+    oc->inMem -= h->memLen;
+    free(h->mem);
+    ord_remove(oc, i);
+}
+
+/* ORD_Write --
+ *
+ * Synopsis:
+ *
+ *    Output 'n' bytes from process 'rank': now, if it is the head, or
+ *    else when its turn comes.
+ */
+
+void
+ORD_Write(ORD_Control* oc, size_t rank, const char* p, size_t n)
+{
+    ORD_Held*	h;
+
+    if (n == 0) {
+	return;
+    }
+    if (rank == oc->next || rank >= oc->rankCnt) {
+	ord_output(oc, p, n);
+	return;
+    }
+    h = ord_get(oc, rank);
+    if (oc->inMem + n > oc->budget) {
+	ord_spill(oc, h, p, n);
+	return;
+    }
+    if (h->memLen + n > h->memMax) {
+	size_t	m = h->memMax ? h->memMax : 1024;
+	while (m < h->memLen + n) {
+	    m *= 2;
+	}
+	h->mem = (char*) realloc(h->mem, m);
+	/*FIXME: Out of memory */
+	h->memMax = m;
+    }
+    memcpy(h->mem + h->memLen, p, n);
+    h->memLen += n;
+    oc->inMem += n;
+}
+
+/* ORD_Finished --
+ *
+ * Synopsis:
+ *
+ *    True iff 'rank' has been finished.
+ */
+
+int
+ORD_Finished(const ORD_Control* oc, size_t rank)
+{
+    size_t	bit = rank - oc->base;
+
+    if (rank >= oc->rankCnt || rank < oc->next) {
+	return 1;
+    }
+    if (bit < oc->winBits && (oc->finished[bit >> 3] & (1 << (bit & 7))) != 0) {
+	return 1;
+    }
+    return oc->skip != NULL && JNL_RankDone(oc->skip, rank);
+}
+
+/* ord_mark --
+ *
+ * Synopsis:
+ *
+ *    Mark 'rank', at or after the head, finished.  If it is past the
+ *    window, the window first moves up to the head, and then grows
+ *    until it holds the rank.
+ */
+
+static void
+ord_mark(ORD_Control* oc, size_t rank)
+{
+    size_t	bit = rank - oc->base;
+
+    if (bit >= oc->winBits) {
+	size_t	drop = (oc->next - oc->base) / 8;
+	size_t	len = oc->winBits / 8;
+
+	if (drop >= len) {
+	    /* The head skipped past the whole window. */
+	    memset(oc->finished, 0, len);
+	    oc->base += 8 * drop;
+	    bit = rank - oc->base;
+	} else if (drop > 0) {
+	    memmove(oc->finished, oc->finished + drop, len - drop);
+	    memset(oc->finished + len - drop, 0, drop);
+	    oc->base += 8 * drop;
+	    bit = rank - oc->base;
+	}
+	while (bit >= oc->winBits) {
+	    len = oc->winBits / 8;
+	    oc->finished = (unsigned char*) realloc(oc->finished, 2 * len);
+	    /*FIXME: Out of memory */
+	    memset(oc->finished + len, 0, len);
+	    oc->winBits *= 2;
+	}
+    }
+    oc->finished[bit >> 3] |= 1 << (bit & 7);
+}
+
+/* ord_advance --
+ *
+ * Synopsis:
+ *
+ *    Move the head past the ranks that have finished, a run of
+ *    skipped ranks at a time, writing out the held output of each
+ *    rank it passes, up to and including the new head.
+ */
+
+static void
+ord_advance(ORD_Control* oc)
+{
+    while (oc->next < oc->rankCnt) {
+	size_t	bit = oc->next - oc->base;
+	size_t	k;
+
+	if (bit < oc->winBits && (oc->finished[bit >> 3] & (1 << (bit & 7))) != 0) {
+	    oc->next++;
+	} else if (oc->skip != NULL && oc->skip->runCnt > 0
+		   && (k = JNL_Find(oc->skip, oc->next)) != (size_t) -1) {
+	    oc->next = oc->skip->runs[k].hi;
+	    if (oc->next > oc->rankCnt) {
+		oc->next = oc->rankCnt;
+	    }
+	} else {
+	    break;
+	}
+	if (oc->next < oc->rankCnt) {
+	    ord_emit(oc, oc->next);
+	}
+    }
+}
+
+/* ORD_Skip --
+ *
+ * Synopsis:
+ *
+ *    Finish every rank in 'rs', which must outlive the ordered output
+ *    and not change.  Call before any output.
+ */
+
+void
+ORD_Skip(ORD_Control* oc, const JNL_RankSet* rs)
+{
+    oc->skip = rs;
+    ord_advance(oc);
+}
+
+/* ORD_Finish --
+ *
+ * Synopsis:
+ *
+ *    Note that process 'rank' will write nothing more.  If it was the
+ *    head, write out the held output of the processes after it, up to
+ *    and including the next that has not finished, which becomes the
+ *    head.
+ */
+
+void
+ORD_Finish(ORD_Control* oc, size_t rank)
+{
+    if (ORD_Finished(oc, rank)) {
+	return;
+    }
+    ord_mark(oc, rank);
+    ord_advance(oc);
+}
+
+/* ord_compare_ranks --
+ *
+ * Synopsis:
+ *
+ *    qsort comparison of two ranks.
+ */
+
+static int
+ord_compare_ranks(const void* a, const void* b)
+{
+    size_t	ra = *(const size_t*) a;
+    size_t	rb = *(const size_t*) b;
+
+    return ra < rb ? -1 : ra > rb;
+}
+
+/* ORD_Drain --
+ *
+ * Synopsis:
+ *
+ *    Write out everything still held, in rank order, whether or not
+ *    the ranks before it finished.  For the end of a job.
+ */
+
+void
+ORD_Drain(ORD_Control* oc)
+{
+    size_t*	ranks;
+    size_t	cnt = 0;
+    size_t	i;
+
+    if (oc->heldCnt > 0) {
+	ranks = (size_t*) malloc(oc->heldCnt * sizeof(size_t));
+	/*FIXME: Out of memory */
+	for (i = 0;  i < oc->heldLen;  ++i) {
+	    if (oc->held[i].rank != ORD_NIL) {
+		ranks[cnt++] = oc->held[i].rank;
+	    }
+	}
+	qsort(ranks, cnt, sizeof(size_t), ord_compare_ranks);
+	for (i = 0;  i < cnt;  ++i) {
+	    ord_emit(oc, ranks[i]);
+	}
+	free(ranks);
+    }
+    oc->next = oc->rankCnt;
+}
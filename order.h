@@ -0,0 +1,89 @@
+/* Ordered output. */
+
+#ifndef ORDERED_OUTPUT_H
+#define ORDERED_OUTPUT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "jnl.h"
+
+/*
+ * Ordered output collects the output of processes that run, and
+ * finish, in any order, and writes it out in process number order.
+ *
+ * The output of the lowest numbered process that has not finished
+ * (the head) is written straight through.  Output of any later
+ * process is held until every process before it has finished: in
+ * memory while the total held stays within the budget, and beyond
+ * that appended to a spill file, which is emptied whenever nothing in
+ * it is still held.  Ranks that never run must be finished too, or
+ * output after them is held until ORD_Drain: those a journal shows
+ * done by handing its rank set to ORD_Skip, and blocked ones one by
+ * one.
+ *
+ * Which ranks have finished is kept for a window of ranks from about
+ * the head, not for every rank, so it takes space for how far ahead
+ * of the head processes finish, however many ranks the job has.  The
+ * head steps over a run of skipped ranks at once.
+ */
+
+#define ORD_NIL		((size_t) -1)
+#define ORD_WINDOW	4096	/* Ranks the finished window starts with. */
+
+typedef void (*ORD_Out)(void* arg, int fd, const char* p, size_t n);
+
+typedef struct ORD_Extent {
+    off_t		off;
+    size_t		len;
+    struct ORD_Extent*	next;
+} ORD_Extent;
+
+typedef struct ORD_Held {
+    size_t		rank;		/* ORD_NIL if the entry is free. */
+    char*		mem;
+    size_t		memLen;
+    size_t		memMax;
+    ORD_Extent*		spill;		/* Spilled output, oldest first. */
+    ORD_Extent*		spillTail;
+} ORD_Held;
+
+typedef struct ORD_Control {
+    int			fd;		/* Where output goes. */
+    ORD_Out		out;		/* If set, called to write to fd. */
+    void*		outArg;
+    size_t		next;		/* The head. */
+    size_t		rankCnt;
+    unsigned char*	finished;	/* Bitmap of ranks from 'base'. */
+    size_t		base;		/* A multiple of 8, at most 'next'. */
+    size_t		winBits;
+    const JNL_RankSet*	skip;		/* Finished from the start, or NULL. */
+    size_t		budget;		/* Bytes held in memory, at most. */
+    size_t		inMem;
+    ORD_Held*		held;		/* Open addressed, by rank. */
+    size_t		heldCnt;
+    size_t		heldLen;
+    int			spillFd;	/* -1 until needed. */
+    off_t		spillEnd;
+    size_t		extentCnt;
+} ORD_Control;
+
+void
+ORD_Init(ORD_Control* oc, int fd, size_t rankCnt, size_t budget);
+
+void
+ORD_Skip(ORD_Control* oc, const JNL_RankSet* rs);
+
+void
+ORD_Write(ORD_Control* oc, size_t rank, const char* p, size_t n);
+
+void
+ORD_Finish(ORD_Control* oc, size_t rank);
+
+int
+ORD_Finished(const ORD_Control* oc, size_t rank);
+
+void
+ORD_Drain(ORD_Control* oc);
+
+#endif /* !defined ORDERED_OUTPUT_H */
@@ -0,0 +1,719 @@
+/* Memory-aware placement. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pack.h"
+
+typedef struct PK_Sorted {
+    PK_Need	need;
+    size_t	proc;
+} PK_Sorted;
+
+/* PK_ParseNeed --
+ *
+ * Synopsis:
+ *
+ *    Parse what a process needs: words "mem=SIZE" and "cores=N",
+ *    separated by white space or commas.  What is not given is no
+ *    memory and one core.
+ *
+ * Returns:
+ *
+ *    0, or -1 if a word does not parse.
+ */
+
+int
+PK_ParseNeed(const char* text, PK_Need* need)
+{
+    char*	copy = strdup(text);
+    char*	save;
+    char*	w;
+    int		rc = 0;
+
+    /*FIXME: Out of memory */
+    need->mem = 0;
+    need->cores = 1;
+    for (w = strtok_r(copy, " \t\n,", &save);
+	 w != NULL;
+	 w = strtok_r(NULL, " \t\n,", &save)) {
+	char*	end;
+	long	n;
+
+	if (!strncmp(w, "mem=", 4)) {
+	    if (ML_ParseSize(w + 4, &need->mem) < 0) {
+		rc = -1;
+	    }
+	} else if (!strncmp(w, "cores=", 6)) {
+	    n = strtol(w + 6, &end, 10);
+	    if (n <= 0 || *end) {
+		rc = -1;
+	    }
+	    need->cores = (size_t) n;
+	} else {
+	    rc = -1;
+	}
+    }
+    free(copy);
+    return rc;
+}
+
+/* pk_compare_needs --
+ *
+ * Synopsis:
+ *
+ *    Order processes largest need first, the memory before the cores,
+ *    then by process number.
+ */
+
+static int
+pk_compare_needs(const void* a, const void* b)
+{
+    const PK_Sorted*	sa = (const PK_Sorted*) a;
+    const PK_Sorted*	sb = (const PK_Sorted*) b;
+
+    if (sa->need.mem != sb->need.mem) {
+	return sa->need.mem > sb->need.mem ? -1 : 1;
+    }
+    if (sa->need.cores != sb->need.cores) {
+	return sa->need.cores > sb->need.cores ? -1 : 1;
+    }
+    return sa->proc < sb->proc ? -1 : sa->proc > sb->proc;
+}
+
+/* pk_prio --
+ *
+ * Synopsis:
+ *
+ *    The treap priority of a host, a hash of its number.
+ */
+
+static uint32_t
+pk_prio(QI_Index h)
+{
+    return (uint32_t) (((uint64_t) (h + 1) * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+/* pk_less --
+ *
+ * Synopsis:
+ *
+ *    True iff host 'a' comes before host 'b' in the treap: less free
+ *    memory, then a lower number.
+ */
+
+static int
+pk_less(const PK_Pack* pk, QI_Index a, QI_Index b)
+{
+    if (pk->freeMem[a] != pk->freeMem[b]) {
+	return pk->freeMem[a] < pk->freeMem[b];
+    }
+    return a < b;
+}
+
+/* pk_update --
+ *
+ * Synopsis:
+ *
+ *    Recompute the most free cores under a node from its children.
+ */
+
+static void
+pk_update(PK_Pack* pk, QI_Index n)
+{
+    size_t	m = pk->freeCores[n];
+
+    if (pk->left[n] != QI_NIL && pk->maxCores[pk->left[n]] > m) {
+	m = pk->maxCores[pk->left[n]];
+    }
+    if (pk->right[n] != QI_NIL && pk->maxCores[pk->right[n]] > m) {
+	m = pk->maxCores[pk->right[n]];
+    }
+    pk->maxCores[n] = m;
+}
+
+/* pk_rotate_right --
+ *
+ * Synopsis:
+ *
+ *    Lift the left child of 'n' above it, and return it.
+ */
+
+static QI_Index
+pk_rotate_right(PK_Pack* pk, QI_Index n)
+{
+    QI_Index	l = pk->left[n];
+
+    pk->left[n] = pk->right[l];
+    pk->right[l] = n;
+    pk_update(pk, n);
+    pk_update(pk, l);
+    return l;
+}
+
+/* pk_rotate_left --
+ *
+ * Synopsis:
+ *
+ *    Lift the right child of 'n' above it, and return it.
+ */
+
+static QI_Index
+pk_rotate_left(PK_Pack* pk, QI_Index n)
+{
+    QI_Index	r = pk->right[n];
+
+    pk->right[n] = pk->left[r];
+    pk->left[r] = n;
+    pk_update(pk, n);
+    pk_update(pk, r);
+    return r;
+}
+
+/* pk_insert --
+ *
+ * Synopsis:
+ *
+ *    Insert host 'h' in the subtree at 'n', and return its new root.
+ */
+
+static QI_Index
+pk_insert(PK_Pack* pk, QI_Index n, QI_Index h)
+{
+    if (n == QI_NIL) {
+	pk->left[h] = pk->right[h] = QI_NIL;
+	pk_update(pk, h);
+	return h;
+    }
+    if (pk_less(pk, h, n)) {
+	pk->left[n] = pk_insert(pk, pk->left[n], h);
+	if (pk_prio(pk->left[n]) > pk_prio(n)) {
+	    return pk_rotate_right(pk, n);
+	}
+    } else {
+	pk->right[n] = pk_insert(pk, pk->right[n], h);
+	if (pk_prio(pk->right[n]) > pk_prio(n)) {
+	    return pk_rotate_left(pk, n);
+	}
+    }
+    pk_update(pk, n);
+    return n;
+}
+
+/* pk_delete --
+ *
+ * Synopsis:
+ *
+ *    Remove host 'h' from the subtree at 'n', and return its new root.
+ *    The host's key must not have changed since it was inserted.
+ */
+
+static QI_Index
+pk_delete(PK_Pack* pk, QI_Index n, QI_Index h)
+{
+    if (n == h) {
+	QI_Index	top;
+
+	if (pk->left[n] == QI_NIL) {
+	    return pk->right[n];
+	}
+	if (pk->right[n] == QI_NIL) {
+	    return pk->left[n];
+	}
+	if (pk_prio(pk->left[n]) > pk_prio(pk->right[n])) {
+	    top = pk_rotate_right(pk, n);
+	    pk->right[top] = pk_delete(pk, n, h);
+	} else {
+	    top = pk_rotate_left(pk, n);
+	    pk->left[top] = pk_delete(pk, n, h);
+	}
+	pk_update(pk, top);
+	return top;
+    }
+    if (pk_less(pk, h, n)) {
+	pk->left[n] = pk_delete(pk, pk->left[n], h);
+    } else {
+	pk->right[n] = pk_delete(pk, pk->right[n], h);
+    }
+    pk_update(pk, n);
+    return n;
+}
+
+/* pk_fit --
+ *
+ * Synopsis:
+ *
+ *    The host under 'n' with the least free memory that has at least
+ *    'mem' free and 'cores' cores free.
+ *
+ * Returns:
+ *
+ *    The host, or QI_NIL if none fits.
+ */
+
+static QI_Index
+pk_fit(const PK_Pack* pk, QI_Index n, uint64_t mem, size_t cores)
+{
+    while (n != QI_NIL && pk->maxCores[n] >= cores) {
+	QI_Index	f;
+
+	if (pk->freeMem[n] < mem) {
+	    n = pk->right[n];
+	    continue;
+	}
+	f = pk_fit(pk, pk->left[n], mem, cores);
+	if (f != QI_NIL) {
+	    return f;
+	}
+	if (pk->freeCores[n] >= cores) {
+	    return n;
+	}
+	n = pk->right[n];
+    }
+    return QI_NIL;
+}
+
+/* pk_file --
+ *
+ * Synopsis:
+ *
+ *    Work out what host 'h' has free, and put it in the treap if it
+ *    can take a process.  It must be out of the treap.
+ */
+
+static void
+pk_file(PK_Pack* pk, QI_Index h)
+{
+    const MachineHost*	mh = &pk->ms->hosts[h];
+
+    if (mh->mem == 0) {
+	pk->freeMem[h] = PK_UNLIMITED;
+    } else {
+	pk->freeMem[h] = mh->mem > pk->usedMem[h] ? mh->mem - pk->usedMem[h] : 0;
+    }
+    pk->freeCores[h] = mh->target > pk->usedCores[h] ? mh->target - pk->usedCores[h] : 0;
+    if (pk->freeSlot[h] != QI_NIL && pk->freeCores[h] > 0) {
+	pk->root = pk_insert(pk, pk->root, h);
+	pk->inTree[h] = 1;
+    }
+}
+
+/* pk_unfile --
+ *
+ * Synopsis:
+ *
+ *    Take host 'h' out of the treap, if it is there.
+ */
+
+static void
+pk_unfile(PK_Pack* pk, QI_Index h)
+{
+    if (pk->inTree[h]) {
+	pk->root = pk_delete(pk, pk->root, h);
+	pk->inTree[h] = 0;
+    }
+}
+
+/* pk_before --
+ *
+ * Synopsis:
+ *
+ *    True iff process 'a' should be placed before process 'b' of the
+ *    same class: higher priority first, then process order.
+ */
+
+static int
+pk_before(const PK_Pack* pk, size_t a, size_t b)
+{
+    if (pk->prio[a] != pk->prio[b]) {
+	return pk->prio[a] > pk->prio[b];
+    }
+    return a < b;
+}
+
+/* pk_next_waiting --
+ *
+ * Synopsis:
+ *
+ *    The first class from 'c' on with processes waiting, or classCnt.
+ */
+
+static size_t
+pk_next_waiting(const PK_Pack* pk, size_t c)
+{
+    while (c < pk->classCnt) {
+	uint64_t	w = pk->waiting[c >> 6] >> (c & 63);
+
+	if (w == 0) {
+	    c = (c | 63) + 1;
+	    continue;
+	}
+	while (!(w & 1)) {
+	    w >>= 1;
+	    ++c;
+	}
+	return c;
+    }
+    return pk->classCnt;
+}
+
+/* PK_Init --
+ *
+ * Synopsis:
+ *
+ *    Set up placement of processes 0 to procCnt-1, whose needs are
+ *    'needs', on the hosts of 'ms'.  The slots on the 'ready' queue
+ *    are taken over; see PK_Absorb.
+ */
+
+void
+PK_Init(PK_Pack* pk, MachineList* ms, const PK_Need* needs, size_t procCnt)
+{
+    PK_Sorted*	sorted;
+    size_t	i;
+
+    pk->ms = ms;
+
+    /*
+     * Sort the processes by need, and make a class of each run of
+     * equal needs.
+     */
+    sorted = (PK_Sorted*) malloc((procCnt + 1) * sizeof(PK_Sorted));
+    pk->classes = (PK_Class*) malloc((procCnt + 1) * sizeof(PK_Class));
+    pk->classOf = (uint32_t*) malloc((procCnt + 1) * sizeof(uint32_t));
+    pk->prio = (double*) malloc((procCnt + 1) * sizeof(double));
+    /*FIXME: Out of memory */
+    for (i = 0;  i < procCnt;  ++i) {
+	sorted[i].need = needs[i];
+	sorted[i].proc = i;
+    }
+    qsort(sorted, procCnt, sizeof(PK_Sorted), pk_compare_needs);
+    pk->classCnt = 0;
+    for (i = 0;  i < procCnt;  ++i) {
+	if (i == 0
+	    || sorted[i].need.mem != sorted[i-1].need.mem
+	    || sorted[i].need.cores != sorted[i-1].need.cores) {
+	    PK_Class*	cp = &pk->classes[pk->classCnt++];
+
+	    cp->need = sorted[i].need;
+	    cp->heap = (size_t*) NULL;
+	    cp->cnt = cp->max = 0;
+	}
+	pk->classOf[sorted[i].proc] = (uint32_t) (pk->classCnt - 1);
+    }
+    free(sorted);
+    pk->waiting = (uint64_t*) calloc(pk->classCnt / 64 + 1, sizeof(uint64_t));
+    /*FIXME: Out of memory */
+    pk->waitCnt = 0;
+
+    /*
+     * Every host starts with all its memory and cores free.
+     */
+    pk->usedMem = (uint64_t*) NULL;
+    pk->usedCores = (size_t*) NULL;
+    pk->freeMem = (uint64_t*) NULL;
+    pk->freeCores = (size_t*) NULL;
+    pk->freeSlot = (QI_Index*) NULL;
+    pk->left = (QI_Index*) NULL;
+    pk->right = (QI_Index*) NULL;
+    pk->maxCores = (size_t*) NULL;
+    pk->inTree = (uint8_t*) NULL;
+    pk->hostMax = 0;
+    pk->slotNext = (QI_Index*) NULL;
+    pk->held = (PK_Need*) NULL;
+    pk->slotMax = 0;
+    pk->root = QI_NIL;
+    PK_Resize(pk);
+    PK_Absorb(pk);
+}
+
+/* PK_Fits --
+ *
+ * Synopsis:
+ *
+ *    True iff some host that is up could run 'proc' when idle.  Call
+ *    this before any process is placed.
+ */
+
+int
+PK_Fits(const PK_Pack* pk, size_t proc)
+{
+    const PK_Class*	cp = &pk->classes[pk->classOf[proc]];
+
+    return pk_fit(pk, pk->root, cp->need.mem, cp->need.cores) != QI_NIL;
+}
+
+/* PK_Add --
+ *
+ * Synopsis:
+ *
+ *    Add process 'proc' to those waiting to be placed.  Of those with
+ *    the same needs, the higher 'prio' goes first.
+ */
+
+void
+PK_Add(PK_Pack* pk, size_t proc, double prio)
+{
+    uint32_t	c = pk->classOf[proc];
+    PK_Class*	cp = &pk->classes[c];
+    size_t	i;
+
+    if (cp->cnt == cp->max) {
+	cp->max = cp->max ? 2 * cp->max : 16;
+	cp->heap = (size_t*) realloc(cp->heap, cp->max * sizeof(size_t));
+	/*FIXME: Out of memory */
+    }
+    pk->prio[proc] = prio;
+    i = cp->cnt++;
+    while (i > 0 && pk_before(pk, proc, cp->heap[(i-1)/2])) {
+	cp->heap[i] = cp->heap[(i-1)/2];
+	i = (i-1)/2;
+    }
+    cp->heap[i] = proc;
+    pk->waiting[c >> 6] |= (uint64_t) 1 << (c & 63);
+    pk->waitCnt++;
+}
+
+/* PK_Absorb --
+ *
+ * Synopsis:
+ *
+ *    Take the slots on the 'ready' queue, and give back to their hosts
+ *    what the processes they ran were holding.
+ */
+
+void
+PK_Absorb(PK_Pack* pk)
+{
+    MachineList*	ms = pk->ms;
+    QI_Index		slot;
+
+    for (;;) {
+	QI_Index	h;
+
+	QI_TAKE(&ms->ready, ms->link, slot);
+	if (slot == QI_NIL) {
+	    break;
+	}
+	PK_Release(pk, slot);
+	h = ms->host[slot];
+	pk_unfile(pk, h);
+	pk->slotNext[slot] = pk->freeSlot[h];
+	pk->freeSlot[h] = slot;
+	pk_file(pk, h);
+    }
+}
+
+/* PK_Release --
+ *
+ * Synopsis:
+ *
+ *    Give back to its host what the process 'slot' ran was holding.
+ *    Call when the process finishes, before the slot is released: it
+ *    may be parked (see ML_ReleaseSlot), and then never absorbed.
+ */
+
+void
+PK_Release(PK_Pack* pk, QI_Index slot)
+{
+    QI_Index	h = pk->ms->host[slot];
+    PK_Need*	np = &pk->held[slot];
+
+    if (np->mem == 0 && np->cores == 0) {
+	return;
+    }
+    pk_unfile(pk, h);
+    pk->usedMem[h] -= np->mem;
+    pk->usedCores[h] -= np->cores;
+    np->mem = 0;
+    np->cores = 0;
+    pk_file(pk, h);
+}
+
+/* PK_Yield --
+ *
+ * Synopsis:
+ *
+ *    Put the ready slots back on the 'ready' queue, so the machine
+ *    list can be changed.  PK_Resize and PK_Absorb take them back.
+ */
+
+void
+PK_Yield(PK_Pack* pk)
+{
+    MachineList*	ms = pk->ms;
+    QI_Index		h;
+
+    for (h = 0;  h < pk->hostMax;  ++h) {
+	pk_unfile(pk, h);
+	while (pk->freeSlot[h] != QI_NIL) {
+	    QI_Index	slot = pk->freeSlot[h];
+
+	    pk->freeSlot[h] = pk->slotNext[slot];
+	    QI_ADD(&ms->ready, ms->link, slot);
+	}
+    }
+}
+
+/* PK_Resize --
+ *
+ * Synopsis:
+ *
+ *    Grow the tables for hosts and slots added to the machine list.
+ */
+
+void
+PK_Resize(PK_Pack* pk)
+{
+    MachineList*	ms = pk->ms;
+    size_t		i;
+
+    if (ms->hcnt > pk->hostMax) {
+	size_t	n = ms->hcnt + 1;
+
+	pk->usedMem = (uint64_t*) realloc(pk->usedMem, n * sizeof(uint64_t));
+	pk->usedCores = (size_t*) realloc(pk->usedCores, n * sizeof(size_t));
+	pk->freeMem = (uint64_t*) realloc(pk->freeMem, n * sizeof(uint64_t));
+	pk->freeCores = (size_t*) realloc(pk->freeCores, n * sizeof(size_t));
+	pk->freeSlot = (QI_Index*) realloc(pk->freeSlot, n * sizeof(QI_Index));
+	pk->left = (QI_Index*) realloc(pk->left, n * sizeof(QI_Index));
+	pk->right = (QI_Index*) realloc(pk->right, n * sizeof(QI_Index));
+	pk->maxCores = (size_t*) realloc(pk->maxCores, n * sizeof(size_t));
+	pk->inTree = (uint8_t*) realloc(pk->inTree, n);
+	/*FIXME: Out of memory */
+	for (i = pk->hostMax;  i < ms->hcnt;  ++i) {
+	    pk->usedMem[i] = 0;
+	    pk->usedCores[i] = 0;
+	    pk->freeSlot[i] = QI_NIL;
+	    pk->inTree[i] = 0;
+	}
+	pk->hostMax = ms->hcnt;
+    }
+    if (ms->mmax > pk->slotMax) {
+	pk->slotNext = (QI_Index*) realloc(pk->slotNext, ms->mmax * sizeof(QI_Index));
+	pk->held = (PK_Need*) realloc(pk->held, ms->mmax * sizeof(PK_Need));
+	/*FIXME: Out of memory */
+	memset(pk->held + pk->slotMax, 0, (ms->mmax - pk->slotMax) * sizeof(PK_Need));
+	pk->slotMax = ms->mmax;
+    }
+}
+
+/* PK_Take --
+ *
+ * Synopsis:
+ *
+ *    Choose a waiting process and a slot to run it on, best fit
+ *    decreasing, and set aside what the process needs.
+ *
+ * Returns:
+ *
+ *    The slot, with the process in '*proc', or QI_NIL if no waiting
+ *    process fits anywhere now.
+ */
+
+QI_Index
+PK_Take(PK_Pack* pk, size_t* proc)
+{
+    uint64_t	most;
+    size_t	lo, hi, c;
+    QI_Index	n;
+
+    if (pk->waitCnt == 0 || pk->root == QI_NIL) {
+	return QI_NIL;
+    }
+
+    /*
+     * Skip the classes that need more memory than any host has free.
+     */
+    for (n = pk->root;  pk->right[n] != QI_NIL;  n = pk->right[n])
+	;
+    most = pk->freeMem[n];
+    lo = 0;
+    hi = pk->classCnt;
+    while (lo < hi) {
+	size_t	mid = lo + (hi - lo) / 2;
+	if (pk->classes[mid].need.mem > most) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
+	}
+    }
+
+    for (c = pk_next_waiting(pk, lo);  c < pk->classCnt;  c = pk_next_waiting(pk, c + 1)) {
+	PK_Class*	cp = &pk->classes[c];
+	QI_Index	h = pk_fit(pk, pk->root, cp->need.mem, cp->need.cores);
+	QI_Index	slot;
+	size_t		last, i;
+
+	if (h == QI_NIL) {
+	    continue;
+	}
+
+	/* Take the class's foremost process. */
+	*proc = cp->heap[0];
+	last = cp->heap[--cp->cnt];
+	i = 0;
+	for (;;) {
+	    size_t	k = 2*i + 1;
+	    if (k >= cp->cnt) {
+		break;
+	    }
+	    if (k+1 < cp->cnt && pk_before(pk, cp->heap[k+1], cp->heap[k])) {
+		++k;
+	    }
+	    if (!pk_before(pk, cp->heap[k], last)) {
+		break;
+	    }
+	    cp->heap[i] = cp->heap[k];
+	    i = k;
+	}
+	cp->heap[i] = last;
+	if (cp->cnt == 0) {
+	    pk->waiting[c >> 6] &= ~((uint64_t) 1 << (c & 63));
+	}
+	pk->waitCnt--;
+
+	/* And one of the host's slots. */
+	pk_unfile(pk, h);
+	slot = pk->freeSlot[h];
+	pk->freeSlot[h] = pk->slotNext[slot];
+	pk->usedMem[h] += cp->need.mem;
+	pk->usedCores[h] += cp->need.cores;
+	pk->held[slot] = cp->need;
+	pk_file(pk, h);
+	return slot;
+    }
+    return QI_NIL;
+}
+
+/* PK_Destroy --
+ *
+ * Synopsis:
+ *
+ *    Free the placement tables.
+ */
+
+void
+PK_Destroy(PK_Pack* pk)
+{
+    size_t	c;
+
+    for (c = 0;  c < pk->classCnt;  ++c) {
+	free(pk->classes[c].heap);
+    }
+    free(pk->classes);
+    free(pk->classOf);
+    free(pk->prio);
+    free(pk->waiting);
+    free(pk->usedMem);
+    free(pk->usedCores);
+    free(pk->freeMem);
+    free(pk->freeCores);
+    free(pk->freeSlot);
+    free(pk->left);
+    free(pk->right);
+    free(pk->maxCores);
+    free(pk->inTree);
+    free(pk->slotNext);
+    free(pk->held);
+}
@@ -0,0 +1,112 @@
+/* Memory-aware placement. */
+
+#ifndef MEMORY_PACK_H
+#define MEMORY_PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "qi.h"
+#include "ml.h"
+
+/*
+ * With -need, or when a task graph says what its tasks need, each
+ * process needs some memory and some cores of the host it runs on,
+ * written as "mem=SIZE cores=N" (SIZE as in the machine file; cores
+ * defaults to 1).  A host has as many cores as slots, and the memory
+ * its machine file lines give, and runs processes only while their
+ * needs fit in what it has.  Its cores follow its target (see ml.h),
+ * so a host drained by reloading the machine list takes nothing more.
+ *
+ * Processes are placed best fit decreasing.  Those with the same
+ * needs form a class, and classes are tried largest first, the memory
+ * before the cores.  The class's foremost process goes to the host
+ * that fits it with the least memory to spare.  Processes of a class
+ * that fits nowhere wait, while those of smaller classes fill in
+ * around them.
+ *
+ * Deciding takes a binary search over the classes, a scan of a bitmap
+ * of those with processes waiting, and a search of a treap of the
+ * hosts that have a core free, keyed by free memory and kept with the
+ * most free cores under each node; so it is cheap however many
+ * processes are waiting.  Hosts a machine file gives no memory sort
+ * after all the others.
+ */
+
+#define PK_UNLIMITED	UINT64_MAX
+
+typedef struct PK_Need {
+    uint64_t	mem;		/* kB. */
+    size_t	cores;
+} PK_Need;
+
+typedef struct PK_Class {
+    PK_Need	need;
+    size_t*	heap;		/* Its waiting processes, by priority. */
+    size_t	cnt;
+    size_t	max;
+} PK_Class;
+
+typedef struct PK_Pack {
+    MachineList*	ms;
+
+    /* Classes, largest first, and each process's. */
+    PK_Class*		classes;
+    size_t		classCnt;
+    uint32_t*		classOf;
+    double*		prio;		/* By process; higher first. */
+    uint64_t*		waiting;	/* Bitmap of classes with processes. */
+    size_t		waitCnt;
+
+    /* By host. */
+    uint64_t*		usedMem;	/* kB. */
+    size_t*		usedCores;
+    uint64_t*		freeMem;	/* kB, or PK_UNLIMITED; the treap key. */
+    size_t*		freeCores;
+    QI_Index*		freeSlot;	/* Its ready slots, a stack. */
+    size_t		hostMax;
+
+    /* By slot. */
+    QI_Index*		slotNext;	/* In freeSlot. */
+    PK_Need*		held;		/* By the process it runs. */
+    size_t		slotMax;
+
+    /* The treap of hosts with a core free. */
+    QI_Index		root;
+    QI_Index*		left;
+    QI_Index*		right;
+    size_t*		maxCores;	/* Most free cores in the subtree. */
+    uint8_t*		inTree;
+} PK_Pack;
+
+int
+PK_ParseNeed(const char* text, PK_Need* need);
+
+void
+PK_Init(PK_Pack* pk, MachineList* ms, const PK_Need* needs, size_t procCnt);
+
+int
+PK_Fits(const PK_Pack* pk, size_t proc);
+
+void
+PK_Add(PK_Pack* pk, size_t proc, double prio);
+
+void
+PK_Absorb(PK_Pack* pk);
+
+void
+PK_Release(PK_Pack* pk, QI_Index slot);
+
+void
+PK_Yield(PK_Pack* pk);
+
+void
+PK_Resize(PK_Pack* pk);
+
+QI_Index
+PK_Take(PK_Pack* pk, size_t* proc);
+
+void
+PK_Destroy(PK_Pack* pk);
+
+#endif /* !defined MEMORY_PACK_H */
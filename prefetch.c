@@ -0,0 +1,140 @@
+/* Input prefetch. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include "prefetch.h"
+
+/* pf_worker --
+ *
+ * Synopsis:
+ *
+ *    A prefetch thread: take the oldest path, and have the kernel
+ *    start reading the file.  Signals are left to the main thread.
+ */
+
+static void*
+pf_worker(void* arg)
+{
+    PF_Prefetcher*	pf = (PF_Prefetcher*) arg;
+    sigset_t		all;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, (sigset_t*) NULL);
+
+    pthread_mutex_lock(&pf->lock);
+    for (;;) {
+	char*	path;
+	int	fd;
+
+	while (pf->cnt == 0 && !pf->stopping) {
+	    pthread_cond_wait(&pf->work, &pf->lock);
+	}
+	if (pf->stopping) {
+	    break;
+	}
+	path = pf->ring[pf->head];
+	pf->head = (pf->head + 1) % PF_RING;
+	pf->cnt--;
+	pthread_mutex_unlock(&pf->lock);
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+	    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	    close(fd);
+	}
+	free(path);
+
+	pthread_mutex_lock(&pf->lock);
+    }
+    pthread_mutex_unlock(&pf->lock);
+    return NULL;
+}
+
+/* PF_Create --
+ *
+ * Synopsis:
+ *
+ *    Make a prefetcher and start its threads.
+ *
+ * Returns:
+ *
+ *    The prefetcher, or NULL if no thread could be started.
+ */
+
+PF_Prefetcher*
+PF_Create(void)
+{
+    PF_Prefetcher*	pf;
+    int			i;
+
+    pf = (PF_Prefetcher*) calloc(1, sizeof(PF_Prefetcher));
+    /*FIXME: Out of memory */
+    pthread_mutex_init(&pf->lock, (pthread_mutexattr_t*) NULL);
+    pthread_cond_init(&pf->work, (pthread_condattr_t*) NULL);
+    for (i = 0;  i < PF_THREADS;  ++i) {
+	if (pthread_create(&pf->threads[i], (pthread_attr_t*) NULL,
+			   pf_worker, pf) != 0) {
+	    break;
+	}
+	pf->threadCnt++;
+    }
+    if (pf->threadCnt == 0) {
+	PF_Destroy(pf);
+	return (PF_Prefetcher*) NULL;
+    }
+    return pf;
+}
+
+/* PF_Hint --
+ *
+ * Synopsis:
+ *
+ *    Queue 'path', from malloc, to be read ahead; the prefetcher
+ *    frees it.  Never waits.
+ */
+
+void
+PF_Hint(PF_Prefetcher* pf, char* path)
+{
+    pthread_mutex_lock(&pf->lock);
+    if (pf->cnt == PF_RING) {
+	pthread_mutex_unlock(&pf->lock);
+	free(path);
+	return;
+    }
+    pf->ring[(pf->head + pf->cnt++) % PF_RING] = path;
+    pthread_cond_signal(&pf->work);
+    pthread_mutex_unlock(&pf->lock);
+}
+
+/* PF_Destroy --
+ *
+ * Synopsis:
+ *
+ *    Stop the threads and free the prefetcher, dropping the hints
+ *    not yet acted on.
+ */
+
+void
+PF_Destroy(PF_Prefetcher* pf)
+{
+    int		i;
+
+    pthread_mutex_lock(&pf->lock);
+    pf->stopping = 1;
+    pthread_cond_broadcast(&pf->work);
+    pthread_mutex_unlock(&pf->lock);
+    for (i = 0;  i < pf->threadCnt;  ++i) {
+	pthread_join(pf->threads[i], (void**) NULL);
+    }
+    for (;  pf->cnt > 0;  pf->cnt--, pf->head = (pf->head + 1) % PF_RING) {
+	free(pf->ring[pf->head]);
+    }
+    pthread_mutex_destroy(&pf->lock);
+    pthread_cond_destroy(&pf->work);
+    free(pf);
+}
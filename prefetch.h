@@ -0,0 +1,47 @@
+/* Input prefetch. */
+
+#ifndef INPUT_PREFETCH_H
+#define INPUT_PREFETCH_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+ * With -prefetch N, the coordinator looks N processes ahead in the
+ * dispatch order.  It hands the rendered -stdin path of each of them
+ * to the prefetcher, which asks the kernel to start reading the file
+ * (posix_fadvise WILLNEED).  When the process starts, its input is
+ * then in the page cache, whether the process reads it itself or
+ * through the spawn command.  The page cache is the buffer pool, and
+ * N bounds how much of it the prefetch claims.
+ *
+ * Opening a file on a shared file system can itself stall, so the
+ * hints are acted on by a few threads.  PF_Hint never blocks.  If
+ * PF_RING hints are already waiting, it drops the new one; prefetch
+ * is only ever advice.
+ */
+
+#define PF_THREADS	2
+#define PF_RING		256
+
+typedef struct PF_Prefetcher {
+    char*		ring[PF_RING];	/* Paths waiting. */
+    size_t		head;
+    size_t		cnt;
+    pthread_mutex_t	lock;
+    pthread_cond_t	work;
+    pthread_t		threads[PF_THREADS];
+    int			threadCnt;
+    int			stopping;
+} PF_Prefetcher;
+
+PF_Prefetcher*
+PF_Create(void);
+
+void
+PF_Hint(PF_Prefetcher* pf, char* path);
+
+void
+PF_Destroy(PF_Prefetcher* pf);
+
+#endif /* !defined INPUT_PREFETCH_H */
@@ -0,0 +1,290 @@
+/* Coordinator profile. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#include "prof.h"
+
+#define PRF_COUNTERS	3	/* Cycles, page faults, context switches. */
+
+int PRF_Active;
+
+static const char* prfNames[prf_pCount] = {
+    "config script",
+    "machine list",
+    "setup",
+    "probe",
+    "stage",
+    "dispatch",
+    "render",
+    "fork",
+    "wait",
+    "reap",
+    "finish"
+};
+
+static struct {
+    pthread_t	owner;
+    PRF_Phase	phase;
+    double	since;
+    uint64_t	counts[PRF_COUNTERS];	/* At 'since'. */
+    int		fd[PRF_COUNTERS];	/* -1 if not counted. */
+    int		slot[PRF_COUNTERS];	/* In a group read. */
+    int		leader;
+    int		nr;			/* Counters in the group. */
+    double	seconds[prf_pCount];
+    size_t	entries[prf_pCount];
+    uint64_t	total[prf_pCount][PRF_COUNTERS];
+} prf;
+
+/* prf_now --
+ *
+ * Synopsis:
+ *
+ *    Seconds on the monotonic clock.
+ */
+
+static double
+prf_now(void)
+{
+    struct timespec	ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+
+/* prf_open --
+ *
+ * Synopsis:
+ *
+ *    Open a counter of this thread, in the group led by 'group' (or
+ *    leading one, if -1).  Kernel time is left out if the kernel
+ *    only allows that.
+ *
+ * Returns:
+ *
+ *    The counter's descriptor, or -1.
+ */
+
+static int
+prf_open(uint32_t type, uint64_t config, int group)
+{
+    struct perf_event_attr	pea;
+    int				fd;
+
+    memset(&pea, 0, sizeof(pea));
+    pea.size = sizeof(pea);
+    pea.type = type;
+    pea.config = config;
+    pea.read_format = PERF_FORMAT_GROUP;
+    pea.exclude_hv = 1;
+    fd = (int) syscall(SYS_perf_event_open, &pea, 0, -1, group,
+		       PERF_FLAG_FD_CLOEXEC);
+    if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+	pea.exclude_kernel = 1;
+	fd = (int) syscall(SYS_perf_event_open, &pea, 0, -1, group,
+			   PERF_FLAG_FD_CLOEXEC);
+    }
+    return fd;
+}
+
+#endif /* HAVE_LINUX_PERF_EVENT_H */
+
+/* prf_read --
+ *
+ * Synopsis:
+ *
+ *    Read the counters into 'v', in one read of the group.
+ */
+
+static void
+prf_read(uint64_t* v)
+{
+    uint64_t	buf[1 + PRF_COUNTERS];
+    int		i;
+
+    if (prf.leader < 0
+	|| read(prf.leader, buf, (1 + prf.nr) * sizeof(uint64_t)) < 0) {
+	return;
+    }
+    for (i = 0;  i < PRF_COUNTERS;  ++i) {
+	if (prf.fd[i] >= 0) {
+	    v[i] = buf[1 + prf.slot[i]];
+	}
+    }
+}
+
+/* PRF_Start --
+ *
+ * Synopsis:
+ *
+ *    Start profiling, in 'phase', from this thread.
+ */
+
+void
+PRF_Start(PRF_Phase phase)
+{
+    int		i;
+
+    prf.leader = -1;
+    for (i = 0;  i < PRF_COUNTERS;  ++i) {
+	prf.fd[i] = -1;
+    }
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    {
+	static const uint32_t	types[PRF_COUNTERS] = {
+	    PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE, PERF_TYPE_SOFTWARE
+	};
+	static const uint64_t	configs[PRF_COUNTERS] = {
+	    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_SW_PAGE_FAULTS,
+	    PERF_COUNT_SW_CONTEXT_SWITCHES
+	};
+
+	for (i = 0;  i < PRF_COUNTERS;  ++i) {
+	    prf.fd[i] = prf_open(types[i], configs[i], prf.leader);
+	    if (prf.fd[i] >= 0) {
+		if (prf.leader < 0) {
+		    prf.leader = prf.fd[i];
+		}
+		prf.slot[i] = prf.nr++;
+	    }
+	}
+    }
+#endif
+    prf.owner = pthread_self();
+    prf.phase = phase;
+    prf.since = prf_now();
+    prf.entries[phase]++;
+    prf_read(prf.counts);
+    PRF_Active = 1;
+}
+
+/* prf_flush --
+ *
+ * Synopsis:
+ *
+ *    Charge the time and counts since the last switch to the phase
+ *    the profile is in.
+ */
+
+static void
+prf_flush(void)
+{
+    uint64_t	v[PRF_COUNTERS];
+    double	now = prf_now();
+    int		i;
+
+    memcpy(v, prf.counts, sizeof(v));
+    prf_read(v);
+    prf.seconds[prf.phase] += now - prf.since;
+    for (i = 0;  i < PRF_COUNTERS;  ++i) {
+	prf.total[prf.phase][i] += v[i] - prf.counts[i];
+    }
+    memcpy(prf.counts, v, sizeof(v));
+    prf.since = now;
+}
+
+/* PRF_Switch --
+ *
+ * Synopsis:
+ *
+ *    Leave the phase the profile is in for 'phase'.  Use PRF_SWITCH.
+ *
+ * Returns:
+ *
+ *    The phase left.
+ */
+
+PRF_Phase
+PRF_Switch(PRF_Phase phase)
+{
+    PRF_Phase	left;
+
+    if (!pthread_equal(pthread_self(), prf.owner)) {
+	return phase;
+    }
+    left = prf.phase;
+    if (phase == left) {
+	return left;
+    }
+    prf_flush();
+    prf.phase = phase;
+    prf.entries[phase]++;
+    return left;
+}
+
+/* PRF_Charge --
+ *
+ * Synopsis:
+ *
+ *    Charge 'seconds', measured before the profile started, to
+ *    'phase'.
+ */
+
+void
+PRF_Charge(PRF_Phase phase, double seconds)
+{
+    prf.seconds[phase] += seconds;
+    prf.entries[phase]++;
+}
+
+/* PRF_Report --
+ *
+ * Synopsis:
+ *
+ *    Print the time, entries and counts of each phase entered, and
+ *    stop profiling.  A count shows as "-" if it was not counted.
+ */
+
+void
+PRF_Report(FILE* fp, const char* progname)
+{
+    static const char*	heads[PRF_COUNTERS] = {
+	"cycles", "faults", "switches"
+    };
+    double	total = 0.0;
+    int		p, i;
+
+    prf_flush();
+    PRF_Active = 0;
+    for (p = 0;  p < prf_pCount;  ++p) {
+	total += prf.seconds[p];
+    }
+    fprintf(fp, "%s: profile, %.6fs\n", progname, total);
+    fprintf(fp, "  %-14s %12s %6s %10s", "phase", "seconds", "%", "entries");
+    for (i = 0;  i < PRF_COUNTERS;  ++i) {
+	fprintf(fp, " %14s", heads[i]);
+    }
+    fprintf(fp, "\n");
+    for (p = 0;  p < prf_pCount;  ++p) {
+	if (prf.entries[p] == 0) {
+	    continue;
+	}
+	fprintf(fp, "  %-14s %12.6f %6.1f %10lu", prfNames[p], prf.seconds[p],
+		total > 0.0 ? 100.0 * prf.seconds[p] / total : 0.0,
+		(unsigned long) prf.entries[p]);
+	for (i = 0;  i < PRF_COUNTERS;  ++i) {
+	    if (prf.fd[i] < 0 || p == prf_pConfig) {
+		fprintf(fp, " %14s", "-");
+	    } else {
+		fprintf(fp, " %14llu", (unsigned long long) prf.total[p][i]);
+	    }
+	}
+	fprintf(fp, "\n");
+    }
+    for (i = 0;  i < PRF_COUNTERS;  ++i) {
+	if (prf.fd[i] >= 0) {
+	    close(prf.fd[i]);
+	}
+    }
+}
@@ -0,0 +1,57 @@
+/* Coordinator profile. */
+
+#ifndef COORDINATOR_PROFILE_H
+#define COORDINATOR_PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * With -profile, the coordinator's time is charged to the phase it is
+ * in, on the monotonic clock, and where the kernel allows it so are
+ * its CPU cycles, page faults and context switches (perf_event_open,
+ * counting this thread only).  At exit, a line is printed for each
+ * phase.
+ *
+ * Code moves between phases with PRF_SWITCH, which returns the phase
+ * it left, so a callee can put it back.  Unless -profile is given,
+ * PRF_SWITCH is a test of PRF_Active and nothing more.  Switches from
+ * other threads than the one that started the profile are ignored, so
+ * with -shards the threads' work is inside the main thread's wait.
+ *
+ * The configuration script runs before the command line is read, so
+ * its time is charged afterwards (PRF_Charge), without counters.
+ */
+
+typedef enum PRF_Phase {
+    prf_pConfig,	/* Configuration script. */
+    prf_pMachines,	/* Machine script or file. */
+    prf_pSetup,		/* Everything else before the job starts. */
+    prf_pProbe,
+    prf_pStage,
+    prf_pDispatch,	/* SpawnJob, less what follows. */
+    prf_pRender,	/* Templates, in SpawnProcess. */
+    prf_pFork,
+    prf_pWait,		/* Blocked in WaitOnMachines. */
+    prf_pReap,		/* Recording an exit. */
+    prf_pFinish,	/* After the job. */
+    prf_pCount
+} PRF_Phase;
+
+extern int PRF_Active;
+
+#define PRF_SWITCH(p) (PRF_Active ? PRF_Switch(p) : (p))
+
+void
+PRF_Start(PRF_Phase phase);
+
+PRF_Phase
+PRF_Switch(PRF_Phase phase);
+
+void
+PRF_Charge(PRF_Phase phase, double seconds);
+
+void
+PRF_Report(FILE* fp, const char* progname);
+
+#endif /* !defined COORDINATOR_PROFILE_H */
@@ -0,0 +1,127 @@
+/* Queued Indices. */
+
+#ifndef QUEUED_INDICES_H
+#define QUEUED_INDICES_H
+
+#include <stdint.h>
+#include <assert.h>
+
+
+/*
+ * Array-backed queue operations.
+ *
+ * These are the queues of qo.h for objects that live in arrays: an
+ * object is named by its 32-bit index, and its linkage is an element
+ * of a QI_Link array indexed the same way.  Compared with pointer
+ * linkages, the links are half the size and packed together, so
+ * walking or moving between queues touches few cache lines.
+ *
+ * A QI_Queue is the control block.  Make sure to call QI_QUEUE_INIT
+ * when the owning object is initialized.  Queues whose membership is
+ * exclusive (an object is on at most one of them at a time) may share
+ * one link array.
+ *
+ * Normally objects are removed from the QI_HEAD and added to the
+ * tail.  To traverse a queue, use QI_NEXT to move from head to tail,
+ * and QI_PREV to move from tail to head; QI_NIL ends the chain.
+ *
+ * An object can be removed from the chain with QI_REMOVE.  But
+ * normally one takes an object from the head, with QI_TAKE (or
+ * QI_TAKE_HEAD).
+ */
+
+typedef uint32_t QI_Index;
+
+#define QI_NIL	((QI_Index) 0xffffffffu)
+
+typedef struct QI_Link {
+    QI_Index	q_prev;
+    QI_Index	q_next;
+} QI_Link;
+
+typedef struct QI_Queue {
+    QI_Index	q_head;
+    QI_Index	q_tail;
+} QI_Queue;
+
+#define QI_QUEUE_INIT(q) \
+    ((q)->q_head = (q)->q_tail = QI_NIL)
+
+#define QI_HEAD(q) ((q)->q_head)
+#define QI_TAIL(q) ((q)->q_tail)
+#define QI_EMPTY(q) ((q)->q_head == QI_NIL)
+
+#define QI_NEXT(lk, i) ((lk)[i].q_next)
+#define QI_PREV(lk, i) ((lk)[i].q_prev)
+
+#define QI_ADD_TAIL(q, lk, i) \
+{ \
+    QI_Index _qi = (i); \
+    (lk)[_qi].q_next = QI_NIL; \
+    (lk)[_qi].q_prev = (q)->q_tail; \
+    if ((q)->q_tail == QI_NIL) { \
+	assert((q)->q_head == QI_NIL); \
+	(q)->q_head = _qi; \
+    } else { \
+	(lk)[(q)->q_tail].q_next = _qi; \
+    } \
+    (q)->q_tail = _qi; \
+}
+
+#define QI_ADD(q, lk, i) QI_ADD_TAIL(q, lk, i)
+
+#define QI_ADD_HEAD(q, lk, i) \
+{ \
+    QI_Index _qi = (i); \
+    (lk)[_qi].q_prev = QI_NIL; \
+    (lk)[_qi].q_next = (q)->q_head; \
+    if ((q)->q_head == QI_NIL) { \
+	assert((q)->q_tail == QI_NIL); \
+	(q)->q_tail = _qi; \
+    } else { \
+	(lk)[(q)->q_head].q_prev = _qi; \
+    } \
+    (q)->q_head = _qi; \
+}
+
+#define QI_TAKE_HEAD(q, lk, iVar) \
+{ \
+    if (((iVar) = (q)->q_head) != QI_NIL) { \
+	if (((q)->q_head = (lk)[(iVar)].q_next) == QI_NIL) { \
+	    (q)->q_tail = QI_NIL; \
+	} else { \
+	    (lk)[(q)->q_head].q_prev = QI_NIL; \
+	} \
+    } \
+}
+
+#define QI_TAKE(q, lk, iVar) QI_TAKE_HEAD(q, lk, iVar)
+
+#define QI_TAKE_TAIL(q, lk, iVar) \
+{ \
+    if (((iVar) = (q)->q_tail) != QI_NIL) { \
+	if (((q)->q_tail = (lk)[(iVar)].q_prev) == QI_NIL) { \
+	    (q)->q_head = QI_NIL; \
+	} else { \
+	    (lk)[(q)->q_tail].q_next = QI_NIL; \
+	} \
+    } \
+}
+
+#define QI_REMOVE(q, lk, i) \
+{ \
+    QI_Index _qi = (i); \
+    if ((lk)[_qi].q_next == QI_NIL) { \
+	(q)->q_tail = (lk)[_qi].q_prev; \
+    } else { \
+	(lk)[(lk)[_qi].q_next].q_prev = (lk)[_qi].q_prev; \
+    } \
+    if ((lk)[_qi].q_prev == QI_NIL) { \
+	(q)->q_head = (lk)[_qi].q_next; \
+    } else { \
+	(lk)[(lk)[_qi].q_prev].q_next = (lk)[_qi].q_next; \
+    } \
+}
+
+
+#endif	/*  !defined QUEUED_INDICES_H */
@@ -0,0 +1,580 @@
+/* Result cache. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include "rcache.h"
+
+#define RC_BUF		65536
+#define RC_HEADER_MAX	128
+
+#define RC_P1	UINT64_C(0x9e3779b97f4a7c15)
+#define RC_P2	UINT64_C(0xc2b2ae3d27d4eb4f)
+
+/* rc_rotl --
+ *
+ * Synopsis:
+ *
+ *    Rotate left by 'r' bits.
+ */
+
+static uint64_t
+rc_rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+/* rc_fmix --
+ *
+ * Synopsis:
+ *
+ *    Final avalanche of a lane.
+ */
+
+static uint64_t
+rc_fmix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= UINT64_C(0xff51afd7ed558ccd);
+    x ^= x >> 33;
+    x *= UINT64_C(0xc4ceb9fe1a85ec53);
+    x ^= x >> 33;
+    return x;
+}
+
+/* rc_mix --
+ *
+ * Synopsis:
+ *
+ *    Hash 'n' bytes into the two lanes of 'k', a word at a time, and
+ *    then their count, so where one field ends and the next starts
+ *    counts too.
+ */
+
+static void
+rc_mix(RC_Key* k, const char* p, size_t n)
+{
+    uint64_t	a = k->h[0], b = k->h[1], w;
+    size_t	i;
+
+    for (i = 0;  i + 8 <= n;  i += 8) {
+	memcpy(&w, p + i, 8);
+	a = rc_rotl(a ^ (w * RC_P1), 31) * RC_P2;
+	b = rc_rotl(b ^ (w * RC_P2), 27) * RC_P1 + a;
+    }
+    if (i < n) {
+	w = 0;
+	memcpy(&w, p + i, n - i);
+	a = rc_rotl(a ^ (w * RC_P1), 31) * RC_P2;
+	b = rc_rotl(b ^ (w * RC_P2), 27) * RC_P1 + a;
+    }
+    k->h[0] = rc_fmix(a ^ n);
+    k->h[1] = rc_fmix(b + k->h[0]);
+}
+
+/* rc_mix_file --
+ *
+ * Synopsis:
+ *
+ *    Hash the contents of a file, a full buffer at a time.  Returns
+ *    0, or -1 if it cannot be read.
+ */
+
+static int
+rc_mix_file(RC_Key* k, const char* path, char* buf)
+{
+    int		fd = open(path, O_RDONLY | O_CLOEXEC);
+    size_t	len;
+    ssize_t	r;
+
+    if (fd < 0) {
+	return -1;
+    }
+    do {
+	for (len = 0;  len < RC_BUF;  len += (size_t) r) {
+	    r = read(fd, buf + len, RC_BUF - len);
+	    if (r < 0 && errno == EINTR) {
+		r = 0;
+		continue;
+	    }
+	    if (r <= 0) {
+		break;
+	    }
+	}
+	if (r < 0) {
+	    close(fd);
+	    return -1;
+	}
+	rc_mix(k, buf, len);
+    } while (len == RC_BUF);
+    close(fd);
+    return 0;
+}
+
+/* rc_path --
+ *
+ * Synopsis:
+ *
+ *    The path of the entry for 'key', to be freed by the caller.
+ */
+
+static char*
+rc_path(const RC_Cache* rc, const RC_Key* key)
+{
+    size_t	len = strlen(rc->dir) + 34;
+    char*	path = (char*) malloc(len);
+    /*FIXME: Out of memory */
+
+    snprintf(path, len, "%s/%016llx%016llx", rc->dir,
+	     (unsigned long long) key->h[0], (unsigned long long) key->h[1]);
+    return path;
+}
+
+/* rc_answer --
+ *
+ * Synopsis:
+ *
+ *    Find the key of a request, and whether it has an entry.
+ */
+
+static void
+rc_answer(RC_Cache* rc, RC_Request* rq, char* buf)
+{
+    char**	pp;
+    char*	path;
+
+    rq->key.h[0] = RC_P1;
+    rq->key.h[1] = RC_P2;
+    rc_mix(&rq->key, rq->words, rq->wordsLen);
+    rq->answer = rc_aMiss;
+    for (pp = rq->paths;  *pp != NULL;  ++pp) {
+	if (rc_mix_file(&rq->key, *pp, buf) < 0) {
+	    rq->answer = rc_aNone;
+	    break;
+	}
+    }
+    if (rq->answer == rc_aMiss) {
+	path = rc_path(rc, &rq->key);
+	if (access(path, R_OK) == 0) {
+	    rq->answer = rc_aHit;
+	}
+	free(path);
+    }
+
+    for (pp = rq->paths;  *pp != NULL;  ++pp) {
+	free(*pp);
+    }
+    free(rq->paths);
+    free(rq->words);
+}
+
+/* rc_worker --
+ *
+ * Synopsis:
+ *
+ *    A hashing thread: take the oldest request not yet taken, and
+ *    answer it.  Signals are left to the main thread.
+ */
+
+static void*
+rc_worker(void* arg)
+{
+    RC_Cache*	rc = (RC_Cache*) arg;
+    char*	buf = (char*) malloc(RC_BUF);
+    sigset_t	all;
+    /*FIXME: Out of memory */
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, (sigset_t*) NULL);
+
+    pthread_mutex_lock(&rc->lock);
+    for (;;) {
+	RC_Request*	rq;
+
+	while (rc->claimed == rc->cnt && !rc->stopping) {
+	    pthread_cond_wait(&rc->work, &rc->lock);
+	}
+	if (rc->stopping) {
+	    break;
+	}
+	rq = &rc->ring[(rc->head + rc->claimed++) % RC_WINDOW];
+	pthread_mutex_unlock(&rc->lock);
+
+	rc_answer(rc, rq, buf);
+
+	pthread_mutex_lock(&rc->lock);
+	rq->done = 1;
+	pthread_cond_broadcast(&rc->done);
+    }
+    pthread_mutex_unlock(&rc->lock);
+    free(buf);
+    return NULL;
+}
+
+/* RC_Open --
+ *
+ * Synopsis:
+ *
+ *    Open the cache in 'dir', making the directory if need be, and
+ *    start its threads.
+ *
+ * Returns:
+ *
+ *    The cache, or NULL (with errno set) if the directory cannot be
+ *    made.
+ */
+
+RC_Cache*
+RC_Open(const char* dir)
+{
+    RC_Cache*	rc;
+    int		i;
+
+    if (mkdir(dir, 0777) < 0 && errno != EEXIST) {
+	return (RC_Cache*) NULL;
+    }
+    if (access(dir, W_OK | X_OK) < 0) {
+	return (RC_Cache*) NULL;
+    }
+    rc = (RC_Cache*) calloc(1, sizeof(RC_Cache));
+    /*FIXME: Out of memory */
+    rc->dir = strdup(dir);
+    /*FIXME: Out of memory */
+    pthread_mutex_init(&rc->lock, (pthread_mutexattr_t*) NULL);
+    pthread_cond_init(&rc->work, (pthread_condattr_t*) NULL);
+    pthread_cond_init(&rc->done, (pthread_condattr_t*) NULL);
+    for (i = 0;  i < RC_THREADS;  ++i) {
+	if (pthread_create(&rc->threads[i], (pthread_attr_t*) NULL,
+			   rc_worker, rc) != 0) {
+	    break;
+	}
+	rc->threadCnt++;
+    }
+    return rc;
+}
+
+/* RC_Full --
+ *
+ * Synopsis:
+ *
+ *    True iff RC_WINDOW requests are waiting to be collected.
+ */
+
+int
+RC_Full(const RC_Cache* rc)
+{
+    return rc->cnt == RC_WINDOW;
+}
+
+/* RC_Queued --
+ *
+ * Synopsis:
+ *
+ *    True iff the oldest request is for process 'proc'.
+ */
+
+int
+RC_Queued(const RC_Cache* rc, size_t proc)
+{
+    return rc->cnt > 0 && rc->ring[rc->head].proc == proc;
+}
+
+/* RC_Oldest --
+ *
+ * Synopsis:
+ *
+ *    The process of the oldest request, or (size_t) -1 if none is
+ *    queued.
+ */
+
+size_t
+RC_Oldest(const RC_Cache* rc)
+{
+    return rc->cnt > 0 ? rc->ring[rc->head].proc : (size_t) -1;
+}
+
+/* RC_Submit --
+ *
+ * Synopsis:
+ *
+ *    Queue process 'proc' to have its key found.  The cache takes
+ *    'words', 'paths' and the strings in it, all from malloc.  There
+ *    must be room (see RC_Full).
+ */
+
+void
+RC_Submit(RC_Cache* rc, size_t proc, char* words, size_t wordsLen, char** paths)
+{
+    RC_Request*	rq;
+
+    pthread_mutex_lock(&rc->lock);
+    rq = &rc->ring[(rc->head + rc->cnt++) % RC_WINDOW];
+    rq->proc = proc;
+    rq->words = words;
+    rq->wordsLen = wordsLen;
+    rq->paths = paths;
+    rq->done = 0;
+    pthread_cond_signal(&rc->work);
+    pthread_mutex_unlock(&rc->lock);
+}
+
+/* RC_Result --
+ *
+ * Synopsis:
+ *
+ *    Collect the oldest request, which must be for 'proc', waiting
+ *    for it if need be.  Without threads, it is answered here.
+ *
+ * Returns:
+ *
+ *    Whether it has an entry, with its key in 'key'; or rc_aNone.
+ */
+
+RC_Answer
+RC_Result(RC_Cache* rc, size_t proc, RC_Key* key)
+{
+    RC_Request*	rq;
+
+    if (!RC_Queued(rc, proc)) {
+	return rc_aNone;
+    }
+    rq = &rc->ring[rc->head];
+    if (rc->threadCnt == 0) {
+	char*	buf = (char*) malloc(RC_BUF);
+	/*FIXME: Out of memory */
+	rc_answer(rc, rq, buf);
+	free(buf);
+	rq->done = 1;
+	rc->claimed++;
+    }
+    pthread_mutex_lock(&rc->lock);
+    while (!rq->done) {
+	pthread_cond_wait(&rc->done, &rc->lock);
+    }
+    rc->head = (rc->head + 1) % RC_WINDOW;
+    rc->cnt--;
+    rc->claimed--;
+    pthread_mutex_unlock(&rc->lock);
+
+    *key = rq->key;
+    if (rq->answer == rc_aHit) {
+	rc->hits++;
+    } else if (rq->answer == rc_aMiss) {
+	rc->misses++;
+    }
+    return rq->answer;
+}
+
+/* RC_Fetch --
+ *
+ * Synopsis:
+ *
+ *    Open the entry for 'key'.  The caller reads its output from
+ *    'e->fd' (with pread) and closes it.
+ *
+ * Returns:
+ *
+ *    0, or -1 if it cannot be read or is not an entry.
+ */
+
+int
+RC_Fetch(RC_Cache* rc, const RC_Key* key, RC_Entry* e)
+{
+    char*		path = rc_path(rc, key);
+    char		head[RC_HEADER_MAX + 1];
+    char*		nl;
+    ssize_t		r;
+    long long		outLen, errLen;
+    struct stat		st;
+
+    e->fd = open(path, O_RDONLY | O_CLOEXEC);
+    free(path);
+    if (e->fd < 0) {
+	return -1;
+    }
+    r = pread(e->fd, head, RC_HEADER_MAX, 0);
+    if (r > 0) {
+	head[r] = '\0';
+    }
+    if (r <= 0 || (nl = strchr(head, '\n')) == NULL
+	|| strncmp(head, RC_MAGIC " ", sizeof(RC_MAGIC)) != 0
+	|| sscanf(head + sizeof(RC_MAGIC), "%d %lld %lld",
+		  &e->status, &outLen, &errLen) != 3
+	|| outLen < 0 || errLen < 0
+	|| fstat(e->fd, &st) < 0
+	|| st.st_size != (nl + 1 - head) + outLen + errLen) {
+	close(e->fd);
+	e->fd = -1;
+	return -1;
+    }
+    e->off = nl + 1 - head;
+    e->outLen = (off_t) outLen;
+    e->errLen = (off_t) errLen;
+    return 0;
+}
+
+/* RC_Spool --
+ *
+ * Synopsis:
+ *
+ *    An anonymous file in the cache directory, to catch output that
+ *    may be stored, or -1.
+ */
+
+int
+RC_Spool(RC_Cache* rc)
+{
+    size_t	len = strlen(rc->dir) + 16;
+    char*	path = (char*) malloc(len);
+    int		fd;
+    /*FIXME: Out of memory */
+
+    snprintf(path, len, "%s/.spoolXXXXXX", rc->dir);
+    fd = mkstemp(path);
+    if (fd >= 0) {
+	unlink(path);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    free(path);
+    return fd;
+}
+
+/* rc_copy --
+ *
+ * Synopsis:
+ *
+ *    Append all of 'from' to 'to'.  Returns 0, or -1.
+ */
+
+static int
+rc_copy(int to, int from, off_t len, char* buf)
+{
+    off_t	off = 0;
+
+    while (off < len) {
+	ssize_t	r = pread(from, buf, len - off < RC_BUF ? (size_t) (len - off) : RC_BUF, off);
+	ssize_t	w;
+	size_t	done;
+
+	if (r <= 0) {
+	    return -1;
+	}
+	for (done = 0;  done < (size_t) r;  done += (size_t) w) {
+	    w = write(to, buf + done, (size_t) r - done);
+	    if (w < 0 && errno == EINTR) {
+		w = 0;
+	    } else if (w <= 0) {
+		return -1;
+	    }
+	}
+	off += r;
+    }
+    return 0;
+}
+
+/* RC_Store --
+ *
+ * Synopsis:
+ *
+ *    Make the entry for 'key' from the output in the spools 'outFd'
+ *    and 'errFd', written from their start.
+ *
+ * Returns:
+ *
+ *    0, or -1 if it cannot be written; the cache is left as it was.
+ */
+
+int
+RC_Store(RC_Cache* rc, const RC_Key* key, int status, int outFd, int errFd)
+{
+    struct stat	outSt, errSt;
+    size_t	len = strlen(rc->dir) + 16;
+    char*	tmp;
+    char*	path;
+    char*	buf;
+    char	head[RC_HEADER_MAX];
+    int		fd, n, rv = -1;
+
+    if (fstat(outFd, &outSt) < 0 || fstat(errFd, &errSt) < 0) {
+	return -1;
+    }
+    tmp = (char*) malloc(len);
+    /*FIXME: Out of memory */
+    snprintf(tmp, len, "%s/.entryXXXXXX", rc->dir);
+    fd = mkstemp(tmp);
+    if (fd < 0) {
+	free(tmp);
+	return -1;
+    }
+    buf = (char*) malloc(RC_BUF);
+    /*FIXME: Out of memory */
+    n = snprintf(head, sizeof head, "%s %d %lld %lld\n", RC_MAGIC, status,
+		 (long long) outSt.st_size, (long long) errSt.st_size);
+    path = rc_path(rc, key);
+    if (write(fd, head, (size_t) n) == n
+	&& rc_copy(fd, outFd, outSt.st_size, buf) == 0
+	&& rc_copy(fd, errFd, errSt.st_size, buf) == 0
+	&& fchmod(fd, 0644) == 0
+	&& close(fd) == 0) {
+	fd = -1;
+	if (rename(tmp, path) == 0) {
+	    rc->stored++;
+	    rv = 0;
+	}
+    }
+    if (fd >= 0) {
+	close(fd);
+    }
+    if (rv < 0) {
+	unlink(tmp);
+    }
+    free(path);
+    free(tmp);
+    free(buf);
+    return rv;
+}
+
+/* RC_Close --
+ *
+ * Synopsis:
+ *
+ *    Stop the threads and free the cache, dropping any requests not
+ *    collected.
+ */
+
+void
+RC_Close(RC_Cache* rc)
+{
+    int		i;
+
+    pthread_mutex_lock(&rc->lock);
+    rc->stopping = 1;
+    pthread_cond_broadcast(&rc->work);
+    pthread_mutex_unlock(&rc->lock);
+    for (i = 0;  i < rc->threadCnt;  ++i) {
+	pthread_join(rc->threads[i], (void**) NULL);
+    }
+    for (;  rc->cnt > 0;  rc->cnt--, rc->head = (rc->head + 1) % RC_WINDOW) {
+	RC_Request*	rq = &rc->ring[rc->head];
+	char**		pp;
+
+	if (rq->done) {
+	    continue;
+	}
+	for (pp = rq->paths;  *pp != NULL;  ++pp) {
+	    free(*pp);
+	}
+	free(rq->paths);
+	free(rq->words);
+    }
+    pthread_mutex_destroy(&rc->lock);
+    pthread_cond_destroy(&rc->work);
+    pthread_cond_destroy(&rc->done);
+    free(rc->dir);
+    free(rc);
+}
@@ -0,0 +1,115 @@
+/* Result cache. */
+
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+/*
+ * With -cache DIR, a process that has already succeeded with the same
+ * command line and inputs is not run again.  Its standard output and
+ * error and its exit code are replayed from the cache instead.
+ *
+ * A process's key is a 128-bit hash of three things: its rendered
+ * command line, the contents of its -stdin file, and the contents of
+ * its -input files, in that order.  The hash is fast, not
+ * cryptographic; the cache trusts whoever can write to DIR.  A
+ * process whose inputs cannot be read has no key.  It is run, and
+ * its results are not stored.
+ *
+ * Each entry is a file in DIR, named by its key in hex.  It holds a
+ * header line "RUNOVRC1 STATUS OUTLEN ERRLEN", then the output, then
+ * the error output.  An entry is written under a temporary name and
+ * then renamed into place.  So jobs sharing a cache each see an entry
+ * whole or not at all.
+ *
+ * Keys are found by a pool of threads.  A thread reads the inputs and
+ * looks for the entry while the coordinator goes on starting
+ * processes.  RC_Submit queues a process, up to RC_WINDOW ahead of
+ * the one being started.  RC_Result waits for the answers, in the
+ * order the processes were queued.
+ */
+
+#define RC_THREADS	4
+#define RC_WINDOW	64
+#define RC_MAGIC	"RUNOVRC1"
+
+typedef struct RC_Key {
+    uint64_t	h[2];
+} RC_Key;
+
+typedef enum RC_Answer {
+    rc_aNone,		/* No key; run it, and do not store it. */
+    rc_aMiss,
+    rc_aHit
+} RC_Answer;
+
+typedef struct RC_Request {
+    size_t	proc;
+    char*	words;		/* The command line, each word NUL-ended. */
+    size_t	wordsLen;
+    char**	paths;		/* Inputs, NULL-ended. */
+    int		done;
+    RC_Answer	answer;
+    RC_Key	key;
+} RC_Request;
+
+typedef struct RC_Entry {
+    int		fd;
+    int		status;		/* Exit code. */
+    off_t	off;		/* Of the output. */
+    off_t	outLen;
+    off_t	errLen;
+} RC_Entry;
+
+typedef struct RC_Cache {
+    char*		dir;
+    RC_Request		ring[RC_WINDOW];
+    size_t		head;		/* Oldest request. */
+    size_t		cnt;
+    size_t		claimed;	/* From the head, taken by threads. */
+    pthread_mutex_t	lock;
+    pthread_cond_t	work;
+    pthread_cond_t	done;
+    pthread_t		threads[RC_THREADS];
+    int			threadCnt;
+    int			stopping;
+    size_t		hits;
+    size_t		misses;
+    size_t		stored;
+} RC_Cache;
+
+RC_Cache*
+RC_Open(const char* dir);
+
+int
+RC_Full(const RC_Cache* rc);
+
+int
+RC_Queued(const RC_Cache* rc, size_t proc);
+
+size_t
+RC_Oldest(const RC_Cache* rc);
+
+void
+RC_Submit(RC_Cache* rc, size_t proc, char* words, size_t wordsLen, char** paths);
+
+RC_Answer
+RC_Result(RC_Cache* rc, size_t proc, RC_Key* key);
+
+int
+RC_Fetch(RC_Cache* rc, const RC_Key* key, RC_Entry* e);
+
+int
+RC_Spool(RC_Cache* rc);
+
+int
+RC_Store(RC_Cache* rc, const RC_Key* key, int status, int outFd, int errFd);
+
+void
+RC_Close(RC_Cache* rc);
+
+#endif /* !defined RESULT_CACHE_H */
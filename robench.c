@@ -0,0 +1,820 @@
+/* Benchmarks. */
+
+/*
+ * Without options, compares the machine list (ml.h: a structure of
+ * arrays with index queues) against the layout it replaced (one
+ * malloc'd MachineItem, plus its name, per slot, on pointer queues),
+ * at a large slot count.  For each it reports the memory held, and
+ * the time per slot to build the list, dispatch every slot, find and
+ * retire a finished process by pid, and walk the run queue as a
+ * teardown does.
+ *
+ *    robench [SLOTS [SLOTS-PER-HOST]]
+ *
+ * The defaults are 1048576 slots, 64 to a host.
+ *
+ * With -suite, times the primitives on the spawn path instead, each
+ * over a range of sizes: template rewriting, argument vectors, the
+ * character accumulator, the pointer queues and machine file parsing.
+ *
+ *    robench -suite [-json] [-match TEXT] [-time SECONDS]
+ *                   [-baseline FILE [-threshold PERCENT]]
+ *
+ * For each it reports the time, the number of allocations and the
+ * bytes allocated per operation; with -json, as one JSON object per
+ * line, to be kept and given to a later run as -baseline.  Against a
+ * baseline, each result is shown with its change, and the exit
+ * status is 1 if any took more than PERCENT (default 10) longer or
+ * allocated more.  -match runs only the benchmarks whose names
+ * contain TEXT; -time is the least time each is run for (default
+ * 0.2).  Allocations are counted only with the GNU C library.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "qo.h"
+#include "ca.h"
+#include "av.h"
+#include "ml.h"
+#include "sweep.h"
+#include "tmpl.h"
+
+/*
+ * The old retire path scans the run queue for the pid, so it is only
+ * timed on a sample.
+ */
+#define OLD_RETIRE_SAMPLE	2000
+
+typedef struct OldItem {
+    char*		mname;
+    pid_t		runPid;
+    size_t		runProc;
+    uint64_t		runKey;
+    double		runStart;
+    int			isLocal;
+    TOPO_Place		place;
+    char*		cpuList;
+    char*		nodeList;
+    QUEUE_LINKAGE(all, struct OldItem*);
+    QUEUE_LINKAGE(ready, struct OldItem*);
+    QUEUE_LINKAGE(run, struct OldItem*);
+} OldItem;
+
+typedef struct OldList {
+    size_t		mcnt;
+    QUEUE_CONTROL_BLOCK(all, struct OldItem*);
+    QUEUE_CONTROL_BLOCK(ready, struct OldItem*);
+    QUEUE_CONTROL_BLOCK(run, struct OldItem*);
+} OldList;
+
+typedef struct Result {
+    size_t	bytes;
+    double	build, dispatch, retire, scan;	/* ns per slot */
+} Result;
+
+static double
+Now(void)
+{
+    struct timespec	ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* HeapInUse --
+ *
+ * Bytes allocated from the heap, where the C library can tell us.
+ */
+
+static size_t
+HeapInUse(void)
+{
+#ifdef __GLIBC__
+    struct mallinfo2	mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+/* Shuffle --
+ *
+ * A random order of the pids 1..n, for retiring processes out of
+ * launch order.
+ */
+
+static pid_t*
+Shuffle(size_t n)
+{
+    pid_t*	p = (pid_t*) malloc(n * sizeof(pid_t));
+    uint64_t	x = 88172645463325252ULL;
+    size_t	i;
+
+    /*FIXME: Out of memory */
+    for (i = 0;  i < n;  ++i) {
+	p[i] = (pid_t) (i + 1);
+    }
+    for (i = n - 1;  i > 0;  --i) {
+	size_t	j;
+	pid_t	t;
+
+	x ^= x << 13;  x ^= x >> 7;  x ^= x << 17;
+	j = x % (i + 1);
+	t = p[i];  p[i] = p[j];  p[j] = t;
+    }
+    return p;
+}
+
+static void
+BenchOld(size_t n, size_t perHost, const pid_t* order, Result* r)
+{
+    OldList*	ms;
+    OldItem*	mi;
+    size_t	i, base, sample;
+    char	name[32];
+    double	t;
+    volatile long	sink = 0;
+
+    base = HeapInUse();
+    t = Now();
+    ms = (OldList*) malloc(sizeof(OldList));
+    /*FIXME: Out of memory */
+    ms->mcnt = 0;
+    QUEUE_CONTROL_BLOCK_INIT(all, ms);
+    QUEUE_CONTROL_BLOCK_INIT(ready, ms);
+    QUEUE_CONTROL_BLOCK_INIT(run, ms);
+    for (i = 0;  i < n;  ++i) {
+	snprintf(name, sizeof name, "node%05lu", (unsigned long) (i / perHost));
+	mi = (OldItem*) malloc(sizeof(OldItem));
+	/*FIXME: OOM */
+	mi->mname = (char*) malloc(strlen(name) + 1);
+	/*FIXME: OOM */
+	strcpy(mi->mname, name);
+	mi->isLocal = 0;
+	mi->place.cpuCnt = 0;
+	mi->cpuList = mi->nodeList = (char*) NULL;
+	QUEUE_ADD(all, ms, mi);
+	QUEUE_ADD(ready, ms, mi);
+	ms->mcnt++;
+    }
+    r->build = (Now() - t) * 1e9 / n;
+    r->bytes = HeapInUse() - base;
+
+    t = Now();
+    for (i = 0;  i < n;  ++i) {
+	QUEUE_TAKE(ready, ms, mi);
+	mi->runPid = (pid_t) (i + 1);
+	mi->runProc = i;
+	mi->runStart = (double) i;
+	QUEUE_ADD(run, ms, mi);
+    }
+    r->dispatch = (Now() - t) * 1e9 / n;
+
+    t = Now();
+    for (mi = QUEUE_HEAD(run, ms);  mi != NULL;  mi = QUEUE_NEXT(run, mi)) {
+	sink += mi->runPid;
+    }
+    r->scan = (Now() - t) * 1e9 / n;
+
+    sample = n < OLD_RETIRE_SAMPLE ? n : OLD_RETIRE_SAMPLE;
+    t = Now();
+    for (i = 0;  i < sample;  ++i) {
+	for (mi = QUEUE_HEAD(run, ms);  mi != NULL;  mi = QUEUE_NEXT(run, mi)) {
+	    if (mi->runPid == order[i]) {
+		QUEUE_REMOVE(run, ms, mi);
+		QUEUE_ADD(ready, ms, mi);
+		break;
+	    }
+	}
+    }
+    r->retire = (Now() - t) * 1e9 / sample;
+
+    while (QUEUE_HEAD(all, ms) != NULL) {
+	QUEUE_TAKE(all, ms, mi);
+	free(mi->mname);
+	free(mi);
+    }
+    free(ms);
+}
+
+static void
+BenchNew(size_t n, size_t perHost, const pid_t* order, Result* r)
+{
+    MachineList*	ms;
+    QI_Index		slot, h = QI_NIL;
+    size_t		i, base;
+    char		name[32];
+    double		t;
+    volatile long	sink = 0;
+
+    base = HeapInUse();
+    t = Now();
+    ms = ML_Create();
+    for (i = 0;  i < n;  ++i) {
+	if (i % perHost == 0) {
+	    snprintf(name, sizeof name, "node%05lu", (unsigned long) (i / perHost));
+	    h = ML_AddHost(ms, name);
+	}
+	ML_AddSlot(ms, h);
+    }
+    r->build = (Now() - t) * 1e9 / n;
+    r->bytes = HeapInUse() - base;
+
+    t = Now();
+    for (i = 0;  i < n;  ++i) {
+	QI_TAKE(&ms->ready, ms->link, slot);
+	ms->pid[slot] = (pid_t) (i + 1);
+	ms->proc[slot] = i;
+	ms->start[slot] = (double) i;
+	ML_MapPid(ms, ms->pid[slot], slot);
+	ms->state[slot] = ml_sRun;
+	QI_ADD(&ms->run, ms->link, slot);
+    }
+    r->dispatch = (Now() - t) * 1e9 / n;
+
+    t = Now();
+    for (slot = QI_HEAD(&ms->run);  slot != QI_NIL;  slot = QI_NEXT(ms->link, slot)) {
+	sink += ms->pid[slot];
+    }
+    r->scan = (Now() - t) * 1e9 / n;
+
+    t = Now();
+    for (i = 0;  i < n;  ++i) {
+	slot = ML_UnmapPid(ms, order[i]);
+	QI_REMOVE(&ms->run, ms->link, slot);
+	ms->state[slot] = ml_sReady;
+	QI_ADD(&ms->ready, ms->link, slot);
+    }
+    r->retire = (Now() - t) * 1e9 / n;
+}
+
+/*
+ * The primitive suite.
+ */
+
+#define SUITE_NAME_MAX		64
+#define SUITE_CASES		64
+#define SUITE_HOST_SLOTS	16	/* Machine file lines per host. */
+
+typedef struct QItem {
+    QUEUE_LINKAGE(q, struct QItem*);
+} QItem;
+
+typedef struct QList {
+    QUEUE_CONTROL_BLOCK(q, struct QItem*);
+} QList;
+
+typedef struct Case {
+    char		name[SUITE_NAME_MAX];
+    size_t		size;		/* Shown with the results. */
+    size_t		per;		/* Operations per call of run. */
+    void		(*run)(struct Case* c, size_t iters);
+    char*		text;		/* A template, word or file. */
+    size_t		textLen;
+    char**		words;		/* Arguments. */
+    QItem*		items;		/* Queue entries. */
+    pid_t*		order;		/* Queue removal order. */
+    TMPL_Values*	tv;
+} Case;
+
+typedef struct Measure {
+    char	name[SUITE_NAME_MAX];
+    size_t	size;
+    size_t	iters;
+    double	ns;			/* Per operation. */
+    double	allocs;
+    double	bytes;
+} Measure;
+
+static size_t		allocCnt;
+static size_t		allocBytes;
+static volatile long	suiteSink;
+
+#ifdef __GLIBC__
+extern void*	__libc_malloc(size_t n);
+extern void*	__libc_calloc(size_t m, size_t n);
+extern void*	__libc_realloc(void* p, size_t n);
+
+/* malloc, calloc, realloc --
+ *
+ * Count allocations, and the bytes asked for, on the way to the C
+ * library's allocator.  Its own internal calls (strdup, fopen) come
+ * here too.
+ */
+
+void*
+malloc(size_t n)
+{
+    allocCnt++;
+    allocBytes += n;
+    return __libc_malloc(n);
+}
+
+void*
+calloc(size_t m, size_t n)
+{
+    allocCnt++;
+    allocBytes += m * n;
+    return __libc_calloc(m, n);
+}
+
+void*
+realloc(void* p, size_t n)
+{
+    allocCnt++;
+    allocBytes += n;
+    return __libc_realloc(p, n);
+}
+#endif
+
+static void
+RunRewrite(Case* c, size_t iters)
+{
+    size_t	i;
+
+    for (i = 0;  i < iters;  ++i) {
+	char*	p = TMPL_Rewrite(c->text, c->tv, "0-3,8-11", "0", i);
+	suiteSink += p[0];
+	free(p);
+    }
+}
+
+static void
+RunArgv(Case* c, size_t iters)
+{
+    AV_Control		avc;
+    const char**	av;
+    size_t		i, j, argc;
+
+    for (i = 0;  i < iters;  ++i) {
+	AV_Init(&avc);
+	for (j = 0;  j < c->size;  ++j) {
+	    AV_AddString(&avc, c->words[j]);
+	}
+	av = AV_Finalize(&avc, &argc);
+	suiteSink += argc;
+	free(av);
+    }
+}
+
+static void
+RunAccumChar(Case* c, size_t iters)
+{
+    CharAccum	ca;
+    size_t	i, j;
+
+    for (i = 0;  i < iters;  ++i) {
+	CHARACCUM_INIT(&ca);
+	for (j = 0;  j < c->size;  ++j) {
+	    CHARACCUM_APPEND_CHAR(&ca, 'x');
+	}
+	suiteSink += CHARACCUM_LENGTH(&ca);
+	free(ca.cb);
+    }
+}
+
+static void
+RunAccumStr(Case* c, size_t iters)
+{
+    CharAccum	ca;
+    size_t	i, j;
+
+    for (i = 0;  i < iters;  ++i) {
+	CHARACCUM_INIT(&ca);
+	for (j = 0;  j < c->size;  j += c->textLen) {
+	    CHARACCUM_APPEND_STR(&ca, c->text);
+	}
+	suiteSink += CHARACCUM_LENGTH(&ca);
+	free(ca.cb);
+    }
+}
+
+static void
+RunQueueCycle(Case* c, size_t iters)
+{
+    QList	ql, *qp = &ql;
+    QItem*	qi;
+    size_t	i, j;
+
+    QUEUE_CONTROL_BLOCK_INIT(q, qp);
+    for (i = 0;  i < iters;  ++i) {
+	for (j = 0;  j < c->size;  ++j) {
+	    qi = &c->items[j];
+	    QUEUE_ADD(q, qp, qi);
+	}
+	for (j = 0;  j < c->size;  ++j) {
+	    QUEUE_TAKE(q, qp, qi);
+	    suiteSink += qi != NULL;
+	}
+    }
+}
+
+static void
+RunQueueRemove(Case* c, size_t iters)
+{
+    QList	ql, *qp = &ql;
+    QItem*	qi;
+    size_t	i, j;
+
+    QUEUE_CONTROL_BLOCK_INIT(q, qp);
+    for (i = 0;  i < iters;  ++i) {
+	for (j = 0;  j < c->size;  ++j) {
+	    qi = &c->items[j];
+	    QUEUE_ADD(q, qp, qi);
+	}
+	for (j = 0;  j < c->size;  ++j) {
+	    qi = &c->items[c->order[j] - 1];
+	    QUEUE_REMOVE(q, qp, qi);
+	}
+	suiteSink += QUEUE_HEAD(q, qp) == NULL;
+    }
+}
+
+static void
+RunParse(Case* c, size_t iters)
+{
+    size_t	i;
+
+    for (i = 0;  i < iters;  ++i) {
+	FILE*		f = fmemopen(c->text, c->textLen, "r");
+	MachineList*	ms;
+	char		err[256];
+
+	/*FIXME: Out of memory */
+	ms = ParseMachineFile(f, err, sizeof(err));
+	fclose(f);
+	suiteSink += ms->mcnt;
+	ML_Destroy(ms);
+    }
+}
+
+/* AddCase --
+ *
+ * A new benchmark, unless its name does not contain 'match'.
+ */
+
+static Case*
+AddCase(Case* cases, size_t* caseCnt, const char* match, const char* name,
+	size_t size, size_t per, void (*run)(Case*, size_t))
+{
+    Case*	c;
+
+    if (strstr(name, match) == NULL || *caseCnt == SUITE_CASES) {
+	return (Case*) NULL;
+    }
+    c = &cases[(*caseCnt)++];
+    memset(c, 0, sizeof(Case));
+    snprintf(c->name, sizeof c->name, "%s", name);
+    c->size = size;
+    c->per = per;
+    c->run = run;
+    return c;
+}
+
+/* SetupSuite --
+ *
+ * The benchmarks and their inputs.  Templates are given as their
+ * length; machine files and queues as their entries; arguments as
+ * their count; accumulated strings as their length.
+ */
+
+static size_t
+SetupSuite(Case* cases, const char* match, TMPL_Values* tv)
+{
+    static const char*	shapes[][2] = {
+	{ "rewrite/literal", "/usr/local/bin/simulate" },
+	{ "rewrite/output", "out/%j/rank-%p.log" },
+	{ "rewrite/pinned", "numactl --physcpubind=%c --membind=%m ./a.out %p" },
+	{ "rewrite/sweep", "run-%{n}-%{mode}/%p.out" }
+    };
+    static const size_t	lengths[] = { 10, 100, 1000, 10000 };
+    static const size_t	counts[] = { 10, 100, 1000, 10000 };
+    static const size_t	chars[] = { 16, 1024, 65536, 1048576 };
+    static const size_t	depths[] = { 10, 1000, 100000, 1000000 };
+    static const size_t	lines[] = { 10, 1000, 100000, 1000000 };
+    size_t		caseCnt = 0;
+    size_t		i, j;
+    Case*		c;
+
+    for (i = 0;  i < sizeof shapes / sizeof shapes[0];  ++i) {
+	c = AddCase(cases, &caseCnt, match, shapes[i][0],
+		    strlen(shapes[i][1]), 1, RunRewrite);
+	if (c != NULL) {
+	    c->text = (char*) shapes[i][1];
+	    c->tv = tv;
+	}
+    }
+    for (i = 0;  i < sizeof lengths / sizeof lengths[0];  ++i) {
+	/* Mostly text, with an escape every 16 characters. */
+	c = AddCase(cases, &caseCnt, match, "rewrite/long", lengths[i], 1,
+		    RunRewrite);
+	if (c != NULL) {
+	    c->text = (char*) malloc(lengths[i] + 1);
+	    /*FIXME: Out of memory */
+	    for (j = 0;  j < lengths[i];  ++j) {
+		c->text[j] = j % 16 == 14 ? '%' : j % 16 == 15 ? 'p' : 'a' + j % 16;
+	    }
+	    c->text[j] = '\0';
+	    c->tv = tv;
+	}
+    }
+    for (i = 0;  i < sizeof counts / sizeof counts[0];  ++i) {
+	c = AddCase(cases, &caseCnt, match, "argv/build", counts[i], 1, RunArgv);
+	if (c != NULL) {
+	    c->words = (char**) malloc(counts[i] * sizeof(char*));
+	    /*FIXME: Out of memory */
+	    for (j = 0;  j < counts[i];  ++j) {
+		char	w[48];
+		snprintf(w, sizeof w, "--input=part-%05lu.dat", (unsigned long) j);
+		c->words[j] = strdup(w);
+	    }
+	}
+    }
+    for (i = 0;  i < sizeof chars / sizeof chars[0];  ++i) {
+	AddCase(cases, &caseCnt, match, "characcum/char", chars[i], 1,
+		RunAccumChar);
+	c = AddCase(cases, &caseCnt, match, "characcum/str", chars[i], 1,
+		    RunAccumStr);
+	if (c != NULL) {
+	    c->text = "/scratch/run-0042/";
+	    c->textLen = strlen(c->text);
+	}
+    }
+    for (i = 0;  i < sizeof depths / sizeof depths[0];  ++i) {
+	QItem*	items = (QItem*) NULL;
+	pid_t*	order = (pid_t*) NULL;
+
+	c = AddCase(cases, &caseCnt, match, "queue/add-take", depths[i],
+		    depths[i], RunQueueCycle);
+	if (c != NULL) {
+	    items = (QItem*) malloc(depths[i] * sizeof(QItem));
+	    /*FIXME: Out of memory */
+	    c->items = items;
+	}
+	c = AddCase(cases, &caseCnt, match, "queue/add-remove", depths[i],
+		    depths[i], RunQueueRemove);
+	if (c != NULL) {
+	    if (items == NULL) {
+		items = (QItem*) malloc(depths[i] * sizeof(QItem));
+		/*FIXME: Out of memory */
+	    }
+	    order = Shuffle(depths[i]);
+	    c->items = items;
+	    c->order = order;
+	}
+    }
+    for (i = 0;  i < sizeof lines / sizeof lines[0];  ++i) {
+	c = AddCase(cases, &caseCnt, match, "machinefile/parse", lines[i], 1,
+		    RunParse);
+	if (c != NULL) {
+	    size_t	len = 0;
+
+	    c->text = (char*) malloc(lines[i] * 32);
+	    /*FIXME: Out of memory */
+	    for (j = 0;  j < lines[i];  ++j) {
+		len += sprintf(c->text + len, "node%06lu.cluster\n",
+			       (unsigned long) (j / SUITE_HOST_SLOTS));
+	    }
+	    c->textLen = len;
+	}
+    }
+    return caseCnt;
+}
+
+/* RunCase --
+ *
+ * Time a benchmark, calling it with more iterations each time until
+ * a run takes at least 'minTime' seconds; that run is the result.
+ */
+
+static void
+RunCase(Case* c, double minTime, Measure* m)
+{
+    size_t	iters = 1;
+    size_t	cnt, bytes;
+    double	t, ops;
+
+    for (;;) {
+	cnt = allocCnt;
+	bytes = allocBytes;
+	t = Now();
+	c->run(c, iters);
+	t = Now() - t;
+	if (t >= minTime) {
+	    break;
+	}
+	if (t < minTime / 100) {
+	    iters *= 100;
+	} else {
+	    /* Aim a little past the minimum, rather than doubling to it. */
+	    iters = (size_t) (iters * 1.2 * minTime / t) + 1;
+	}
+    }
+    ops = (double) iters * c->per;
+    snprintf(m->name, sizeof m->name, "%s", c->name);
+    m->size = c->size;
+    m->iters = iters;
+    m->ns = t * 1e9 / ops;
+    m->allocs = (allocCnt - cnt) / ops;
+    m->bytes = (allocBytes - bytes) / ops;
+}
+
+/* LoadBaseline --
+ *
+ * Read the results of an earlier -json run.
+ */
+
+static Measure*
+LoadBaseline(const char* path, size_t* cnt)
+{
+    FILE*	f = fopen(path, "r");
+    Measure*	base;
+    size_t	max = 64;
+    char	line[512];
+
+    if (f == NULL) {
+	fprintf(stderr, "robench: Can't open baseline \"%s\"\n", path);
+	exit(1);
+    }
+    base = (Measure*) malloc(max * sizeof(Measure));
+    /*FIXME: Out of memory */
+    *cnt = 0;
+    while (fgets(line, sizeof line, f) != NULL) {
+	Measure*	m;
+	unsigned long	size, iters;
+
+	if (*cnt == max) {
+	    max *= 2;
+	    base = (Measure*) realloc(base, max * sizeof(Measure));
+	    /*FIXME: Out of memory */
+	}
+	m = &base[*cnt];
+	if (sscanf(line, "{\"name\":\"%63[^\"]\",\"size\":%lu,\"iters\":%lu,"
+		   "\"ns_per_op\":%lf,\"allocs_per_op\":%lf,\"bytes_per_op\":%lf",
+		   m->name, &size, &iters, &m->ns, &m->allocs, &m->bytes) == 6) {
+	    m->size = size;
+	    m->iters = iters;
+	    ++*cnt;
+	}
+    }
+    fclose(f);
+    return base;
+}
+
+static void
+SuiteUsage(void)
+{
+    fprintf(stderr, "Usage: robench -suite [-json] [-match TEXT] [-time SECONDS]\n"
+	    "                      [-baseline FILE [-threshold PERCENT]]\n");
+    exit(1);
+}
+
+/* Suite --
+ *
+ * Run the primitive benchmarks.  Returns the exit status.
+ */
+
+static int
+Suite(int argc, char** argv)
+{
+    Case*		cases;
+    size_t		caseCnt, baseCnt = 0, i, j;
+    Measure*		base = (Measure*) NULL;
+    const char*		match = "";
+    double		minTime = 0.2, threshold = 10;
+    int			json = 0, regressed = 0;
+    SWP_Sweep		sweep;
+    TMPL_Values		tv;
+    char		err[256];
+
+    for (i = 1;  i < (size_t) argc;  ++i) {
+	if (!strcmp(argv[i], "-json")) {
+	    json = 1;
+	} else if (i + 1 == (size_t) argc) {
+	    SuiteUsage();
+	} else if (!strcmp(argv[i], "-match")) {
+	    match = argv[++i];
+	} else if (!strcmp(argv[i], "-time")) {
+	    minTime = strtod(argv[++i], NULL);
+	} else if (!strcmp(argv[i], "-baseline")) {
+	    base = LoadBaseline(argv[++i], &baseCnt);
+	} else if (!strcmp(argv[i], "-threshold")) {
+	    threshold = strtod(argv[++i], NULL);
+	} else {
+	    SuiteUsage();
+	}
+    }
+    if (minTime <= 0 || threshold < 0) {
+	SuiteUsage();
+    }
+
+    SWP_Init(&sweep);
+    if (SWP_Scan(&sweep, "%{n=1..64}%{mode=fast,exact,slow}", err, sizeof err) < 0
+	|| SWP_Finish(&sweep, err, sizeof err) < 0) {
+	fprintf(stderr, "robench: %s\n", err);
+	exit(1);
+    }
+    tv.jobName = "bench";
+    tv.stagePath = "/tmp/runover-bench";
+    tv.kvsAddress = "head:40000";
+    tv.kvsToken = (const char*) NULL;
+    tv.procCnt = 1024;
+    tv.sweep = &sweep;
+
+    cases = (Case*) malloc(SUITE_CASES * sizeof(Case));
+    /*FIXME: Out of memory */
+    caseCnt = SetupSuite(cases, match, &tv);
+
+    if (!json) {
+	printf("%-20s %8s %12s %10s %12s", "benchmark", "size", "ns/op",
+	       "allocs/op", "bytes/op");
+	if (base != NULL) {
+	    printf(" %12s %8s", "base ns/op", "change");
+	}
+	printf("\n");
+    }
+    for (i = 0;  i < caseCnt;  ++i) {
+	Measure		m;
+	Measure*	b = (Measure*) NULL;
+	int		worse = 0;
+
+	RunCase(&cases[i], minTime, &m);
+	for (j = 0;  j < baseCnt;  ++j) {
+	    if (!strcmp(base[j].name, m.name) && base[j].size == m.size) {
+		b = &base[j];
+		worse = m.ns > b->ns * (1 + threshold / 100)
+		    || m.allocs > b->allocs + 0.005;
+		regressed |= worse;
+		break;
+	    }
+	}
+	if (json) {
+	    printf("{\"name\":\"%s\",\"size\":%lu,\"iters\":%lu,"
+		   "\"ns_per_op\":%.2f,\"allocs_per_op\":%.3f,\"bytes_per_op\":%.1f",
+		   m.name, (unsigned long) m.size, (unsigned long) m.iters,
+		   m.ns, m.allocs, m.bytes);
+	    if (b != NULL) {
+		printf(",\"base_ns_per_op\":%.2f,\"base_allocs_per_op\":%.3f,"
+		       "\"regressed\":%s", b->ns, b->allocs,
+		       worse ? "true" : "false");
+	    }
+	    printf("}\n");
+	} else {
+	    printf("%-20s %8lu %12.1f %10.2f %12.1f", m.name,
+		   (unsigned long) m.size, m.ns, m.allocs, m.bytes);
+	    if (b != NULL) {
+		printf(" %12.1f %+7.1f%%%s", b->ns, (m.ns / b->ns - 1) * 100,
+		       worse ? "  REGRESSED" : "");
+	    }
+	    printf("\n");
+	}
+	fflush(stdout);
+    }
+    return regressed;
+}
+
+int
+main(int argc, char** argv)
+{
+    size_t	n = 1048576, perHost = 64;
+    pid_t*	order;
+    Result	old, new;
+
+    if (argc > 1 && !strcmp(argv[1], "-suite")) {
+	return Suite(argc - 1, argv + 1);
+    }
+    if (argc > 1) {
+	n = strtoul(argv[1], NULL, 0);
+    }
+    if (argc > 2) {
+	perHost = strtoul(argv[2], NULL, 0);
+    }
+    if (n == 0 || perHost == 0 || n >= QI_NIL) {
+	fprintf(stderr, "Usage: %s [SLOTS [SLOTS-PER-HOST]]\n", argv[0]);
+	exit(1);
+    }
+    order = Shuffle(n);
+
+    BenchOld(n, perHost, order, &old);
+    BenchNew(n, perHost, order, &new);
+
+    printf("%lu slots, %lu per host\n\n",
+	   (unsigned long) n, (unsigned long) perHost);
+    printf("%-22s %14s %14s\n", "", "pointer list", "slot table");
+    printf("%-22s %14.1f %14.1f\n", "memory (bytes/slot)",
+	   (double) old.bytes / n, (double) new.bytes / n);
+    printf("%-22s %14.1f %14.1f\n", "build (ns/slot)", old.build, new.build);
+    printf("%-22s %14.1f %14.1f\n", "dispatch (ns/slot)",
+	   old.dispatch, new.dispatch);
+    printf("%-22s %14.1f %14.1f\n", "retire by pid (ns)",
+	   old.retire, new.retire);
+    printf("%-22s %14.1f %14.1f\n", "run queue walk (ns)", old.scan, new.scan);
+    return 0;
+}
@@ -0,0 +1,891 @@
+/* Scheduling simulator. */
+
+/*
+ * Replays a job on a simulated clock instead of running it, once for
+ * each of several dispatch policies, and reports for each the
+ * makespan, the share of slot time spent running tasks, and the
+ * times by which half, 95% and 99% of the tasks had finished.  A
+ * million tasks take a few seconds a policy.
+ *
+ *    rosim -machinefile MF (-trace FILE | -synthetic N:DIST)
+ *          [-policy LIST] [-speed SIGMA] [-remote FACTOR]
+ *          [-noise SIGMA] [-slow FACTOR] [-seed N] [-json]
+ *
+ * The slots are those of the machine file.  The tasks come from a
+ * trace written by "runover -trace", or are N drawn from a
+ * distribution:
+ *
+ *    fixed:S  uniform:A:B  exp:MEAN  lognormal:MEDIAN:SIGMA
+ *    pareto:MIN:ALPHA
+ *
+ * A host's speed is taken from the trace, as the mean time of the
+ * tasks it ran over the mean of all of them; hosts the trace does not
+ * name, and all hosts of a synthetic job, have the nominal speed.
+ * -speed spreads the speeds further, by a lognormal factor of the
+ * given sigma.  Each task has a home, the host it ran on (a host
+ * picked at random for a synthetic job); run anywhere else it takes
+ * -remote times as long (default 1, no penalty).
+ *
+ * The policies, given to -policy separated by commas (default all):
+ *
+ *    fifo       in order, to the first free slot, as runover does
+ *    lpt        longest predicted first; the prediction is the task's
+ *               time, off by a lognormal factor of sigma -noise
+ *    locality   a slot takes a task whose home is its host first
+ *    speculate  fifo, and once no task waits, a free slot runs a
+ *               copy of the oldest task that has run -slow (default
+ *               1.5) times the mean task time; whichever copy
+ *               finishes first counts, and the other is killed
+ *
+ * Every run draws from the same -seed, so runs are repeatable.  With
+ * -json, each policy's results are one JSON object per line.  Task
+ * graphs are not simulated.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "qi.h"
+#include "ml.h"
+
+#define NO_TASK		((size_t) -1)
+
+typedef enum Policy {
+    pFIFO,
+    pLPT,
+    pLOCALITY,
+    pSPECULATE,
+    pCOUNT
+} Policy;
+
+static const char* const policyNames[pCOUNT] = {
+    "fifo", "lpt", "locality", "speculate"
+};
+
+typedef enum DistKind {
+    dFIXED,
+    dUNIFORM,
+    dEXP,
+    dLOGNORMAL,
+    dPARETO
+} DistKind;
+
+typedef struct Dist {
+    DistKind	kind;
+    double	a, b;
+} Dist;
+
+/* The tasks, and what is known of them before they run. */
+typedef struct Job {
+    size_t	n;
+    double*	work;		/* Seconds at home on a host of speed 1. */
+    double*	guess;		/* What lpt predicts. */
+    QI_Index*	home;		/* Host, or QI_NIL for none. */
+} Job;
+
+typedef struct Event {
+    double	when;
+    QI_Index	slot;		/* QI_NIL to look for stragglers. */
+    uint32_t	epoch;
+} Event;
+
+typedef struct Sim {
+    MachineList*	ms;
+    const Job*		job;
+    const double*	factor;		/* By host: time taken per unit work. */
+    Policy		policy;
+    double		remote;
+    double		slow;
+
+    /* Tasks not yet started: 'order' from 'next', or all from 'next'. */
+    const size_t*	order;		/* NULL for task order. */
+    size_t		next;
+    uint8_t*		taken;
+    double*		finish;
+
+    /* With locality, the tasks by home, each host's from 'first'. */
+    size_t*		byHome;
+    size_t*		first;		/* hcnt + 1 of them. */
+    size_t*		cursor;
+
+    /* By slot: the copy it runs with speculation. */
+    uint32_t*		epoch;
+    QI_Index*		peer;
+
+    Event*		heap;
+    size_t		heapCnt;
+    size_t		heapMax;
+    double		wakeAt;		/* < 0 if no wake-up is queued. */
+
+    double		now;
+    double		busy;		/* Slot-seconds. */
+    double		wasted;		/* Of it, in copies that lost. */
+    double		ranSum;		/* Of finished tasks. */
+    size_t		done;
+    size_t		backups;
+} Sim;
+
+typedef struct Result {
+    double	makespan;
+    double	util;
+    double	p50, p95, p99;
+    size_t	backups;
+    double	wasted;
+} Result;
+
+static uint64_t	rngState = 0x9e3779b97f4a7c15ULL;
+
+/* Uniform --
+ *
+ * A uniform deviate in [0, 1), by xorshift64*.
+ */
+
+static double
+Uniform(void)
+{
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return (double) ((rngState * 0x2545f4914f6cdd1dULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Normal --
+ *
+ * A standard normal deviate, by Box-Muller.
+ */
+
+static double
+Normal(void)
+{
+    double	r = sqrt(-2.0 * log(1.0 - Uniform()));
+
+    return r * cos(2.0 * M_PI * Uniform());
+}
+
+/* ParseDist --
+ *
+ * Parse a distribution, "NAME:PARAM[:PARAM]".  Returns 0, or -1 if
+ * it is not one.
+ */
+
+static int
+ParseDist(const char* text, Dist* d)
+{
+    char	name[16];
+    int		cnt;
+
+    d->b = 0.0;
+    cnt = sscanf(text, "%15[a-z]:%lf:%lf", name, &d->a, &d->b);
+    if (cnt < 2 || d->a < 0) {
+	return -1;
+    }
+    if (!strcmp(name, "fixed") && cnt == 2) {
+	d->kind = dFIXED;
+    } else if (!strcmp(name, "uniform") && cnt == 3 && d->b >= d->a) {
+	d->kind = dUNIFORM;
+    } else if (!strcmp(name, "exp") && cnt == 2) {
+	d->kind = dEXP;
+    } else if (!strcmp(name, "lognormal") && cnt == 3 && d->b >= 0) {
+	d->kind = dLOGNORMAL;
+    } else if (!strcmp(name, "pareto") && cnt == 3 && d->a > 0 && d->b > 0) {
+	d->kind = dPARETO;
+    } else {
+	return -1;
+    }
+    return 0;
+}
+
+/* Draw --
+ *
+ * A deviate of distribution 'd'.
+ */
+
+static double
+Draw(const Dist* d)
+{
+    switch (d->kind) {
+    case dFIXED:
+	return d->a;
+    case dUNIFORM:
+	return d->a + (d->b - d->a) * Uniform();
+    case dEXP:
+	return -d->a * log(1.0 - Uniform());
+    case dLOGNORMAL:
+	return d->a * exp(d->b * Normal());
+    case dPARETO:
+	return d->a / pow(1.0 - Uniform(), 1.0 / d->b);
+    }
+    return 0.0;
+}
+
+/* AllocJob --
+ *
+ * Make room for 'n' tasks.
+ */
+
+static void
+AllocJob(Job* job, size_t n)
+{
+    job->n = n;
+    job->work = (double*) malloc((n + 1) * sizeof(double));
+    /*FIXME: Out of memory */
+    job->guess = (double*) malloc((n + 1) * sizeof(double));
+    /*FIXME: Out of memory */
+    job->home = (QI_Index*) malloc((n + 1) * sizeof(QI_Index));
+    /*FIXME: Out of memory */
+}
+
+/* Synthesize --
+ *
+ * Make a job of 'n' tasks with times drawn from 'd', each with a
+ * home picked at random.
+ */
+
+static void
+Synthesize(Job* job, size_t n, const Dist* d, const MachineList* ms)
+{
+    size_t	t;
+
+    AllocJob(job, n);
+    for (t = 0;  t < n;  ++t) {
+	job->work[t] = Draw(d);
+	job->home[t] = (QI_Index) (Uniform() * ms->hcnt);
+    }
+}
+
+typedef struct TraceLine {
+    size_t	proc;
+    QI_Index	host;		/* In the hosts the trace names. */
+    double	took;
+} TraceLine;
+
+static int
+CompareLines(const void* a, const void* b)
+{
+    const TraceLine*	x = (const TraceLine*) a;
+    const TraceLine*	y = (const TraceLine*) b;
+
+    if (x->proc != y->proc) {
+	return x->proc < y->proc ? -1 : 1;
+    }
+    return 0;
+}
+
+/* LoadTrace --
+ *
+ * Make a job of the processes in a trace, in process order, and set
+ * the speed of each host of 'ms' the trace names.
+ */
+
+static void
+LoadTrace(Job* job, const char* path, const MachineList* ms, double* factor)
+{
+    FILE*		f = fopen(path, "r");
+    MachineList*	seen = ML_Create();
+    TraceLine*		lines;
+    size_t		cnt = 0, max = 1024, h, t;
+    double*		sum;
+    size_t*		ran;
+    double		total = 0.0;
+    QI_Index*		simHost;
+    char		line[1024];
+
+    if (f == NULL) {
+	fprintf(stderr, "rosim: Can't open trace \"%s\"\n", path);
+	exit(1);
+    }
+    lines = (TraceLine*) malloc(max * sizeof(TraceLine));
+    /*FIXME: Out of memory */
+    while (fgets(line, sizeof line, f) != NULL) {
+	unsigned long long	proc;
+	char		host[256];
+	double		start, took;
+
+	if (line[0] == '#' || line[0] == '\n') {
+	    continue;
+	}
+	if (sscanf(line, "%llu %255s %lf %lf", &proc, host, &start, &took) != 4
+	    || took < 0) {
+	    fprintf(stderr, "rosim: %s: %lu: bad line\n",
+		    path, (unsigned long) cnt + 1);
+	    exit(1);
+	}
+	if (cnt == max) {
+	    max *= 2;
+	    lines = (TraceLine*) realloc(lines, max * sizeof(TraceLine));
+	    /*FIXME: Out of memory */
+	}
+	lines[cnt].proc = proc;
+	lines[cnt].host = ML_AddHost(seen, host);
+	lines[cnt].took = took;
+	total += took;
+	cnt++;
+    }
+    fclose(f);
+    if (cnt == 0) {
+	fprintf(stderr, "rosim: %s: no processes\n", path);
+	exit(1);
+    }
+    qsort(lines, cnt, sizeof(TraceLine), CompareLines);
+
+    /* The speed of each host seen, and which of 'ms' it is. */
+    for (h = 0;  h < ms->hcnt;  ++h) {
+	ML_AddHost(seen, ms->hosts[h].name);
+    }
+    sum = (double*) calloc(seen->hcnt, sizeof(double));
+    /*FIXME: Out of memory */
+    ran = (size_t*) calloc(seen->hcnt, sizeof(size_t));
+    /*FIXME: Out of memory */
+    simHost = (QI_Index*) malloc(seen->hcnt * sizeof(QI_Index));
+    /*FIXME: Out of memory */
+    for (t = 0;  t < cnt;  ++t) {
+	sum[lines[t].host] += lines[t].took;
+	ran[lines[t].host]++;
+    }
+    for (h = 0;  h < seen->hcnt;  ++h) {
+	sum[h] = ran[h] > 0 && total > 0 ? (sum[h] / ran[h]) / (total / cnt) : 1.0;
+	simHost[h] = QI_NIL;
+    }
+    for (h = 0;  h < ms->hcnt;  ++h) {
+	QI_Index	sh = ML_AddHost(seen, ms->hosts[h].name);
+
+	simHost[sh] = (QI_Index) h;
+	factor[h] = sum[sh];
+    }
+
+    AllocJob(job, cnt);
+    for (t = 0;  t < cnt;  ++t) {
+	double	f = sum[lines[t].host];
+
+	job->work[t] = f > 0 ? lines[t].took / f : lines[t].took;
+	job->home[t] = simHost[lines[t].host];
+    }
+
+    free(lines);
+    free(simHost);
+    free(sum);
+    free(ran);
+    ML_Destroy(seen);
+}
+
+/* sim_push --
+ *
+ * Synopsis:
+ *
+ *    Queue an event.
+ */
+
+static void
+sim_push(Sim* s, double when, QI_Index slot, uint32_t epoch)
+{
+    size_t	i;
+
+    if (s->heapCnt == s->heapMax) {
+	s->heapMax = s->heapMax ? 2 * s->heapMax : 1024;
+	s->heap = (Event*) realloc(s->heap, s->heapMax * sizeof(Event));
+	/*FIXME: Out of memory */
+    }
+    i = s->heapCnt++;
+    while (i > 0 && s->heap[(i - 1) / 2].when > when) {
+	s->heap[i] = s->heap[(i - 1) / 2];
+	i = (i - 1) / 2;
+    }
+    s->heap[i].when = when;
+    s->heap[i].slot = slot;
+    s->heap[i].epoch = epoch;
+}
+
+/* sim_pop --
+ *
+ * Synopsis:
+ *
+ *    Take the earliest event.
+ */
+
+static Event
+sim_pop(Sim* s)
+{
+    Event	top = s->heap[0];
+    Event	last = s->heap[--s->heapCnt];
+    size_t	i = 0, c;
+
+    while ((c = 2 * i + 1) < s->heapCnt) {
+	if (c + 1 < s->heapCnt && s->heap[c + 1].when < s->heap[c].when) {
+	    c++;
+	}
+	if (s->heap[c].when >= last.when) {
+	    break;
+	}
+	s->heap[i] = s->heap[c];
+	i = c;
+    }
+    s->heap[i] = last;
+    return top;
+}
+
+/* sim_next --
+ *
+ * Synopsis:
+ *
+ *    Take the task to start next on a slot of host 'host', or return
+ *    NO_TASK if none is waiting.
+ */
+
+static size_t
+sim_next(Sim* s, QI_Index host)
+{
+    size_t	t;
+
+    if (s->byHome != NULL) {
+	while (s->cursor[host] < s->first[host + 1]) {
+	    t = s->byHome[s->cursor[host]++];
+	    if (!s->taken[t]) {
+		return t;
+	    }
+	}
+    }
+    while (s->next < s->job->n) {
+	t = s->order != NULL ? s->order[s->next] : s->next;
+	s->next++;
+	if (!s->taken[t]) {
+	    return t;
+	}
+    }
+    return NO_TASK;
+}
+
+/* sim_start --
+ *
+ * Synopsis:
+ *
+ *    Start task 't' on a ready slot.
+ */
+
+static void
+sim_start(Sim* s, QI_Index slot, size_t t)
+{
+    MachineList*	ms = s->ms;
+    QI_Index		host = ms->host[slot];
+    double		took = s->job->work[t] * s->factor[host];
+
+    if (s->job->home[t] != QI_NIL && s->job->home[t] != host) {
+	took *= s->remote;
+    }
+    s->taken[t] = 1;
+    ms->state[slot] = ml_sRun;
+    ms->proc[slot] = t;
+    ms->start[slot] = s->now;
+    s->peer[slot] = QI_NIL;
+    QI_ADD(&ms->run, ms->link, slot);
+    sim_push(s, s->now + took, slot, s->epoch[slot]);
+}
+
+/* sim_straggler --
+ *
+ * Synopsis:
+ *
+ *    The running slot to copy with speculation, or QI_NIL.  The run
+ *    queue is in the order the slots started, so the first with no
+ *    copy is the one that has run longest; if it has not run long
+ *    enough yet, a wake-up is queued for when it will have.
+ */
+
+static QI_Index
+sim_straggler(Sim* s)
+{
+    MachineList*	ms = s->ms;
+    QI_Index		slot;
+    double		limit;
+
+    if (s->done == 0) {
+	return QI_NIL;
+    }
+    limit = s->slow * s->ranSum / s->done;
+    for (slot = QI_HEAD(&ms->run);  slot != QI_NIL;
+	 slot = QI_NEXT(ms->link, slot)) {
+	if (s->peer[slot] != QI_NIL) {
+	    continue;
+	}
+	if (s->now >= ms->start[slot] + limit) {
+	    return slot;
+	}
+	if (s->wakeAt < 0 || ms->start[slot] + limit < s->wakeAt) {
+	    s->wakeAt = ms->start[slot] + limit;
+	    sim_push(s, s->wakeAt, QI_NIL, 0);
+	}
+	break;
+    }
+    return QI_NIL;
+}
+
+/* sim_fill --
+ *
+ * Synopsis:
+ *
+ *    Start tasks on ready slots while there are tasks to start.
+ */
+
+static void
+sim_fill(Sim* s)
+{
+    MachineList*	ms = s->ms;
+    QI_Index		slot, victim;
+    size_t		t;
+
+    while (!QI_EMPTY(&ms->ready)) {
+	slot = QI_HEAD(&ms->ready);
+	t = sim_next(s, ms->host[slot]);
+	if (t != NO_TASK) {
+	    QI_TAKE(&ms->ready, ms->link, slot);
+	    sim_start(s, slot, t);
+	    continue;
+	}
+	if (s->policy != pSPECULATE || (victim = sim_straggler(s)) == QI_NIL) {
+	    break;
+	}
+	QI_TAKE(&ms->ready, ms->link, slot);
+	sim_start(s, slot, ms->proc[victim]);
+	s->peer[slot] = victim;
+	s->peer[victim] = slot;
+	s->backups++;
+    }
+}
+
+/* sim_finish --
+ *
+ * Synopsis:
+ *
+ *    The task on 'slot' has finished; free the slot, and kill the
+ *    other copy of the task, if any.
+ */
+
+static void
+sim_finish(Sim* s, QI_Index slot)
+{
+    MachineList*	ms = s->ms;
+    QI_Index		other = s->peer[slot];
+    double		ran = s->now - ms->start[slot];
+
+    s->busy += ran;
+    s->ranSum += ran;
+    s->done++;
+    s->finish[ms->proc[slot]] = s->now;
+    QI_REMOVE(&ms->run, ms->link, slot);
+    ML_ReleaseSlot(ms, slot);
+    if (other != QI_NIL) {
+	double	lost = s->now - ms->start[other];
+
+	s->busy += lost;
+	s->wasted += lost;
+	s->epoch[other]++;
+	QI_REMOVE(&ms->run, ms->link, other);
+	ML_ReleaseSlot(ms, other);
+    }
+}
+
+static int
+CompareDoubles(const void* a, const void* b)
+{
+    double	x = *(const double*) a;
+    double	y = *(const double*) b;
+
+    return x < y ? -1 : x > y;
+}
+
+static const double*	sortGuess;
+
+static int
+CompareGuess(const void* a, const void* b)
+{
+    const double*	guess = sortGuess;
+    double		x = guess[*(const size_t*) a];
+    double		y = guess[*(const size_t*) b];
+
+    if (x != y) {
+	return x > y ? -1 : 1;
+    }
+    return *(const size_t*) a < *(const size_t*) b ? -1 : 1;
+}
+
+/* Simulate --
+ *
+ * Run 'job' on the slots of 'ms' under 'policy'.
+ */
+
+static void
+Simulate(MachineList* ms, const Job* job, const double* factor,
+	 Policy policy, double remote, double slow, Result* r)
+{
+    Sim		s;
+    size_t*	order = (size_t*) NULL;
+    size_t	t, h;
+    QI_Index	slot;
+
+    memset(&s, 0, sizeof s);
+    s.ms = ms;
+    s.job = job;
+    s.factor = factor;
+    s.policy = policy;
+    s.remote = remote;
+    s.slow = slow;
+    s.wakeAt = -1.0;
+    s.taken = (uint8_t*) calloc(job->n + 1, 1);
+    /*FIXME: Out of memory */
+    s.finish = (double*) malloc((job->n + 1) * sizeof(double));
+    /*FIXME: Out of memory */
+    s.epoch = (uint32_t*) calloc(ms->mcnt + 1, sizeof(uint32_t));
+    /*FIXME: Out of memory */
+    s.peer = (QI_Index*) malloc((ms->mcnt + 1) * sizeof(QI_Index));
+    /*FIXME: Out of memory */
+
+    if (policy == pLPT) {
+	order = (size_t*) malloc((job->n + 1) * sizeof(size_t));
+	/*FIXME: Out of memory */
+	for (t = 0;  t < job->n;  ++t) {
+	    order[t] = t;
+	}
+	sortGuess = job->guess;
+	qsort(order, job->n, sizeof(size_t), CompareGuess);
+	s.order = order;
+    }
+    if (policy == pLOCALITY) {
+	s.first = (size_t*) calloc(ms->hcnt + 2, sizeof(size_t));
+	/*FIXME: Out of memory */
+	s.cursor = (size_t*) malloc((ms->hcnt + 1) * sizeof(size_t));
+	/*FIXME: Out of memory */
+	s.byHome = (size_t*) malloc((job->n + 1) * sizeof(size_t));
+	/*FIXME: Out of memory */
+	for (t = 0;  t < job->n;  ++t) {
+	    if (job->home[t] != QI_NIL) {
+		s.first[job->home[t] + 1]++;
+	    }
+	}
+	for (h = 0;  h < ms->hcnt;  ++h) {
+	    s.first[h + 1] += s.first[h];
+	    s.cursor[h] = s.first[h];
+	}
+	for (t = 0;  t < job->n;  ++t) {
+	    if (job->home[t] != QI_NIL) {
+		s.byHome[s.cursor[job->home[t]]++] = t;
+	    }
+	}
+	for (h = 0;  h < ms->hcnt;  ++h) {
+	    s.cursor[h] = s.first[h];
+	}
+    }
+
+    /* Every slot ready, in machine file order. */
+    QI_QUEUE_INIT(&ms->ready);
+    QI_QUEUE_INIT(&ms->run);
+    for (slot = 0;  slot < ms->mcnt;  ++slot) {
+	ms->state[slot] = ml_sReady;
+	QI_ADD(&ms->ready, ms->link, slot);
+    }
+
+    sim_fill(&s);
+    while (s.heapCnt > 0) {
+	Event	e = sim_pop(&s);
+
+	if (e.slot == QI_NIL) {
+	    s.now = e.when;
+	    if (e.when >= s.wakeAt) {
+		s.wakeAt = -1.0;
+	    }
+	} else if (e.epoch != s.epoch[e.slot]) {
+	    continue;
+	} else {
+	    s.now = e.when;
+	    sim_finish(&s, e.slot);
+	}
+	sim_fill(&s);
+    }
+
+    qsort(s.finish, job->n, sizeof(double), CompareDoubles);
+    r->makespan = job->n > 0 ? s.finish[job->n - 1] : 0.0;
+    r->util = r->makespan > 0 ? s.busy / (ms->liveCnt * r->makespan) : 0.0;
+    r->p50 = s.finish[(size_t) (0.50 * (job->n - 1))];
+    r->p95 = s.finish[(size_t) (0.95 * (job->n - 1))];
+    r->p99 = s.finish[(size_t) (0.99 * (job->n - 1))];
+    r->backups = s.backups;
+    r->wasted = s.wasted;
+
+    free(s.taken);
+    free(s.finish);
+    free(s.epoch);
+    free(s.peer);
+    free(s.heap);
+    free(order);
+    free(s.first);
+    free(s.cursor);
+    free(s.byHome);
+}
+
+static void
+Usage(void)
+{
+    fprintf(stderr, "Usage: rosim -machinefile MF (-trace FILE | -synthetic N:DIST)\n"
+	    "             [-policy LIST] [-speed SIGMA] [-remote FACTOR]\n"
+	    "             [-noise SIGMA] [-slow FACTOR] [-seed N] [-json]\n");
+    exit(1);
+}
+
+int
+main(int argc, char** argv)
+{
+    const char*		mfPath = NULL;
+    const char*		tracePath = NULL;
+    const char*		synthetic = NULL;
+    const char*		policies = "fifo,lpt,locality,speculate";
+    double		speed = 0.0, remote = 1.0, noise = 0.0, slow = 1.5;
+    int			json = 0;
+    int			want[pCOUNT];
+    MachineList*	ms;
+    FILE*		mff;
+    char		err[256];
+    double*		factor;
+    Job			job;
+    double		sum = 0.0, longest = 0.0;
+    size_t		h, t;
+    int			i, p;
+
+    for (i = 1;  i < argc;  ++i) {
+	if (!strcmp(argv[i], "-json")) {
+	    json = 1;
+	} else if (i + 1 == argc) {
+	    Usage();
+	} else if (!strcmp(argv[i], "-machinefile")) {
+	    mfPath = argv[++i];
+	} else if (!strcmp(argv[i], "-trace")) {
+	    tracePath = argv[++i];
+	} else if (!strcmp(argv[i], "-synthetic")) {
+	    synthetic = argv[++i];
+	} else if (!strcmp(argv[i], "-policy")) {
+	    policies = argv[++i];
+	} else if (!strcmp(argv[i], "-speed")) {
+	    speed = strtod(argv[++i], NULL);
+	} else if (!strcmp(argv[i], "-remote")) {
+	    remote = strtod(argv[++i], NULL);
+	} else if (!strcmp(argv[i], "-noise")) {
+	    noise = strtod(argv[++i], NULL);
+	} else if (!strcmp(argv[i], "-slow")) {
+	    slow = strtod(argv[++i], NULL);
+	} else if (!strcmp(argv[i], "-seed")) {
+	    rngState = strtoull(argv[++i], NULL, 0) * 0x9e3779b97f4a7c15ULL + 1;
+	} else {
+	    Usage();
+	}
+    }
+    if (mfPath == NULL || (tracePath == NULL) == (synthetic == NULL)
+	|| speed < 0 || remote <= 0 || noise < 0 || slow <= 0) {
+	Usage();
+    }
+    memset(want, 0, sizeof want);
+    {
+	const char*	w = policies;
+
+	while (*w) {
+	    size_t	len = strcspn(w, ",");
+
+	    for (p = 0;  p < pCOUNT; ++p) {
+		if (strlen(policyNames[p]) == len
+		    && !strncmp(w, policyNames[p], len)) {
+		    break;
+		}
+	    }
+	    if (p == pCOUNT) {
+		fprintf(stderr, "rosim: Unknown policy \"%.*s\"\n", (int) len, w);
+		exit(1);
+	    }
+	    want[p] = 1;
+	    w += len;
+	    if (*w == ',') {
+		w++;
+	    }
+	}
+    }
+
+    mff = fopen(mfPath, "r");
+    if (mff == NULL) {
+	fprintf(stderr, "rosim: Can't open machine file \"%s\"\n", mfPath);
+	exit(1);
+    }
+    ms = ParseMachineFile(mff, err, sizeof err);
+    fclose(mff);
+    if (ms == NULL) {
+	fprintf(stderr, "rosim: %s: %s\n", mfPath, err);
+	exit(1);
+    }
+    if (ms->liveCnt == 0) {
+	fprintf(stderr, "rosim: %s: no slots\n", mfPath);
+	exit(1);
+    }
+
+    factor = (double*) malloc((ms->hcnt + 1) * sizeof(double));
+    /*FIXME: Out of memory */
+    for (h = 0;  h < ms->hcnt;  ++h) {
+	factor[h] = 1.0;
+    }
+    if (tracePath != NULL) {
+	LoadTrace(&job, tracePath, ms, factor);
+    } else {
+	Dist		d;
+	char*		end;
+	unsigned long	n = strtoul(synthetic, &end, 0);
+
+	if (*end != ':' || n == 0 || ParseDist(end + 1, &d) < 0) {
+	    fprintf(stderr, "rosim: Bad synthetic job \"%s\"\n", synthetic);
+	    exit(1);
+	}
+	Synthesize(&job, n, &d, ms);
+    }
+    for (h = 0;  h < ms->hcnt;  ++h) {
+	factor[h] *= exp(speed * Normal());
+    }
+    for (t = 0;  t < job.n;  ++t) {
+	double	at = job.work[t] * (job.home[t] != QI_NIL ? factor[job.home[t]] : 1.0);
+
+	job.guess[t] = job.work[t] * exp(noise * Normal());
+	sum += at;
+	if (at > longest) {
+	    longest = at;
+	}
+    }
+
+    if (!json) {
+	printf("%lu tasks on %lu slots; %.2fs of work at home, the longest %.2fs\n\n",
+	       (unsigned long) job.n, (unsigned long) ms->liveCnt, sum, longest);
+	printf("%-10s %12s %7s %12s %12s %12s %8s %12s\n", "policy",
+	       "makespan", "util", "p50", "p95", "p99", "backups", "wasted");
+    }
+    for (p = 0;  p < pCOUNT;  ++p) {
+	Result	r;
+
+	if (!want[p]) {
+	    continue;
+	}
+	Simulate(ms, &job, factor, (Policy) p, remote, slow, &r);
+	if (json) {
+	    printf("{\"policy\":\"%s\",\"tasks\":%lu,\"slots\":%lu,"
+		   "\"makespan\":%.6f,\"utilisation\":%.6f,\"p50\":%.6f,"
+		   "\"p95\":%.6f,\"p99\":%.6f,\"backups\":%lu,\"wasted\":%.6f}\n",
+		   policyNames[p], (unsigned long) job.n,
+		   (unsigned long) ms->liveCnt, r.makespan, r.util,
+		   r.p50, r.p95, r.p99, (unsigned long) r.backups, r.wasted);
+	} else {
+	    printf("%-10s %12.2f %6.1f%% %12.2f %12.2f %12.2f %8lu %12.2f\n",
+		   policyNames[p], r.makespan, 100.0 * r.util, r.p50, r.p95,
+		   r.p99, (unsigned long) r.backups, r.wasted);
+	}
+	fflush(stdout);
+    }
+
+    free(job.work);
+    free(job.guess);
+    free(job.home);
+    free(factor);
+    ML_Destroy(ms);
+    return 0;
+}
@@ -11,12 +11,26 @@
 #define RO_MACHINE_SCRIPT	"./machine-script.sh"
 #endif
 
-#define MAX_MACHINE_LINE	1024
 #define MAX_CONFIG_LINE		1024
+#define DEFAULT_KILL_GRACE	5
+#define TIMEOUT_TICK		0.01	/* Seconds; timer wheel resolution. */
+#define DEFAULT_PROBE_COMMAND	"true"
+#define DEFAULT_STAGE_TIMEOUT	600	/* Seconds staging may take. */
+#define BATCH_MAX		1024	/* Processes in one batch. */
+#define BATCH_TARGET		1.0	/* Seconds; -batch auto aims for this. */
+#define DEFAULT_ORDER_BUDGET	64	/* Megabytes -keep-order holds in memory. */
+#define REPLAY_BUF		65536	/* Bytes of cached output copied at once. */
+#define PFD_KVS			QI_NIL		/* pfdSlot entries that are */
+#define PFD_WRITER		(QI_NIL - 1)	/* not slots. */
+#define PFD_ADAPT		(QI_NIL - 2)
+
+#define _GNU_SOURCE		/* For ppoll. */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <stdarg.h>
+#include <limits.h>
 #include <string.h>
 #include <assert.h>
 #include <ctype.h>
@@ -25,11 +39,39 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <poll.h>
 #include <fcntl.h>
+#include <time.h>
+#include <netdb.h>
+#include <ifaddrs.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
 
-#include "qo.h"
+#include "qi.h"
 #include "ca.h"
 #include "av.h"
+#include "jnl.h"
+#include "dag.h"
+#include "hist.h"
+#include "topo.h"
+#include "stage.h"
+#include "ml.h"
+#include "tw.h"
+#include "sweep.h"
+#include "tmpl.h"
+#include "batch.h"
+#include "order.h"
+#include "kvs.h"
+#include "aw.h"
+#include "adapt.h"
+#include "pack.h"
+#include "rcache.h"
+#include "prefetch.h"
+#include "shard.h"
+#include "prof.h"
 
 
 /* Configuration information.
@@ -39,6 +81,23 @@ typedef struct roConfigData {
     char*	machineScript;
     char*	jobName;
     char*	spawnCommand;
+    char*	killCommand;
+    unsigned	killGrace;
+    int		localExec;
+    int		remoteCpus;	/* Assumed remote topology; 0 if */
+    int		remoteNodes;	/* the same as this host. */
+    char*	stageDir;	/* Staging directory template. */
+    char*	stagePath;	/* Rendered, once staged. */
+    double	stageTimeout;	/* Seconds, or 0 for no limit. */
+    char*	probeCommand;
+    SWP_Sweep*	sweep;		/* Parameters of the templates, or NULL. */
+    size_t	orderBudget;	/* Bytes; for -keep-order. */
+    size_t	procCnt;	/* Processes in the job. */
+    const char*	kvsAddress;	/* Rendezvous service, or NULL. */
+    const char*	kvsToken;	/* Its token, or NULL. */
+    AW_Backend	writer;		/* For captured output. */
+    double	adaptInterval;	/* Seconds between load samples. */
+    char*	loadCommand;	/* Prints a host's load; see adapt.h. */
 } roConfigData;
 
 typedef struct roJobData {
@@ -46,119 +105,292 @@ typedef struct roJobData {
     const char*	outTemplate;
     const char*	errTemplate;
     const char**	progargv;
+    JNL_Control*	journal;
+    JNL_RankSet		skip;
+    DAG_Graph*		dag;
+    HIST_Table*		history;
+    size_t*		order;		/* Dispatch order, or NULL. */
+    size_t		orderCnt;
+    int			lpt;
+    double		timeout;	/* Seconds; 0 for none. */
+    TW_Wheel*		timers;		/* Slot deadlines, or NULL. */
+    size_t		timedOutCnt;
+    size_t		batch;		/* Processes per batch; 0 for none. */
+    int			batchAuto;	/* Size batches from rankTime. */
+    struct SlotBatch*	batches;	/* By slot, when batching. */
+    double		rankTime;	/* Seconds per process; < 0 unknown. */
+    char		batchMark[BAT_MARK_MAX];
+    size_t		markLen;
+    struct pollfd*	pfd;		/* Output pipes being waited on. */
+    QI_Index*		pfdSlot;
+    ORD_Control*	ordered;	/* Standard output in rank order, or NULL. */
+    struct SlotOutput*	slotOut;	/* By slot, when ordered. */
+    KVS_Server*		kvs;		/* Rendezvous service, or NULL. */
+    AW_Writer*		writer;		/* Writes captured output, or NULL. */
+    AD_Control*		adapt;		/* Adapts slots to load, or NULL. */
+    const char*		needTemplate;	/* What each process needs, or NULL. */
+    PK_Pack*		pack;		/* Places by need, or NULL. */
+    int			elastic;	/* Reload the machine list on SIGHUP. */
+    const char*		machineFile;	/* Where it came from; NULL for the script. */
+    FILE*		trace;		/* Where processes are recorded, or NULL. */
+    double		traceOrigin;	/* When the job started. */
+    RC_Cache*		cache;		/* Results of earlier runs, or NULL. */
+    const char**	inputTemplates;	/* Inputs the cache key covers. */
+    struct SlotSpool*	spool;		/* By slot, with a cache. */
+    size_t		cacheNext;	/* Next process to look up ahead. */
+    size_t		cacheProc;	/* Process whose key is below. */
+    int			cacheKeyed;
+    RC_Key		cacheKey;
+    PF_Prefetcher*	prefetch;	/* Reads inputs ahead, or NULL. */
+    size_t		prefetchAhead;	/* Processes to look ahead. */
+    size_t		prefetchNext;	/* Next place in the order to hint. */
+    size_t		shardCnt;	/* Threads starting processes; 0 for none. */
+    SH_Sched*		shards;		/* While they are starting them. */
 } roJobData;
 
-
-/* MachineItem and MachineList --
+/* SlotBatch --
  *
- * A MachineItem object represents an instance of a process on a
- * particular machine.  It needs to include the hostname, the status
- * of the job currently in progress, and various queue linkages.
+ * The processes a slot is running as one batch, and the pipes their
+ * output comes back on.  The two streams each count the records they
+ * have passed, which tells whose output they are carrying.
+ */
+
+typedef struct SlotBatch {
+    size_t*		ranks;
+    size_t		cnt;		/* 0 if the slot has no batch. */
+    size_t		outIdx;
+    size_t		errIdx;
+    BAT_Stream*		out;
+    BAT_Stream*		err;
+    double		rankStart;
+} SlotBatch;
+
+/* SlotOutput --
  *
- * A MachineList object contains a set of MachineItem objects, as well
- * as the queue control blocks for those items.
+ * Where the standard output a slot is reading goes, with -keep-order:
+ * the rank it belongs to.  A slot not running a batch reads it from
+ * its own pipe.
  */
 
-typedef struct MachineItem {
-    char*		mname;
-    pid_t		runPid;
-    QUEUE_LINKAGE(all, struct MachineItem*);
-    QUEUE_LINKAGE(ready, struct MachineItem*);
-    QUEUE_LINKAGE(run, struct MachineItem*);
-} MachineItem;
+typedef struct SlotOutput {
+    ORD_Control*	oc;
+    size_t		rank;
+    BAT_Stream*		capture;	/* NULL if none, or batching. */
+} SlotOutput;
 
-typedef struct MachineList {
-    size_t		mcnt;
-    QUEUE_CONTROL_BLOCK(all, struct MachineItem*);
-    QUEUE_CONTROL_BLOCK(ready, struct MachineItem*);
-    QUEUE_CONTROL_BLOCK(run, struct MachineItem*);
-} MachineList;
+/* SlotSpool --
+ *
+ * With -cache, where the output of a process with a key goes while it
+ * runs: two anonymous files, passed on when it ends, and stored in the
+ * cache if it succeeded.
+ */
 
+typedef struct SlotSpool {
+    int			keyed;		/* 0 if the output is not spooled. */
+    int			out;
+    int			err;
+    RC_Key		key;
+} SlotSpool;
 
-/* ParseMachineFile --
+/* ShardJob --
  *
- * Parse the machine file information from the specified file stream.
- * Return a machine structure.
+ * With -shards, what the shards need to start processes and record
+ * their exits.
  */
-MachineList*
-ParseMachineFile(FILE* mff)
-{
-    MachineList*	ms;
-    MachineItem*	mi;
-    char		ml[MAX_MACHINE_LINE+1];
 
-    /*
-     * Allocate, initialize the MachineList object.
-     */
-    ms = (MachineList*) malloc(sizeof(MachineList));
-    /*FIXME: Out of memory */
-    ms->mcnt = 0;
-    QUEUE_CONTROL_BLOCK_INIT(all, ms);
-    QUEUE_CONTROL_BLOCK_INIT(ready, ms);
-    QUEUE_CONTROL_BLOCK_INIT(run, ms);
+typedef struct ShardJob {
+    char*		progname;
+    MachineList*	ms;
+    roConfigData*	rcd;
+    roJobData*		rjd;
+} ShardJob;
 
-    /*
-     * Read lines from machine file, and parse.
-     */
-    while (fgets(ml, MAX_MACHINE_LINE+1, mff) != NULL) {
-	size_t	mls = strlen(ml);
-	char*	cp;
+
+/* IsLocalAddress --
+ *
+ * True iff 'name' is a numeric address of one of this machine's
+ * network interfaces.
+ */
 
-	/*
-	 * Remove trailing newline.  If missing, the line was
-	 * truncated.
-	 */
-	if (ml[--mls] == '\n') {
-	    ml[mls] = '\0';
-	}
-	/*FIXME: What to do if line was truncated? */
+static int
+IsLocalAddress(const char* name)
+{
+    unsigned char	addr[sizeof(struct in6_addr)];
+    int			family;
+    struct ifaddrs*	ifa;
+    struct ifaddrs*	ip;
+    int			found = 0;
 
-	/*
-	 * Skip leading whitespace.  Check if we have a comment or
-	 * blank line.
-	 */
-	for (cp = ml;  *cp && isspace(*cp);  ++cp)
-	    ;
-	if (!*cp || *cp == '#') {
+    if (inet_pton(AF_INET, name, addr) == 1) {
+	family = AF_INET;
+    } else if (inet_pton(AF_INET6, name, addr) == 1) {
+	family = AF_INET6;
+    } else {
+	return 0;
+    }
+    if (family == AF_INET && addr[0] == 127) {
+	return 1;
+    }
+    if (getifaddrs(&ifa) < 0) {
+	return 0;
+    }
+    for (ip = ifa;  ip != NULL && !found;  ip = ip->ifa_next) {
+	if (ip->ifa_addr == NULL || ip->ifa_addr->sa_family != family) {
 	    continue;
 	}
+	if (family == AF_INET) {
+	    found = !memcmp(&((struct sockaddr_in*) ip->ifa_addr)->sin_addr,
+			    addr, sizeof(struct in_addr));
+	} else {
+	    found = !memcmp(&((struct sockaddr_in6*) ip->ifa_addr)->sin6_addr,
+			    addr, sizeof(struct in6_addr));
+	}
+    }
+    freeifaddrs(ifa);
+    return found;
+}
 
-	/*
-	 * Clean up any trailing whitespace.
-	 */
-	{
-	    char *ecp;
-	    for (ecp = cp + strlen(cp) - 1;  isspace(*ecp);  --ecp) {
-		*ecp = '\0';
+/* IsLocalHost --
+ *
+ * True iff the machine name refers to this machine: "localhost", this
+ * machine's host name (with or without its domain) or canonical name,
+ * or one of its addresses.  Other names are not looked up, so that a
+ * large machine list costs no DNS traffic.
+ */
+
+static int
+IsLocalHost(const char* name)
+{
+    static char		hostName[256];
+    static char		canonName[256];
+    static int		haveNames = 0;
+    size_t		sl;
+
+    if (!haveNames) {
+	struct addrinfo	hints;
+	struct addrinfo*	ai;
+
+	hostName[0] = canonName[0] = '\0';
+	if (gethostname(hostName, sizeof(hostName)) == 0) {
+	    hostName[sizeof(hostName)-1] = '\0';
+	    memset(&hints, 0, sizeof(hints));
+	    hints.ai_flags = AI_CANONNAME;
+	    if (getaddrinfo(hostName, NULL, &hints, &ai) == 0) {
+		if (ai->ai_canonname != NULL) {
+		    strncpy(canonName, ai->ai_canonname, sizeof(canonName)-1);
+		    canonName[sizeof(canonName)-1] = '\0';
+		}
+		freeaddrinfo(ai);
 	    }
 	}
+	haveNames = 1;
+    }
 
-	/*
-	 * Create a machine item.  Add it to the list of machines.
-	 */
-	mi = (MachineItem*) malloc(sizeof(MachineItem));
-	/*FIXME: OOM */
-	mi->mname = (char*) malloc(strlen(cp) + 1);
-	/*FIXME: OOM */
-	strcpy(mi->mname, cp);
-	QUEUE_ADD(all, ms, mi);
-	QUEUE_ADD(ready, ms, mi);
-	ms->mcnt++;
+    if (0 == strcmp(name, "localhost")
+	|| 0 == strncmp(name, "localhost.", 10)) {
+	return 1;
+    }
+    if (hostName[0]) {
+	if (0 == strcmp(name, hostName)) {
+	    return 1;
+	}
+	/* The short name, when the host name is fully qualified. */
+	sl = strlen(name);
+	if (0 == strncmp(name, hostName, sl) && hostName[sl] == '.') {
+	    return 1;
+	}
     }
-    return ms;
+    if (canonName[0] && 0 == strcmp(name, canonName)) {
+	return 1;
+    }
+    return IsLocalAddress(name);
 }
-
+
+/* MarkLocalMachines --
+ *
+ * Flag the hosts that are this host, so processes can be run on them
+ * without the spawn command.
+ */
+
+static void
+MarkLocalMachines(MachineList* ms)
+{
+    size_t	h;
+
+    for (h = 0;  h < ms->hcnt;  ++h) {
+	ms->hosts[h].isLocal = IsLocalHost(ms->hosts[h].name);
+    }
+}
+
+/* PlaceMachines --
+ *
+ * Give each slot a fixed set of CPUs and memory nodes under the
+ * pinning policy.  The slots of a host are numbered in machine list
+ * order, and divide up that host's topology: this host's own, for
+ * local slots, or the configured (or else this host's) topology for
+ * remote ones.
+ */
+
+static void
+PlaceMachines(MachineList* ms, roConfigData* rcd, TOPO_Policy policy)
+{
+    TOPO_Info		local;
+    TOPO_Info		remote;
+    size_t*		total;
+    size_t*		seen;
+    size_t		s;
+
+    TOPO_Local(&local);
+    if (rcd->remoteCpus > 0) {
+	TOPO_Uniform(&remote, rcd->remoteCpus, rcd->remoteNodes);
+    } else {
+	remote = local;
+    }
+
+    ms->pin = (MachinePin*) calloc(ms->mmax, sizeof(MachinePin));
+    total = (size_t*) calloc(ms->hcnt, sizeof(size_t));
+    seen = (size_t*) calloc(ms->hcnt, sizeof(size_t));
+    /*FIXME: Out of memory */
+    for (s = 0;  s < ms->mcnt;  ++s) {
+	total[ms->host[s]]++;
+    }
+    for (s = 0;  s < ms->mcnt;  ++s) {
+	QI_Index	h = ms->host[s];
+	MachinePin*	mp = &ms->pin[s];
+
+	TOPO_Assign(ms->hosts[h].isLocal ? &local : &remote, policy,
+		    seen[h]++, total[h], &mp->place);
+	mp->cpuList = TOPO_CpuList(&mp->place);
+	mp->nodeList = TOPO_NodeList(&mp->place);
+    }
+    free(total);
+    free(seen);
+}
+
 /* MainSignalHandler --
  *
  * Synopsis:
  *
  *     Signal handler for the main program.  This flags that SIGINT
- *     etc. has been received; the signal is then propogated to any
- *     running spawner subprocesses.  Those spawners are responsible,
- *     in turn, for propogating the signal to the remote machine.
+ *     etc. has been received; the main loop notices the flag, stops
+ *     spawning, and tears the job down (see TeardownJob).  SIGALRM
+ *     marks the end of the teardown grace period.  With -elastic,
+ *     SIGHUP asks for the machine list to be reloaded.
+ */
+static volatile sig_atomic_t saw_SIGINT = 0;
+static volatile sig_atomic_t saw_SIGQUIT = 0;
+static volatile sig_atomic_t saw_SIGTERM = 0;
+static volatile sig_atomic_t saw_SIGALRM = 0;
+static volatile sig_atomic_t saw_SIGHUP = 0;
+
+/*
+ * While the job runs, the signals above (and SIGCHLD) are blocked
+ * except while WaitOnMachines sleeps, so one cannot arrive between
+ * checking for it and going to sleep.  Children get the original mask
+ * back before they exec.
  */
-static sig_atomic_t saw_SIGINT = 0;
-static sig_atomic_t saw_SIGQUIT = 0;
+static sigset_t origMask;
+static sigset_t waitMask;
 static void
 MainSignalHandler(int s)
 {
@@ -169,262 +401,2311 @@ MainSignalHandler(int s)
     case SIGQUIT:
 	saw_SIGQUIT = 1;
 	break;
+    case SIGTERM:
+	saw_SIGTERM = 1;
+	break;
+    case SIGALRM:
+	saw_SIGALRM = 1;
+	break;
+    case SIGHUP:
+	saw_SIGHUP = 1;
+	break;
+    case SIGCHLD:
+	/* Just interrupts the wait. */
+	break;
     default:
 	break;
     }	
 }
-
-/* WaitOnMachines --
+
+/* PendingSignal --
  *
- * Wait for a process to complete, and move the corresponding
- * MachineItem from the run queue to the ready queue.
+ * Return the terminating signal that has been received, or 0 if none
+ * has.  SIGTERM takes precedence, then SIGINT, then SIGQUIT.
  */
 
-static void
-WaitOnMachines(MachineList* ms)
+static int
+PendingSignal(void)
 {
-    pid_t	rc;
-    int		ws;
-
-    rc = wait(&ws);
-    if (rc > 0) {
-	MachineItem*	mi;
-	/*
-	 * rc is the pid of the child that exited.  Scan through the
-	 * run queue to identify the MachineItem, and move it to the
-	 * ready queue.
-	 */
-	for (mi = QUEUE_HEAD(run, ms);  mi != NULL;  mi = QUEUE_NEXT(run, mi)) {
-	    if (mi->runPid == rc) {
-		break;
-	    }
-	}
-	if (mi != NULL) {
-	    QUEUE_REMOVE(run, ms, mi);
-	    QUEUE_ADD(ready, ms, mi);
-	}
-    } else if (errno == EINTR) {
-	/*
-	 * A signal was caught.  Pass it along to the various spawner
-	 * subprocesses.
-	 */
-	printf("Caught signal!\n");
-	if (saw_SIGINT) {
-	    printf("Handle SIGINT\n");
-	} else if (saw_SIGQUIT) {
-	    printf("Handle SIGQUIT\n");
-	}
+    if (saw_SIGTERM) {
+	return SIGTERM;
+    } else if (saw_SIGINT) {
+	return SIGINT;
+    } else if (saw_SIGQUIT) {
+	return SIGQUIT;
     }
+    return 0;
 }
 
-
-/* GetReadyMachine --
+/* Now --
  *
- * Get a machine from the 'ready' queue.  Wait if neccessary.
+ * Seconds on the monotonic clock.
  */
 
-static
-MachineItem*
-GetReadyMachine(MachineList* ms)
+static double
+Now(void)
 {
-    MachineItem* mi;
-
-    do {
-	QUEUE_TAKE(ready, ms, mi);
-	if (mi != NULL) {
-	    return mi;
-	}
+    struct timespec	ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
 
-	WaitOnMachines(ms);
-    } while (1);
+/* Sooner --
+ *
+ * Shorten a ppoll timeout, '*timeout' (NULL for none), to 'delay'
+ * seconds if that is sooner, keeping it in 'ts'.
+ */
 
+static void
+Sooner(struct timespec* ts, struct timespec** timeout, double delay)
+{
+    if (delay < 0.0) {
+	delay = 0.0;
+    }
+    if (*timeout != NULL && ts->tv_sec + ts->tv_nsec * 1e-9 <= delay) {
+	return;
+    }
+    ts->tv_sec = (time_t) delay;
+    ts->tv_nsec = (long) ((delay - (time_t) delay) * 1e9);
+    *timeout = ts;
 }
-
+
 /* RewriteString --
  *
  * Generate a string, to be freed with "free" by the caller, with
- * substitutions performed.
+ * substitutions performed.  The slot substitutions (%c and %m) are
+ * empty if 'mp' is NULL (the slot is not pinned, or there is no
+ * slot), the staging directory (%s) is empty if nothing was
+ * staged, and the rendezvous address and token (%k and %t) are empty
+ * without -kvs.  A
+ * sweep parameter (%{NAME=...} or %{NAME}) is replaced by
+ * its value at point 'proc'.
  */
 
 static char*
-RewriteString(const char* param, roConfigData* rcd, size_t proc)
+RewriteString(const char* param, roConfigData* rcd, MachinePin* mp, size_t proc)
 {
-    CharAccum	ca;
-    char	buf[50];
-
-    const char*	pp;
-
-    enum { fsCHAR, fsPCT } fmtState = fsCHAR;
+    TMPL_Values	tv;
 
-    CHARACCUM_INIT(&ca);
-
-    /*
-     * Copy from param to cp.
-     */
-    for (pp = param;  *pp;  ++pp) {
-	switch (fmtState) {
-	case fsCHAR:
-	    if (*pp == '%') {
-		fmtState = fsPCT;
-	    } else {
-		CHARACCUM_APPEND_CHAR(&ca, *pp);
-	    }
-	    break;
-	case fsPCT:
-	    switch (*pp) {
-	    case '%':
-		CHARACCUM_APPEND_CHAR(&ca, '%');
-		fmtState = fsCHAR;
-		break;
-	    case 'j':
-		CHARACCUM_APPEND_STR(&ca, rcd->jobName);
-		fmtState = fsCHAR;
-		break;
-	    case 'p':
-		sprintf(buf, "%lu", (unsigned long) proc);
-		CHARACCUM_APPEND_STR(&ca, buf);
-		fmtState = fsCHAR;
-	    default:
-		/* FIXME: What to do here??? */
-		fmtState = fsCHAR;
-		break;
-	    }
-	}
-    }
-
-    CHARACCUM_FINALIZE(&ca);
+    tv.jobName = rcd->jobName;
+    tv.stagePath = rcd->stagePath;
+    tv.kvsAddress = rcd->kvsAddress;
+    tv.kvsToken = rcd->kvsToken;
+    tv.procCnt = rcd->procCnt;
+    tv.sweep = rcd->sweep;
+    return TMPL_Rewrite(param, &tv, mp ? mp->cpuList : NULL,
+			mp ? mp->nodeList : NULL, proc);
 }
-
-/* SpawnProcess --
+
+/* KeyString --
  *
- * Spawn a process.
+ * As RewriteString, for a runtime history key.  The rendezvous
+ * address (%k) and token (%t) change from run to run, and are not
+ * known yet when the job is planned, so they are left as written; a
+ * process keeps its key across runs.
  */
 
-void
-SpawnProcess(const char* progname, MachineList* ms, MachineItem* mi, roConfigData* rcd, size_t proc, roJobData* rjd)
+static char*
+KeyString(const char* param, roConfigData* rcd, size_t proc)
 {
-    const char**	nv;
-    const char*		inPath = (const char*) NULL;
-    const char*		outPath = (const char*) NULL;
-    const char*		errPath = (const char*) NULL;
-    pid_t		pid;
+    TMPL_Values	tv;
 
-    /* 
-     * Rewrite args, inserting spawn command and remote host name.
-     */
-    {
-	const char**	ap;
-	AV_Control	avc;
+    tv.jobName = rcd->jobName;
+    tv.stagePath = rcd->stagePath;
+    tv.kvsAddress = "%k";
+    tv.kvsToken = "%t";
+    tv.procCnt = rcd->procCnt;
+    tv.sweep = rcd->sweep;
+    return TMPL_Rewrite(param, &tv, NULL, NULL, proc);
+}
 
-	AV_Init(&avc);
+/* TaskArgv --
+ *
+ * The argument templates for a process: the task's own command when
+ * running a task graph, or the program and its arguments.
+ */
 
-	AV_AddString(&avc, rcd->spawnCommand);
-	AV_AddString(&avc, mi->mname);
+static const char**
+TaskArgv(roJobData* rjd, size_t proc)
+{
+    if (rjd->dag != NULL) {
+	return rjd->dag->tasks[proc].argv;
+    }
+    return rjd->progargv;
+}
 
-	for (ap = rjd->progargv; *ap != NULL;  ++ap) {
-	    const char*	np;
-	    np = RewriteString(*ap, rcd, proc);
-	    AV_AddString(&avc, np);
-	    free((char*) np);
-	}
+/* TaskKey --
+ *
+ * The runtime history key for a process: a hash of its rendered
+ * command line and input path, as KeyString renders them.
+ */
 
-	nv = AV_Finalize(&avc, NULL);
+static uint64_t
+TaskKey(roConfigData* rcd, roJobData* rjd, size_t proc)
+{
+    uint64_t		h = HIST_HASH_INIT;
+    const char**	ap;
+    char*		np;
 
+    for (ap = TaskArgv(rjd, proc);  *ap != NULL;  ++ap) {
+	np = KeyString(*ap, rcd, proc);
+	h = HIST_Hash(h, np);
+	free(np);
     }
     if (rjd->inTemplate) {
-	inPath = RewriteString(rjd->inTemplate, rcd, proc);
-    }
-    if (rjd->outTemplate) {
-	outPath = RewriteString(rjd->outTemplate, rcd, proc);
-    }
-    if (rjd->errTemplate) {
-	errPath = RewriteString(rjd->errTemplate, rcd, proc);
+	np = KeyString(rjd->inTemplate, rcd, proc);
+	h = HIST_Hash(h, np);
+	free(np);
     }
+    return h;
+}
 
+/* OpenRankOutput --
+ *
+ * Open the file that output of process 'proc' goes to, from the
+ * template, as SpawnProcess would; or use 'fd' if there is no
+ * template.  Returns -1 (discard the output) if the file cannot be
+ * opened.
+ */
 
-    /*
-     * Fork.
-     */
+static int
+OpenRankOutput(char* progname, MachineList* ms, QI_Index slot, roConfigData* rcd, const char* tmpl, size_t proc, int fd)
+{
+    char*	path;
 
-    pid = fork();
-    if (pid > 0) {
-	/*
-	 * I am parent process.
-	 */
-	mi->runPid = pid;
-    } else if (pid == 0) {
-	/*
-	 * I am child process.
-	 */
+    if (tmpl == NULL) {
+	return fd;
+    }
+    path = RewriteString(tmpl, rcd,
+			 ms->pin && slot != QI_NIL ? &ms->pin[slot] : NULL, proc);
+    fd = open(path, O_WRONLY|O_APPEND|O_CREAT, 0644);
+    if (fd < 0) {
+	fprintf(stderr, "%s: Error opening \"%s\": %s\n",
+		progname, path, strerror(errno));
+    }
+    free(path);
+    return fd;
+}
 
-	if (inPath) {
-	    int fd = open(inPath, O_RDONLY);
-	    if (fd < 0) {
-		fprintf(stderr, "%s: Error opening \"%s\": %s\n",
-			progname, inPath, strerror(errno));
-		exit(1);
-	    }
-	    if (fd != 0) {
-		close(0);
-		dup2(fd, 0);
-		close(fd);
-	    }
-	}
+/* TraceProcess --
+ *
+ * With -trace, record a completed process: its rank, the host it ran
+ * on, when it started and how long it took, both in seconds, and how
+ * it ended (its exit code, 128 plus the signal that killed it, or -1
+ * if it timed out).
+ */
 
-	if (outPath) {
-	    int fd = open(outPath, O_WRONLY|O_APPEND|O_CREAT, 0644);
-	    if (fd < 0) {
-		fprintf(stderr, "%s: Error opening \"%s\": %s\n",
-			progname, outPath, strerror(errno));
-		exit(1);
-	    }
-	    if (fd != 1) {
-		close(1);
-		dup2(fd, 1);
-		close(fd);
-	    }
-	}
+static void
+TraceProcess(MachineList* ms, QI_Index slot, roJobData* rjd, size_t proc,
+	     double start, int ws)
+{
+    int		status;
 
-	if (errPath) {
-	    int fd = open(errPath, O_WRONLY|O_APPEND|O_CREAT, 0644);
-	    if (fd < 0) {
-		fprintf(stderr, "%s: Error opening \"%s\": %s\n",
-			progname, errPath, strerror(errno));
-		exit(1);
-	    }
-	    if (fd != 2) {
-		close(2);
-		dup2(fd, 2);
-		close(fd);
-	    }
-	}
+    if (ws == JNL_TIMEDOUT) {
+	status = -1;
+    } else if (WIFEXITED(ws)) {
+	status = WEXITSTATUS(ws);
+    } else {
+	status = 128 + WTERMSIG(ws);
+    }
+    fprintf(rjd->trace, "%llu %s %.6f %.6f %d\n", (unsigned long long) proc,
+	    ML_NAME(ms, slot), start - rjd->traceOrigin, Now() - start, status);
+}
 
-	signal(SIGINT, SIG_DFL);
-	signal(SIGQUIT, SIG_DFL);
-	setsid();
+/* FinishRank --
+ *
+ * Record a process of a batch that has completed: in the journal,
+ * the runtime history, and the running estimate of process time.
+ * With -keep-order, its output is complete.
+ */
 
-	execvp(nv[0], (char* const*)nv);
-	/*FIXME: Big error!!! */
-    }
+static void
+FinishRank(MachineList* ms, QI_Index slot, roConfigData* rcd, roJobData* rjd, size_t proc, int ws)
+{
+    SlotBatch*	sb = &rjd->batches[slot];
+    double	now = Now();
+    double	took = now - sb->rankStart;
+    int		ok = WIFEXITED(ws) && WEXITSTATUS(ws) == 0;
 
-    free((char*) nv);
-    if (outPath) {
-	free((char*) outPath);
+    if (rjd->journal != NULL) {
+	JNL_Append(rjd->journal, proc, ws);
     }
-    if (errPath) {
-	free((char*) errPath);
+    if (rjd->trace != NULL) {
+	TraceProcess(ms, slot, rjd, proc, sb->rankStart, ws);
+    }
+    if (rjd->history != NULL && ok) {
+	HIST_Update(rjd->history, TaskKey(rcd, rjd, proc), took);
     }
+    if (rjd->ordered != NULL) {
+	ORD_Finish(rjd->ordered, proc);
+    }
+    rjd->rankTime = rjd->rankTime < 0 ? took : 0.5 * (rjd->rankTime + took);
+    sb->rankStart = now;
 }
-
-/* SpawnJob --
- * 
- * Spawn the various processes in this job.
+
+/* WriterSink --
+ *
+ * Pass captured output to the writer, to be written to 'fd' without
+ * waiting.
+ */
+
+static void
+WriterSink(void* arg, int fd, const char* p, size_t n)
+{
+    AW_Write((AW_Writer*) arg, fd, p, n);
+}
+
+/* CloseOutput --
+ *
+ * Close a file captured output was written to: once the writer has
+ * written everything queued for it, if there is a writer.
+ */
+
+static void
+CloseOutput(roJobData* rjd, int fd)
+{
+    if (rjd->writer != NULL) {
+	AW_Close(rjd->writer, fd);
+    } else {
+	close(fd);
+    }
+}
+
+/* ServiceBatch --
+ *
+ * Pass on the output a batch has written, switching each stream to
+ * the next process's destination at each record.  A record on
+ * standard output also completes a process.
+ */
+
+static void
+ServiceBatch(char* progname, MachineList* ms, QI_Index slot, roConfigData* rcd, roJobData* rjd)
+{
+    SlotBatch*	sb = &rjd->batches[slot];
+    int		st;
+
+    while (BAT_Fill(sb->out) > 0 || sb->out->len > 0) {
+	if (!BAT_Next(sb->out, rjd->batchMark, rjd->markLen, &st)) {
+	    break;
+	}
+	if (sb->outIdx >= sb->cnt) {
+	    continue;
+	}
+	FinishRank(ms, slot, rcd, rjd, sb->ranks[sb->outIdx], (st & 0xff) << 8);
+	if (sb->out->dest > 2) {
+	    CloseOutput(rjd, sb->out->dest);
+	}
+	if (++sb->outIdx < sb->cnt) {
+	    sb->out->dest = OpenRankOutput(progname, ms, slot, rcd, rjd->outTemplate,
+					   sb->ranks[sb->outIdx], 1);
+	    if (rjd->slotOut != NULL) {
+		rjd->slotOut[slot].rank = sb->ranks[sb->outIdx];
+	    }
+	} else {
+	    sb->out->dest = 1;
+	}
+    }
+    while (BAT_Fill(sb->err) > 0 || sb->err->len > 0) {
+	if (!BAT_Next(sb->err, rjd->batchMark, rjd->markLen, &st)) {
+	    break;
+	}
+	if (sb->err->dest > 2) {
+	    CloseOutput(rjd, sb->err->dest);
+	}
+	if (++sb->errIdx < sb->cnt) {
+	    sb->err->dest = OpenRankOutput(progname, ms, slot, rcd, rjd->errTemplate,
+					   sb->ranks[sb->errIdx], 2);
+	} else {
+	    sb->err->dest = 2;
+	}
+    }
+}
+
+/* EndBatch --
+ *
+ * A batch has exited.  Pass on the rest of its output, and record the
+ * processes it did not report as failed: with its own status, or as
+ * timed out if it was killed for its time limit.
+ */
+
+static void
+EndBatch(char* progname, MachineList* ms, QI_Index slot, roConfigData* rcd, roJobData* rjd, int ws)
+{
+    SlotBatch*	sb = &rjd->batches[slot];
+
+    ServiceBatch(progname, ms, slot, rcd, rjd);
+    BAT_Flush(sb->out);
+    BAT_Flush(sb->err);
+    if (ms->state[slot] == ml_sKilled) {
+	ws = JNL_TIMEDOUT;
+    } else if (ws == 0) {
+	ws = 255 << 8;
+    }
+    while (sb->outIdx < sb->cnt) {
+	FinishRank(ms, slot, rcd, rjd, sb->ranks[sb->outIdx++], ws);
+    }
+    if (sb->out->dest > 2) {
+	CloseOutput(rjd, sb->out->dest);
+    }
+    if (sb->err->dest > 2) {
+	CloseOutput(rjd, sb->err->dest);
+    }
+    BAT_Close(sb->out);
+    BAT_Close(sb->err);
+    free(sb->ranks);
+    sb->cnt = 0;
+}
+
+/* OrderedSink --
+ *
+ * Pass standard output read for a slot to the ordered output, as
+ * output of the rank the slot is reading.
+ */
+
+static void
+OrderedSink(void* arg, int fd, const char* p, size_t n)
+{
+    SlotOutput*	so = (SlotOutput*) arg;
+
+    (void) fd;		/* Only standard output is ordered. */
+    ORD_Write(so->oc, so->rank, p, n);
+}
+
+/* ServiceCapture --
+ *
+ * Pass on what a process has written to its standard output pipe.
+ */
+
+static void
+ServiceCapture(QI_Index slot, roJobData* rjd)
+{
+    BAT_Stream*	cs = rjd->slotOut[slot].capture;
+
+    while (cs != NULL && BAT_Fill(cs) > 0) {
+	BAT_Flush(cs);
+    }
+}
+
+/* EndCapture --
+ *
+ * A process with its standard output on a pipe has exited.  Pass on
+ * the rest of its output and close the pipe.  Anything written later,
+ * by processes it left behind, is lost.
+ */
+
+static void
+EndCapture(QI_Index slot, roJobData* rjd)
+{
+    SlotOutput*	so = &rjd->slotOut[slot];
+
+    if (so->capture == NULL) {
+	return;
+    }
+    ServiceCapture(slot, rjd);
+    BAT_Flush(so->capture);
+    BAT_Close(so->capture);
+    so->capture = (BAT_Stream*) NULL;
+}
+
+/* FinishBlocked --
+ *
+ * With -keep-order, end the output of the task graph tasks blocked
+ * since 'from' tasks were, which will now never run, so output after
+ * them is not held to the end.
+ */
+
+static void
+FinishBlocked(roJobData* rjd, size_t from)
+{
+    size_t	i;
+
+    for (i = from;  i < rjd->dag->blockedCnt;  ++i) {
+	ORD_Finish(rjd->ordered, rjd->dag->blocked[i]);
+    }
+}
+
+/* ReplayOutput --
+ *
+ * Pass on 'len' bytes of spooled or cached output, from 'off' in
+ * 'from', to where the standard output (stream 1) or error (2) of
+ * process 'proc' goes.
+ */
+
+static void
+ReplayOutput(char* progname, MachineList* ms, QI_Index slot, roConfigData* rcd, roJobData* rjd, size_t proc, int stream, int from, off_t off, off_t len)
+{
+    const char*	tmpl = stream == 1 ? rjd->outTemplate : rjd->errTemplate;
+    int		ordered = stream == 1 && tmpl == NULL && rjd->ordered != NULL;
+    int		fd = ordered ? -1 : OpenRankOutput(progname, ms, slot, rcd, tmpl, proc, stream);
+    char*	buf;
+
+    if (len == 0 || (fd < 0 && !ordered)) {
+	if (fd > 2) {
+	    close(fd);
+	}
+	return;
+    }
+    buf = (char*) malloc(REPLAY_BUF);
+    /*FIXME: Out of memory */
+    while (len > 0) {
+	ssize_t	r = pread(from, buf, len < REPLAY_BUF ? (size_t) len : REPLAY_BUF, off);
+
+	if (r <= 0) {
+	    break;
+	}
+	if (ordered) {
+	    ORD_Write(rjd->ordered, proc, buf, (size_t) r);
+	} else if (rjd->writer != NULL) {
+	    AW_Throttle(rjd->writer);
+	    AW_Write(rjd->writer, fd, buf, (size_t) r);
+	} else {
+	    ssize_t	w;
+	    size_t	done;
+
+	    for (done = 0;  done < (size_t) r;  done += (size_t) w) {
+		w = write(fd, buf + done, (size_t) r - done);
+		if (w < 0 && errno == EINTR) {
+		    w = 0;
+		} else if (w <= 0) {
+		    break;
+		}
+	    }
+	}
+	off += r;
+	len -= r;
+    }
+    free(buf);
+    if (fd > 2) {
+	CloseOutput(rjd, fd);
+    }
+}
+
+/* EndSpool --
+ *
+ * A process whose output was spooled has exited.  Store its output in
+ * the cache if it succeeded, and pass it on.
+ */
+
+static void
+EndSpool(char* progname, MachineList* ms, QI_Index slot, roConfigData* rcd, roJobData* rjd, int ok)
+{
+    SlotSpool*	sp = &rjd->spool[slot];
+    struct stat	outSt, errSt;
+
+    if (!sp->keyed) {
+	return;
+    }
+    if (ok && RC_Store(rjd->cache, &sp->key, 0, sp->out, sp->err) < 0) {
+	fprintf(stderr, "%s: Unable to store process %llu in the cache: %s\n",
+		progname, (unsigned long long) ms->proc[slot], strerror(errno));
+    }
+    if (fstat(sp->out, &outSt) == 0) {
+	ReplayOutput(progname, ms, slot, rcd, rjd, ms->proc[slot], 1,
+		     sp->out, 0, outSt.st_size);
+    }
+    if (fstat(sp->err, &errSt) == 0) {
+	ReplayOutput(progname, ms, slot, rcd, rjd, ms->proc[slot], 2,
+		     sp->err, 0, errSt.st_size);
+    }
+    close(sp->out);
+    close(sp->err);
+    sp->keyed = 0;
+}
+
+/* ArmTimer --
+ *
+ * Set the interval timer to go off when the timer wheel next needs
+ * attention, so a wait for a process does not sleep through a
+ * deadline.  The SIGALRM just interrupts the wait.
+ */
+
+static void
+ArmTimer(roJobData* rjd)
+{
+    struct itimerval	it;
+    double		delay = TW_Next(rjd->timers);
+
+    memset(&it, 0, sizeof(it));
+    if (delay >= 0.0) {
+	delay -= Now();
+	if (delay < 0.001) {
+	    delay = 0.001;
+	}
+	it.it_value.tv_sec = (time_t) delay;
+	it.it_value.tv_usec = (suseconds_t) ((delay - (time_t) delay) * 1e6);
+    }
+    saw_SIGALRM = 0;
+    setitimer(ITIMER_REAL, &it, (struct itimerval*) NULL);
+}
+
+/* ExpireTimeouts --
+ *
+ * Kill the process group of every process whose time limit has
+ * passed.  The slot stays on the run queue until the process is
+ * reaped, and is then recorded as timed out.
+ */
+
+static void
+ExpireTimeouts(char* progname, MachineList* ms, roJobData* rjd)
+{
+    QI_Index	slot;
+
+    while ((slot = TW_Expire(rjd->timers, Now())) != QI_NIL) {
+	if (ms->state[slot] != ml_sRun) {
+	    continue;
+	}
+	fprintf(stderr, "%s: process %llu on %s timed out after %.2fs\n",
+		progname, (unsigned long long) ms->proc[slot], ML_NAME(ms, slot),
+		Now() - ms->start[slot]);
+	if (killpg(ms->pid[slot], SIGKILL) < 0 && errno == ESRCH) {
+	    kill(ms->pid[slot], SIGKILL);
+	}
+	ms->state[slot] = ml_sKilled;
+	rjd->timedOutCnt++;
+    }
+}
+
+/* ReloadMachines --
+ *
+ * Read the machine file, or run the machine script, again, and bring
+ * the machine list in line with it (see ML_Reconcile): new slots go on
+ * the ready queue, and hosts that are gone or have fewer slots drain.
+ * The tables kept by slot grow with the list.  If the list cannot be
+ * read, the old one stays.
+ */
+
+static void
+ReloadMachines(char* progname, MachineList* ms, roConfigData* rcd, roJobData* rjd)
+{
+    MachineList*	next;
+    FILE*		mff;
+    char		err[256];
+    const char*		source = rjd->machineFile ? rjd->machineFile : rcd->machineScript;
+    size_t		oldMax = ms->mmax;
+    size_t		oldHosts = ms->hcnt;
+    size_t		h, slots = 0, hosts = 0;
+
+    if (rjd->machineFile != NULL) {
+	mff = fopen(rjd->machineFile, "r");
+    } else {
+	mff = popen(rcd->machineScript, "r");
+    }
+    if (mff == (FILE*) NULL) {
+	fprintf(stderr, "%s: Unable to reread \"%s\"; keeping the machine list\n",
+		progname, source);
+	return;
+    }
+    next = ParseMachineFile(mff, err, sizeof(err));
+    if (rjd->machineFile != NULL) {
+	fclose(mff);
+    } else {
+	pclose(mff);
+    }
+    if (next == NULL) {
+	fprintf(stderr, "%s: %s: %s; keeping the machine list\n",
+		progname, source, err);
+	return;
+    }
+
+    if (rjd->pack != NULL) {
+	PK_Yield(rjd->pack);
+    }
+    ML_Reconcile(ms, next);
+    ML_Destroy(next);
+    for (h = oldHosts;  h < ms->hcnt && rcd->localExec;  ++h) {
+	ms->hosts[h].isLocal = IsLocalHost(ms->hosts[h].name);
+    }
+    if (rjd->pack != NULL) {
+	PK_Resize(rjd->pack);
+	PK_Absorb(rjd->pack);
+    }
+
+    if (rjd->pfd != NULL) {
+	size_t	nfd = 2 * ms->mmax + 2 + ms->hcnt;
+
+	rjd->pfd = (struct pollfd*) realloc(rjd->pfd, nfd * sizeof(struct pollfd));
+	rjd->pfdSlot = (QI_Index*) realloc(rjd->pfdSlot, nfd * sizeof(QI_Index));
+	/*FIXME: Out of memory */
+    }
+    if (ms->mmax > oldMax && rjd->slotOut != NULL) {
+	rjd->slotOut = (SlotOutput*) realloc(rjd->slotOut, ms->mmax * sizeof(SlotOutput));
+	/*FIXME: Out of memory */
+	memset(rjd->slotOut + oldMax, 0, (ms->mmax - oldMax) * sizeof(SlotOutput));
+    }
+    if (ms->mmax > oldMax && rjd->spool != NULL) {
+	rjd->spool = (SlotSpool*) realloc(rjd->spool, ms->mmax * sizeof(SlotSpool));
+	/*FIXME: Out of memory */
+	memset(rjd->spool + oldMax, 0, (ms->mmax - oldMax) * sizeof(SlotSpool));
+    }
+    if (ms->mmax > oldMax && rjd->batches != NULL) {
+	rjd->batches = (SlotBatch*) realloc(rjd->batches, ms->mmax * sizeof(SlotBatch));
+	/*FIXME: Out of memory */
+	memset(rjd->batches + oldMax, 0, (ms->mmax - oldMax) * sizeof(SlotBatch));
+    }
+
+    for (h = 0;  h < ms->hcnt;  ++h) {
+	if (!ms->hosts[h].isDown && ms->hosts[h].target > 0) {
+	    slots += ms->hosts[h].target;
+	    hosts++;
+	}
+    }
+    fprintf(stderr, "%s: Reloaded the machine list: %lu slots on %lu hosts\n",
+	    progname, (unsigned long) slots, (unsigned long) hosts);
+}
+
+/* WaitOnMachines --
+ *
+ * Wait for a process to complete, record it in the journal, the task
+ * graph and the runtime history, and move the corresponding slot from
+ * the run queue to the ready queue.  A process killed for running
+ * past its time limit is recorded as failed, with status JNL_TIMEDOUT
+ * in the journal.  While waiting, pass on the output of batches and
+ * of processes whose output is kept in order (unless the writer is
+ * over its budget), write captured output,
+ * sync the journal, answer the rendezvous service, and enforce time
+ * limits.  A process that aborts through
+ * the rendezvous service tears the job down, as SIGTERM would.  With
+ * -adapt, sample the hosts' load; if that unparks slots, return so
+ * they can be used.  With -elastic, reload the machine list on SIGHUP
+ * and return, and with nothing running, wait for a signal rather than
+ * returning.  If a signal interrupts the wait, simply return; callers
+ * check PendingSignal.
+ */
+
+static void
+WaitOnMachines(char* progname, MachineList* ms, roConfigData* rcd, roJobData* rjd)
+{
+    pid_t	rc;
+    int		ws;
+    int		polled;
+    PRF_Phase	phase;
+
+    for (;;) {
+	nfds_t		n = 0;
+	nfds_t		i;
+	QI_Index	slot;
+	struct timespec	ts;
+	struct timespec*	timeout = (struct timespec*) NULL;
+	size_t		unparked = 0;
+
+	rc = waitpid(-1, &ws, WNOHANG);
+	if (rc > 0 || (rc < 0 && !rjd->elastic)) {
+	    break;
+	}
+	if (PendingSignal() || (saw_SIGALRM && rjd->timers == NULL)) {
+	    return;
+	}
+	if (saw_SIGHUP) {
+	    saw_SIGHUP = 0;
+	    ReloadMachines(progname, ms, rcd, rjd);
+	    return;
+	}
+
+	if (rjd->kvs != NULL) {
+	    rjd->pfd[n].fd = rjd->kvs->epollFd;
+	    rjd->pfd[n].events = POLLIN;
+	    rjd->pfdSlot[n++] = PFD_KVS;
+	}
+	if (rjd->writer != NULL) {
+	    AW_Submit(rjd->writer);
+	    rjd->pfd[n].fd = rjd->writer->notifyFd;
+	    rjd->pfd[n].events = POLLIN;
+	    rjd->pfdSlot[n++] = PFD_WRITER;
+	}
+	if (rjd->adapt != NULL) {
+	    size_t	h;
+
+	    AD_Tick(rjd->adapt, Now());
+	    for (h = 0;  h < ms->hcnt;  ++h) {
+		if (rjd->adapt->hosts[h].fd >= 0) {
+		    rjd->pfd[n].fd = rjd->adapt->hosts[h].fd;
+		    rjd->pfd[n].events = POLLIN;
+		    rjd->pfdSlot[n++] = PFD_ADAPT;
+		}
+	    }
+	    Sooner(&ts, &timeout, AD_Next(rjd->adapt) - Now());
+	}
+	if (rjd->journal != NULL) {
+	    double	due = JNL_Tick(rjd->journal);
+	    if (due >= 0.0) {
+		Sooner(&ts, &timeout, due);
+	    }
+	}
+	if (rjd->writer != NULL && AW_Full(rjd->writer)) {
+	    /* Read no more output until the writer catches up. */
+	} else if (rjd->batches != NULL) {
+	    for (slot = QI_HEAD(&ms->run);  slot != QI_NIL;  slot = QI_NEXT(ms->link, slot)) {
+		SlotBatch*	sb = &rjd->batches[slot];
+		if (sb->cnt == 0) {
+		    continue;
+		}
+		if (sb->out->fd >= 0) {
+		    rjd->pfd[n].fd = sb->out->fd;
+		    rjd->pfd[n].events = POLLIN;
+		    rjd->pfdSlot[n++] = slot;
+		}
+		if (sb->err->fd >= 0) {
+		    rjd->pfd[n].fd = sb->err->fd;
+		    rjd->pfd[n].events = POLLIN;
+		    rjd->pfdSlot[n++] = slot;
+		}
+	    }
+	} else if (rjd->slotOut != NULL) {
+	    for (slot = QI_HEAD(&ms->run);  slot != QI_NIL;  slot = QI_NEXT(ms->link, slot)) {
+		BAT_Stream*	cs = rjd->slotOut[slot].capture;
+		if (cs != NULL && cs->fd >= 0) {
+		    rjd->pfd[n].fd = cs->fd;
+		    rjd->pfd[n].events = POLLIN;
+		    rjd->pfdSlot[n++] = slot;
+		}
+	    }
+	}
+	if (rjd->timers != NULL) {
+	    ArmTimer(rjd);
+	}
+	phase = PRF_SWITCH(prf_pWait);
+	polled = ppoll(rjd->pfd, n, timeout, &waitMask);
+	PRF_SWITCH(phase);
+	if (polled > 0) {
+	    QI_Index	served = QI_NIL;
+	    int		sampled = 0;
+
+	    for (i = 0;  i < n;  ++i) {
+		if (!rjd->pfd[i].revents) {
+		    continue;
+		}
+		if (rjd->pfdSlot[i] == PFD_WRITER) {
+		    AW_Reap(rjd->writer);
+		} else if (rjd->pfdSlot[i] == PFD_ADAPT) {
+		    sampled = 1;
+		} else if (rjd->pfdSlot[i] == PFD_KVS) {
+		    KVS_Service(rjd->kvs);
+		    if (rjd->kvs->aborted) {
+			fprintf(stderr, "%s: process %ld aborted the job: %s\n",
+				progname, rjd->kvs->abortRank, rjd->kvs->abortMsg);
+			rjd->kvs->aborted = 0;
+			saw_SIGTERM = 1;
+		    }
+		} else if (rjd->pfdSlot[i] == served) {
+		    /* Both of a batch's streams were just read. */
+		} else if (rjd->batches != NULL) {
+		    served = rjd->pfdSlot[i];
+		    ServiceBatch(progname, ms, served, rcd, rjd);
+		} else {
+		    ServiceCapture(rjd->pfdSlot[i], rjd);
+		}
+	    }
+	    if (sampled) {
+		/* Reads every host's sampler that has finished. */
+		unparked += AD_Service(rjd->adapt);
+	    }
+	}
+	if (rjd->timers != NULL) {
+	    ExpireTimeouts(progname, ms, rjd);
+	}
+	if (unparked > 0) {
+	    return;
+	}
+    }
+
+    if (rc > 0) {
+	/*
+	 * rc is the pid of the child that exited.  Look up its slot,
+	 * and move it to the ready queue.  Other children (e.g., kill
+	 * command helpers) are not in the table.
+	 */
+	QI_Index	slot = ML_UnmapPid(ms, rc);
+	if (slot != QI_NIL) {
+	    int ok = WIFEXITED(ws) && WEXITSTATUS(ws) == 0;
+
+	    phase = PRF_SWITCH(prf_pReap);
+	    if (ms->state[slot] != ml_sKilled && rjd->timers != NULL) {
+		TW_Cancel(rjd->timers, slot);
+	    }
+	    if (rjd->batches != NULL && rjd->batches[slot].cnt > 0) {
+		EndBatch(progname, ms, slot, rcd, rjd, ws);
+	    } else {
+		if (ms->state[slot] == ml_sKilled) {
+		    ws = JNL_TIMEDOUT;
+		    ok = 0;
+		}
+		if (rjd->spool != NULL) {
+		    EndSpool(progname, ms, slot, rcd, rjd, ok);
+		}
+		if (rjd->journal != NULL) {
+		    JNL_Append(rjd->journal, ms->proc[slot], ws);
+		}
+		if (rjd->trace != NULL) {
+		    TraceProcess(ms, slot, rjd, ms->proc[slot],
+				 ms->start[slot], ws);
+		}
+		if (rjd->dag != NULL) {
+		    size_t blocked = rjd->dag->blockedCnt;
+		    DAG_Complete(rjd->dag, ms->proc[slot], ok);
+		    if (rjd->ordered != NULL) {
+			FinishBlocked(rjd, blocked);
+		    }
+		}
+		if (rjd->history != NULL && ok) {
+		    HIST_Update(rjd->history, ms->key[slot],
+				Now() - ms->start[slot]);
+		}
+		if (rjd->ordered != NULL) {
+		    EndCapture(slot, rjd);
+		    ORD_Finish(rjd->ordered, ms->proc[slot]);
+		}
+	    }
+	    QI_REMOVE(&ms->run, ms->link, slot);
+	    if (rjd->pack != NULL) {
+		PK_Release(rjd->pack, slot);
+	    }
+	    ML_ReleaseSlot(ms, slot);
+	    PRF_SWITCH(phase);
+	}
+    }
+}
+
+
+/* GetReadyMachine --
+ *
+ * Get a slot from the 'ready' queue.  Wait if neccessary.  Returns
+ * QI_NIL if a terminating signal arrives, so no new work is started.
+ */
+
+static
+QI_Index
+GetReadyMachine(char* progname, MachineList* ms, roConfigData* rcd, roJobData* rjd)
+{
+    QI_Index	slot;
+
+    do {
+	if (PendingSignal()) {
+	    return QI_NIL;
+	}
+
+	QI_TAKE(&ms->ready, ms->link, slot);
+	if (slot != QI_NIL) {
+	    return slot;
+	}
+
+	WaitOnMachines(progname, ms, rcd, rjd);
+    } while (1);
+
+}
+
+/* ChildMessage --
+ *
+ * From a forked child: write the strings given, up to a NULL, to the
+ * standard error.  A shard, writer or cache thread may have held the
+ * stdio or malloc locks when the child was forked, so the child uses
+ * neither.
+ */
+
+static void
+ChildMessage(const char* s, ...)
+{
+    va_list	ap;
+
+    va_start(ap, s);
+    for (;  s != NULL;  s = va_arg(ap, const char*)) {
+	if (write(2, s, strlen(s)) < 0) {
+	    break;
+	}
+    }
+    va_end(ap);
+}
+
+/* SpawnProcess --
+ *
+ * Spawn a process.  On a machine that is this host, the program is
+ * run directly, unless the configuration turns that off; otherwise it
+ * is run on the machine through the spawn command.  With -keep-order,
+ * its standard output comes back on a pipe.  If its output is to be
+ * kept in the cache, both streams go to the slot's spool instead.
  */
 
 void
+SpawnProcess(const char* progname, MachineList* ms, QI_Index slot, roConfigData* rcd, size_t proc, roJobData* rjd)
+{
+    MachineHost*	mh = ML_HOST(ms, slot);
+    MachinePin*		mp = ms->pin ? &ms->pin[slot] : (MachinePin*) NULL;
+    const char**	nv;
+    const char*		inPath = (const char*) NULL;
+    const char*		outPath = (const char*) NULL;
+    const char*		errPath = (const char*) NULL;
+    const char**	progargv = TaskArgv(rjd, proc);
+    SlotSpool*		sp = rjd->spool ? &rjd->spool[slot] : (SlotSpool*) NULL;
+    int			spooled = sp != NULL && sp->keyed;
+    int			outPipe[2];
+    pid_t		pid;
+    PRF_Phase		phase = PRF_SWITCH(prf_pRender);
+
+    /* 
+     * Rewrite args, inserting spawn command and remote host name.
+     */
+    {
+	const char**	ap;
+	AV_Control	avc;
+
+	AV_Init(&avc);
+
+	if (!(mh->isLocal && rcd->localExec)) {
+	    AV_AddString(&avc, rcd->spawnCommand);
+	    AV_AddString(&avc, mh->name);
+	}
+
+	for (ap = progargv; *ap != NULL;  ++ap) {
+	    const char*	np;
+	    np = RewriteString(*ap, rcd, mp, proc);
+	    AV_AddString(&avc, np);
+	    free((char*) np);
+	}
+
+	nv = AV_Finalize(&avc, NULL);
+
+    }
+    if (rjd->inTemplate) {
+	inPath = RewriteString(rjd->inTemplate, rcd, mp, proc);
+    }
+    if (rjd->outTemplate) {
+	outPath = RewriteString(rjd->outTemplate, rcd, mp, proc);
+    }
+    if (rjd->errTemplate) {
+	errPath = RewriteString(rjd->errTemplate, rcd, mp, proc);
+    }
+    if (rjd->ordered != NULL && !spooled && pipe(outPipe) < 0) {
+	fprintf(stderr, "%s: Unable to create pipe: %s\n",
+		progname, strerror(errno));
+	exit(1);
+    }
+
+
+    /*
+     * Fork.
+     */
+
+    PRF_SWITCH(prf_pFork);
+    pid = fork();
+    if (pid > 0) {
+	/*
+	 * I am parent process.
+	 */
+	ms->pid[slot] = pid;
+	if (rjd->shards != NULL) {
+	    SH_MapPid(rjd->shards, pid, slot);
+	} else {
+	    ML_MapPid(ms, pid, slot);
+	}
+	if (rjd->ordered != NULL && !spooled) {
+	    SlotOutput*	so = &rjd->slotOut[slot];
+
+	    close(outPipe[1]);
+	    so->oc = rjd->ordered;
+	    so->rank = proc;
+	    so->capture = BAT_Open(outPipe[0], 1);
+	    so->capture->sink = OrderedSink;
+	    so->capture->sinkArg = so;
+	}
+    } else if (pid == 0) {
+	/*
+	 * I am child process.
+	 */
+
+	if (inPath) {
+	    int fd = open(inPath, O_RDONLY);
+	    if (fd < 0) {
+		ChildMessage(progname, ": Error opening \"", inPath, "\": ",
+			     strerror(errno), "\n", (char*) NULL);
+		_exit(1);
+	    }
+	    if (fd != 0) {
+		close(0);
+		dup2(fd, 0);
+		close(fd);
+	    }
+	}
+
+	if (spooled) {
+	    dup2(sp->out, 1);
+	} else if (outPath) {
+	    int fd = open(outPath, O_WRONLY|O_APPEND|O_CREAT, 0644);
+	    if (fd < 0) {
+		ChildMessage(progname, ": Error opening \"", outPath, "\": ",
+			     strerror(errno), "\n", (char*) NULL);
+		_exit(1);
+	    }
+	    if (fd != 1) {
+		close(1);
+		dup2(fd, 1);
+		close(fd);
+	    }
+	} else if (rjd->ordered != NULL) {
+	    dup2(outPipe[1], 1);
+	    close(outPipe[0]);
+	    close(outPipe[1]);
+	}
+
+	if (spooled) {
+	    dup2(sp->err, 2);
+	} else if (errPath) {
+	    int fd = open(errPath, O_WRONLY|O_APPEND|O_CREAT, 0644);
+	    if (fd < 0) {
+		ChildMessage(progname, ": Error opening \"", errPath, "\": ",
+			     strerror(errno), "\n", (char*) NULL);
+		_exit(1);
+	    }
+	    if (fd != 2) {
+		close(2);
+		dup2(fd, 2);
+		close(fd);
+	    }
+	}
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGQUIT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	sigprocmask(SIG_SETMASK, &origMask, (sigset_t*) NULL);
+	setsid();
+
+	if (mh->isLocal && rcd->localExec && mp != NULL
+	    && TOPO_Apply(&mp->place) < 0) {
+	    ChildMessage(progname, ": Unable to pin to CPUs ", mp->cpuList, ": ",
+			 strerror(errno), "\n", (char*) NULL);
+	}
+
+	execvp(nv[0], (char* const*)nv);
+	ChildMessage(progname, ": Unable to run \"", nv[0], "\": ",
+		     strerror(errno), "\n", (char*) NULL);
+	_exit(127);
+    }
+
+    PRF_SWITCH(phase);
+    free((char*) nv);
+    if (inPath) {
+	free((char*) inPath);
+    }
+    if (outPath) {
+	free((char*) outPath);
+    }
+    if (errPath) {
+	free((char*) errPath);
+    }
+}
+
+/* RunKillCommand --
+ *
+ * Propagate a teardown to the remote side: run the configured kill
+ * command, through the spawn command, once on every distinct remote
+ * host that still has a running process.  The helpers are not waited
+ * for here; their exits are reaped (and ignored) by WaitOnMachines.
+ */
+
+static void
+RunKillCommand(MachineList* ms, roConfigData* rcd)
+{
+    unsigned char*	seen;
+    QI_Index		slot;
+    char*		kc;
+
+    seen = (unsigned char*) calloc(ms->hcnt, 1);
+    /*FIXME: Out of memory */
+    kc = RewriteString(rcd->killCommand, rcd, NULL, 0);
+    for (slot = QI_HEAD(&ms->run);  slot != QI_NIL;  slot = QI_NEXT(ms->link, slot)) {
+	MachineHost*	mh = ML_HOST(ms, slot);
+	pid_t		pid;
+
+	if ((mh->isLocal && rcd->localExec) || seen[ms->host[slot]]) {
+	    continue;
+	}
+	seen[ms->host[slot]] = 1;
+	pid = fork();
+	if (pid == 0) {
+	    int fd = open("/dev/null", O_RDONLY);
+	    if (fd > 0) {
+		dup2(fd, 0);
+		close(fd);
+	    }
+	    signal(SIGINT, SIG_DFL);
+	    signal(SIGQUIT, SIG_DFL);
+	    signal(SIGTERM, SIG_DFL);
+	    sigprocmask(SIG_SETMASK, &origMask, (sigset_t*) NULL);
+	    setsid();
+	    execl(rcd->spawnCommand, rcd->spawnCommand, mh->name, kc,
+		  (char*) NULL);
+	    _exit(127);
+	}
+    }
+    free(kc);
+    free(seen);
+}
+
+/* SignalRunning --
+ *
+ * Send a signal to the process group of every running process.  Each
+ * child called setsid, so it leads its own group, and the signal
+ * reaches the spawn command and anything it started locally.
+ */
+
+static void
+SignalRunning(MachineList* ms, int sig)
+{
+    QI_Index	slot;
+
+    for (slot = QI_HEAD(&ms->run);  slot != QI_NIL;  slot = QI_NEXT(ms->link, slot)) {
+	if (killpg(ms->pid[slot], sig) < 0 && errno == ESRCH) {
+	    kill(ms->pid[slot], sig);
+	}
+    }
+}
+
+/* TeardownJob --
+ *
+ * Tear the job down after receiving a terminating signal.  The signal
+ * is forwarded to every running process group in a single pass, and
+ * the kill command (if any) is run on the remote hosts.  If processes
+ * are still running when the grace period expires, or if a second
+ * signal arrives, they are sent SIGKILL.  Returns once every running
+ * process has been reaped.
+ */
+
+static void
+TeardownJob(char* progname, MachineList* ms, roConfigData* rcd, roJobData* rjd, int sig)
+{
+    int		killed = 0;
+
+    /* Nothing more will start, so the load no longer matters. */
+    if (rjd->adapt != NULL) {
+	AD_Stop(rjd->adapt);
+	rjd->adapt = (AD_Control*) NULL;
+    }
+    if (QI_EMPTY(&ms->run)) {
+	return;
+    }
+
+    SignalRunning(ms, sig);
+    if (rcd->killCommand != NULL) {
+	RunKillCommand(ms, rcd);
+    }
+
+    /*
+     * Every process is being killed, so deadlines no longer matter,
+     * and the interval timer now measures the grace period.
+     */
+    if (rjd->timers != NULL) {
+	TW_Free(rjd->timers);
+	rjd->timers = (TW_Wheel*) NULL;
+    }
+
+    saw_SIGINT = saw_SIGQUIT = saw_SIGTERM = saw_SIGALRM = 0;
+    if (rcd->killGrace > 0) {
+	alarm(rcd->killGrace);
+    } else {
+	saw_SIGALRM = 1;
+    }
+
+    while (!QI_EMPTY(&ms->run)) {
+	if (saw_SIGALRM || PendingSignal()) {
+	    if (!killed) {
+		SignalRunning(ms, SIGKILL);
+		killed = 1;
+	    }
+	    saw_SIGINT = saw_SIGQUIT = saw_SIGTERM = saw_SIGALRM = 0;
+	}
+	WaitOnMachines(progname, ms, rcd, rjd);
+    }
+    alarm(0);
+}
+
+/* StageInputs --
+ *
+ * Copy the files to be staged into the staging directory on every
+ * host in the machine list that is up, before anything runs.  Processes find
+ * them through the %s substitution.
+ */
+
+static void
+StageInputs(char* progname, MachineList* ms, roConfigData* rcd, const char** files)
+{
+    const char**	hosts;
+    char*		reached;
+    size_t		hcnt = 0, fcnt, h;
+    int			keepLocal = 0;
+    double		started = Now();
+
+    if (rcd->stageDir != NULL) {
+	rcd->stagePath = RewriteString(rcd->stageDir, rcd, NULL, 0);
+    } else {
+	rcd->stagePath = RewriteString(rcd->jobName[0] ? "/tmp/runover-%j"
+				       : "/tmp/runover-stage", rcd, NULL, 0);
+    }
+    if (STG_Check(rcd->stagePath) < 0) {
+	fprintf(stderr, "%s: Staging directory \"%s\" cannot contain spaces or quotes\n",
+		progname, rcd->stagePath);
+	exit(1);
+    }
+
+    /*
+     * Stage to each host once.  This host is handled directly, by the
+     * coordinator end of the relay.  Hosts that the probe dropped, or
+     * that have no slots, are left out: they would only hold up the
+     * relay.
+     */
+    hosts = (const char**) malloc((ms->hcnt + 1) * sizeof(const char*));
+    /*FIXME: Out of memory */
+    for (h = 0;  h < ms->hcnt;  ++h) {
+	if (ms->hosts[h].isDown || ms->hosts[h].target == 0) {
+	    continue;
+	}
+	if (ms->hosts[h].isLocal && rcd->localExec) {
+	    keepLocal = 1;
+	    continue;
+	}
+	if (STG_Check(ms->hosts[h].name) < 0) {
+	    fprintf(stderr, "%s: Cannot stage to host \"%s\"\n",
+		    progname, ms->hosts[h].name);
+	    exit(1);
+	}
+	hosts[hcnt++] = ms->hosts[h].name;
+    }
+
+    for (fcnt = 0;  files[fcnt] != NULL;  ++fcnt) {
+	if (access(files[fcnt], R_OK) < 0) {
+	    fprintf(stderr, "%s: Cannot stage \"%s\": %s\n",
+		    progname, files[fcnt], strerror(errno));
+	    exit(1);
+	}
+    }
+    h = STG_Duplicate(files, fcnt);
+    if (h != (size_t) -1) {
+	fprintf(stderr, "%s: Cannot stage \"%s\": an earlier file has the same name\n",
+		progname, files[h]);
+	exit(1);
+    }
+    reached = (char*) malloc(hcnt + 1);
+    /*FIXME: Out of memory */
+    if (STG_Broadcast(rcd->spawnCommand, rcd->stagePath, files, fcnt,
+		      hosts, hcnt, keepLocal, rcd->stageTimeout, reached) < 0) {
+	int	timedOut = errno == ETIMEDOUT;
+
+	for (h = 0;  h < hcnt;  ++h) {
+	    if (!reached[h]) {
+		fprintf(stderr, "%s: Staging did not reach host \"%s\"\n",
+			progname, hosts[h]);
+	    }
+	}
+	if (keepLocal && !reached[hcnt]) {
+	    fprintf(stderr, "%s: Staging did not reach this host\n",
+		    progname);
+	}
+	if (timedOut) {
+	    fprintf(stderr, "%s: Staging to \"%s\" timed out after %gs\n",
+		    progname, rcd->stagePath, rcd->stageTimeout);
+	} else {
+	    fprintf(stderr, "%s: Staging to \"%s\" failed\n",
+		    progname, rcd->stagePath);
+	}
+	exit(1);
+    }
+    if (PRF_Active) {
+	fprintf(stderr, "%s: staged %lu files to %lu hosts in %.2fs\n",
+		progname, (unsigned long) fcnt,
+		(unsigned long) (hcnt + keepLocal), Now() - started);
+    }
+    free(reached);
+    free((char*) hosts);
+}
+
+/* ProbedHost --
+ *
+ * A probe in progress, for finding the host by the probe's pid.
+ */
+
+typedef struct ProbedHost {
+    pid_t	pid;
+    QI_Index	host;
+    int		done;
+} ProbedHost;
+
+static int
+CompareProbedHosts(const void* a, const void* b)
+{
+    pid_t	pa = ((const ProbedHost*) a)->pid;
+    pid_t	pb = ((const ProbedHost*) b)->pid;
+
+    return pa < pb ? -1 : pa > pb;
+}
+
+/* ProbeHosts --
+ *
+ * Check that every remote host can run a process before the job
+ * starts, by running the probe command on all of them at once through
+ * the spawn command.  A host whose probe fails, or has not finished
+ * within 'limit' seconds, is dropped: its slots are taken off the
+ * ready queue, so a dead node costs one probe rather than a connect
+ * timeout for every process sent to it.  Each host's probe time is
+ * kept for the run summary.  Returns the number of hosts dropped.
+ */
+
+static size_t
+ProbeHosts(char* progname, MachineList* ms, roConfigData* rcd, double limit)
+{
+    ProbedHost*		ph;
+    size_t		pcnt = 0, left, dropped = 0, i;
+    struct sigaction	sa;
+    struct itimerval	it;
+    double		started;
+
+    ph = (ProbedHost*) malloc((ms->hcnt + 1) * sizeof(ProbedHost));
+    /*FIXME: Out of memory */
+
+    /*
+     * A SIGALRM marks the deadline; it must interrupt the wait.
+     */
+    sa.sa_handler = MainSignalHandler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction(SIGALRM, &sa, NULL);
+    saw_SIGALRM = 0;
+
+    started = Now();
+    for (i = 0;  i < ms->hcnt;  ++i) {
+	MachineHost*	mh = &ms->hosts[i];
+	pid_t		pid;
+
+	if (mh->isLocal && rcd->localExec) {
+	    mh->probeTime = 0.0;
+	    continue;
+	}
+	pid = fork();
+	if (pid < 0) {
+	    fprintf(stderr, "%s: Unable to fork probe: %s\n",
+		    progname, strerror(errno));
+	    exit(1);
+	}
+	if (pid == 0) {
+	    int fd = open("/dev/null", O_RDWR);
+	    if (fd >= 0) {
+		dup2(fd, 0);
+		dup2(fd, 1);
+		dup2(fd, 2);
+		if (fd > 2) {
+		    close(fd);
+		}
+	    }
+	    setpgid(0, 0);
+	    execl(rcd->spawnCommand, rcd->spawnCommand, mh->name,
+		  rcd->probeCommand, (char*) NULL);
+	    _exit(127);
+	}
+	setpgid(pid, pid);
+	ph[pcnt].pid = pid;
+	ph[pcnt].host = (QI_Index) i;
+	ph[pcnt].done = 0;
+	pcnt++;
+    }
+    qsort(ph, pcnt, sizeof(ProbedHost), CompareProbedHosts);
+
+    memset(&it, 0, sizeof(it));
+    it.it_value.tv_sec = (time_t) limit;
+    it.it_value.tv_usec = (suseconds_t) ((limit - (time_t) limit) * 1e6);
+    if (pcnt > 0) {
+	setitimer(ITIMER_REAL, &it, (struct itimerval*) NULL);
+    }
+
+    /*
+     * Collect the probes as they finish.  At the deadline, kill the
+     * rest; they count as failed.
+     */
+    for (left = pcnt;  left > 0;  ) {
+	ProbedHost	key;
+	ProbedHost*	p;
+	int		ws;
+
+	if (saw_SIGALRM) {
+	    for (i = 0;  i < pcnt;  ++i) {
+		if (!ph[i].done) {
+		    killpg(ph[i].pid, SIGKILL);
+		}
+	    }
+	    saw_SIGALRM = 0;
+	}
+	key.pid = wait(&ws);
+	if (key.pid < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    break;
+	}
+	p = (ProbedHost*) bsearch(&key, ph, pcnt, sizeof(ProbedHost),
+				  CompareProbedHosts);
+	if (p == NULL || p->done) {
+	    continue;
+	}
+	if (WIFEXITED(ws) && WEXITSTATUS(ws) == 0) {
+	    ms->hosts[p->host].probeTime = Now() - started;
+	} else {
+	    ML_DropHost(ms, p->host);
+	    dropped++;
+	    fprintf(stderr, "%s: Dropping host \"%s\": probe %s\n",
+		    progname, ms->hosts[p->host].name,
+		    WIFSIGNALED(ws) && WTERMSIG(ws) == SIGKILL
+		    ? "timed out" : "failed");
+	}
+	p->done = 1;
+	left--;
+    }
+
+    memset(&it, 0, sizeof(it));
+    setitimer(ITIMER_REAL, &it, (struct itimerval*) NULL);
+    free(ph);
+    return dropped;
+}
+
+/* ReportProbes --
+ *
+ * Print the probe time of every host, for the run summary.
+ */
+
+static void
+ReportProbes(char* progname, MachineList* ms, roConfigData* rcd)
+{
+    size_t	h;
+
+    for (h = 0;  h < ms->hcnt;  ++h) {
+	MachineHost*	mh = &ms->hosts[h];
+
+	if (mh->isDown) {
+	    fprintf(stderr, "%s: probe %s: down\n", progname, mh->name);
+	} else if (mh->isLocal && rcd->localExec) {
+	    fprintf(stderr, "%s: probe %s: local\n", progname, mh->name);
+	} else {
+	    fprintf(stderr, "%s: probe %s: %.3fs\n",
+		    progname, mh->name, mh->probeTime);
+	}
+    }
+}
+
+/* ReportAdapt --
+ *
+ * Print the range of slots every host was given by -adapt, for the
+ * run summary.
+ */
+
+static void
+ReportAdapt(char* progname, MachineList* ms, AD_Control* ad)
+{
+    size_t	h;
+
+    for (h = 0;  h < ms->hcnt;  ++h) {
+	AD_Host*	ah = &ad->hosts[h];
+
+	if (ms->hosts[h].isDown) {
+	    continue;
+	}
+	fprintf(stderr, "%s: adapt %s: %lu slots, ran %lu to %lu at once\n",
+		progname, ms->hosts[h].name, (unsigned long) ah->configured,
+		(unsigned long) ah->least, (unsigned long) ah->most);
+    }
+}
+
+/* CacheRequest --
+ *
+ * Queue process 'proc' to have its cache key found: its rendered
+ * command line, and the paths of its input files.
+ */
+
+static void
+CacheRequest(roConfigData* rcd, roJobData* rjd, size_t proc)
+{
+    CharAccum		ca;
+    const char**	ap;
+    char**		paths;
+    size_t		cnt = 0;
+
+    CHARACCUM_INIT(&ca);
+    for (ap = TaskArgv(rjd, proc);  *ap != NULL;  ++ap) {
+	char*	np = RewriteString(*ap, rcd, NULL, proc);
+	CHARACCUM_APPEND_STR(&ca, np);
+	CHARACCUM_APPEND_CHAR(&ca, '\0');
+	free(np);
+    }
+    for (ap = rjd->inputTemplates;  *ap != NULL;  ++ap) {
+	cnt++;
+    }
+    paths = (char**) malloc((cnt + 2) * sizeof(char*));
+    /*FIXME: Out of memory */
+    cnt = 0;
+    if (rjd->inTemplate != NULL) {
+	paths[cnt++] = RewriteString(rjd->inTemplate, rcd, NULL, proc);
+    }
+    for (ap = rjd->inputTemplates;  *ap != NULL;  ++ap) {
+	paths[cnt++] = RewriteString(*ap, rcd, NULL, proc);
+    }
+    paths[cnt] = (char*) NULL;
+    RC_Submit(rjd->cache, proc, ca.cb, ca.cbLen, paths);
+}
+
+/* PrefetchCache --
+ *
+ * Keep the cache looking up keys ahead of dispatch: queue the next
+ * processes in order, up to the cache's window, skipping those the
+ * journal says are done.
+ */
+
+static void
+PrefetchCache(roConfigData* rcd, roJobData* rjd, size_t np)
+{
+    while (rjd->cacheNext < np && !RC_Full(rjd->cache)) {
+	size_t	proc = rjd->order ? rjd->order[rjd->cacheNext] : rjd->cacheNext;
+
+	if (!JNL_RankDone(&rjd->skip, proc)) {
+	    CacheRequest(rcd, rjd, proc);
+	}
+	rjd->cacheNext++;
+    }
+}
+
+/* PrefetchInputs --
+ *
+ * With -prefetch, hint the input files of the processes in the
+ * 'prefetchAhead' places of the dispatch order after place 'i'.
+ */
+
+static void
+PrefetchInputs(roConfigData* rcd, roJobData* rjd, size_t i, size_t np)
+{
+    size_t	end = i + 1 + rjd->prefetchAhead;
+
+    if (end > np) {
+	end = np;
+    }
+    if (rjd->prefetchNext <= i) {
+	rjd->prefetchNext = i + 1;
+    }
+    for (;  rjd->prefetchNext < end;  rjd->prefetchNext++) {
+	size_t	proc = rjd->order ? rjd->order[rjd->prefetchNext] : rjd->prefetchNext;
+
+	if (!JNL_RankDone(&rjd->skip, proc)) {
+	    PF_Hint(rjd->prefetch,
+		    RewriteString(rjd->inTemplate, rcd, (MachinePin*) NULL, proc));
+	}
+    }
+}
+
+/* ServeCached --
+ *
+ * With -cache, look up process 'proc'.  If it is in the cache, pass on
+ * its output, record it as done, and return 1: it need not run.
+ * Otherwise keep its key for StartProcess, and return 0.
+ */
+
+static int
+ServeCached(char* progname, MachineList* ms, roConfigData* rcd, roJobData* rjd, size_t proc)
+{
+    RC_Entry	e;
+    RC_Answer	answer;
+
+    if (rjd->cache == NULL) {
+	return 0;
+    }
+    if (!RC_Queued(rjd->cache, proc)) {
+	CacheRequest(rcd, rjd, proc);
+    }
+    answer = RC_Result(rjd->cache, proc, &rjd->cacheKey);
+    rjd->cacheProc = proc;
+    rjd->cacheKeyed = answer != rc_aNone;
+    if (answer != rc_aHit || RC_Fetch(rjd->cache, &rjd->cacheKey, &e) < 0) {
+	return 0;
+    }
+    rjd->cacheKeyed = 0;
+
+    ReplayOutput(progname, ms, QI_NIL, rcd, rjd, proc, 1, e.fd, e.off, e.outLen);
+    ReplayOutput(progname, ms, QI_NIL, rcd, rjd, proc, 2, e.fd,
+		 e.off + e.outLen, e.errLen);
+    close(e.fd);
+    if (rjd->journal != NULL) {
+	JNL_Append(rjd->journal, proc, (e.status & 0xff) << 8);
+    }
+    if (rjd->dag != NULL) {
+	DAG_Complete(rjd->dag, proc, e.status == 0);
+    }
+    if (rjd->ordered != NULL) {
+	ORD_Finish(rjd->ordered, proc);
+    }
+    return 1;
+}
+
+/* TakeReadyTask --
+ *
+ * The next task of the graph to start, or -1 if none is ready.  With
+ * -cache, the ready tasks are looked up ahead, up to the cache's
+ * window, in the order the graph gives them; those in the cache are
+ * served here, and may make more ready.
+ */
+
+static long
+TakeReadyTask(char* progname, MachineList* ms, roConfigData* rcd, roJobData* rjd)
+{
+    long	t;
+
+    if (rjd->cache == NULL) {
+	return DAG_TakeReady(rjd->dag);
+    }
+    for (;;) {
+	while (!RC_Full(rjd->cache) && (t = DAG_TakeReady(rjd->dag)) >= 0) {
+	    CacheRequest(rcd, rjd, (size_t) t);
+	}
+	t = (long) RC_Oldest(rjd->cache);
+	if (t < 0 || !ServeCached(progname, ms, rcd, rjd, (size_t) t)) {
+	    return t;
+	}
+    }
+}
+
+/* StartProcess --
+ *
+ * Start process 'proc' on a ready slot, and move the slot to the run
+ * queue.  If the process has a time limit, set the slot's deadline.
+ * With -cache, spool the output of a process with a key.
+ */
+
+static void
+StartProcess(char* progname, MachineList* ms, QI_Index slot, roConfigData* rcd, size_t proc, roJobData* rjd)
+{
+    ms->proc[slot] = proc;
+    if (rjd->history != NULL) {
+	ms->key[slot] = TaskKey(rcd, rjd, proc);
+    }
+    if (rjd->spool != NULL && rjd->cacheKeyed && rjd->cacheProc == proc) {
+	SlotSpool*	sp = &rjd->spool[slot];
+
+	sp->out = RC_Spool(rjd->cache);
+	sp->err = RC_Spool(rjd->cache);
+	sp->keyed = sp->out >= 0 && sp->err >= 0;
+	sp->key = rjd->cacheKey;
+	if (!sp->keyed && sp->out >= 0) {
+	    close(sp->out);
+	}
+	if (!sp->keyed && sp->err >= 0) {
+	    close(sp->err);
+	}
+	rjd->cacheKeyed = 0;
+    }
+    ms->start[slot] = Now();
+    SpawnProcess(progname, ms, slot, rcd, proc, rjd);
+    ms->state[slot] = ml_sRun;
+    QI_ADD(&ms->run, ms->link, slot);
+    if (rjd->timers != NULL) {
+	double limit = rjd->timeout;
+	if (rjd->dag != NULL && rjd->dag->tasks[proc].timeout > 0) {
+	    limit = rjd->dag->tasks[proc].timeout;
+	}
+	if (limit > 0) {
+	    TW_Add(rjd->timers, slot, ms->start[slot] + limit);
+	}
+    }
+}
+
+/* AppendShellWord --
+ *
+ * Append 'w' to a shell command line, quoted so the shell takes it as
+ * one word, unchanged.
+ */
+
+static void
+AppendShellWord(CharAccum* ca, const char* w)
+{
+    CHARACCUM_APPEND_CHAR(ca, '\'');
+    for (;  *w;  ++w) {
+	if (*w == '\'') {
+	    CHARACCUM_APPEND_STR(ca, "'\\''");
+	} else {
+	    CHARACCUM_APPEND_CHAR(ca, *w);
+	}
+    }
+    CHARACCUM_APPEND_CHAR(ca, '\'');
+}
+
+/* BatchScript --
+ *
+ * The shell script that runs a batch: each process in turn, in a
+ * subshell, followed by its records (see batch.h).  For a local slot
+ * the words are quoted, as execvp would take them; for a remote one
+ * they are joined with spaces and evaluated, as the remote shell
+ * would take the line the spawn command joins, so a line that does
+ * not parse fails alone.  An input template names a file on the host
+ * that runs the batch.
+ */
+
+static char*
+BatchScript(MachineList* ms, QI_Index slot, roConfigData* rcd, roJobData* rjd, const size_t* ranks, size_t cnt)
+{
+    MachinePin*	mp = ms->pin ? &ms->pin[slot] : (MachinePin*) NULL;
+    int		local = ML_HOST(ms, slot)->isLocal && rcd->localExec;
+    CharAccum	ca;
+    size_t	i;
+
+    CHARACCUM_INIT(&ca);
+    CHARACCUM_APPEND_STR(&ca, "m=`printf '\\036'`");
+    CHARACCUM_APPEND_STR(&ca, rjd->batchMark + 1);
+    CHARACCUM_APPEND_CHAR(&ca, '\n');
+    for (i = 0;  i < cnt;  ++i) {
+	const char**	ap;
+	char*		w;
+	CharAccum	line;
+
+	CHARACCUM_INIT(&line);
+	for (ap = TaskArgv(rjd, ranks[i]);  *ap != NULL;  ++ap) {
+	    w = RewriteString(*ap, rcd, mp, ranks[i]);
+	    if (local) {
+		AppendShellWord(&line, w);
+	    } else {
+		CHARACCUM_APPEND_STR(&line, w);
+	    }
+	    CHARACCUM_APPEND_CHAR(&line, ' ');
+	    free(w);
+	}
+	CHARACCUM_APPEND_STR(&ca, local ? "( " : "( eval ");
+	if (local) {
+	    CHARACCUM_APPEND_STR(&ca, line.cb);
+	} else {
+	    AppendShellWord(&ca, line.cb);
+	}
+	free(line.cb);
+	CHARACCUM_APPEND_STR(&ca, " )");
+	if (rjd->inTemplate) {
+	    w = RewriteString(rjd->inTemplate, rcd, mp, ranks[i]);
+	    CHARACCUM_APPEND_STR(&ca, " <");
+	    if (local) {
+		AppendShellWord(&ca, w);
+	    } else {
+		CHARACCUM_APPEND_STR(&ca, w);
+	    }
+	    free(w);
+	}
+	CHARACCUM_APPEND_STR(&ca, "; printf '%s %d\\n' \"$m\" $?; printf '%s\\n' \"$m\" >&2\n");
+    }
+    CHARACCUM_FINALIZE(&ca);
+}
+
+/* StartBatch --
+ *
+ * Start the processes 'ranks' on a ready slot as one batch: a single
+ * shell, run through the spawn command unless the slot is local,
+ * whose output comes back on pipes and is passed on by ServiceBatch.
+ * The batch gets the time limit of all its processes together.
+ */
+
+static void
+StartBatch(char* progname, MachineList* ms, QI_Index slot, roConfigData* rcd, const size_t* ranks, size_t cnt, roJobData* rjd)
+{
+    MachineHost*	mh = ML_HOST(ms, slot);
+    MachinePin*		mp = ms->pin ? &ms->pin[slot] : (MachinePin*) NULL;
+    SlotBatch*		sb = &rjd->batches[slot];
+    char*		script;
+    int			outPipe[2], errPipe[2];
+    pid_t		pid;
+
+    script = BatchScript(ms, slot, rcd, rjd, ranks, cnt);
+    if (pipe(outPipe) < 0 || pipe(errPipe) < 0) {
+	fprintf(stderr, "%s: Unable to create pipe: %s\n",
+		progname, strerror(errno));
+	exit(1);
+    }
+
+    pid = fork();
+    if (pid == 0) {
+	dup2(outPipe[1], 1);
+	dup2(errPipe[1], 2);
+	close(outPipe[0]);
+	close(outPipe[1]);
+	close(errPipe[0]);
+	close(errPipe[1]);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGQUIT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	sigprocmask(SIG_SETMASK, &origMask, (sigset_t*) NULL);
+	setsid();
+	if (mh->isLocal && rcd->localExec) {
+	    if (mp != NULL && TOPO_Apply(&mp->place) < 0) {
+		ChildMessage(progname, ": Unable to pin to CPUs ", mp->cpuList,
+			     ": ", strerror(errno), "\n", (char*) NULL);
+	    }
+	    execl("/bin/sh", "sh", "-c", script, (char*) NULL);
+	} else {
+	    execl(rcd->spawnCommand, rcd->spawnCommand, mh->name, script,
+		  (char*) NULL);
+	}
+	ChildMessage(progname, ": Unable to run batch: ", strerror(errno), "\n",
+		     (char*) NULL);
+	_exit(127);
+    }
+    close(outPipe[1]);
+    close(errPipe[1]);
+    free(script);
+    if (pid < 0) {
+	fprintf(stderr, "%s: Unable to fork: %s\n", progname, strerror(errno));
+	exit(1);
+    }
+
+    sb->ranks = (size_t*) malloc(cnt * sizeof(size_t));
+    /*FIXME: Out of memory */
+    memcpy(sb->ranks, ranks, cnt * sizeof(size_t));
+    sb->cnt = cnt;
+    sb->outIdx = sb->errIdx = 0;
+    sb->out = BAT_Open(outPipe[0],
+		       OpenRankOutput(progname, ms, slot, rcd, rjd->outTemplate, ranks[0], 1));
+    sb->err = BAT_Open(errPipe[0],
+		       OpenRankOutput(progname, ms, slot, rcd, rjd->errTemplate, ranks[0], 2));
+    sb->rankStart = Now();
+    if (rjd->writer != NULL) {
+	sb->out->sink = sb->err->sink = WriterSink;
+	sb->out->sinkArg = sb->err->sinkArg = rjd->writer;
+    }
+    if (rjd->ordered != NULL) {
+	SlotOutput*	so = &rjd->slotOut[slot];
+
+	so->oc = rjd->ordered;
+	so->rank = ranks[0];
+	sb->out->sink = OrderedSink;
+	sb->out->sinkArg = so;
+    }
+
+    ms->proc[slot] = ranks[0];
+    ms->start[slot] = sb->rankStart;
+    ms->pid[slot] = pid;
+    ML_MapPid(ms, pid, slot);
+    ms->state[slot] = ml_sRun;
+    QI_ADD(&ms->run, ms->link, slot);
+    if (rjd->timers != NULL && rjd->timeout > 0) {
+	TW_Add(rjd->timers, slot, ms->start[slot] + rjd->timeout * cnt);
+    }
+}
+
+/* BatchSize --
+ *
+ * How many processes to put in the next batch.  With -batch auto,
+ * enough to take about BATCH_TARGET seconds at the observed time per
+ * process, starting from one while nothing has been observed; but
+ * never more than an even share of what is left among the slots, so
+ * the last batches do not leave most slots idle.
+ */
+
+static size_t
+BatchSize(MachineList* ms, roJobData* rjd, size_t left)
+{
+    size_t	k = rjd->batch;
+    size_t	share;
+
+    if (!rjd->batchAuto) {
+	return k;
+    }
+    k = 1;
+    if (rjd->rankTime > 0) {
+	double	want = BATCH_TARGET / rjd->rankTime;
+	k = want >= BATCH_MAX ? BATCH_MAX : (size_t) want + 1;
+    }
+    share = (left + ms->liveCnt - 1) / (ms->liveCnt ? ms->liveCnt : 1);
+    if (k > share) {
+	k = share;
+    }
+    return k ? k : 1;
+}
+
+/* SpawnDag --
+ *
+ * Spawn the tasks of a task graph.  Whenever a machine is ready, it
+ * is given the highest priority task whose dependencies have all
+ * succeeded; if there is none, wait for something to finish.
+ */
+
+static void
+SpawnDag(char* progname, MachineList* ms, roConfigData* rcd, roJobData* rjd)
+{
+    DAG_Graph*	g = rjd->dag;
+    size_t	t;
+
+    for (t = 0;  t < g->taskCnt;  ++t) {
+	if (JNL_RankDone(&rjd->skip, t)) {
+	    DAG_Complete(g, t, 1);
+	}
+    }
+
+    for (;;) {
+	QI_Index	slot;
+	long		t;
+
+	slot = GetReadyMachine(progname, ms, rcd, rjd);
+	if (slot == QI_NIL) {
+	    break;
+	}
+	t = TakeReadyTask(progname, ms, rcd, rjd);
+	if (t < 0) {
+	    /*
+	     * Nothing is ready.  Give the machine back, and wait for a
+	     * running task to release more work.
+	     */
+	    QI_ADD_HEAD(&ms->ready, ms->link, slot);
+	    if (QI_EMPTY(&ms->run)) {
+		break;
+	    }
+	    WaitOnMachines(progname, ms, rcd, rjd);
+	    continue;
+	}
+	StartProcess(progname, ms, slot, rcd, (size_t) t, rjd);
+    }
+}
+
+/* PlannedTask --
+ *
+ * A process and its expected runtime, for ordering the dispatch.
+ */
+
+typedef struct PlannedTask {
+    double	expect;
+    size_t	proc;
+} PlannedTask;
+
+static int
+ComparePlannedTasks(const void* a, const void* b)
+{
+    const PlannedTask*	pa = (const PlannedTask*) a;
+    const PlannedTask*	pb = (const PlannedTask*) b;
+
+    if (pa->expect != pb->expect) {
+	return (pa->expect > pb->expect) ? -1 : 1;
+    }
+    return (pa->proc < pb->proc) ? -1 : (pa->proc > pb->proc);
+}
+
+/* PredictMakespan --
+ *
+ * Predict the makespan of dispatching 'n' tasks, with the given
+ * runtimes and in the given order, over 'm' machines: each task goes
+ * to the machine that frees up first.  A heap holds the time each
+ * machine frees up.
+ */
+
+static double
+PredictMakespan(const PlannedTask* pt, size_t n, size_t m)
+{
+    double*	busy;
+    double	span = 0.0;
+    size_t	i, j;
+
+    if (m == 0) {
+	return 0.0;
+    }
+    busy = (double*) calloc(m, sizeof(double));
+    /*FIXME: Out of memory */
+    for (i = 0;  i < n;  ++i) {
+	double	t = busy[0] + pt[i].expect;
+	if (t > span) {
+	    span = t;
+	}
+	/* Replace the root, and sift down. */
+	for (j = 0;  2*j + 1 < m;  ) {
+	    size_t c = 2*j + 1;
+	    if (c + 1 < m && busy[c+1] < busy[c]) {
+		++c;
+	    }
+	    if (busy[c] >= t) {
+		break;
+	    }
+	    busy[j] = busy[c];
+	    j = c;
+	}
+	busy[j] = t;
+    }
+    free(busy);
+    return span;
+}
+
+/* PlanJob --
+ *
+ * Use the runtime history to plan the job.  Task graph weights become
+ * expected runtimes; with -lpt, processes are dispatched longest
+ * expected runtime first.  Processes with no history are expected to
+ * take the mean of those that have one.  Returns the predicted
+ * makespan, or -1.0 if there is no history to predict from.
+ */
+
+static double
+PlanJob(MachineList* ms, roConfigData* rcd, roJobData* rjd, size_t np)
+{
+    PlannedTask*	pt;
+    size_t		n = 0;
+    size_t		known = 0;
+    double		total = 0.0;
+    double		mean;
+    double		span;
+    size_t		i;
+
+    pt = (PlannedTask*) malloc((np + 1) * sizeof(PlannedTask));
+    /*FIXME: Out of memory */
+    for (i = 0;  i < np;  ++i) {
+	if (JNL_RankDone(&rjd->skip, i)) {
+	    continue;
+	}
+	pt[n].proc = i;
+	pt[n].expect = HIST_Lookup(rjd->history, TaskKey(rcd, rjd, i));
+	if (pt[n].expect >= 0.0) {
+	    total += pt[n].expect;
+	    known++;
+	}
+	n++;
+    }
+    if (known == 0) {
+	free(pt);
+	return -1.0;
+    }
+    mean = total / known;
+    for (i = 0;  i < n;  ++i) {
+	if (pt[i].expect < 0.0) {
+	    pt[i].expect = mean;
+	    total += mean;
+	}
+    }
+
+    if (rjd->dag != NULL) {
+	/*
+	 * The graph dispatches by critical path, which DAG_Prepare
+	 * computes from these weights.  Here, predict the work spread
+	 * over every machine; the caller takes the larger of the two.
+	 */
+	for (i = 0;  i < n;  ++i) {
+	    rjd->dag->tasks[pt[i].proc].weight = pt[i].expect;
+	}
+	free(pt);
+	return total / (ms->liveCnt ? ms->liveCnt : 1);
+    }
+
+    if (rjd->lpt) {
+	qsort(pt, n, sizeof(PlannedTask), ComparePlannedTasks);
+	rjd->order = (size_t*) malloc((n + 1) * sizeof(size_t));
+	/*FIXME: Out of memory */
+	for (i = 0;  i < n;  ++i) {
+	    rjd->order[i] = pt[i].proc;
+	}
+	rjd->orderCnt = n;
+    }
+    span = PredictMakespan(pt, n, ms->liveCnt);
+    free(pt);
+    return span;
+}
+
+/* SpawnPacked --
+ *
+ * Spawn the processes, or the tasks of the graph as they become
+ * ready, each on a host its needs fit (see pack.h).
+ */
+
+static void
+SpawnPacked(char* progname, MachineList* ms, roConfigData* rcd, size_t np, roJobData* rjd)
+{
+    PK_Pack*	pk = rjd->pack;
+    DAG_Graph*	g = rjd->dag;
+    size_t	i;
+
+    if (g != NULL) {
+	for (i = 0;  i < g->taskCnt;  ++i) {
+	    if (JNL_RankDone(&rjd->skip, i)) {
+		DAG_Complete(g, i, 1);
+	    }
+	}
+    } else {
+	if (rjd->order != NULL) {
+	    np = rjd->orderCnt;
+	}
+	for (i = 0;  i < np;  ++i) {
+	    size_t	proc = rjd->order ? rjd->order[i] : i;
+	    if (!JNL_RankDone(&rjd->skip, proc)) {
+		PK_Add(pk, proc, -(double) i);
+	    }
+	}
+    }
+
+    while (!PendingSignal()) {
+	QI_Index	slot;
+	size_t		proc;
+	long		t;
+
+	while (g != NULL && (t = DAG_TakeReady(g)) >= 0) {
+	    PK_Add(pk, (size_t) t, g->tasks[t].prio);
+	}
+	PK_Absorb(pk);
+	slot = PK_Take(pk, &proc);
+	if (slot != QI_NIL && ServeCached(progname, ms, rcd, rjd, proc)) {
+	    PK_Release(pk, slot);
+	    ML_ReleaseSlot(ms, slot);
+	    continue;
+	}
+	if (slot != QI_NIL) {
+	    StartProcess(progname, ms, slot, rcd, proc, rjd);
+	    continue;
+	}
+	if (QI_EMPTY(&ms->run) && (pk->waitCnt == 0 || !rjd->elastic)) {
+	    break;
+	}
+	WaitOnMachines(progname, ms, rcd, rjd);
+    }
+    if (pk->waitCnt > 0 && !PendingSignal()) {
+	fprintf(stderr, "%s: %lu processes not run: no host has room for them\n",
+		progname, (unsigned long) pk->waitCnt);
+    }
+}
+
+/* StartSharded --
+ *
+ * From a shard: start process 'proc' on 'slot', unless the journal
+ * says it is done.
+ */
+
+static int
+StartSharded(void* arg, QI_Index slot, size_t proc)
+{
+    ShardJob*		sj = (ShardJob*) arg;
+    MachineList*	ms = sj->ms;
+    roJobData*		rjd = sj->rjd;
+
+    if (JNL_RankDone(&rjd->skip, proc)) {
+	return 0;
+    }
+    ms->proc[slot] = proc;
+    if (rjd->history != NULL) {
+	ms->key[slot] = TaskKey(sj->rcd, rjd, proc);
+    }
+    ms->start[slot] = Now();
+    SpawnProcess(sj->progname, ms, slot, sj->rcd, proc, rjd);
+    ms->state[slot] = ml_sRun;
+    return 1;
+}
+
+/* FinishSharded --
+ *
+ * From a shard: record a completed process, as WaitOnMachines does.
+ */
+
+static void
+FinishSharded(void* arg, QI_Index slot, int ws)
+{
+    ShardJob*		sj = (ShardJob*) arg;
+    MachineList*	ms = sj->ms;
+    roJobData*		rjd = sj->rjd;
+
+    if (rjd->journal != NULL) {
+	JNL_Append(rjd->journal, ms->proc[slot], ws);
+	if (rjd->journal->recCnt == 1) {
+	    /* The main thread keeps the deadline to sync it. */
+	    SH_Notify(rjd->shards);
+	}
+    }
+    if (rjd->trace != NULL) {
+	TraceProcess(ms, slot, rjd, ms->proc[slot], ms->start[slot], ws);
+    }
+    if (rjd->history != NULL && WIFEXITED(ws) && WEXITSTATUS(ws) == 0) {
+	HIST_Update(rjd->history, ms->key[slot], Now() - ms->start[slot]);
+    }
+}
+
+/* SpawnSharded --
+ *
+ * With -shards, start the first 'np' processes in the dispatch order
+ * from the shards, reaping for them until all have started or a
+ * terminating signal arrives.  Those still running are left on the
+ * 'run' queue.  Returns -1, having started nothing, if no shard can
+ * run; the job then goes on without them.
+ */
+
+static int
+SpawnSharded(char* progname, MachineList* ms, roConfigData* rcd, size_t np, roJobData* rjd)
+{
+    ShardJob		sj;
+    SH_Sched*		sh;
+    struct timespec	tick;
+    size_t		i;
+    size_t		started = 0, stolen = 0;
+    int			polled;
+    PRF_Phase		phase;
+
+    sj.progname = progname;
+    sj.ms = ms;
+    sj.rcd = rcd;
+    sj.rjd = rjd;
+    sh = SH_Create(ms, rjd->shardCnt, rjd->order, np,
+		   StartSharded, FinishSharded, &sj);
+    if (sh == NULL) {
+	return -1;
+    }
+    rjd->shards = sh;
+    if (SH_Begin(sh) < 0) {
+	SH_Stop(sh);
+	SH_Destroy(sh);
+	rjd->shards = (SH_Sched*) NULL;
+	return -1;
+    }
+
+    /*
+     * An exit kept aside is looked up again each millisecond until the
+     * shard that forked it has entered its pid.
+     */
+    while (SH_Live(sh) && !PendingSignal()) {
+	struct pollfd	pfd;
+	struct timespec*	timeout = (struct timespec*) NULL;
+	uint64_t	cnt;
+
+	SH_Reap(sh);
+	if (sh->orphanCnt > 0) {
+	    Sooner(&tick, &timeout, 0.001);
+	}
+	if (rjd->journal != NULL) {
+	    double	due;
+
+	    /* The shards append to the journal under the finish lock. */
+	    pthread_mutex_lock(&sh->finishLock);
+	    due = JNL_Tick(rjd->journal);
+	    pthread_mutex_unlock(&sh->finishLock);
+	    if (due >= 0.0) {
+		Sooner(&tick, &timeout, due);
+	    }
+	}
+	pfd.fd = sh->notifyFd;
+	pfd.events = POLLIN;
+	phase = PRF_SWITCH(prf_pWait);
+	polled = ppoll(&pfd, 1, timeout, &waitMask);
+	PRF_SWITCH(phase);
+	if (polled > 0 && read(sh->notifyFd, &cnt, sizeof(cnt)) < 0) {
+	    /* Nothing to clear. */
+	}
+    }
+    SH_Stop(sh);
+    rjd->shards = (SH_Sched*) NULL;
+
+    for (i = 0;  i < sh->shardCnt;  ++i) {
+	started += sh->shards[i].started;
+	stolen += sh->shards[i].stolen;
+    }
+    if (PRF_Active) {
+	fprintf(stderr, "%s: %lu shards started %lu processes, %lu stolen\n",
+		progname, (unsigned long) sh->shardCnt, (unsigned long) started,
+		(unsigned long) stolen);
+    }
+    SH_Destroy(sh);
+    return 0;
+}
+
+/* SpawnJob --
+ * 
+ * Spawn the various processes in this job.  Returns 0, or the signal
+ * that caused the job to be torn down.
+ */
+
+int
 SpawnJob(char* progname, MachineList* ms, roConfigData* rcd, size_t np, roJobData* rjd)
 {
-    size_t	proc;
+    size_t	i;
+    int		sig;
+    PRF_Phase	phase = PRF_SWITCH(prf_pDispatch);
 
     /*
      * Set up signal handling.
@@ -438,26 +2719,184 @@ SpawnJob(char* progname, MachineList* ms, roConfigData* rcd, size_t np, roJobDat
 
 	sigaction(SIGINT, &sa, NULL);
 	sigaction(SIGQUIT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGALRM, &sa, NULL);
+	if (rjd->elastic) {
+	    sigaction(SIGHUP, &sa, NULL);
+	}
+	sa.sa_flags = SA_NOCLDSTOP;
+	sigaction(SIGCHLD, &sa, NULL);
+
+	sigemptyset(&sa.sa_mask);
+	sigaddset(&sa.sa_mask, SIGINT);
+	sigaddset(&sa.sa_mask, SIGQUIT);
+	sigaddset(&sa.sa_mask, SIGTERM);
+	sigaddset(&sa.sa_mask, SIGALRM);
+	sigaddset(&sa.sa_mask, SIGCHLD);
+	if (rjd->elastic) {
+	    sigaddset(&sa.sa_mask, SIGHUP);
+	}
+	sigprocmask(SIG_BLOCK, &sa.sa_mask, &origMask);
+	waitMask = origMask;
+	sigdelset(&waitMask, SIGINT);
+	sigdelset(&waitMask, SIGQUIT);
+	sigdelset(&waitMask, SIGTERM);
+	sigdelset(&waitMask, SIGALRM);
+	sigdelset(&waitMask, SIGCHLD);
+	sigdelset(&waitMask, SIGHUP);
+    }
+
+    /*
+     * Descriptors to wait on: two pipes per slot for batches, one with
+     * -keep-order, the rendezvous service, the writer, and a load
+     * sampler per host with -adapt.  Output the coordinator captures is
+     * written by the writer, so a slow file system does not hold up
+     * reaping and starting processes.
+     */
+    if (rjd->batch > 0 || rjd->batchAuto || rjd->ordered != NULL || rjd->kvs != NULL
+	|| rjd->adapt != NULL) {
+	size_t	nfd = 2 * ms->mmax + 2 + ms->hcnt;
+
+	rjd->pfd = (struct pollfd*) malloc(nfd * sizeof(struct pollfd));
+	rjd->pfdSlot = (QI_Index*) malloc(nfd * sizeof(QI_Index));
+	/*FIXME: Out of memory */
+    }
+    if (rjd->ordered != NULL) {
+	rjd->slotOut = (SlotOutput*) calloc(ms->mmax, sizeof(SlotOutput));
+	/*FIXME: Out of memory */
+    }
+    if (rjd->cache != NULL) {
+	rjd->spool = (SlotSpool*) calloc(ms->mmax, sizeof(SlotSpool));
+	/*FIXME: Out of memory */
+    }
+    if (rjd->batch > 0 || rjd->batchAuto || rjd->ordered != NULL) {
+	rjd->writer = AW_Create(rcd->writer);
+	if (rjd->writer != NULL && rjd->ordered != NULL) {
+	    rjd->ordered->out = WriterSink;
+	    rjd->ordered->outArg = rjd->writer;
+	}
     }
 
     /*
-     * Spawn the jobs.
+     * Spawn the jobs, skipping those the journal says are done.
      */
-    for (proc = 0;  proc < np;  ++proc) {
-	MachineItem*	mi;
-	mi = GetReadyMachine(ms);
-	SpawnProcess(progname, ms, mi, rcd, proc, rjd);
-	QUEUE_ADD(run, ms, mi);
+    if (rjd->pack != NULL) {
+	SpawnPacked(progname, ms, rcd, np, rjd);
+	np = 0;
+    } else if (rjd->dag != NULL) {
+	SpawnDag(progname, ms, rcd, rjd);
+	np = 0;
+    }
+    if (rjd->order != NULL && np > 0) {
+	np = rjd->orderCnt;
+    }
+    if (rjd->batch > 0 || rjd->batchAuto) {
+	size_t*	ranks = (size_t*) malloc(BATCH_MAX * sizeof(size_t));
+
+	rjd->batches = (SlotBatch*) calloc(ms->mmax, sizeof(SlotBatch));
+	/*FIXME: Out of memory */
+	for (i = 0;  i < np;  ) {
+	    QI_Index	slot;
+	    size_t	k, cnt = 0;
+
+	    slot = GetReadyMachine(progname, ms, rcd, rjd);
+	    if (slot == QI_NIL) {
+		break;
+	    }
+	    if (rjd->prefetch != NULL) {
+		PrefetchInputs(rcd, rjd, i, np);
+	    }
+	    k = BatchSize(ms, rjd, np - i);
+	    for (;  cnt < k && i < np;  ++i) {
+		size_t proc = rjd->order ? rjd->order[i] : i;
+		if (!JNL_RankDone(&rjd->skip, proc)) {
+		    ranks[cnt++] = proc;
+		}
+	    }
+	    if (cnt == 0) {
+		QI_ADD_HEAD(&ms->ready, ms->link, slot);
+		break;
+	    }
+	    StartBatch(progname, ms, slot, rcd, ranks, cnt, rjd);
+	}
+	free(ranks);
+	np = 0;
+    }
+    if (rjd->shardCnt > 0 && np > 0
+	&& SpawnSharded(progname, ms, rcd, np, rjd) == 0) {
+	np = 0;
+    }
+    for (i = 0;  i < np;  ++i) {
+	QI_Index	slot;
+	size_t		proc;
+
+	/* Step over a run the journal says is done, whole. */
+	if (rjd->order == NULL && rjd->skip.runCnt > 0) {
+	    i = JNL_NextUndone(&rjd->skip, i);
+	    if (i >= np) {
+		break;
+	    }
+	}
+	proc = rjd->order ? rjd->order[i] : i;
+	if (JNL_RankDone(&rjd->skip, proc)) {
+	    continue;
+	}
+	if (rjd->prefetch != NULL) {
+	    PrefetchInputs(rcd, rjd, i, np);
+	}
+	if (rjd->cache != NULL) {
+	    PrefetchCache(rcd, rjd, np);
+	}
+	if (ServeCached(progname, ms, rcd, rjd, proc)) {
+	    continue;
+	}
+	slot = GetReadyMachine(progname, ms, rcd, rjd);
+	if (slot == QI_NIL) {
+	    break;
+	}
+	StartProcess(progname, ms, slot, rcd, proc, rjd);
     }
 
     /*
      * Wait until everything is done.
      */
-    while (QUEUE_HEAD(run, ms) != NULL) {
-	WaitOnMachines(ms);
+    while (!QI_EMPTY(&ms->run) && !PendingSignal()) {
+	WaitOnMachines(progname, ms, rcd, rjd);
+    }
+
+    sig = PendingSignal();
+    if (sig) {
+	TeardownJob(progname, ms, rcd, rjd, sig);
+    } else if (rjd->dag != NULL && rjd->dag->blockedCnt > 0) {
+	fprintf(stderr, "%s: %lu tasks not run because a dependency failed\n",
+		progname, (unsigned long) rjd->dag->blockedCnt);
+    }
+    if (rjd->timers != NULL) {
+	ArmTimer(rjd);
+    }
+    if (rjd->timedOutCnt > 0) {
+	fprintf(stderr, "%s: %lu processes timed out\n",
+		progname, (unsigned long) rjd->timedOutCnt);
     }
+    if (rjd->adapt != NULL) {
+	AD_Stop(rjd->adapt);
+    }
+    if (rjd->ordered != NULL) {
+	ORD_Drain(rjd->ordered);
+    }
+    if (rjd->writer != NULL) {
+	if (AW_Drain(rjd->writer) < 0) {
+	    fprintf(stderr, "%s: Error writing output: %s\n",
+		    progname, strerror(errno));
+	}
+	AW_Destroy(rjd->writer);
+	rjd->writer = (AW_Writer*) NULL;
+    }
+    sigprocmask(SIG_SETMASK, &origMask, (sigset_t*) NULL);
+    PRF_SWITCH(phase);
+    return sig;
 }
-
+
 /*==================================================
 *
 * Configuration file parsing.
@@ -512,6 +2951,22 @@ static void SetSpawnCommand(roConfigData* rcd, const char* spawnCommand)
     strcpy(rcd->spawnCommand, spawnCommand);
 }
 
+/* SetKillCommand --
+ *
+ * Set the command run on remote hosts when the job is torn down.
+ *
+ */
+
+static void SetKillCommand(roConfigData* rcd, const char* killCommand)
+{
+    if (rcd->killCommand != NULL) {
+	free(rcd->killCommand);
+    }
+    rcd->killCommand = (char*) malloc(strlen(killCommand)+1);
+    /*FIXME: Out of memory */
+    strcpy(rcd->killCommand, killCommand);
+}
+
 
 /* ParseConfigScript --
  *
@@ -532,6 +2987,20 @@ ParseConfigScript(const char* progname, FILE* cff)
     rcd = (roConfigData*) malloc(sizeof(roConfigData));
     /*FIXME: Out of memory */
     rcd->machineScript = rcd->jobName = (char*) NULL;
+    rcd->spawnCommand = rcd->killCommand = (char*) NULL;
+    rcd->killGrace = DEFAULT_KILL_GRACE;
+    rcd->localExec = 1;
+    rcd->remoteCpus = rcd->remoteNodes = 0;
+    rcd->stageDir = rcd->stagePath = (char*) NULL;
+    rcd->stageTimeout = DEFAULT_STAGE_TIMEOUT;
+    rcd->probeCommand = strdup(DEFAULT_PROBE_COMMAND);
+    rcd->sweep = (SWP_Sweep*) NULL;
+    rcd->orderBudget = (size_t) DEFAULT_ORDER_BUDGET << 20;
+    rcd->procCnt = 0;
+    rcd->kvsAddress = rcd->kvsToken = (const char*) NULL;
+    rcd->writer = aw_bUring;
+    rcd->adaptInterval = AD_DEFAULT_INTERVAL;
+    rcd->loadCommand = strdup(AD_DEFAULT_COMMAND);
     SetMachineScript(rcd, RO_MACHINE_SCRIPT);
     SetJobName(rcd, "");
     /*FIXME: Default at configure time. */
@@ -613,6 +3082,102 @@ ParseConfigScript(const char* progname, FILE* cff)
 		exit(1);
 	    }
 	    SetSpawnCommand(rcd, cp);
+	} else if (0 == strcmp(tok, "killcommand")) {
+	    if (!*cp) {
+		fprintf(stderr, "%s: %lu: killcommand directive requires a command\n",
+			progname, lineCount);
+		exit(1);
+	    }
+	    SetKillCommand(rcd, cp);
+	} else if (0 == strcmp(tok, "killgrace")) {
+	    char*	ep;
+	    long	kg = strtol(cp, &ep, 0);
+	    if (!*cp || *ep || kg < 0) {
+		fprintf(stderr, "%s: %lu: killgrace directive requires a number of seconds\n",
+			progname, lineCount);
+		exit(1);
+	    }
+	    rcd->killGrace = (unsigned) kg;
+	} else if (0 == strcmp(tok, "topology")) {
+	    int	cpus, nodes = 1;
+	    if (sscanf(cp, "%d %d", &cpus, &nodes) < 1 || cpus < 1 || nodes < 1) {
+		fprintf(stderr, "%s: %lu: topology directive requires CPU and node counts\n",
+			progname, lineCount);
+		exit(1);
+	    }
+	    rcd->remoteCpus = cpus;
+	    rcd->remoteNodes = nodes;
+	} else if (0 == strcmp(tok, "stagedir")) {
+	    if (!*cp) {
+		fprintf(stderr, "%s: %lu: stagedir directive requires a path\n",
+			progname, lineCount);
+		exit(1);
+	    }
+	    free(rcd->stageDir);
+	    rcd->stageDir = strdup(cp);
+	} else if (0 == strcmp(tok, "stagetimeout")) {
+	    char*	ep;
+	    double	st = strtod(cp, &ep);
+	    if (!*cp || *ep || st < 0) {
+		fprintf(stderr, "%s: %lu: stagetimeout directive requires a number of seconds\n",
+			progname, lineCount);
+		exit(1);
+	    }
+	    rcd->stageTimeout = st;
+	} else if (0 == strcmp(tok, "probecommand")) {
+	    if (!*cp) {
+		fprintf(stderr, "%s: %lu: probecommand directive requires a command\n",
+			progname, lineCount);
+		exit(1);
+	    }
+	    free(rcd->probeCommand);
+	    rcd->probeCommand = strdup(cp);
+	} else if (0 == strcmp(tok, "orderbudget")) {
+	    char*	ep;
+	    long	mb = strtol(cp, &ep, 0);
+	    if (!*cp || *ep || mb <= 0) {
+		fprintf(stderr, "%s: %lu: orderbudget directive requires a number of megabytes\n",
+			progname, lineCount);
+		exit(1);
+	    }
+	    rcd->orderBudget = (size_t) mb << 20;
+	} else if (0 == strcmp(tok, "outputwriter")) {
+	    if (0 == strcmp(cp, "uring")) {
+		rcd->writer = aw_bUring;
+	    } else if (0 == strcmp(cp, "threads")) {
+		rcd->writer = aw_bThreads;
+	    } else {
+		fprintf(stderr, "%s: %lu: outputwriter directive requires \"uring\" or \"threads\"\n",
+			progname, lineCount);
+		exit(1);
+	    }
+	} else if (0 == strcmp(tok, "adaptinterval")) {
+	    char*	ep;
+	    double	ai = strtod(cp, &ep);
+	    if (!*cp || *ep || ai <= 0) {
+		fprintf(stderr, "%s: %lu: adaptinterval directive requires a number of seconds\n",
+			progname, lineCount);
+		exit(1);
+	    }
+	    rcd->adaptInterval = ai;
+	} else if (0 == strcmp(tok, "loadcommand")) {
+	    if (!*cp) {
+		fprintf(stderr, "%s: %lu: loadcommand directive requires a command\n",
+			progname, lineCount);
+		exit(1);
+	    }
+	    free(rcd->loadCommand);
+	    rcd->loadCommand = strdup(cp);
+	} else if (0 == strcmp(tok, "localexec")) {
+	    if (0 == strcmp(cp, "on") || 0 == strcmp(cp, "yes")) {
+		rcd->localExec = 1;
+	    } else if (0 == strcmp(cp, "off") || 0 == strcmp(cp, "no")) {
+		rcd->localExec = 0;
+	    } else {
+		fprintf(stderr, "%s: %lu: localexec directive requires \"on\" or \"off\"\n",
+			progname, lineCount);
+		exit(1);
+	    }
 	} else {
 	    fprintf(stderr, "%s: %lu: Unknown directive \"%s\"\n",
 		    progname, lineCount, tok);
@@ -636,13 +3201,36 @@ ParseConfigScript(const char* progname, FILE* cff)
 static void
 Usage(char* av0, int ec)
 {
-    fprintf(stderr, "Usage: %s [-np NP] [-machinefile MF] -- PROG ARGS...\n\n",
+    fprintf(stderr, "Usage: %s [-np NP] [-machinefile MF] -- PROG ARGS...\n",
+	    av0);
+    fprintf(stderr, "       %s [-machinefile MF] -dag DAGFILE\n\n",
 	    av0);
     fprintf(stderr, "  -np NP           Run job NP times.\n");
     fprintf(stderr, "  -machinefile MF  Use machines in MF.\n");
     fprintf(stderr, "  -stderr ERRTEMP  Path template for error file.\n");
     fprintf(stderr, "  -stdin INTEMP    Path template for input file.\n");
     fprintf(stderr, "  -stdout OUTTEMP  Path template for output file.\n");
+    fprintf(stderr, "  -dag DAGFILE     Run the task graph in DAGFILE.\n");
+    fprintf(stderr, "  -journal FILE    Record completed processes in FILE.\n");
+    fprintf(stderr, "  -resume          Skip processes the journal shows succeeded.\n");
+    fprintf(stderr, "  -history FILE    Keep a runtime history in FILE.\n");
+    fprintf(stderr, "  -lpt             Run longest expected processes first.\n");
+    fprintf(stderr, "  -pin POLICY      Pin slots to CPUs: compact, scatter or numa.\n");
+    fprintf(stderr, "  -stage FILE      Copy FILE to every host before starting.\n");
+    fprintf(stderr, "  -timeout SECS    Kill processes that run longer than SECS.\n");
+    fprintf(stderr, "  -probe SECS      Drop hosts that cannot run a process within SECS.\n");
+    fprintf(stderr, "  -batch K|auto    Run K processes per remote invocation.\n");
+    fprintf(stderr, "  -keep-order      Write standard output in process order.\n");
+    fprintf(stderr, "  -kvs             Serve a PMI-1 rendezvous service at %%k.\n");
+    fprintf(stderr, "  -adapt LO:HI     Run LO to HI times each host's slots, by its load.\n");
+    fprintf(stderr, "  -need NEEDTEMP   Place by what each process needs, \"mem=SIZE cores=N\".\n");
+    fprintf(stderr, "  -elastic         Reload the machine list on SIGHUP.\n");
+    fprintf(stderr, "  -trace FILE      Record each process's host and timing in FILE.\n");
+    fprintf(stderr, "  -cache DIR       Replay processes that succeeded before from DIR.\n");
+    fprintf(stderr, "  -input INTEMP    Path template for a file the cache key covers.\n");
+    fprintf(stderr, "  -prefetch N      Read the input files of the next N processes ahead.\n");
+    fprintf(stderr, "  -shards K        Start processes from K threads, each with its own hosts.\n");
+    fprintf(stderr, "  -profile         Print where the coordinator's time went, by phase.\n");
 
     exit(ec);
 }
@@ -656,11 +3244,41 @@ int
 main(int argc, char* argv[])
 {
     char*	progname;
-    int		np = -1;
+    size_t	np = 0;		/* 0 until given. */
     const char* 	mf = NULL;
+    char		mfErr[256];
     MachineList*	ms;
     roConfigData*	rcd;
     roJobData		rjd;
+    int			sig;
+    const char*		journalPath = NULL;
+    const char*		dagPath = NULL;
+    DAG_Graph		dag;
+    const char*		historyPath = NULL;
+    HIST_Table		history;
+    const char*		tracePath = NULL;
+    const char*		cachePath = NULL;
+    AV_Control		inputFiles;
+    size_t		inputCnt;
+    double		predicted = -1.0;
+    double		started;
+    TOPO_Policy		pinPolicy = topo_pNone;
+    AV_Control		stageFiles;
+    size_t		stageCnt;
+    int			resume = 0;
+    JNL_Control		journal;
+    TW_Wheel		timers;
+    double		probeLimit = 0.0;
+    SWP_Sweep		sweep;
+    int			keepOrder = 0;
+    ORD_Control		ordered;
+    int			useKvs = 0;
+    KVS_Server		kvs;
+    double		adaptLo = 0.0, adaptHi = 0.0;
+    AD_Control		adapt;
+    PK_Pack		pack;
+    int			profile = 0;
+    double		configTime;
 
     /*
      * The program name, for error messages, etc.
@@ -673,6 +3291,7 @@ main(int argc, char* argv[])
     /*
      * Parse the configuration script.
      */
+    configTime = Now();
     {
 	FILE* cff = popen(RO_CONFIG_SCRIPT, "r");
 	if (cff == (FILE*) NULL) {
@@ -683,6 +3302,7 @@ main(int argc, char* argv[])
 	rcd = ParseConfigScript(progname, cff);
 	pclose(cff);
     }
+    configTime = Now() - configTime;
 
     /*
      * Parse command line.  Options are of the form "-np", to resemble
@@ -691,11 +3311,54 @@ main(int argc, char* argv[])
     rjd.inTemplate = (const char*) NULL;
     rjd.outTemplate = (const char*) NULL;
     rjd.errTemplate = (const char*) NULL;
+    rjd.journal = (JNL_Control*) NULL;
+    rjd.dag = (DAG_Graph*) NULL;
+    rjd.progargv = (const char**) NULL;
+    rjd.history = (HIST_Table*) NULL;
+    rjd.order = (size_t*) NULL;
+    rjd.orderCnt = 0;
+    rjd.lpt = 0;
+    rjd.timeout = 0.0;
+    rjd.timers = (TW_Wheel*) NULL;
+    rjd.timedOutCnt = 0;
+    rjd.batch = 0;
+    rjd.batchAuto = 0;
+    rjd.batches = (SlotBatch*) NULL;
+    rjd.rankTime = -1.0;
+    rjd.pfd = (struct pollfd*) NULL;
+    rjd.pfdSlot = (QI_Index*) NULL;
+    rjd.ordered = (ORD_Control*) NULL;
+    rjd.slotOut = (SlotOutput*) NULL;
+    rjd.kvs = (KVS_Server*) NULL;
+    rjd.writer = (AW_Writer*) NULL;
+    rjd.adapt = (AD_Control*) NULL;
+    rjd.needTemplate = (const char*) NULL;
+    rjd.pack = (PK_Pack*) NULL;
+    rjd.elastic = 0;
+    rjd.machineFile = (const char*) NULL;
+    rjd.trace = (FILE*) NULL;
+    rjd.traceOrigin = 0.0;
+    rjd.cache = (RC_Cache*) NULL;
+    rjd.inputTemplates = (const char**) NULL;
+    rjd.spool = (SlotSpool*) NULL;
+    rjd.cacheNext = 0;
+    rjd.cacheProc = 0;
+    rjd.cacheKeyed = 0;
+    rjd.prefetch = (PF_Prefetcher*) NULL;
+    rjd.prefetchAhead = 0;
+    rjd.prefetchNext = 0;
+    rjd.shardCnt = 0;
+    rjd.shards = (SH_Sched*) NULL;
+    BAT_MakeMark(rjd.batchMark, &rjd.markLen);
+    AV_Init(&stageFiles);
+    AV_Init(&inputFiles);
+    JNL_RankSetInit(&rjd.skip);
     {
 	const char** op;
 	enum { sOPT, sNP, sMACHINE,
-	       sSTDIN, sSTDOUT, sSTDERR,
-	       sPARAM, sDONE } state;
+	       sSTDIN, sSTDOUT, sSTDERR, sJOURNAL, sDAG, sHISTORY, sPIN, sSTAGE,
+	       sTIMEOUT, sPROBE, sBATCH, sADAPT, sNEED, sTRACE, sCACHE, sINPUT,
+	       sPREFETCH, sSHARDS, sPARAM, sDONE } state;
 
 	state = sOPT;
 	for (op = (const char**) (argv+1);  *op;  ++op) {
@@ -712,6 +3375,48 @@ main(int argc, char* argv[])
 		    state = sSTDOUT;
 		} else if (!strcmp(*op, "-stderr")) {
 		    state = sSTDERR;
+		} else if (!strcmp(*op, "-dag")) {
+		    state = sDAG;
+		} else if (!strcmp(*op, "-journal")) {
+		    state = sJOURNAL;
+		} else if (!strcmp(*op, "-resume")) {
+		    resume = 1;
+		} else if (!strcmp(*op, "-history")) {
+		    state = sHISTORY;
+		} else if (!strcmp(*op, "-trace")) {
+		    state = sTRACE;
+		} else if (!strcmp(*op, "-cache")) {
+		    state = sCACHE;
+		} else if (!strcmp(*op, "-input")) {
+		    state = sINPUT;
+		} else if (!strcmp(*op, "-prefetch")) {
+		    state = sPREFETCH;
+		} else if (!strcmp(*op, "-profile")) {
+		    profile = 1;
+		} else if (!strcmp(*op, "-shards")) {
+		    state = sSHARDS;
+		} else if (!strcmp(*op, "-lpt")) {
+		    rjd.lpt = 1;
+		} else if (!strcmp(*op, "-pin")) {
+		    state = sPIN;
+		} else if (!strcmp(*op, "-stage")) {
+		    state = sSTAGE;
+		} else if (!strcmp(*op, "-timeout")) {
+		    state = sTIMEOUT;
+		} else if (!strcmp(*op, "-probe")) {
+		    state = sPROBE;
+		} else if (!strcmp(*op, "-batch")) {
+		    state = sBATCH;
+		} else if (!strcmp(*op, "-keep-order")) {
+		    keepOrder = 1;
+		} else if (!strcmp(*op, "-kvs")) {
+		    useKvs = 1;
+		} else if (!strcmp(*op, "-adapt")) {
+		    state = sADAPT;
+		} else if (!strcmp(*op, "-need")) {
+		    state = sNEED;
+		} else if (!strcmp(*op, "-elastic")) {
+		    rjd.elastic = 1;
 		} else if (!strcmp(*op, "-help")
 			   || !strcmp(*op, "-h")
 			   || !strcmp(*op, "-?")) {
@@ -722,46 +3427,183 @@ main(int argc, char* argv[])
 		    fprintf(stderr, "%s: Unknown option \"%s\"\n",
 			    progname, *op);
 		    Usage(progname, 1);
-		} else {
-		    rjd.progargv = op;
-		    state = sDONE;
-		    goto parseDone;
+		} else {
+		    rjd.progargv = op;
+		    state = sDONE;
+		    goto parseDone;
+		}
+		break;
+
+	    case sNP:
+	    {
+		char *			ep;
+		unsigned long long	lnp;
+
+		errno = 0;
+		lnp = strtoull(*op, &ep, 0);
+		if (**op == '-' || lnp == 0 || *ep || errno == ERANGE
+		    || (unsigned long long) (size_t) lnp != lnp) {
+		    fprintf(stderr, "%s: \"-np\" requires a positive integer.\n",
+			    progname);
+		    Usage(progname, 1);
+		}
+		np = (size_t) lnp;
+		state = sOPT;
+		break;
+	    }
+
+	    case sMACHINE:
+		mf = *op;
+		state = sOPT;
+		break;
+
+	    case sSTDIN:
+		rjd.inTemplate = *op;
+		state = sOPT;
+		break;
+
+	    case sSTDOUT:
+		rjd.outTemplate = *op;
+		state = sOPT;
+		break;
+
+	    case sSTDERR:
+		rjd.errTemplate = *op;
+		state = sOPT;
+		break;
+
+	    case sJOURNAL:
+		journalPath = *op;
+		state = sOPT;
+		break;
+
+	    case sDAG:
+		dagPath = *op;
+		state = sOPT;
+		break;
+
+	    case sHISTORY:
+		historyPath = *op;
+		state = sOPT;
+		break;
+
+	    case sTRACE:
+		tracePath = *op;
+		state = sOPT;
+		break;
+
+	    case sCACHE:
+		cachePath = *op;
+		state = sOPT;
+		break;
+
+	    case sINPUT:
+		AV_AddString(&inputFiles, *op);
+		state = sOPT;
+		break;
+
+	    case sPREFETCH:
+	    {
+		char*	ep;
+		long	n = strtol(*op, &ep, 0);
+		if (n <= 0 || *ep) {
+		    fprintf(stderr, "%s: \"-prefetch\" requires a positive count.\n",
+			    progname);
+		    Usage(progname, 1);
+		}
+		rjd.prefetchAhead = (size_t) n;
+		state = sOPT;
+		break;
+	    }
+
+	    case sSHARDS:
+	    {
+		char*	ep;
+		long	n = strtol(*op, &ep, 0);
+		if (n <= 0 || *ep) {
+		    fprintf(stderr, "%s: \"-shards\" requires a positive count.\n",
+			    progname);
+		    Usage(progname, 1);
+		}
+		rjd.shardCnt = (size_t) n;
+		state = sOPT;
+		break;
+	    }
+
+	    case sSTAGE:
+		AV_AddString(&stageFiles, *op);
+		state = sOPT;
+		break;
+
+	    case sPIN:
+		if (TOPO_ParsePolicy(*op, &pinPolicy) < 0) {
+		    fprintf(stderr, "%s: Unknown pinning policy \"%s\"\n",
+			    progname, *op);
+		    Usage(progname, 1);
 		}
+		state = sOPT;
 		break;
 
-	    case sNP:
+	    case sTIMEOUT:
 	    {
-		char *	ep;
-		long	lnp;
-		lnp = strtol(*op, &ep, 0);
-		if (lnp <= 0 || *ep) {
-		    fprintf(stderr, "%s: \"-np\" requires a positive integer.\n",
+		char*	ep;
+		rjd.timeout = strtod(*op, &ep);
+		if (rjd.timeout <= 0 || *ep) {
+		    fprintf(stderr, "%s: \"-timeout\" requires a positive number of seconds.\n",
 			    progname);
 		    Usage(progname, 1);
 		}
-		/* FIXME: Make sure we don't go too large. */
-		np = (int) lnp;
 		state = sOPT;
 		break;
 	    }
 
-	    case sMACHINE:
-		mf = *op;
+	    case sPROBE:
+	    {
+		char*	ep;
+		probeLimit = strtod(*op, &ep);
+		if (probeLimit <= 0 || *ep) {
+		    fprintf(stderr, "%s: \"-probe\" requires a positive number of seconds.\n",
+			    progname);
+		    Usage(progname, 1);
+		}
 		state = sOPT;
 		break;
+	    }
 
-	    case sSTDIN:
-		rjd.inTemplate = *op;
+	    case sBATCH:
+		if (!strcmp(*op, "auto")) {
+		    rjd.batchAuto = 1;
+		} else {
+		    char*	ep;
+		    long	k = strtol(*op, &ep, 0);
+		    if (k <= 0 || k > BATCH_MAX || *ep) {
+			fprintf(stderr, "%s: \"-batch\" requires \"auto\" or a count from 1 to %d.\n",
+				progname, BATCH_MAX);
+			Usage(progname, 1);
+		    }
+		    rjd.batch = (size_t) k;
+		}
 		state = sOPT;
 		break;
 
-	    case sSTDOUT:
-		rjd.outTemplate = *op;
+	    case sADAPT:
+	    {
+		char*	ep;
+		adaptLo = strtod(*op, &ep);
+		if (*ep == ':') {
+		    adaptHi = strtod(ep + 1, &ep);
+		}
+		if (adaptLo <= 0 || adaptHi < adaptLo || *ep) {
+		    fprintf(stderr, "%s: \"-adapt\" requires bounds LO:HI, with 0 < LO <= HI.\n",
+			    progname);
+		    Usage(progname, 1);
+		}
 		state = sOPT;
 		break;
+	    }
 
-	    case sSTDERR:
-		rjd.errTemplate = *op;
+	    case sNEED:
+		rjd.needTemplate = *op;
 		state = sOPT;
 		break;
 
@@ -782,6 +3624,9 @@ main(int argc, char* argv[])
 	switch (state) {
 	case sOPT:
 	case sPARAM:
+	    if (dagPath != NULL) {
+		break;
+	    }
 	    fprintf(stderr, "%s: Missing program to run.\n", progname);
 	    Usage(progname, 1);
 
@@ -801,15 +3646,80 @@ main(int argc, char* argv[])
 	    fprintf(stderr, "%s: \"-stderr\" requires a file template.\n",
 		    progname);
 	    Usage(progname, 1);
+	case sJOURNAL:
+	    fprintf(stderr, "%s: \"-journal\" requires a file name.\n",
+		    progname);
+	    Usage(progname, 1);
+	case sDAG:
+	    fprintf(stderr, "%s: \"-dag\" requires a file name.\n",
+		    progname);
+	    Usage(progname, 1);
+	case sHISTORY:
+	    fprintf(stderr, "%s: \"-history\" requires a file name.\n",
+		    progname);
+	    Usage(progname, 1);
+	case sTRACE:
+	    fprintf(stderr, "%s: \"-trace\" requires a file name.\n",
+		    progname);
+	    Usage(progname, 1);
+	case sCACHE:
+	    fprintf(stderr, "%s: \"-cache\" requires a directory.\n",
+		    progname);
+	    Usage(progname, 1);
+	case sINPUT:
+	    fprintf(stderr, "%s: \"-input\" requires a file template.\n",
+		    progname);
+	    Usage(progname, 1);
+	case sPREFETCH:
+	    fprintf(stderr, "%s: \"-prefetch\" requires a count.\n",
+		    progname);
+	    Usage(progname, 1);
+	case sSHARDS:
+	    fprintf(stderr, "%s: \"-shards\" requires a count.\n",
+		    progname);
+	    Usage(progname, 1);
+	case sPIN:
+	    fprintf(stderr, "%s: \"-pin\" requires a policy.\n",
+		    progname);
+	    Usage(progname, 1);
+	case sSTAGE:
+	    fprintf(stderr, "%s: \"-stage\" requires a file name.\n",
+		    progname);
+	    Usage(progname, 1);
+	case sTIMEOUT:
+	    fprintf(stderr, "%s: \"-timeout\" requires a time limit.\n",
+		    progname);
+	    Usage(progname, 1);
+	case sPROBE:
+	    fprintf(stderr, "%s: \"-probe\" requires a time limit.\n",
+		    progname);
+	    Usage(progname, 1);
+	case sBATCH:
+	    fprintf(stderr, "%s: \"-batch\" requires a count.\n",
+		    progname);
+	    Usage(progname, 1);
+	case sADAPT:
+	    fprintf(stderr, "%s: \"-adapt\" requires bounds.\n",
+		    progname);
+	    Usage(progname, 1);
+	case sNEED:
+	    fprintf(stderr, "%s: \"-need\" requires a template.\n",
+		    progname);
+	    Usage(progname, 1);
 	case sDONE:
 	    break;
 	}
     }
+    if (profile) {
+	PRF_Start(prf_pSetup);
+	PRF_Charge(prf_pConfig, configTime);
+    }
 
     /*
      * We need a to process the machine list.  If no list was
      * provided, we need to choose a default.
      */
+    PRF_SWITCH(prf_pMachines);
     if (mf != NULL) {
 	/*
 	 * A machine list was specified.
@@ -820,8 +3730,13 @@ main(int argc, char* argv[])
 		    progname, mf);
 	    exit(1);
 	}
-	ms = ParseMachineFile(mff);
+	ms = ParseMachineFile(mff, mfErr, sizeof(mfErr));
 	fclose(mff);
+	rjd.machineFile = mf;
+	if (ms == NULL) {
+	    fprintf(stderr, "%s: %s: %s\n", progname, mf, mfErr);
+	    exit(1);
+	}
     } else {
 	/*
 	 * Use the program to generate the machine list.
@@ -832,21 +3747,460 @@ main(int argc, char* argv[])
 		    progname, RO_MACHINE_SCRIPT);
 	    exit(1);
 	}
-	ms = ParseMachineFile(mff);
+	ms = ParseMachineFile(mff, mfErr, sizeof(mfErr));
 	pclose(mff);
+	if (ms == NULL) {
+	    fprintf(stderr, "%s: %s: %s\n", progname, rcd->machineScript, mfErr);
+	    exit(1);
+	}
+    }
+
+    if (rcd->localExec) {
+	MarkLocalMachines(ms);
+    }
+    PRF_SWITCH(prf_pSetup);
+
+    /*
+     * Drop hosts that cannot run anything, before any process is sent
+     * to them.
+     */
+    if (probeLimit > 0) {
+	PRF_SWITCH(prf_pProbe);
+	ProbeHosts(progname, ms, rcd, probeLimit);
+	PRF_SWITCH(prf_pSetup);
+	if (ms->liveCnt == 0) {
+	    fprintf(stderr, "%s: No host passed the probe.\n", progname);
+	    exit(1);
+	}
+    }
+
+    /*
+     * A task graph replaces the program and the process count.
+     */
+    if (dagPath != NULL) {
+	FILE*	df;
+	char	err[256];
+
+	if (rjd.progargv != NULL || np > 0) {
+	    fprintf(stderr, "%s: \"-dag\" cannot be used with \"-np\" or a program.\n",
+		    progname);
+	    Usage(progname, 1);
+	}
+	if (rjd.batch > 0 || rjd.batchAuto) {
+	    fprintf(stderr, "%s: \"-dag\" cannot be used with \"-batch\".\n",
+		    progname);
+	    Usage(progname, 1);
+	}
+	df = fopen(dagPath, "r");
+	if (df == (FILE*) NULL) {
+	    fprintf(stderr, "%s: Unable to open task graph \"%s\"\n",
+		    progname, dagPath);
+	    exit(1);
+	}
+	if (DAG_Parse(&dag, df, err, sizeof(err)) < 0) {
+	    fprintf(stderr, "%s: %s: %s\n", progname, dagPath, err);
+	    exit(1);
+	}
+	fclose(df);
+	rjd.dag = &dag;
+	np = dag.taskCnt;
+    }
+
+    /*
+     * A parameter sweep in the templates sets the process count: one
+     * process per point.
+     */
+    {
+	const char*	tmpl[4];
+	const char**	ap;
+	char		err[256];
+	size_t		i;
+
+	SWP_Init(&sweep);
+	tmpl[0] = rjd.inTemplate;
+	tmpl[1] = rjd.outTemplate;
+	tmpl[2] = rjd.errTemplate;
+	tmpl[3] = rjd.needTemplate;
+	for (ap = rjd.progargv;  ap != NULL && *ap;  ++ap) {
+	    if (SWP_Scan(&sweep, *ap, err, sizeof(err)) < 0) {
+		fprintf(stderr, "%s: %s\n", progname, err);
+		exit(1);
+	    }
+	}
+	for (i = 0;  i < 4;  ++i) {
+	    if (tmpl[i] != NULL && SWP_Scan(&sweep, tmpl[i], err, sizeof(err)) < 0) {
+		fprintf(stderr, "%s: %s\n", progname, err);
+		exit(1);
+	    }
+	}
+	if (SWP_Finish(&sweep, err, sizeof(err)) < 0) {
+	    fprintf(stderr, "%s: %s\n", progname, err);
+	    exit(1);
+	}
+	if (sweep.dimCnt > 0) {
+	    if (rjd.dag != NULL) {
+		fprintf(stderr, "%s: \"-dag\" cannot be used with a parameter sweep.\n",
+			progname);
+		exit(1);
+	    }
+	    if (np == 0 && (uint64_t) (size_t) sweep.size != sweep.size) {
+		fprintf(stderr, "%s: The sweep has %llu points, too many to run.\n",
+			progname, (unsigned long long) sweep.size);
+		exit(1);
+	    }
+	    if (np == 0) {
+		np = (size_t) sweep.size;
+	    } else if ((uint64_t) np > sweep.size) {
+		fprintf(stderr, "%s: \"-np\" exceeds the %llu points of the sweep.\n",
+			progname, (unsigned long long) sweep.size);
+		exit(1);
+	    }
+	    rcd->sweep = &sweep;
+	}
     }
 
     /*
      * If 'np' was not specified, use the size of the machine list.
      */
-    if (np < 0) {
-	np = ms->mcnt;
+    if (np == 0) {
+	np = ms->liveCnt;
+    }
+    rcd->procCnt = np;
+
+    /*
+     * Open the journal.  When resuming, first find which processes
+     * have already completed successfully.
+     */
+    if (resume && journalPath == NULL) {
+	fprintf(stderr, "%s: \"-resume\" requires \"-journal\".\n",
+		progname);
+	Usage(progname, 1);
+    }
+    if (journalPath != NULL) {
+	if (resume && JNL_Load(journalPath, &rjd.skip) < 0) {
+	    fprintf(stderr, "%s: Unable to read journal \"%s\": %s\n",
+		    progname, journalPath, strerror(errno));
+	    exit(1);
+	}
+	if (JNL_Open(&journal, journalPath, resume) < 0) {
+	    fprintf(stderr, "%s: Unable to open journal \"%s\": %s\n",
+		    progname, journalPath, strerror(errno));
+	    exit(1);
+	}
+	rjd.journal = &journal;
+    }
+
+    /*
+     * Plan the job from the runtime history.  Task graph priorities
+     * depend on the planned weights, so prepare the graph after.
+     */
+    if (rjd.lpt && historyPath == NULL) {
+	fprintf(stderr, "%s: \"-lpt\" requires \"-history\".\n",
+		progname);
+	Usage(progname, 1);
+    }
+    if (historyPath != NULL) {
+	HIST_Init(&history);
+	if (HIST_Load(&history, historyPath) < 0) {
+	    fprintf(stderr, "%s: Unable to read history \"%s\": %s\n",
+		    progname, historyPath, strerror(errno));
+	    exit(1);
+	}
+	rjd.history = &history;
+	predicted = PlanJob(ms, rcd, &rjd, np);
+    }
+    if (rjd.dag != NULL) {
+	char	err[256];
+	if (DAG_Prepare(rjd.dag, err, sizeof(err)) < 0) {
+	    fprintf(stderr, "%s: %s: %s\n", progname, dagPath, err);
+	    exit(1);
+	}
+	if (predicted >= 0.0 && DAG_CriticalPath(rjd.dag) > predicted) {
+	    predicted = DAG_CriticalPath(rjd.dag);
+	}
+    }
+
+    /*
+     * Keep standard output in process order.  Processes the journal
+     * says are done write nothing, so they are finished already.
+     */
+    if (keepOrder) {
+	if (rjd.outTemplate != NULL) {
+	    fprintf(stderr, "%s: \"-keep-order\" cannot be used with \"-stdout\".\n",
+		    progname);
+	    Usage(progname, 1);
+	}
+	ORD_Init(&ordered, 1, np, rcd->orderBudget);
+	ORD_Skip(&ordered, &rjd.skip);
+	rjd.ordered = &ordered;
+    }
+
+    /*
+     * Start the rendezvous service.  Its fences wait for every
+     * process, so every process must be running at once.
+     */
+    if (useKvs) {
+	char	err[256];
+	int	local = 1;
+	size_t	h;
+
+	if (rjd.dag != NULL || rjd.batch > 0 || rjd.batchAuto || resume
+	    || adaptHi > 0) {
+	    fprintf(stderr, "%s: \"-kvs\" cannot be used with \"-dag\", \"-batch\", \"-resume\" or \"-adapt\".\n",
+		    progname);
+	    Usage(progname, 1);
+	}
+	if (np > ms->liveCnt) {
+	    fprintf(stderr, "%s: \"-kvs\" needs a slot for each of the %llu processes.\n",
+		    progname, (unsigned long long) np);
+	    exit(1);
+	}
+	for (h = 0;  h < ms->hcnt;  ++h) {
+	    if (!ms->hosts[h].isLocal && !ms->hosts[h].isDown) {
+		local = 0;
+	    }
+	}
+	if (KVS_Open(&kvs, rcd->jobName, np, local, err, sizeof(err)) < 0) {
+	    fprintf(stderr, "%s: Unable to start rendezvous service: %s\n",
+		    progname, err);
+	    exit(1);
+	}
+	rjd.kvs = &kvs;
+	rcd->kvsAddress = kvs.address;
+	rcd->kvsToken = kvs.token;
+	setenv("PMI_TOKEN", kvs.token, 1);
+    }
+
+    /*
+     * Stage input files to the hosts.
+     */
+    {
+	const char**	files = AV_Finalize(&stageFiles, &stageCnt);
+	if (stageCnt > 1) {
+	    PRF_SWITCH(prf_pStage);
+	    StageInputs(progname, ms, rcd, files);
+	    PRF_SWITCH(prf_pSetup);
+	}
+	free((char*) files);
+    }
+
+    /*
+     * Keep a timer wheel for the slot deadlines if any process has a
+     * time limit.
+     */
+    {
+	int	limited = rjd.timeout > 0;
+	size_t	t;
+
+	for (t = 0;  !limited && rjd.dag != NULL && t < rjd.dag->taskCnt;  ++t) {
+	    limited = rjd.dag->tasks[t].timeout > 0;
+	}
+	if (limited) {
+	    rjd.timers = &timers;
+	    TW_Init(rjd.timers, Now(), TIMEOUT_TICK);
+	}
+    }
+
+    /*
+     * Make the slots -adapt may grow into, parked for now, then place
+     * them all.
+     */
+    if (rjd.elastic && (adaptHi > 0 || pinPolicy != topo_pNone)) {
+	fprintf(stderr, "%s: \"-elastic\" cannot be used with \"-adapt\" or \"-pin\".\n",
+		progname);
+	Usage(progname, 1);
+    }
+    if (adaptHi > 0) {
+	AD_Init(&adapt, ms, adaptLo, adaptHi, rcd->adaptInterval,
+		rcd->spawnCommand, rcd->loadCommand, rcd->localExec,
+		&origMask, Now());
+	rjd.adapt = &adapt;
+    }
+    if (pinPolicy != topo_pNone) {
+	PlaceMachines(ms, rcd, pinPolicy);
+    }
+
+    /*
+     * Place processes by what they need, if anything says.  The needs
+     * are found up front, so a process too big for every host stops
+     * the job before anything runs.
+     */
+    {
+	int	packed = rjd.needTemplate != NULL;
+	size_t	t;
+
+	for (t = 0;  !packed && rjd.dag != NULL && t < rjd.dag->taskCnt;  ++t) {
+	    packed = rjd.dag->tasks[t].need != NULL;
+	}
+	if (packed) {
+	    PK_Need*	needs;
+	    size_t	p;
+
+	    if (rjd.batch > 0 || rjd.batchAuto || adaptHi > 0 || useKvs) {
+		fprintf(stderr, "%s: Placing by need cannot be used with \"-batch\", \"-adapt\" or \"-kvs\".\n",
+			progname);
+		Usage(progname, 1);
+	    }
+	    needs = (PK_Need*) malloc((np + 1) * sizeof(PK_Need));
+	    /*FIXME: Out of memory */
+	    for (p = 0;  p < np;  ++p) {
+		char*	text;
+
+		if (rjd.dag != NULL && rjd.dag->tasks[p].need != NULL) {
+		    text = strdup(rjd.dag->tasks[p].need);
+		} else if (rjd.needTemplate != NULL) {
+		    text = RewriteString(rjd.needTemplate, rcd,
+					 (MachinePin*) NULL, p);
+		} else {
+		    text = strdup("");
+		}
+		/*FIXME: Out of memory */
+		if (PK_ParseNeed(text, &needs[p]) < 0) {
+		    fprintf(stderr, "%s: Process %llu has a bad need \"%s\".\n",
+			    progname, (unsigned long long) p, text);
+		    exit(1);
+		}
+		free(text);
+	    }
+	    PK_Init(&pack, ms, needs, np);
+	    free(needs);
+	    for (p = 0;  p < np;  ++p) {
+		if (!JNL_RankDone(&rjd.skip, p) && !PK_Fits(&pack, p)) {
+		    fprintf(stderr, "%s: Process %llu needs more than any host has.\n",
+			    progname, (unsigned long long) p);
+		    exit(1);
+		}
+	    }
+	    rjd.pack = &pack;
+	}
+    }
+
+    /*
+     * Open the result cache.  Its key covers the command line and the
+     * inputs, but a batch script or a rendezvous makes the result
+     * depend on more than that.
+     */
+    rjd.inputTemplates = AV_Finalize(&inputFiles, &inputCnt);
+    if (cachePath == NULL && inputCnt > 1) {
+	fprintf(stderr, "%s: \"-input\" requires \"-cache\".\n",
+		progname);
+	Usage(progname, 1);
+    }
+    if (cachePath != NULL) {
+	if (rjd.batch > 0 || rjd.batchAuto || useKvs) {
+	    fprintf(stderr, "%s: \"-cache\" cannot be used with \"-batch\" or \"-kvs\".\n",
+		    progname);
+	    Usage(progname, 1);
+	}
+	rjd.cache = RC_Open(cachePath);
+	if (rjd.cache == NULL) {
+	    fprintf(stderr, "%s: Unable to open cache \"%s\": %s\n",
+		    progname, cachePath, strerror(errno));
+	    exit(1);
+	}
+    }
+
+    /*
+     * Start reading inputs ahead.  Without threads, there is no
+     * prefetch, but the job runs as it would have.
+     */
+    if (rjd.prefetchAhead > 0) {
+	if (rjd.inTemplate == NULL) {
+	    fprintf(stderr, "%s: \"-prefetch\" requires \"-stdin\".\n",
+		    progname);
+	    Usage(progname, 1);
+	}
+	if (rjd.dag != NULL || rjd.pack != NULL) {
+	    fprintf(stderr, "%s: \"-prefetch\" cannot be used with \"-dag\" or \"-need\".\n",
+		    progname);
+	    Usage(progname, 1);
+	}
+	rjd.prefetch = PF_Create();
+    }
+
+    /*
+     * Start processes from shards.  They start and record processes
+     * and nothing else, so whatever needs the coordinator's own loop
+     * (output it reads, timers, a task graph, rendezvous, changing
+     * the slots) stays without them.
+     */
+    if (rjd.shardCnt > 0
+	&& (rjd.dag != NULL || rjd.batch > 0 || rjd.batchAuto || keepOrder
+	    || useKvs || adaptHi > 0 || rjd.elastic || rjd.timers != NULL
+	    || rjd.pack != NULL || rjd.cache != NULL || rjd.prefetch != NULL)) {
+	fprintf(stderr, "%s: \"-shards\" cannot be used with \"-dag\", \"-batch\", \"-keep-order\", \"-kvs\", \"-adapt\", \"-elastic\", \"-timeout\", \"-need\", \"-cache\" or \"-prefetch\".\n",
+		progname);
+	Usage(progname, 1);
+    }
+
+    /*
+     * Open the trace, for rosim to replay.
+     */
+    if (tracePath != NULL) {
+	rjd.trace = fopen(tracePath, "w");
+	if (rjd.trace == NULL) {
+	    fprintf(stderr, "%s: Unable to open trace \"%s\": %s\n",
+		    progname, tracePath, strerror(errno));
+	    exit(1);
+	}
+	fcntl(fileno(rjd.trace), F_SETFD, FD_CLOEXEC);
+	fprintf(rjd.trace, "# PROC HOST START SECONDS STATUS\n");
     }
 
     /*
      * Spawn processes in this job.
      */
-    SpawnJob(progname, ms, rcd, np, &rjd);
+    started = Now();
+    rjd.traceOrigin = started;
+    sig = SpawnJob(progname, ms, rcd, np, &rjd);
+    PRF_SWITCH(prf_pFinish);
+
+    if (rjd.journal != NULL && JNL_Close(rjd.journal) < 0) {
+	fprintf(stderr, "%s: Error writing journal \"%s\": %s\n",
+		progname, journalPath, strerror(errno));
+    }
+    if (rjd.trace != NULL && fclose(rjd.trace) != 0) {
+	fprintf(stderr, "%s: Error writing trace \"%s\": %s\n",
+		progname, tracePath, strerror(errno));
+    }
+    if (rjd.history != NULL) {
+	if (predicted >= 0.0) {
+	    fprintf(stderr, "%s: makespan predicted %.2fs, achieved %.2fs\n",
+		    progname, predicted, Now() - started);
+	} else {
+	    fprintf(stderr, "%s: makespan achieved %.2fs (no history)\n",
+		    progname, Now() - started);
+	}
+	if (HIST_Save(rjd.history, historyPath) < 0) {
+	    fprintf(stderr, "%s: Error writing history \"%s\": %s\n",
+		    progname, historyPath, strerror(errno));
+	}
+    }
+    if (probeLimit > 0) {
+	ReportProbes(progname, ms, rcd);
+    }
+    if (adaptHi > 0) {
+	ReportAdapt(progname, ms, &adapt);
+    }
+    if (rjd.kvs != NULL) {
+	KVS_Close(rjd.kvs);
+    }
+    if (rjd.pack != NULL) {
+	PK_Destroy(rjd.pack);
+    }
+    if (rjd.prefetch != NULL) {
+	PF_Destroy(rjd.prefetch);
+    }
+    if (rjd.cache != NULL) {
+	fprintf(stderr, "%s: cache: %lu hits, %lu misses, %lu stored\n",
+		progname, (unsigned long) rjd.cache->hits,
+		(unsigned long) rjd.cache->misses,
+		(unsigned long) rjd.cache->stored);
+	RC_Close(rjd.cache);
+    }
+    if (profile) {
+	PRF_Report(stderr, progname);
+    }
 
 
 #if 0
@@ -854,19 +4208,27 @@ main(int argc, char* argv[])
     {
 	const char**	progargv = rjd.progargv;
 
-	printf("np = %d\n", np);
+	printf("np = %llu\n", (unsigned long long) np);
 	for (; *progargv; ++progargv) {
 	    printf("AV: %s\n", *progargv);
 	}
 	{
-	    MachineItem*	mi = QUEUE_HEAD(all, ms);
-	    while (mi) {
-		printf("HOST: |%s|\n", mi->mname);
-		mi = QUEUE_NEXT(all, mi);
+	    size_t	slot;
+	    for (slot = 0;  slot < ms->mcnt;  ++slot) {
+		printf("HOST: |%s|\n", ML_NAME(ms, slot));
 	    }
 	}
     }
 #endif
 
+    /*
+     * If the job was torn down by a signal, die from it too, so our
+     * parent sees why we stopped.
+     */
+    if (sig) {
+	signal(sig, SIG_DFL);
+	raise(sig);
+    }
+
     return 0;
 }
@@ -0,0 +1,579 @@
+/* Sharded dispatch. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/eventfd.h>
+#include "shard.h"
+
+#define SH_NONE		((uint32_t) 0xffffffffu)
+
+/* sh_wake --
+ *
+ * Synopsis:
+ *
+ *    Signal an eventfd.
+ */
+
+static void
+sh_wake(int fd)
+{
+    uint64_t	one = 1;
+
+    if (write(fd, &one, sizeof(one)) < 0) {
+	/* Only fails if the count is already huge; it is signalled. */
+    }
+}
+
+/* sh_take --
+ *
+ * Synopsis:
+ *
+ *    Take a place from the head of a shard's share, or from its end
+ *    if 'steal'.
+ *
+ * Returns:
+ *
+ *    1 with the place in '*p', or 0 if the share is empty.
+ */
+
+static int
+sh_take(SH_Shard* sd, int steal, size_t* p)
+{
+    uint64_t	span = __atomic_load_n(&sd->span, __ATOMIC_ACQUIRE);
+
+    for (;;) {
+	uint64_t	head = span & 0xffffffffu;
+	uint64_t	end = span >> 32;
+	uint64_t	next;
+	uint64_t	j;
+
+	if (head >= end) {
+	    return 0;
+	}
+	if (steal) {
+	    j = end - 1;
+	    next = head | (end - 1) << 32;
+	} else {
+	    j = head;
+	    next = (head + 1) | end << 32;
+	}
+	if (__atomic_compare_exchange_n(&sd->span, &span, next, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+	    *p = (size_t) j * sd->sched->shardCnt + sd->index;
+	    return 1;
+	}
+    }
+}
+
+/* sh_next --
+ *
+ * Synopsis:
+ *
+ *    The next place for a shard to start: its own, or one stolen
+ *    from the other shards in turn.
+ *
+ * Returns:
+ *
+ *    1 with the place in '*p', or 0 if no shard has any left.
+ */
+
+static int
+sh_next(SH_Shard* sd, size_t* p)
+{
+    SH_Sched*	sh = sd->sched;
+    size_t	i;
+
+    if (sh_take(sd, 0, p)) {
+	return 1;
+    }
+    for (i = 1;  i < sh->shardCnt;  ++i) {
+	if (sh_take(&sh->shards[(sd->index + i) % sh->shardCnt], 1, p)) {
+	    sd->stolen++;
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+/* sh_collect --
+ *
+ * Synopsis:
+ *
+ *    Record the exits the reaper has handed a shard, and free their
+ *    slots.
+ */
+
+static void
+sh_collect(SH_Shard* sd)
+{
+    SH_Sched*	sh = sd->sched;
+    MachineList* ms = sh->ms;
+    size_t	head = sd->exitHead;
+    size_t	tail = __atomic_load_n(&sd->exitTail, __ATOMIC_ACQUIRE);
+
+    if (head == tail) {
+	return;
+    }
+    pthread_mutex_lock(&sh->finishLock);
+    for (;  head != tail;  ++head) {
+	SH_Exit*	e = &sd->exits[head & sd->exitMask];
+
+	sh->finish(sh->arg, e->slot, e->ws);
+	ms->state[e->slot] = ml_sReady;
+	QI_ADD(&sd->ready, ms->link, e->slot);
+	sd->running--;
+    }
+    pthread_mutex_unlock(&sh->finishLock);
+    __atomic_store_n(&sd->exitHead, head, __ATOMIC_RELEASE);
+}
+
+/* sh_dispatch --
+ *
+ * Synopsis:
+ *
+ *    Start processes on a shard's free slots while there are any to
+ *    start.
+ */
+
+static void
+sh_dispatch(SH_Shard* sd)
+{
+    SH_Sched*	sh = sd->sched;
+    MachineList* ms = sh->ms;
+
+    while (!QI_EMPTY(&sd->ready)
+	   && !__atomic_load_n(&sh->stopping, __ATOMIC_ACQUIRE)) {
+	QI_Index	slot;
+	size_t		p;
+
+	if (!sh_next(sd, &p)) {
+	    break;
+	}
+	QI_TAKE(&sd->ready, ms->link, slot);
+	if (sh->start(sh->arg, slot, sh->order ? sh->order[p] : p)) {
+	    sd->running++;
+	    sd->started++;
+	} else {
+	    QI_ADD_HEAD(&sd->ready, ms->link, slot);
+	}
+    }
+}
+
+/* sh_pending --
+ *
+ * Synopsis:
+ *
+ *    True if any shard has places left.  Shares only shrink, so once
+ *    this is false it stays false.
+ */
+
+static int
+sh_pending(SH_Sched* sh)
+{
+    size_t	i;
+
+    for (i = 0;  i < sh->shardCnt;  ++i) {
+	uint64_t span = __atomic_load_n(&sh->shards[i].span, __ATOMIC_ACQUIRE);
+	if ((span & 0xffffffffu) < (span >> 32)) {
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+/* sh_worker --
+ *
+ * Synopsis:
+ *
+ *    A shard's thread: record exits and start processes until there
+ *    is nothing left to start and nothing of its own running, or the
+ *    shards are stopped.  Signals are left to the main thread.
+ */
+
+static void*
+sh_worker(void* arg)
+{
+    SH_Shard*	sd = (SH_Shard*) arg;
+    SH_Sched*	sh = sd->sched;
+    sigset_t	all;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, (sigset_t*) NULL);
+
+    for (;;) {
+	struct pollfd	pfd;
+	uint64_t	cnt;
+
+	sh_collect(sd);
+	sh_dispatch(sd);
+	if (__atomic_load_n(&sh->stopping, __ATOMIC_ACQUIRE)
+	    || (sd->running == 0 && !sh_pending(sh))) {
+	    break;
+	}
+	pfd.fd = sd->wakeFd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, -1) > 0 && read(sd->wakeFd, &cnt, sizeof(cnt)) < 0) {
+	    /* Another wake-up took it. */
+	}
+    }
+    __atomic_sub_fetch(&sh->live, 1, __ATOMIC_ACQ_REL);
+    sh_wake(sh->notifyFd);
+    return NULL;
+}
+
+/* SH_Create --
+ *
+ * Synopsis:
+ *
+ *    Deal the machine list's ready slots, host by host, and the 'np'
+ *    places of the dispatch order 'order' (or 0 to np - 1 if NULL)
+ *    among up to 'shards' shards.  Each host goes to the shard with
+ *    the fewest slots so far.  There are no more shards than hosts
+ *    with a ready slot.  Takes every slot off the 'ready' queue.
+ *
+ * Returns:
+ *
+ *    The shards, not yet started, or NULL if no slot is ready, a
+ *    share would not fit in 32 bits, or an eventfd cannot be made.
+ */
+
+SH_Sched*
+SH_Create(MachineList* ms, size_t shards, const size_t* order, size_t np,
+	  SH_Start start, SH_Finish finish, void* arg)
+{
+    SH_Sched*	sh;
+    size_t*	hostSlots;	/* Ready slots, by host. */
+    uint32_t*	hostShard;
+    size_t	hostCnt = 0;
+    size_t	i;
+    QI_Index	slot;
+
+    hostSlots = (size_t*) calloc(ms->hcnt + 1, sizeof(size_t));
+    hostShard = (uint32_t*) malloc((ms->hcnt + 1) * sizeof(uint32_t));
+    /*FIXME: Out of memory */
+    for (slot = QI_HEAD(&ms->ready);  slot != QI_NIL;  slot = QI_NEXT(ms->link, slot)) {
+	hostCnt += hostSlots[ms->host[slot]]++ == 0;
+    }
+    if (shards > hostCnt) {
+	shards = hostCnt;
+    }
+    if (hostCnt == 0 || (np - 1) / shards >= 0xffffffffu) {
+	free(hostSlots);
+	free(hostShard);
+	return (SH_Sched*) NULL;
+    }
+
+    sh = (SH_Sched*) calloc(1, sizeof(SH_Sched));
+    sh->shards = (SH_Shard*) calloc(shards, sizeof(SH_Shard));
+    sh->shardOf = (uint32_t*) malloc((ms->mmax + 1) * sizeof(uint32_t));
+    /*FIXME: Out of memory */
+    sh->ms = ms;
+    sh->shardCnt = shards;
+    sh->order = order;
+    sh->np = np;
+    sh->start = start;
+    sh->finish = finish;
+    sh->arg = arg;
+    sh->notifyFd = -1;
+    pthread_mutex_init(&sh->pidLock, (pthread_mutexattr_t*) NULL);
+    pthread_mutex_init(&sh->finishLock, (pthread_mutexattr_t*) NULL);
+    for (i = 0;  i < shards;  ++i) {
+	sh->shards[i].wakeFd = -1;
+    }
+
+    /*
+     * Hosts go to shards in the order the ready queue first reaches
+     * them, and slots in the order it holds them, so one shard starts
+     * its slots as the loop without shards would.
+     */
+    for (i = 0;  i < ms->mmax;  ++i) {
+	sh->shardOf[i] = SH_NONE;
+    }
+    for (i = 0;  i < ms->hcnt;  ++i) {
+	hostShard[i] = SH_NONE;
+    }
+    for (slot = QI_HEAD(&ms->ready);  slot != QI_NIL;  slot = QI_NEXT(ms->link, slot)) {
+	QI_Index	h = ms->host[slot];
+
+	if (hostShard[h] == SH_NONE) {
+	    size_t	k, best = 0;
+
+	    for (k = 1;  k < shards;  ++k) {
+		if (sh->shards[k].slotCnt < sh->shards[best].slotCnt) {
+		    best = k;
+		}
+	    }
+	    hostShard[h] = (uint32_t) best;
+	    sh->shards[best].slotCnt += hostSlots[h];
+	}
+	sh->shardOf[slot] = hostShard[h];
+    }
+    free(hostSlots);
+    free(hostShard);
+
+    for (i = 0;  i < shards;  ++i) {
+	SH_Shard*	sd = &sh->shards[i];
+	size_t		len = 1;
+	uint64_t	cnt = np > i ? (np - i + shards - 1) / shards : 0;
+
+	while (len < sd->slotCnt) {
+	    len <<= 1;
+	}
+	sd->sched = sh;
+	sd->index = i;
+	QI_QUEUE_INIT(&sd->ready);
+	sd->exits = (SH_Exit*) malloc(len * sizeof(SH_Exit));
+	/*FIXME: Out of memory */
+	sd->exitMask = len - 1;
+	sd->span = cnt << 32;
+	sd->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (sd->wakeFd < 0) {
+	    SH_Destroy(sh);
+	    return (SH_Sched*) NULL;
+	}
+    }
+    sh->notifyFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (sh->notifyFd < 0) {
+	SH_Destroy(sh);
+	return (SH_Sched*) NULL;
+    }
+
+    while (!QI_EMPTY(&ms->ready)) {
+	QI_TAKE(&ms->ready, ms->link, slot);
+	QI_ADD(&sh->shards[sh->shardOf[slot]].ready, ms->link, slot);
+    }
+    return sh;
+}
+
+/* SH_Begin --
+ *
+ * Synopsis:
+ *
+ *    Start the shards' threads.  The places of a shard whose thread
+ *    does not start are stolen by the others.
+ *
+ * Returns:
+ *
+ *    0, or -1 if no thread could be started.
+ */
+
+int
+SH_Begin(SH_Sched* sh)
+{
+    size_t	i;
+    size_t	started = 0;
+
+    for (i = 0;  i < sh->shardCnt;  ++i) {
+	SH_Shard*	sd = &sh->shards[i];
+
+	__atomic_add_fetch(&sh->live, 1, __ATOMIC_ACQ_REL);
+	if (pthread_create(&sd->thread, (pthread_attr_t*) NULL,
+			   sh_worker, sd) != 0) {
+	    __atomic_sub_fetch(&sh->live, 1, __ATOMIC_ACQ_REL);
+	    continue;
+	}
+	sd->threadOk = 1;
+	started++;
+    }
+    return started > 0 ? 0 : -1;
+}
+
+/* SH_Live --
+ *
+ * Synopsis:
+ *
+ *    True while a shard's thread has not finished.
+ */
+
+int
+SH_Live(SH_Sched* sh)
+{
+    return __atomic_load_n(&sh->live, __ATOMIC_ACQUIRE) > 0;
+}
+
+/* SH_MapPid --
+ *
+ * Synopsis:
+ *
+ *    From a shard: record that 'slot' is running process 'pid'.
+ */
+
+void
+SH_MapPid(SH_Sched* sh, pid_t pid, QI_Index slot)
+{
+    pthread_mutex_lock(&sh->pidLock);
+    ML_MapPid(sh->ms, pid, slot);
+    pthread_mutex_unlock(&sh->pidLock);
+}
+
+/* SH_Notify --
+ *
+ * Synopsis:
+ *
+ *    From a shard's callback: wake the main thread, so it looks again
+ *    at what it is waiting for.
+ */
+
+void
+SH_Notify(SH_Sched* sh)
+{
+    sh_wake(sh->notifyFd);
+}
+
+/* sh_route --
+ *
+ * Synopsis:
+ *
+ *    Hand the exit of 'pid' to the shard whose slot ran it.
+ *
+ * Returns:
+ *
+ *    1, or 0 if the pid is not in the table (yet).
+ */
+
+static int
+sh_route(SH_Sched* sh, pid_t pid, int ws)
+{
+    QI_Index	slot;
+    SH_Shard*	sd;
+    size_t	tail;
+
+    pthread_mutex_lock(&sh->pidLock);
+    slot = ML_UnmapPid(sh->ms, pid);
+    pthread_mutex_unlock(&sh->pidLock);
+    if (slot == QI_NIL) {
+	return 0;
+    }
+    sd = &sh->shards[sh->shardOf[slot]];
+    tail = sd->exitTail;
+    sd->exits[tail & sd->exitMask].slot = slot;
+    sd->exits[tail & sd->exitMask].ws = ws;
+    __atomic_store_n(&sd->exitTail, tail + 1, __ATOMIC_RELEASE);
+    sh_wake(sd->wakeFd);
+    return 1;
+}
+
+/* SH_Reap --
+ *
+ * Synopsis:
+ *
+ *    From the main thread: reap the children that have exited, and
+ *    hand their exits to the shards, with any kept aside before.
+ *    Call when SIGCHLD arrives, and again soon while an exit is kept
+ *    aside (sh->orphanCnt > 0).
+ */
+
+void
+SH_Reap(SH_Sched* sh)
+{
+    size_t	i, n;
+    pid_t	pid;
+    int		ws;
+
+    for (i = n = 0;  i < sh->orphanCnt;  ++i) {
+	if (!sh_route(sh, sh->orphans[i].pid, sh->orphans[i].ws)) {
+	    sh->orphans[n++] = sh->orphans[i];
+	}
+    }
+    sh->orphanCnt = n;
+    while ((pid = waitpid(-1, &ws, WNOHANG)) > 0) {
+	if (sh_route(sh, pid, ws)) {
+	    continue;
+	}
+	if (sh->orphanCnt == sh->orphanMax) {
+	    sh->orphanMax = sh->orphanMax ? 2 * sh->orphanMax : 16;
+	    sh->orphans = (SH_Orphan*) realloc(sh->orphans,
+					       sh->orphanMax * sizeof(SH_Orphan));
+	    /*FIXME: Out of memory */
+	}
+	sh->orphans[sh->orphanCnt].pid = pid;
+	sh->orphans[sh->orphanCnt++].ws = ws;
+    }
+}
+
+/* SH_Stop --
+ *
+ * Synopsis:
+ *
+ *    Stop the shards' threads, once they have started what they are
+ *    starting, and record the exits already reaped.  The machine
+ *    list's queues are made whole again: slots still running go on
+ *    'run', with their pids in the table, and the rest on 'ready'.
+ */
+
+void
+SH_Stop(SH_Sched* sh)
+{
+    MachineList*	ms = sh->ms;
+    size_t		i;
+    QI_Index		slot;
+
+    __atomic_store_n(&sh->stopping, 1, __ATOMIC_RELEASE);
+    for (i = 0;  i < sh->shardCnt;  ++i) {
+	sh_wake(sh->shards[i].wakeFd);
+    }
+    for (i = 0;  i < sh->shardCnt;  ++i) {
+	if (sh->shards[i].threadOk) {
+	    pthread_join(sh->shards[i].thread, (void**) NULL);
+	    sh->shards[i].threadOk = 0;
+	}
+    }
+
+    for (i = 0;  i < sh->orphanCnt;  ++i) {
+	slot = ML_UnmapPid(ms, sh->orphans[i].pid);
+	if (slot != QI_NIL) {
+	    sh->finish(sh->arg, slot, sh->orphans[i].ws);
+	    ms->state[slot] = ml_sReady;
+	    QI_ADD(&sh->shards[sh->shardOf[slot]].ready, ms->link, slot);
+	}
+    }
+    sh->orphanCnt = 0;
+    for (i = 0;  i < sh->shardCnt;  ++i) {
+	SH_Shard*	sd = &sh->shards[i];
+
+	sh_collect(sd);
+	while (!QI_EMPTY(&sd->ready)) {
+	    QI_TAKE(&sd->ready, ms->link, slot);
+	    QI_ADD(&ms->ready, ms->link, slot);
+	}
+    }
+    for (slot = 0;  slot < ms->mcnt;  ++slot) {
+	if (sh->shardOf[slot] != SH_NONE && ms->state[slot] == ml_sRun) {
+	    QI_ADD(&ms->run, ms->link, slot);
+	}
+    }
+}
+
+/* SH_Destroy --
+ *
+ * Synopsis:
+ *
+ *    Free the shards, which must be stopped.
+ */
+
+void
+SH_Destroy(SH_Sched* sh)
+{
+    size_t	i;
+
+    for (i = 0;  i < sh->shardCnt;  ++i) {
+	free(sh->shards[i].exits);
+	if (sh->shards[i].wakeFd >= 0) {
+	    close(sh->shards[i].wakeFd);
+	}
+    }
+    if (sh->notifyFd >= 0) {
+	close(sh->notifyFd);
+    }
+    pthread_mutex_destroy(&sh->pidLock);
+    pthread_mutex_destroy(&sh->finishLock);
+    free(sh->orphans);
+    free(sh->shardOf);
+    free(sh->shards);
+    free(sh);
+}
@@ -0,0 +1,125 @@
+/* Sharded dispatch. */
+
+#ifndef SHARDED_DISPATCH_H
+#define SHARDED_DISPATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include "qi.h"
+#include "ml.h"
+
+/*
+ * With -shards K, the processes are started by K threads, not by the
+ * coordinator's one loop.  Each thread owns a shard: some of the
+ * hosts, with all their slots, and a share of the processes to run.
+ * The shares are dealt out in dispatch order, place i to shard i mod
+ * K, so the shards start the job near its head together.
+ *
+ * A shard's share is a range of places, [head, end), packed into one
+ * word.  The owner takes from the head, so its processes start in
+ * order; a shard with a free slot and nothing left of its own steals
+ * one from the end of another's.  Both are a compare and swap on the
+ * word.
+ *
+ * The main thread reaps.  It finds the slot of each exit in the
+ * machine list's pid table, and hands the exit to the shard that owns
+ * the slot through that shard's exit ring.  The ring has one producer
+ * and one consumer and is never full: it holds a place for each of
+ * the shard's slots, and a slot does not start again until its exit
+ * has been taken.  A shard records the exit, then starts the next
+ * process on the slot itself.
+ *
+ * A child may exit before the shard that forked it has entered it in
+ * the pid table.  The reaper keeps such an exit aside and looks it up
+ * again later.
+ *
+ * Recording exits (the callback SH_Finish) is serialized; starting
+ * processes (SH_Start) is not.  When the shards are stopped, the slots
+ * still running go back on the machine list's 'run' queue, and their
+ * pids stay in its table, so the rest of the job is waited for as
+ * without shards.
+ */
+
+/* Start process 'proc' on 'slot'; returns 0 if it need not run. */
+typedef int (*SH_Start)(void* arg, QI_Index slot, size_t proc);
+
+/* Record the exit of the process running on 'slot'. */
+typedef void (*SH_Finish)(void* arg, QI_Index slot, int ws);
+
+typedef struct SH_Exit {
+    QI_Index	slot;
+    int		ws;
+} SH_Exit;
+
+typedef struct SH_Shard {
+    struct SH_Sched*	sched;
+    size_t		index;
+    QI_Queue		ready;		/* Its slots, free. */
+    size_t		slotCnt;
+    size_t		running;
+    uint64_t		span;		/* Places left: head | end << 32. */
+    SH_Exit*		exits;		/* From the reaper. */
+    size_t		exitMask;	/* Ring length, less one. */
+    size_t		exitHead;	/* Taken by the shard. */
+    size_t		exitTail;	/* Given by the reaper. */
+    int			wakeFd;		/* An eventfd. */
+    pthread_t		thread;
+    int			threadOk;
+    size_t		started;
+    size_t		stolen;
+} SH_Shard;
+
+typedef struct SH_Orphan {
+    pid_t	pid;
+    int		ws;
+} SH_Orphan;
+
+typedef struct SH_Sched {
+    MachineList*	ms;
+    SH_Shard*		shards;
+    size_t		shardCnt;
+    uint32_t*		shardOf;	/* By slot. */
+    const size_t*	order;		/* Dispatch order, or NULL. */
+    size_t		np;
+    SH_Start		start;
+    SH_Finish		finish;
+    void*		arg;
+    pthread_mutex_t	pidLock;	/* ms's pid table. */
+    pthread_mutex_t	finishLock;
+    int			stopping;
+    int			live;		/* Shards not yet done. */
+    int			notifyFd;	/* An eventfd; a shard is done, or SH_Notify. */
+    SH_Orphan*		orphans;	/* Exits not yet in the pid table. */
+    size_t		orphanCnt;
+    size_t		orphanMax;
+} SH_Sched;
+
+SH_Sched*
+SH_Create(MachineList* ms, size_t shards, const size_t* order, size_t np,
+	  SH_Start start, SH_Finish finish, void* arg);
+
+int
+SH_Begin(SH_Sched* sh);
+
+int
+SH_Live(SH_Sched* sh);
+
+void
+SH_MapPid(SH_Sched* sh, pid_t pid, QI_Index slot);
+
+void
+SH_Notify(SH_Sched* sh);
+
+void
+SH_Reap(SH_Sched* sh);
+
+void
+SH_Stop(SH_Sched* sh);
+
+void
+SH_Destroy(SH_Sched* sh);
+
+#endif /* !defined SHARDED_DISPATCH_H */
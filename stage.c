@@ -0,0 +1,345 @@
+/* Input staging. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "stage.h"
+#include "ca.h"
+
+/*
+ * The relay script, run as
+ *
+ *     sh -c SCRIPT SCRIPT KEEP DIR SPAWN SELF HOST...
+ *
+ * It splits the hosts between (at most) two children, starts each
+ * child through SPAWN with its share of the hosts, and copies its
+ * standard input to them through fifos, unpacking it into DIR if
+ * KEEP is 1.  The script passes itself ($0) on, single quoted, so it
+ * must not contain single quotes itself (it makes one with printf):
+ * that keeps the quoting flat at every level.
+ * A host that does not keep the data (the coordinator) relays to a
+ * single child.  A host that has unpacked the data writes its own
+ * name (SELF) on standard output, which comes back through every
+ * relay to the coordinator, so it can tell which hosts the data
+ * reached.  A relay killed (when staging takes too long) removes its
+ * fifos.
+ */
+
+static const char stg_relay[] =
+    "k=$1 d=$2 sp=$3 me=$4; shift 4; "
+    "n=$#; h=$n; [ \"$k\" = 1 ] && h=$(((n+1)/2)); "
+    "L= R= i=0; "
+    "for x; do if [ $i -lt $h ]; then L=\"$L $x\"; else R=\"$R $x\"; fi; i=$((i+1)); done; "
+    "q=$(printf \\\\047); "
+    "t=${TMPDIR:-/tmp}/runover-relay.$$; mkdir -p \"$t\" || exit 1; "
+    "trap \"rm -rf \\\"$t\\\"; exit 1\" HUP TERM; "
+    "o= p= s=0; "
+    "for c in \"$L\" \"$R\"; do "
+      "[ -n \"$c\" ] || continue; set -- $c; x=$1; shift; "
+      "mkfifo \"$t/$x\" || exit 1; "
+      "\"$sp\" $x \"sh -c $q$0$q $q$0$q 1 $q$d$q $q$sp$q $x $*\" < \"$t/$x\" & "
+      "p=\"$p $!\" o=\"$o $t/$x\"; "
+    "done; "
+    "if [ \"$k\" = 1 ]; then "
+      "mkdir -p \"$d\" && tee $o | tar xf - -C \"$d\" && echo \"$me\" || s=1; "
+    "else tee $o > /dev/null || s=1; fi; "
+    "for x in $p; do wait $x || s=1; done; "
+    "rm -rf \"$t\"; exit $s";
+
+/* STG_Check --
+ *
+ * Synopsis:
+ *
+ *    Check that a host or directory name can be passed through the
+ *    relay: no white space or quotes.
+ *
+ * Returns:
+ *
+ *    0 if so, -1 if not.
+ */
+
+int
+STG_Check(const char* name)
+{
+    for (;  *name;  ++name) {
+	if (isspace((unsigned char) *name) || *name == '\'' || *name == '"') {
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+/* stg_quote --
+ *
+ * Synopsis:
+ *
+ *    Append a string to 'ca', single quoted for the shell.
+ */
+
+static void
+stg_quote(CharAccum* ca, const char* s)
+{
+    CHARACCUM_APPEND_CHAR(ca, '\'');
+    for (;  *s;  ++s) {
+	if (*s == '\'') {
+	    CHARACCUM_APPEND_STR(ca, "'\\''");
+	} else {
+	    CHARACCUM_APPEND_CHAR(ca, *s);
+	}
+    }
+    CHARACCUM_APPEND_CHAR(ca, '\'');
+}
+
+/* stg_base --
+ *
+ * Synopsis:
+ *
+ *    The last component of a path: the name it is staged under.
+ */
+
+static const char*
+stg_base(const char* path)
+{
+    const char*	base = strrchr(path, '/');
+
+    return base == NULL ? path : base + 1;
+}
+
+/* STG_Duplicate --
+ *
+ * Synopsis:
+ *
+ *    Find a file that would be staged under the same name as an
+ *    earlier one, and overwrite it on every host.
+ *
+ * Returns:
+ *
+ *    The index of the file, or (size_t) -1 if there is none.
+ */
+
+size_t
+STG_Duplicate(const char** files, size_t fileCnt)
+{
+    size_t	i, j;
+
+    for (i = 1;  i < fileCnt;  ++i) {
+	for (j = 0;  j < i;  ++j) {
+	    if (0 == strcmp(stg_base(files[i]), stg_base(files[j]))) {
+		return i;
+	    }
+	}
+    }
+    return (size_t) -1;
+}
+
+/* stg_reached --
+ *
+ * Synopsis:
+ *
+ *    Mark the hosts named by the complete lines in 'buf' as reached,
+ *    and drop those lines from it.  "-" is this host, the last
+ *    'reached' flag.
+ */
+
+static void
+stg_reached(char* buf, size_t* len, const char** hosts, size_t hostCnt,
+	    char* reached)
+{
+    char*	line = buf;
+    char*	nl;
+    size_t	i;
+
+    while ((nl = memchr(line, '\n', *len - (line - buf))) != NULL) {
+	*nl = '\0';
+	if (0 == strcmp(line, "-")) {
+	    reached[hostCnt] = 1;
+	}
+	for (i = 0;  i < hostCnt;  ++i) {
+	    if (0 == strcmp(line, hosts[i])) {
+		reached[i] = 1;
+		break;
+	    }
+	}
+	line = nl + 1;
+    }
+    *len -= line - buf;
+    memmove(buf, line, *len);
+}
+
+/* STG_Broadcast --
+ *
+ * Synopsis:
+ *
+ *    Stage files into 'dir' on every host.  If 'keepLocal' is true,
+ *    they are also unpacked into 'dir' on this host.  Host names and
+ *    'dir' must pass STG_Check.  If staging has not finished within
+ *    'limit' seconds (if positive), the relay is killed.  'reached'
+ *    has a flag for each host, and one more for this host; each is
+ *    set if the files were unpacked there.
+ *
+ * Returns:
+ *
+ *    0 if every host received the files, or -1, with errno ETIMEDOUT
+ *    if the time limit passed.
+ */
+
+int
+STG_Broadcast(const char* spawnCommand, const char* dir,
+	      const char** files, size_t fileCnt,
+	      const char** hosts, size_t hostCnt, int keepLocal,
+	      double limit, char* reached)
+{
+    CharAccum		ca;
+    char		cwd[4096];
+    size_t		i;
+    pid_t		pid;
+    int			ws;
+    int			out[2];
+    char		buf[1024];
+    size_t		len = 0;
+    int			timedOut = 0;
+    struct timespec	now;
+    double		deadline = 0.0;
+
+    memset(reached, 0, hostCnt + 1);
+    if (hostCnt == 0 && !keepLocal) {
+	return 0;
+    }
+
+    /*
+     * tar cf - -C DIR BASE ... | sh -c RELAY RELAY KEEP DIR SPAWN - HOST...
+     *
+     * Each -C is taken relative to the one before, so the directories
+     * are made absolute.
+     */
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+	return -1;
+    }
+    CHARACCUM_INIT(&ca);
+    CHARACCUM_APPEND_STR(&ca, "tar cf -");
+    for (i = 0;  i < fileCnt;  ++i) {
+	const char*	base = stg_base(files[i]);
+	char*		fdir;
+
+	if (base == files[i]) {
+	    fdir = strdup(cwd);
+	} else if (files[i][0] == '/') {
+	    fdir = strndup(files[i], (base - 1 == files[i]) ? 1 : base - 1 - files[i]);
+	} else {
+	    fdir = (char*) malloc(strlen(cwd) + (base - files[i]) + 1);
+	    /*FIXME: Out of memory */
+	    sprintf(fdir, "%s/%.*s", cwd, (int) (base - 1 - files[i]), files[i]);
+	}
+	CHARACCUM_APPEND_STR(&ca, " -C ");
+	stg_quote(&ca, fdir);
+	CHARACCUM_APPEND_CHAR(&ca, ' ');
+	stg_quote(&ca, base);
+	free(fdir);
+    }
+    CHARACCUM_APPEND_STR(&ca, " | sh -c ");
+    stg_quote(&ca, stg_relay);
+    CHARACCUM_APPEND_CHAR(&ca, ' ');
+    stg_quote(&ca, stg_relay);
+    CHARACCUM_APPEND_STR(&ca, keepLocal ? " 1 " : " 0 ");
+    stg_quote(&ca, dir);
+    CHARACCUM_APPEND_CHAR(&ca, ' ');
+    stg_quote(&ca, spawnCommand);
+    CHARACCUM_APPEND_STR(&ca, " -");
+    for (i = 0;  i < hostCnt;  ++i) {
+	CHARACCUM_APPEND_CHAR(&ca, ' ');
+	CHARACCUM_APPEND_STR(&ca, hosts[i]);
+    }
+
+    if (pipe(out) < 0) {
+	free(ca.cb);
+	return -1;
+    }
+    pid = fork();
+    if (pid == 0) {
+	/* In a group of its own, so it can be killed whole. */
+	setpgid(0, 0);
+	dup2(out[1], 1);
+	close(out[0]);
+	close(out[1]);
+	execl("/bin/sh", "sh", "-c", CHARACCUM_STRING(&ca), (char*) NULL);
+	_exit(127);
+    }
+    free(ca.cb);
+    close(out[1]);
+    if (pid < 0) {
+	close(out[0]);
+	return -1;
+    }
+    setpgid(pid, pid);
+
+    /*
+     * Collect the names of the hosts reached until every relay has
+     * closed its output, or the time limit passes.
+     */
+    if (limit > 0) {
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	deadline = now.tv_sec + now.tv_nsec * 1e-9 + limit;
+    }
+    for (;;) {
+	struct pollfd	pfd;
+	int		wait = -1;
+	ssize_t		n;
+
+	if (limit > 0) {
+	    double	left;
+
+	    clock_gettime(CLOCK_MONOTONIC, &now);
+	    left = deadline - (now.tv_sec + now.tv_nsec * 1e-9);
+	    if (left <= 0) {
+		timedOut = 1;
+		break;
+	    }
+	    wait = (int) (left * 1000) + 1;
+	}
+	pfd.fd = out[0];
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, wait) <= 0) {
+	    continue;
+	}
+	n = read(out[0], buf + len, sizeof(buf) - 1 - len);
+	if (n < 0 && errno == EINTR) {
+	    continue;
+	}
+	if (n <= 0) {
+	    break;
+	}
+	len += n;
+	stg_reached(buf, &len, hosts, hostCnt, reached);
+	if (len == sizeof(buf) - 1) {
+	    /* Not a host name; drop it. */
+	    len = 0;
+	}
+    }
+    close(out[0]);
+    if (timedOut) {
+	/* The relays clean up on SIGTERM; give them a second. */
+	struct timespec	pause = { 0, 10000000 };
+
+	kill(-pid, SIGTERM);
+	for (i = 0;  i < 100 && waitpid(pid, &ws, WNOHANG) == 0;  ++i) {
+	    nanosleep(&pause, (struct timespec*) NULL);
+	}
+	kill(-pid, SIGKILL);
+	errno = ETIMEDOUT;
+	return -1;
+    }
+    while (waitpid(pid, &ws, 0) < 0) {
+	if (errno != EINTR) {
+	    return -1;
+	}
+    }
+    return (WIFEXITED(ws) && WEXITSTATUS(ws) == 0) ? 0 : -1;
+}
@@ -0,0 +1,34 @@
+/* Input staging. */
+
+#ifndef INPUT_STAGING_H
+#define INPUT_STAGING_H
+
+#include <stddef.h>
+
+/*
+ * Files are staged by streaming a tar archive of them down a binary
+ * tree of hosts: each host unpacks the stream into the staging
+ * directory while relaying it, through the spawn command, to at most
+ * two more hosts.  The coordinator sends each byte once (to the root
+ * of the tree), and the time to reach every host grows with the
+ * depth of the tree, not the number of hosts.
+ *
+ * Files are staged under their base names, so two files with the
+ * same base name cannot be staged together (STG_Duplicate).  Each
+ * host reports back once it has unpacked the files, so when staging
+ * fails or runs out of time the hosts it did not reach are known.
+ */
+
+int
+STG_Check(const char* name);
+
+size_t
+STG_Duplicate(const char** files, size_t fileCnt);
+
+int
+STG_Broadcast(const char* spawnCommand, const char* dir,
+	      const char** files, size_t fileCnt,
+	      const char** hosts, size_t hostCnt, int keepLocal,
+	      double limit, char* reached);
+
+#endif /* !defined INPUT_STAGING_H */
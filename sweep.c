@@ -0,0 +1,289 @@
+/* Parameter sweeps. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "sweep.h"
+
+/* SWP_Init --
+ *
+ * Synopsis:
+ *
+ *    Initialize a sweep with no parameters.
+ */
+
+void
+SWP_Init(SWP_Sweep* sw)
+{
+    sw->dims = (SWP_Dim*) NULL;
+    sw->dimCnt = 0;
+    sw->refs = (char**) NULL;
+    sw->refCnt = 0;
+    sw->size = 1;
+}
+
+/* SWP_Lookup --
+ *
+ * Synopsis:
+ *
+ *    Find the parameter named by the 'len' characters at 'name'.
+ *
+ * Returns:
+ *
+ *    Its index, or -1.
+ */
+
+long
+SWP_Lookup(const SWP_Sweep* sw, const char* name, size_t len)
+{
+    size_t	d;
+
+    for (d = 0;  d < sw->dimCnt;  ++d) {
+	if (strlen(sw->dims[d].name) == len
+	    && !memcmp(sw->dims[d].name, name, len)) {
+	    return (long) d;
+	}
+    }
+    return -1;
+}
+
+/* swp_range --
+ *
+ * Synopsis:
+ *
+ *    Parse 'word' as A..B or A..B..STEP into 'it'.
+ *
+ * Returns:
+ *
+ *    1 if it is a range, 0 if it is not, or -1 if it is an empty or
+ *    malformed one.
+ */
+
+static int
+swp_range(const char* word, SWP_Item* it)
+{
+    char*	ep;
+    long	hi;
+
+    errno = 0;
+    it->lo = strtol(word, &ep, 10);
+    if (ep == word || strncmp(ep, "..", 2)) {
+	return 0;
+    }
+    word = ep + 2;
+    hi = strtol(word, &ep, 10);
+    if (ep == word) {
+	return 0;
+    }
+    it->step = 1;
+    if (!strncmp(ep, "..", 2)) {
+	word = ep + 2;
+	it->step = strtol(word, &ep, 10);
+	if (ep == word) {
+	    return 0;
+	}
+    }
+    if (*ep) {
+	return 0;
+    }
+    if (errno || it->step <= 0 || hi < it->lo) {
+	return -1;
+    }
+    it->word = (char*) NULL;
+    it->count = ((uint64_t) hi - (uint64_t) it->lo) / (uint64_t) it->step + 1;
+    return 1;
+}
+
+/* swp_define --
+ *
+ * Synopsis:
+ *
+ *    Add a parameter, with the values in the 'len' characters at
+ *    'spec'.
+ */
+
+static int
+swp_define(SWP_Sweep* sw, const char* name, size_t nameLen,
+	   const char* spec, size_t len, char* err, size_t errLen)
+{
+    SWP_Dim*	dp;
+    char*	text;
+    char*	word;
+    char*	save;
+
+    if (nameLen == 0) {
+	snprintf(err, errLen, "parameter with no name");
+	return -1;
+    }
+    if (SWP_Lookup(sw, name, nameLen) >= 0) {
+	snprintf(err, errLen, "parameter \"%.*s\" given values twice",
+		 (int) nameLen, name);
+	return -1;
+    }
+
+    sw->dims = (SWP_Dim*) realloc(sw->dims, (sw->dimCnt + 1) * sizeof(SWP_Dim));
+    /*FIXME: Out of memory */
+    dp = &sw->dims[sw->dimCnt];
+    dp->name = strndup(name, nameLen);
+    dp->items = (SWP_Item*) NULL;
+    dp->itemCnt = 0;
+    dp->size = 0;
+    dp->stride = 1;
+
+    text = strndup(spec, len);
+    /*FIXME: Out of memory */
+    for (word = strtok_r(text, ",", &save);
+	 word != NULL;
+	 word = strtok_r(NULL, ",", &save)) {
+	SWP_Item*	it;
+	int		r;
+
+	dp->items = (SWP_Item*) realloc(dp->items,
+					(dp->itemCnt + 1) * sizeof(SWP_Item));
+	/*FIXME: Out of memory */
+	it = &dp->items[dp->itemCnt];
+	r = swp_range(word, it);
+	if (r < 0) {
+	    snprintf(err, errLen, "bad range \"%s\" for parameter \"%s\"",
+		     word, dp->name);
+	    free(text);
+	    return -1;
+	}
+	if (r == 0) {
+	    it->word = strdup(word);
+	    it->count = 1;
+	}
+	if (dp->size + it->count < dp->size) {
+	    snprintf(err, errLen, "parameter \"%s\" has too many values",
+		     dp->name);
+	    free(text);
+	    return -1;
+	}
+	dp->size += it->count;
+	dp->itemCnt++;
+    }
+    free(text);
+    if (dp->size == 0) {
+	snprintf(err, errLen, "parameter \"%s\" has no values", dp->name);
+	return -1;
+    }
+    sw->dimCnt++;
+    return 0;
+}
+
+/* SWP_Scan --
+ *
+ * Synopsis:
+ *
+ *    Find the parameters defined and used in a template.  '%%' is
+ *    skipped, as RewriteString treats it.
+ *
+ * Returns:
+ *
+ *    0 on success, or -1 with a message in 'err'.
+ */
+
+int
+SWP_Scan(SWP_Sweep* sw, const char* tmpl, char* err, size_t errLen)
+{
+    const char*	cp;
+
+    for (cp = tmpl;  *cp;  ++cp) {
+	const char*	end;
+	const char*	eq;
+
+	if (cp[0] != '%' || cp[1] == '\0') {
+	    continue;
+	}
+	if (cp[1] != '{') {
+	    ++cp;
+	    continue;
+	}
+	cp += 2;
+	end = strchr(cp, '}');
+	if (end == NULL) {
+	    snprintf(err, errLen, "unterminated \"%%{\" in \"%s\"", tmpl);
+	    return -1;
+	}
+	eq = memchr(cp, '=', end - cp);
+	if (eq != NULL) {
+	    if (swp_define(sw, cp, eq - cp, eq + 1, end - eq - 1,
+			   err, errLen) < 0) {
+		return -1;
+	    }
+	} else {
+	    sw->refs = (char**) realloc(sw->refs, (sw->refCnt + 1) * sizeof(char*));
+	    /*FIXME: Out of memory */
+	    sw->refs[sw->refCnt++] = strndup(cp, end - cp);
+	}
+	cp = end;
+    }
+    return 0;
+}
+
+/* SWP_Finish --
+ *
+ * Synopsis:
+ *
+ *    Check that every parameter used has values, and work out the
+ *    number of points and the decoding of process numbers.
+ *
+ * Returns:
+ *
+ *    0 on success, or -1 with a message in 'err'.
+ */
+
+int
+SWP_Finish(SWP_Sweep* sw, char* err, size_t errLen)
+{
+    size_t	i;
+
+    for (i = 0;  i < sw->refCnt;  ++i) {
+	if (SWP_Lookup(sw, sw->refs[i], strlen(sw->refs[i])) < 0) {
+	    snprintf(err, errLen, "parameter \"%s\" has no values", sw->refs[i]);
+	    return -1;
+	}
+	free(sw->refs[i]);
+    }
+    free(sw->refs);
+    sw->refs = (char**) NULL;
+    sw->refCnt = 0;
+
+    sw->size = 1;
+    for (i = sw->dimCnt;  i-- > 0;  ) {
+	sw->dims[i].stride = sw->size;
+	if (sw->size > UINT64_MAX / sw->dims[i].size) {
+	    snprintf(err, errLen, "sweep has too many points");
+	    return -1;
+	}
+	sw->size *= sw->dims[i].size;
+    }
+    return 0;
+}
+
+/* SWP_Value --
+ *
+ * Synopsis:
+ *
+ *    The value of parameter 'd' at 'point'.  Range values are
+ *    formatted into 'buf', which must hold SWP_VALUE_MAX characters.
+ */
+
+const char*
+SWP_Value(const SWP_Sweep* sw, size_t d, uint64_t point, char* buf)
+{
+    const SWP_Dim*	dp = &sw->dims[d];
+    uint64_t		k = (point / dp->stride) % dp->size;
+    size_t		i;
+
+    for (i = 0;  k >= dp->items[i].count;  ++i) {
+	k -= dp->items[i].count;
+    }
+    if (dp->items[i].word != NULL) {
+	return dp->items[i].word;
+    }
+    snprintf(buf, SWP_VALUE_MAX, "%ld",
+	     (long) ((uint64_t) dp->items[i].lo + k * (uint64_t) dp->items[i].step));
+    return buf;
+}
@@ -0,0 +1,66 @@
+/* Parameter sweeps. */
+
+#ifndef PARAMETER_SWEEP_H
+#define PARAMETER_SWEEP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A template may name a parameter and the values it sweeps:
+ *
+ *     %{NAME=VALUE,VALUE,...}
+ *
+ * Each VALUE is either a word, or an integer range A..B or A..B..STEP
+ * (inclusive, STEP positive).  Later uses of the same parameter may
+ * leave out the values, as %{NAME}.  Values cannot contain ',' or
+ * '}'.
+ *
+ * The job runs once for every point of the cartesian product of the
+ * parameters.  Process number p is decoded into a point on demand, as
+ * a mixed radix number whose first parameter varies slowest, so no
+ * table of points is built: a sweep costs the size of its text,
+ * however many points it has.
+ */
+
+#define SWP_VALUE_MAX	32	/* Buffer for a formatted range value. */
+
+typedef struct SWP_Item {
+    char*	word;		/* NULL for a range. */
+    long	lo;
+    long	step;
+    uint64_t	count;		/* Values in this item. */
+} SWP_Item;
+
+typedef struct SWP_Dim {
+    char*	name;
+    SWP_Item*	items;
+    size_t	itemCnt;
+    uint64_t	size;
+    uint64_t	stride;
+} SWP_Dim;
+
+typedef struct SWP_Sweep {
+    SWP_Dim*	dims;
+    size_t	dimCnt;
+    char**	refs;		/* Names used; checked by SWP_Finish. */
+    size_t	refCnt;
+    uint64_t	size;		/* Points; 1 if there are no parameters. */
+} SWP_Sweep;
+
+void
+SWP_Init(SWP_Sweep* sw);
+
+int
+SWP_Scan(SWP_Sweep* sw, const char* tmpl, char* err, size_t errLen);
+
+int
+SWP_Finish(SWP_Sweep* sw, char* err, size_t errLen);
+
+long
+SWP_Lookup(const SWP_Sweep* sw, const char* name, size_t len);
+
+const char*
+SWP_Value(const SWP_Sweep* sw, size_t d, uint64_t point, char* buf);
+
+#endif /* !defined PARAMETER_SWEEP_H */
@@ -0,0 +1,34 @@
+#! /bin/sh
+#
+# A batch whose processes write only to the standard error must have
+# that stream read, though its standard output has nothing to read.
+# Otherwise the processes block writing, and runover spins waiting.
+
+RUNOVER=${RUNOVER:-./runover}
+dir=`mktemp -d` || exit 1
+trap 'rm -rf "$dir"' 0
+
+printf 'localhost\nlocalhost\n' > "$dir/mf"
+"$RUNOVER" -np 4 -machinefile "$dir/mf" -batch 2 -stderr "$dir/err.%p" -- \
+    sh -c 'head -c 200000 /dev/zero >&2' > "$dir/out" 2> "$dir/log" &
+pid=$!
+
+(sleep 30; kill -9 $pid) 2> /dev/null &
+watchdog=$!
+wait $pid
+status=$?
+kill $watchdog 2> /dev/null
+
+if [ $status -ne 0 ]; then
+    echo "batch-stderr: runover exited with $status" >&2
+    cat "$dir/log" >&2
+    exit 1
+fi
+for p in 0 1 2 3; do
+    size=`wc -c < "$dir/err.$p"`
+    if [ "$size" -ne 200000 ]; then
+	echo "batch-stderr: process $p wrote $size bytes, not 200000" >&2
+	exit 1
+    fi
+done
+exit 0
@@ -0,0 +1,40 @@
+#! /bin/sh
+#
+# A -cache hit replays the process's standard output and error, and
+# records it as having succeeded, without running it.
+
+RUNOVER=${RUNOVER:-./runover}
+dir=`mktemp -d` || exit 1
+trap 'rm -rf "$dir"' 0
+
+fail() {
+    echo "cache: $*" >&2
+    exit 1
+}
+
+run() {
+    "$RUNOVER" -np 4 -machinefile "$dir/mf" -cache "$dir/cache" \
+	-stdout "$dir/out$1.%p" -stderr "$dir/err$1.%p" -journal "$dir/j$1" -- \
+	sh -c "touch $dir/ran.%p; echo out %p; echo err %p >&2" 2> "$dir/log" \
+	|| fail "run $1 exited with $?"
+}
+
+printf 'localhost\nlocalhost\n' > "$dir/mf"
+mkdir "$dir/cache"
+run 1
+rm -f "$dir"/ran.*
+run 2
+for p in 0 1 2 3; do
+    [ -f "$dir/ran.$p" ] && fail "process $p ran again"
+    [ "`cat "$dir/out2.$p"`" = "out $p" ] \
+	|| fail "process $p replayed output \"`cat "$dir/out2.$p"`\""
+    [ "`cat "$dir/err2.$p"`" = "err $p" ] \
+	|| fail "process $p replayed error output \"`cat "$dir/err2.$p"`\""
+done
+
+# The replayed processes are journaled as succeeded, so none is rerun.
+"$RUNOVER" -np 4 -machinefile "$dir/mf" -journal "$dir/j2" -resume -- \
+    sh -c "touch $dir/ran.%p" 2> "$dir/log" \
+    || fail "resumed run exited with $?"
+ls "$dir"/ran.* > /dev/null 2>&1 && fail "a replayed process was not journaled as succeeded"
+exit 0
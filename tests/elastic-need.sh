@@ -0,0 +1,36 @@
+#! /bin/sh
+#
+# Shrinking the machine list of an -elastic job run with -need parks
+# the slots of the lines taken away.  What their processes held must
+# go back to the host, or the processes still waiting never fit and
+# the job never ends.
+
+RUNOVER=${RUNOVER:-./runover}
+dir=`mktemp -d` || exit 1
+trap 'rm -rf "$dir"' 0
+
+printf 'localhost\nlocalhost\nlocalhost\nlocalhost\n' > "$dir/mf"
+"$RUNOVER" -np 8 -machinefile "$dir/mf" -need cores=1 -elastic -- \
+    sh -c 'echo start %p; sleep 2' > "$dir/out" 2> "$dir/err" &
+pid=$!
+sleep 1
+printf 'localhost\nlocalhost\n' > "$dir/mf"
+kill -HUP $pid
+
+(sleep 30; kill -9 $pid) 2> /dev/null &
+watchdog=$!
+wait $pid
+status=$?
+kill $watchdog 2> /dev/null
+
+if [ $status -ne 0 ]; then
+    echo "elastic-need: runover exited with $status" >&2
+    cat "$dir/err" >&2
+    exit 1
+fi
+started=`grep -c '^start ' "$dir/out"`
+if [ "$started" -ne 8 ]; then
+    echo "elastic-need: $started of 8 processes started" >&2
+    exit 1
+fi
+exit 0
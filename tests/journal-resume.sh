@@ -0,0 +1,33 @@
+#! /bin/sh
+#
+# With -journal, a rerun with -resume runs only the processes that did
+# not succeed before, and records them, so a third run has nothing
+# left to do.
+
+RUNOVER=${RUNOVER:-./runover}
+dir=`mktemp -d` || exit 1
+trap 'rm -rf "$dir"' 0
+
+fail() {
+    echo "journal-resume: $*" >&2
+    exit 1
+}
+
+printf 'localhost\nlocalhost\n' > "$dir/mf"
+"$RUNOVER" -np 6 -machinefile "$dir/mf" -journal "$dir/j" -- \
+    sh -c 'echo %p; test %p != 1 && test %p != 4' > "$dir/out1" 2> "$dir/log" \
+    || fail "first run exited with $?"
+[ "`sort -n "$dir/out1" | tr '\n' ' '`" = "0 1 2 3 4 5 " ] \
+    || fail "first run ran `tr '\n' ' ' < "$dir/out1"`"
+
+"$RUNOVER" -np 6 -machinefile "$dir/mf" -journal "$dir/j" -resume -- \
+    sh -c 'echo %p' > "$dir/out2" 2> "$dir/log" \
+    || fail "second run exited with $?"
+[ "`sort -n "$dir/out2" | tr '\n' ' '`" = "1 4 " ] \
+    || fail "second run ran `tr '\n' ' ' < "$dir/out2"`, not 1 and 4"
+
+"$RUNOVER" -np 6 -machinefile "$dir/mf" -journal "$dir/j" -resume -- \
+    sh -c 'echo %p' > "$dir/out3" 2> "$dir/log" \
+    || fail "third run exited with $?"
+[ -s "$dir/out3" ] && fail "third run ran `tr '\n' ' ' < "$dir/out3"`"
+exit 0
@@ -0,0 +1,31 @@
+#! /bin/sh
+#
+# With -keep-order, output comes out in process order however the
+# processes finish: here the last started finishes first.
+
+RUNOVER=${RUNOVER:-./runover}
+dir=`mktemp -d` || exit 1
+trap 'rm -rf "$dir"' 0
+
+for i in 1 2 3 4 5 6 7 8; do
+    echo localhost
+done > "$dir/mf"
+"$RUNOVER" -np 8 -machinefile "$dir/mf" -keep-order -- \
+    sh -c 'sleep 0.$((8 - %p)); echo first %p; echo second %p' \
+    > "$dir/out" 2> "$dir/log"
+status=$?
+if [ $status -ne 0 ]; then
+    echo "keep-order: runover exited with $status" >&2
+    cat "$dir/log" >&2
+    exit 1
+fi
+for p in 0 1 2 3 4 5 6 7; do
+    echo "first $p"
+    echo "second $p"
+done > "$dir/expect"
+if ! cmp -s "$dir/expect" "$dir/out"; then
+    echo "keep-order: output out of order:" >&2
+    cat "$dir/out" >&2
+    exit 1
+fi
+exit 0
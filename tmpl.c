@@ -0,0 +1,128 @@
+/* Template expansion. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ca.h"
+#include "tmpl.h"
+
+/* TMPL_Rewrite --
+ *
+ * Synopsis:
+ *
+ *    Generate a string, to be freed with "free" by the caller, with
+ *    the escapes of template 'param' replaced for process 'proc'.
+ *    The slot substitutions (%c and %m) are 'cpuList' and
+ *    'nodeList'.  A sweep parameter (%{NAME=...} or %{NAME}) is
+ *    replaced by its value at point 'proc'.
+ */
+
+char*
+TMPL_Rewrite(const char* param, const TMPL_Values* tv,
+	     const char* cpuList, const char* nodeList, size_t proc)
+{
+    CharAccum	ca;
+    char	buf[SWP_VALUE_MAX > 50 ? SWP_VALUE_MAX : 50];
+
+    const char*	pp;
+
+    enum { fsCHAR, fsPCT } fmtState = fsCHAR;
+
+    CHARACCUM_INIT(&ca);
+
+    /*
+     * Copy from param to cp.
+     */
+    for (pp = param;  *pp;  ++pp) {
+	switch (fmtState) {
+	case fsCHAR:
+	    if (*pp == '%') {
+		fmtState = fsPCT;
+	    } else {
+		CHARACCUM_APPEND_CHAR(&ca, *pp);
+	    }
+	    break;
+	case fsPCT:
+	    switch (*pp) {
+	    case '%':
+		CHARACCUM_APPEND_CHAR(&ca, '%');
+		fmtState = fsCHAR;
+		break;
+	    case 'j':
+		if (tv->jobName != NULL) {
+		    CHARACCUM_APPEND_STR(&ca, tv->jobName);
+		}
+		fmtState = fsCHAR;
+		break;
+	    case 'p':
+		sprintf(buf, "%llu", (unsigned long long) proc);
+		CHARACCUM_APPEND_STR(&ca, buf);
+		fmtState = fsCHAR;
+		break;
+	    case 'n':
+		sprintf(buf, "%llu", (unsigned long long) tv->procCnt);
+		CHARACCUM_APPEND_STR(&ca, buf);
+		fmtState = fsCHAR;
+		break;
+	    case 'k':
+		if (tv->kvsAddress != NULL) {
+		    CHARACCUM_APPEND_STR(&ca, tv->kvsAddress);
+		}
+		fmtState = fsCHAR;
+		break;
+	    case 't':
+		if (tv->kvsToken != NULL) {
+		    CHARACCUM_APPEND_STR(&ca, tv->kvsToken);
+		}
+		fmtState = fsCHAR;
+		break;
+	    case 'c':
+		if (cpuList != NULL) {
+		    CHARACCUM_APPEND_STR(&ca, cpuList);
+		}
+		fmtState = fsCHAR;
+		break;
+	    case 'm':
+		if (nodeList != NULL) {
+		    CHARACCUM_APPEND_STR(&ca, nodeList);
+		}
+		fmtState = fsCHAR;
+		break;
+	    case 's':
+		if (tv->stagePath != NULL) {
+		    CHARACCUM_APPEND_STR(&ca, tv->stagePath);
+		}
+		fmtState = fsCHAR;
+		break;
+	    case '{':
+	    {
+		/* A sweep parameter; its values were read by SWP_Scan. */
+		const char*	end = strchr(pp, '}');
+		size_t		len;
+		long		d;
+
+		if (end == NULL) {
+		    fmtState = fsCHAR;
+		    break;
+		}
+		len = strcspn(pp + 1, "=}");
+		d = tv->sweep ? SWP_Lookup(tv->sweep, pp + 1, len) : -1;
+		if (d >= 0) {
+		    CHARACCUM_APPEND_STR(&ca, SWP_Value(tv->sweep, (size_t) d,
+							proc, buf));
+		}
+		pp = end;
+		fmtState = fsCHAR;
+		break;
+	    }
+	    default:
+		/* FIXME: What to do here??? */
+		fmtState = fsCHAR;
+		break;
+	    }
+	}
+    }
+
+    CHARACCUM_FINALIZE(&ca);
+}
+
@@ -0,0 +1,27 @@
+/* Template expansion. */
+
+#ifndef TEMPLATE_H
+#define TEMPLATE_H
+
+#include <stddef.h>
+#include "sweep.h"
+
+/*
+ * The values a template's escapes are replaced with.  Any string may
+ * be NULL, in which case its escape expands to nothing.
+ */
+
+typedef struct TMPL_Values {
+    const char*		jobName;	/* %j */
+    const char*		stagePath;	/* %s */
+    const char*		kvsAddress;	/* %k */
+    const char*		kvsToken;	/* %t */
+    size_t		procCnt;	/* %n */
+    const SWP_Sweep*	sweep;		/* %{NAME}, or NULL. */
+} TMPL_Values;
+
+char*
+TMPL_Rewrite(const char* param, const TMPL_Values* tv,
+	     const char* cpuList, const char* nodeList, size_t proc);
+
+#endif /* !defined TEMPLATE_H */
@@ -0,0 +1,358 @@
+/* Processor topology and slot placement. */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include "topo.h"
+#include "ca.h"
+
+/* Memory policy modes, as in <numaif.h>. */
+#define TOPO_MPOL_PREFERRED	1
+#define TOPO_MPOL_BIND		2
+#define TOPO_MPOL_INTERLEAVE	3
+
+/* TOPO_ParsePolicy --
+ *
+ * Synopsis:
+ *
+ *    Look up a pinning policy by name.
+ *
+ * Returns:
+ *
+ *    0 on success, -1 if the name is unknown.
+ */
+
+int
+TOPO_ParsePolicy(const char* name, TOPO_Policy* policy)
+{
+    if (0 == strcmp(name, "none")) {
+	*policy = topo_pNone;
+    } else if (0 == strcmp(name, "compact")) {
+	*policy = topo_pCompact;
+    } else if (0 == strcmp(name, "scatter")) {
+	*policy = topo_pScatter;
+    } else if (0 == strcmp(name, "numa")) {
+	*policy = topo_pNuma;
+    } else {
+	return -1;
+    }
+    return 0;
+}
+
+/* topo_node_of --
+ *
+ * Synopsis:
+ *
+ *    Find the NUMA node of a CPU from sysfs.  Returns 0 if the system
+ *    does not say.
+ */
+
+static int
+topo_node_of(int cpu)
+{
+    int		node;
+    char	path[128];
+
+    for (node = 0;  node < TOPO_MAX_NODES;  ++node) {
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu%d/node%d", cpu, node);
+	if (access(path, F_OK) == 0) {
+	    return node;
+	}
+    }
+    return 0;
+}
+
+/* TOPO_Local --
+ *
+ * Synopsis:
+ *
+ *    Find the topology of this host: the CPUs we may run on, sorted by
+ *    node.
+ */
+
+void
+TOPO_Local(TOPO_Info* ti)
+{
+    cpu_set_t	cs;
+    int		cpu, node;
+    int		cnt = 0;
+    int		maxNode = 0;
+    int*	byCpu;
+
+    CPU_ZERO(&cs);
+    if (sched_getaffinity(0, sizeof(cs), &cs) < 0) {
+	TOPO_Uniform(ti, (int) sysconf(_SC_NPROCESSORS_ONLN), 1);
+	return;
+    }
+    ti->cpuCnt = CPU_COUNT(&cs);
+    ti->cpus = (int*) malloc(ti->cpuCnt * sizeof(int));
+    ti->cpuNode = (int*) malloc(ti->cpuCnt * sizeof(int));
+    byCpu = (int*) malloc(CPU_SETSIZE * sizeof(int));
+    /*FIXME: Out of memory */
+    for (cpu = 0;  cpu < CPU_SETSIZE;  ++cpu) {
+	if (CPU_ISSET(cpu, &cs)) {
+	    byCpu[cpu] = topo_node_of(cpu);
+	    if (byCpu[cpu] > maxNode) {
+		maxNode = byCpu[cpu];
+	    }
+	}
+    }
+
+    /* Nodes with no usable CPUs are left out of the node list. */
+    ti->nodeCnt = 0;
+    for (node = 0;  node <= maxNode;  ++node) {
+	int	first = cnt;
+
+	for (cpu = 0;  cpu < CPU_SETSIZE;  ++cpu) {
+	    if (CPU_ISSET(cpu, &cs) && byCpu[cpu] == node) {
+		ti->cpus[cnt] = cpu;
+		ti->cpuNode[cnt] = node;
+		cnt++;
+	    }
+	}
+	if (cnt > first) {
+	    ti->nodes[ti->nodeCnt++] = node;
+	}
+    }
+    free(byCpu);
+}
+
+/* TOPO_Uniform --
+ *
+ * Synopsis:
+ *
+ *    Make a topology of 'cpuCnt' CPUs split evenly over 'nodeCnt'
+ *    nodes, for hosts whose topology we cannot see.
+ */
+
+void
+TOPO_Uniform(TOPO_Info* ti, int cpuCnt, int nodeCnt)
+{
+    int		i;
+
+    if (cpuCnt < 1) {
+	cpuCnt = 1;
+    }
+    if (nodeCnt < 1 || nodeCnt > cpuCnt) {
+	nodeCnt = 1;
+    }
+    if (nodeCnt > TOPO_MAX_NODES) {
+	nodeCnt = TOPO_MAX_NODES;
+    }
+    ti->cpuCnt = cpuCnt;
+    ti->nodeCnt = nodeCnt;
+    ti->cpus = (int*) malloc(cpuCnt * sizeof(int));
+    ti->cpuNode = (int*) malloc(cpuCnt * sizeof(int));
+    /*FIXME: Out of memory */
+    for (i = 0;  i < nodeCnt;  ++i) {
+	ti->nodes[i] = i;
+    }
+    for (i = 0;  i < cpuCnt;  ++i) {
+	ti->cpus[i] = i;
+	ti->cpuNode[i] = (int) ((long) i * nodeCnt / cpuCnt);
+    }
+}
+
+/* TOPO_Assign --
+ *
+ * Synopsis:
+ *
+ *    Place slot 'k' of the 'n' slots on a host.  When there are more
+ *    slots than CPUs (or nodes, for the numa policy), slots share.
+ */
+
+void
+TOPO_Assign(TOPO_Info* ti, TOPO_Policy policy, size_t k, size_t n, TOPO_Place* tp)
+{
+    size_t	C = (size_t) ti->cpuCnt;
+    size_t	i;
+
+    tp->cpus = (int*) malloc(C * sizeof(int));
+    /*FIXME: Out of memory */
+    tp->cpuCnt = 0;
+    tp->nodeMask = 0;
+    tp->memMode = topo_mDefault;
+
+    switch (policy) {
+    case topo_pNone:
+	return;
+
+    case topo_pCompact:
+	if (n > C) {
+	    tp->cpus[tp->cpuCnt++] = ti->cpus[k % C];
+	} else {
+	    for (i = k * C / n;  i < (k + 1) * C / n;  ++i) {
+		tp->cpus[tp->cpuCnt++] = ti->cpus[i];
+	    }
+	}
+	tp->memMode = topo_mPreferred;
+	break;
+
+    case topo_pScatter:
+	for (i = k % C;  i < C;  i += n) {
+	    tp->cpus[tp->cpuCnt++] = ti->cpus[i];
+	}
+	tp->memMode = topo_mInterleave;
+	break;
+
+    case topo_pNuma:
+    {
+	int node = ti->nodes[k % (size_t) ti->nodeCnt];
+	for (i = 0;  i < C;  ++i) {
+	    if (ti->cpuNode[i] == node) {
+		tp->cpus[tp->cpuCnt++] = ti->cpus[i];
+	    }
+	}
+	tp->memMode = topo_mBind;
+	break;
+    }
+    }
+
+    for (i = 0;  i < (size_t) tp->cpuCnt;  ++i) {
+	size_t	j;
+	for (j = 0;  j < C && ti->cpus[j] != tp->cpus[i];  ++j)
+	    ;
+	tp->nodeMask |= 1UL << ti->cpuNode[j];
+	if (tp->memMode == topo_mPreferred) {
+	    /* Only the first CPU's node is preferred. */
+	    break;
+	}
+    }
+    if (tp->memMode == topo_mInterleave
+	&& (tp->nodeMask & (tp->nodeMask - 1)) == 0) {
+	tp->memMode = topo_mPreferred;
+    }
+}
+
+/* topo_list --
+ *
+ * Synopsis:
+ *
+ *    Format a sorted list of numbers as a string like "0-3,8,10-11",
+ *    as taskset and numactl accept.  Free the result with "free".
+ */
+
+static char*
+topo_list(const int* v, int cnt)
+{
+    CharAccum	ca;
+    char	buf[32];
+    int		i, j;
+
+    CHARACCUM_INIT(&ca);
+    for (i = 0;  i < cnt;  i = j) {
+	for (j = i + 1;  j < cnt && v[j] == v[j-1] + 1;  ++j)
+	    ;
+	if (j - i > 1) {
+	    sprintf(buf, "%s%d-%d", i ? "," : "", v[i], v[j-1]);
+	} else {
+	    sprintf(buf, "%s%d", i ? "," : "", v[i]);
+	}
+	CHARACCUM_APPEND_STR(&ca, buf);
+    }
+    CHARACCUM_FINALIZE(&ca);
+}
+
+static int
+topo_compare_ints(const void* a, const void* b)
+{
+    return *(const int*) a - *(const int*) b;
+}
+
+/* TOPO_CpuList --
+ *
+ * Synopsis:
+ *
+ *    The placement's CPUs as a list string.
+ */
+
+char*
+TOPO_CpuList(const TOPO_Place* tp)
+{
+    int*	v = (int*) malloc((tp->cpuCnt + 1) * sizeof(int));
+    char*	s;
+
+    memcpy(v, tp->cpus, tp->cpuCnt * sizeof(int));
+    qsort(v, tp->cpuCnt, sizeof(int), topo_compare_ints);
+    s = topo_list(v, tp->cpuCnt);
+    free(v);
+    return s;
+}
+
+/* TOPO_NodeList --
+ *
+ * Synopsis:
+ *
+ *    The placement's memory nodes as a list string.
+ */
+
+char*
+TOPO_NodeList(const TOPO_Place* tp)
+{
+    int		v[TOPO_MAX_NODES];
+    int		cnt = 0;
+    int		node;
+
+    for (node = 0;  node < TOPO_MAX_NODES;  ++node) {
+	if (tp->nodeMask & (1UL << node)) {
+	    v[cnt++] = node;
+	}
+    }
+    return topo_list(v, cnt);
+}
+
+/* TOPO_Apply --
+ *
+ * Synopsis:
+ *
+ *    Pin the calling process to a placement: set its CPU affinity and
+ *    memory policy.  Called in the child, before exec.
+ *
+ * Returns:
+ *
+ *    0 on success, -1 with errno set.
+ */
+
+int
+TOPO_Apply(const TOPO_Place* tp)
+{
+    cpu_set_t	cs;
+    int		i;
+    int		mode;
+
+    if (tp->cpuCnt == 0) {
+	return 0;
+    }
+    CPU_ZERO(&cs);
+    for (i = 0;  i < tp->cpuCnt;  ++i) {
+	CPU_SET(tp->cpus[i], &cs);
+    }
+    if (sched_setaffinity(0, sizeof(cs), &cs) < 0) {
+	return -1;
+    }
+
+    switch (tp->memMode) {
+    case topo_mPreferred:
+	mode = TOPO_MPOL_PREFERRED;
+	break;
+    case topo_mBind:
+	mode = TOPO_MPOL_BIND;
+	break;
+    case topo_mInterleave:
+	mode = TOPO_MPOL_INTERLEAVE;
+	break;
+    default:
+	return 0;
+    }
+#ifdef SYS_set_mempolicy
+    /* Ignore failure: kernels without NUMA support refuse this. */
+    syscall(SYS_set_mempolicy, mode, &tp->nodeMask,
+	    (unsigned long) (8 * sizeof(tp->nodeMask)));
+#endif
+    return 0;
+}
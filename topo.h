@@ -0,0 +1,72 @@
+/* Processor topology and slot placement. */
+
+#ifndef PROCESSOR_TOPOLOGY_H
+#define PROCESSOR_TOPOLOGY_H
+
+#include <stddef.h>
+
+/*
+ * A topology lists the usable CPUs in node order, with the NUMA node
+ * of each, and the nodes that have any.  Nodes keep the numbers the
+ * system gives them, since those are what the memory policy and %m
+ * name; a cpuset may allow only some of them.  A placement gives one slot, out of several sharing a
+ * host, its CPUs and memory nodes under a pinning policy:
+ *
+ *   compact  -- consecutive CPUs, filling one node before the next.
+ *   scatter  -- every n'th CPU, so each slot spans all the nodes.
+ *   numa     -- all the CPUs of one node, nodes taken round robin.
+ */
+
+#define TOPO_MAX_NODES	64
+
+typedef enum TOPO_Policy {
+    topo_pNone,
+    topo_pCompact,
+    topo_pScatter,
+    topo_pNuma
+} TOPO_Policy;
+
+typedef enum TOPO_MemMode {
+    topo_mDefault,
+    topo_mPreferred,
+    topo_mBind,
+    topo_mInterleave
+} TOPO_MemMode;
+
+typedef struct TOPO_Info {
+    int*	cpus;		/* CPU numbers, in node order. */
+    int*	cpuNode;	/* Node of each, as the system numbers it. */
+    int		cpuCnt;
+    int		nodes[TOPO_MAX_NODES];	/* Nodes with usable CPUs, in order. */
+    int		nodeCnt;
+} TOPO_Info;
+
+typedef struct TOPO_Place {
+    int*		cpus;
+    int			cpuCnt;
+    unsigned long	nodeMask;
+    TOPO_MemMode	memMode;
+} TOPO_Place;
+
+int
+TOPO_ParsePolicy(const char* name, TOPO_Policy* policy);
+
+void
+TOPO_Local(TOPO_Info* ti);
+
+void
+TOPO_Uniform(TOPO_Info* ti, int cpuCnt, int nodeCnt);
+
+void
+TOPO_Assign(TOPO_Info* ti, TOPO_Policy policy, size_t k, size_t n, TOPO_Place* tp);
+
+char*
+TOPO_CpuList(const TOPO_Place* tp);
+
+char*
+TOPO_NodeList(const TOPO_Place* tp);
+
+int
+TOPO_Apply(const TOPO_Place* tp);
+
+#endif /* !defined PROCESSOR_TOPOLOGY_H */
@@ -0,0 +1,313 @@
+/* Timer wheels. */
+
+#include <stdlib.h>
+#include <string.h>
+#include "tw.h"
+
+#define TW_MASK		(TW_SIZE - 1)
+#define TW_SPAN		((uint64_t) 1 << (TW_BITS * TW_LEVELS))
+
+/* TW_Init --
+ *
+ * Synopsis:
+ *
+ *    Initialize an empty wheel.  Tick 0 starts at 'origin', and each
+ *    tick is 'tick' seconds long.
+ */
+
+void
+TW_Init(TW_Wheel* tw, double origin, double tick)
+{
+    size_t	i;
+
+    memset(tw, 0, sizeof(TW_Wheel));
+    tw->origin = origin;
+    tw->tick = tick;
+    for (i = 0;  i <= TW_EXPIRED;  ++i) {
+	QI_QUEUE_INIT(&tw->bucket[i]);
+    }
+}
+
+/* TW_Free --
+ *
+ * Synopsis:
+ *
+ *    Release the storage of a wheel.
+ */
+
+void
+TW_Free(TW_Wheel* tw)
+{
+    free(tw->due);
+    free(tw->where);
+    free(tw->link);
+    tw->due = (uint64_t*) NULL;
+    tw->where = (uint16_t*) NULL;
+    tw->link = (QI_Link*) NULL;
+    tw->cap = 0;
+    tw->count = 0;
+}
+
+/* tw_place --
+ *
+ * Synopsis:
+ *
+ *    File 'id' by its deadline, relative to the current tick.
+ */
+
+static void
+tw_place(TW_Wheel* tw, QI_Index id)
+{
+    uint64_t	d = tw->due[id];
+    uint64_t	delta;
+    int		l;
+    size_t	b;
+
+    if (d < tw->now) {
+	b = TW_EXPIRED;
+    } else {
+	delta = d - tw->now;
+	if (delta >= TW_SPAN) {
+	    d = tw->now + TW_SPAN - 1;
+	    delta = TW_SPAN - 1;
+	}
+	for (l = 0;  delta >= ((uint64_t) 1 << (TW_BITS * (l + 1)));  ++l)
+	    ;
+	b = l * TW_SIZE + ((d >> (TW_BITS * l)) & TW_MASK);
+	tw->levelCnt[l]++;
+    }
+    tw->where[id] = (uint16_t) b;
+    QI_ADD(&tw->bucket[b], tw->link, id);
+}
+
+/* tw_unplace --
+ *
+ * Synopsis:
+ *
+ *    Take 'id' out of the bucket it is filed in.
+ */
+
+static void
+tw_unplace(TW_Wheel* tw, QI_Index id)
+{
+    size_t	b = tw->where[id];
+
+    QI_REMOVE(&tw->bucket[b], tw->link, id);
+    if (b != TW_EXPIRED) {
+	tw->levelCnt[b / TW_SIZE]--;
+    }
+    tw->where[id] = TW_NOWHERE;
+}
+
+/* TW_Add --
+ *
+ * Synopsis:
+ *
+ *    Set the deadline of 'id' to 'when', replacing any it had.
+ */
+
+void
+TW_Add(TW_Wheel* tw, QI_Index id, double when)
+{
+    double	t;
+
+    if (id >= tw->cap) {
+	size_t	n;
+	size_t	i;
+
+	for (n = tw->cap ? tw->cap : 64;  n <= id;  n *= 2)
+	    ;
+	tw->due = (uint64_t*) realloc(tw->due, n * sizeof(uint64_t));
+	tw->where = (uint16_t*) realloc(tw->where, n * sizeof(uint16_t));
+	tw->link = (QI_Link*) realloc(tw->link, n * sizeof(QI_Link));
+	/*FIXME: Out of memory */
+	for (i = tw->cap;  i < n;  ++i) {
+	    tw->where[i] = TW_NOWHERE;
+	}
+	tw->cap = n;
+    }
+    if (tw->where[id] != TW_NOWHERE) {
+	tw_unplace(tw, id);
+	tw->count--;
+    }
+
+    /* Round up, so a deadline never fires early. */
+    t = (when - tw->origin) / tw->tick;
+    tw->due[id] = t <= 0 ? 0 : (uint64_t) t + ((double) (uint64_t) t < t);
+    tw_place(tw, id);
+    tw->count++;
+}
+
+/* TW_Cancel --
+ *
+ * Synopsis:
+ *
+ *    Remove the deadline of 'id', if it has one.
+ */
+
+void
+TW_Cancel(TW_Wheel* tw, QI_Index id)
+{
+    if (id < tw->cap && tw->where[id] != TW_NOWHERE) {
+	tw_unplace(tw, id);
+	tw->count--;
+    }
+}
+
+/* tw_cascade --
+ *
+ * Synopsis:
+ *
+ *    The wheel has just turned to a multiple of TW_SIZE ticks: move
+ *    the deadlines in the coarser buckets that have come round down
+ *    to the finer levels.
+ */
+
+static void
+tw_cascade(TW_Wheel* tw)
+{
+    int		l;
+
+    for (l = 1;  l < TW_LEVELS;  ++l) {
+	size_t		idx = (tw->now >> (TW_BITS * l)) & TW_MASK;
+	QI_Queue	q = tw->bucket[l * TW_SIZE + idx];
+	QI_Index	id;
+
+	QI_QUEUE_INIT(&tw->bucket[l * TW_SIZE + idx]);
+	for (id = QI_HEAD(&q);  id != QI_NIL;  ) {
+	    QI_Index	next = QI_NEXT(tw->link, id);
+	    tw->levelCnt[l]--;
+	    tw_place(tw, id);
+	    id = next;
+	}
+	if (idx != 0) {
+	    break;
+	}
+    }
+}
+
+/* tw_advance --
+ *
+ * Synopsis:
+ *
+ *    Process every tick up to and including 'target', moving the
+ *    deadlines that fall in them to the expired bucket.  Runs of
+ *    ticks with nothing at the finest level are skipped a turn at a
+ *    time.
+ */
+
+static void
+tw_advance(TW_Wheel* tw, uint64_t target)
+{
+    while (tw->now <= target) {
+	if (tw->levelCnt[0] == 0) {
+	    uint64_t	next = (tw->now | TW_MASK) + 1;
+
+	    if (next > target + 1) {
+		tw->now = target + 1;
+		break;
+	    }
+	    tw->now = next;
+	} else {
+	    QI_Queue*	q = &tw->bucket[tw->now & TW_MASK];
+	    QI_Index	id;
+
+	    for (;;) {
+		QI_TAKE(q, tw->link, id);
+		if (id == QI_NIL) {
+		    break;
+		}
+		tw->levelCnt[0]--;
+		tw->where[id] = TW_EXPIRED;
+		QI_ADD(&tw->bucket[TW_EXPIRED], tw->link, id);
+	    }
+	    tw->now++;
+	}
+	if ((tw->now & TW_MASK) == 0) {
+	    tw_cascade(tw);
+	}
+    }
+}
+
+/* TW_Next --
+ *
+ * Synopsis:
+ *
+ *    When the wheel next needs attention: the time of the earliest
+ *    deadline at the finest level, or of the next turn that moves
+ *    deadlines down from a coarser one.  A time at or before the
+ *    present means something has already expired.
+ *
+ * Returns:
+ *
+ *    The time, or a negative number if there are no deadlines.
+ */
+
+double
+TW_Next(TW_Wheel* tw)
+{
+    uint64_t	best = 0;
+    int		found = 0;
+    int		l;
+    uint64_t	k;
+
+    if (tw->count == 0) {
+	return -1.0;
+    }
+    if (!QI_EMPTY(&tw->bucket[TW_EXPIRED])) {
+	return tw->origin;
+    }
+    for (l = 0;  l < TW_LEVELS;  ++l) {
+	int		shift = TW_BITS * l;
+	uint64_t	base = tw->now >> shift;
+
+	if (tw->levelCnt[l] == 0) {
+	    continue;
+	}
+	/*
+	 * At the finest level the current bucket is still to come; at
+	 * the coarser ones it was cascaded when the wheel turned into
+	 * it, and next comes round a full turn later.
+	 */
+	for (k = (l == 0 ? 0 : 1);  k <= TW_SIZE;  ++k) {
+	    if (!QI_EMPTY(&tw->bucket[l * TW_SIZE + ((base + k) & TW_MASK)])) {
+		uint64_t t = (base + k) << shift;
+		if (!found || t < best) {
+		    best = t;
+		    found = 1;
+		}
+		break;
+	    }
+	}
+    }
+    return tw->origin + best * tw->tick;
+}
+
+/* TW_Expire --
+ *
+ * Synopsis:
+ *
+ *    Bring the wheel up to time 'now', and take one object whose
+ *    deadline has passed.  Call repeatedly to collect them all.
+ *
+ * Returns:
+ *
+ *    The object, or QI_NIL if none has expired.
+ */
+
+QI_Index
+TW_Expire(TW_Wheel* tw, double now)
+{
+    QI_Index	id;
+    double	t = (now - tw->origin) / tw->tick;
+
+    if (t >= 0) {
+	tw_advance(tw, (uint64_t) t);
+    }
+    QI_TAKE(&tw->bucket[TW_EXPIRED], tw->link, id);
+    if (id != QI_NIL) {
+	tw->where[id] = TW_NOWHERE;
+	tw->count--;
+    }
+    return id;
+}
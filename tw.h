@@ -0,0 +1,73 @@
+/* Timer wheels. */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "qi.h"
+
+/*
+ * A timer wheel holds deadlines for a set of numbered objects (here,
+ * slots), at most one each.  Time is counted in ticks of a fixed
+ * length from the moment the wheel was created.
+ *
+ * The wheel is hierarchical: TW_LEVELS levels of TW_SIZE buckets,
+ * each level's buckets a TW_SIZE times coarser than the one below.
+ * A deadline goes in the finest level that can hold it, and moves
+ * ("cascades") down a level each time the wheel turns past its
+ * bucket.  Adding and cancelling a deadline are constant time, and an
+ * advance only visits buckets that have come due, so the cost of a
+ * timeout does not depend on how many others are outstanding.
+ * Deadlines further away than the wheel spans wait in the top level
+ * and are placed again as it turns.
+ *
+ * The wheel is not driven by a periodic tick.  The owner asks
+ * TW_Next when the wheel next needs attention, sleeps until then (or
+ * until something else happens), and collects whatever has expired
+ * with TW_Expire.
+ */
+
+#define TW_BITS		6
+#define TW_SIZE		(1 << TW_BITS)
+#define TW_LEVELS	4
+
+#define TW_NOWHERE	0xffff
+#define TW_EXPIRED	(TW_LEVELS * TW_SIZE)
+
+typedef struct TW_Wheel {
+    double	origin;		/* Time of tick 0. */
+    double	tick;		/* Seconds per tick. */
+    uint64_t	now;		/* First tick not yet processed. */
+
+    /* Per-object deadline, and where it is filed. */
+    uint64_t*	due;
+    uint16_t*	where;
+    QI_Link*	link;
+    size_t	cap;
+
+    size_t	levelCnt[TW_LEVELS];
+    size_t	count;
+    QI_Queue	bucket[TW_LEVELS * TW_SIZE + 1];	/* + expired */
+} TW_Wheel;
+
+void
+TW_Init(TW_Wheel* tw, double origin, double tick);
+
+void
+TW_Free(TW_Wheel* tw);
+
+void
+TW_Add(TW_Wheel* tw, QI_Index id, double when);
+
+void
+TW_Cancel(TW_Wheel* tw, QI_Index id);
+
+double
+TW_Next(TW_Wheel* tw);
+
+QI_Index
+TW_Expire(TW_Wheel* tw, double now);
+
+#endif /* !defined TIMER_WHEEL_H */